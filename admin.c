@@ -0,0 +1,146 @@
+/*
+ * Autor: Guido Barosio
+ * Email: guido@bravo47.com
+ * Fecha: 2024-06-08
+ */
+
+#include "admin.h"
+#include "plugins/plugin.h"
+#include "utils/access_log.h"
+#include "utils/latency.h"
+#include "utils/logs.h"
+#include "utils/metrics.h"
+#include "utils/socket.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#define ADMIN_REQUEST_SIZE 2048
+#define ADMIN_RESPONSE_SIZE 16384
+
+// Reads the request head, giving up after a second of silence. Returns
+// the bytes read, or -1.
+static int read_request(int fd, char *buffer, size_t size) {
+    size_t len = 0;
+    while (len < size - 1) {
+        ssize_t n = recv(fd, buffer + len, size - 1 - len, 0);
+        if (n <= 0) {
+            if (n == -1 && errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        len += n;
+        buffer[len] = '\0';
+        if (strstr(buffer, "\r\n\r\n") || strstr(buffer, "\n\n")) {
+            break;
+        }
+    }
+    return (int)len;
+}
+
+static void send_all(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, data, len, 0);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        data += n;
+        len -= n;
+    }
+}
+
+static size_t format_metrics(char *out, size_t size) {
+    size_t len = metrics_format(out, size);
+    len += metrics_format_value(out + len, size - len, "yathr_plugin_dropped_total", "counter",
+                                "Async plugin snapshots dropped because the queue was full.", plugin_dropped());
+    len += metrics_format_value(out + len, size - len, "yathr_access_log_dropped_total", "counter",
+                                "Access log records dropped because the writer fell behind.",
+                                access_log_dropped());
+    len += latency_format(out + len, size - len);
+    return len;
+}
+
+static void serve_admin_request(int fd) {
+    static const char not_found[] = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+    char request[ADMIN_REQUEST_SIZE];
+    char body[ADMIN_RESPONSE_SIZE];
+    char head[256];
+
+    if (read_request(fd, request, sizeof(request)) <= 0) {
+        return;
+    }
+    if (strncmp(request, "GET /metrics ", 13) != 0 && strncmp(request, "GET /metrics?", 13) != 0) {
+        send_all(fd, not_found, sizeof(not_found) - 1);
+        return;
+    }
+
+    size_t body_len = format_metrics(body, sizeof(body));
+    int head_len = snprintf(head, sizeof(head),
+                            "HTTP/1.1 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                            "Content-Length: %zu\r\nConnection: close\r\n\r\n", body_len);
+    send_all(fd, head, head_len);
+    send_all(fd, body, body_len);
+}
+
+// Answers scrapes one at a time. Scrapes are rare and cheap, so a
+// blocking loop on its own thread keeps them away from the workers' event
+// loops entirely: the request path only ever increments counters.
+static void *admin_main(void *arg) {
+    int server_fd = *(int *)arg;
+    struct timeval timeout = {1, 0};
+
+    while (1) {
+        int fd = accept(server_fd, NULL, NULL);
+        if (fd == -1) {
+            if (errno != EINTR) {
+                log_warning("Admin accept failed: %s", strerror(errno));
+                sleep(1);
+            }
+            continue;
+        }
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        serve_admin_request(fd);
+        close(fd);
+    }
+    return NULL;
+}
+
+// Serves GET /metrics on port from a thread of its own. Returns 0, or -1
+// when the listener or the thread cannot be created.
+int start_admin_server(int port) {
+    static int server_fd;
+    pthread_t thread;
+
+    server_fd = create_server_socket(port);
+    if (server_fd == -1) {
+        return -1;
+    }
+    // create_server_socket() hands out non-blocking listeners for the
+    // event loops; this one blocks in accept()
+    int flags = fcntl(server_fd, F_GETFL, 0);
+    if (flags == -1 || fcntl(server_fd, F_SETFL, flags & ~O_NONBLOCK) == -1) {
+        log_error("fcntl on admin socket failed: %s", strerror(errno));
+        close(server_fd);
+        return -1;
+    }
+
+    int rc = pthread_create(&thread, NULL, admin_main, &server_fd);
+    if (rc != 0) {
+        log_error("pthread_create for admin thread failed: %s", strerror(rc));
+        close(server_fd);
+        return -1;
+    }
+    pthread_detach(thread);
+    log_info("Metrics served on port %d", port);
+    return 0;
+}
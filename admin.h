@@ -0,0 +1,12 @@
+/*
+ * Autor: Guido Barosio
+ * Email: guido@bravo47.com
+ * Fecha: 2024-06-08
+ */
+
+#ifndef ADMIN_H
+#define ADMIN_H
+
+int start_admin_server(int port);
+
+#endif // ADMIN_H
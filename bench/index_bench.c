@@ -0,0 +1,147 @@
+/*
+ * Autor: Guido Barosio
+ * Email: guido@bravo47.com
+ * Fecha: 2024-06-08
+ */
+
+/*
+ * index_bench: route index microbenchmark.
+ *
+ *   index_bench [-n routes] [-l lookups]
+ *
+ * Loads the same generated route set (keys like the ones bench/loadgen
+ * requests) once per index kind and table size, and times find_route()
+ * on keys drawn at random, present and absent, with the route filter off
+ * so that every lookup reaches the index. Prints one line of key=value
+ * pairs per index and table size: nanoseconds per hit and per miss.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../routing.h"
+
+static const size_t default_sizes[] = {1000, 100000, 1000000};
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t next_random(uint64_t *state) {
+    // xorshift64*
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545F4914F6CDD1DULL;
+}
+
+static int write_routes(const char *path, size_t routes) {
+    FILE *f = fopen(path, "w");
+    if (f == NULL) {
+        return -1;
+    }
+    for (size_t i = 0; i < routes; i++) {
+        fprintf(f, "bench%07zu\thttps://example.com/landing/%zu\n", 2 * i, i);
+    }
+    return fclose(f);
+}
+
+typedef char BenchKey[16];
+
+// Fills keys with keys drawn at random from the routes' numbers (even)
+// or from the numbers between them (odd), so misses land all over the
+// index rather than past its end.
+static void draw_keys(BenchKey *keys, long count, size_t routes, int odd, uint64_t seed) {
+    for (long i = 0; i < count; i++) {
+        snprintf(keys[i], sizeof(BenchKey), "bench%07zu", 2 * (next_random(&seed) % routes) + odd);
+    }
+}
+
+// Nanoseconds per find_route() over keys; found counts the hits.
+static double time_lookups(const BenchKey *keys, long count, long *found) {
+    double started = now_seconds();
+    long hits = 0;
+    for (long i = 0; i < count; i++) {
+        Route route;
+        hits += find_route(NULL, 0, keys[i], strlen(keys[i]), &route);
+    }
+    *found = hits;
+    return (now_seconds() - started) * 1e9 / count;
+}
+
+// present holds keys in the table, absent keys that fall between them.
+static int run(RouteIndexKind kind, size_t routes, const BenchKey *present, const BenchKey *absent, long lookups) {
+    long found_present, found_absent;
+    double hit_ns = time_lookups(present, lookups, &found_present);
+    double miss_ns = time_lookups(absent, lookups, &found_absent);
+    if (found_present != lookups || found_absent != 0) {
+        fprintf(stderr, "index=%s: %ld of %ld present and %ld absent keys found\n", route_index_name(kind),
+                found_present, lookups, found_absent);
+        return -1;
+    }
+    printf("index=%s routes=%zu hit_ns=%.1f miss_ns=%.1f\n", route_index_name(kind), routes, hit_ns, miss_ns);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    size_t sizes[8];
+    size_t size_count = 0;
+    long lookups = 2000000;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:l:")) != -1) {
+        if (opt == 'n' && size_count < sizeof(sizes) / sizeof(sizes[0])) {
+            sizes[size_count++] = strtoul(optarg, NULL, 10);
+        } else if (opt == 'l') {
+            lookups = atol(optarg);
+        } else {
+            fprintf(stderr, "usage: %s [-n routes]... [-l lookups]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (size_count == 0) {
+        memcpy(sizes, default_sizes, sizeof(default_sizes));
+        size_count = sizeof(default_sizes) / sizeof(default_sizes[0]);
+    }
+
+    BenchKey *present = malloc(lookups * sizeof(BenchKey));
+    BenchKey *absent = malloc(lookups * sizeof(BenchKey));
+    if (present == NULL || absent == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/index_bench_%d.tsv", getpid());
+    configure_route_filter(0);
+    int status = 0;
+    for (size_t s = 0; s < size_count && status == 0; s++) {
+        if (write_routes(path, sizes[s]) == -1) {
+            perror(path);
+            status = 1;
+            break;
+        }
+        draw_keys(present, lookups, sizes[s], 0, 1);
+        draw_keys(absent, lookups, sizes[s], 1, 2);
+        for (int kind = ROUTE_INDEX_HASH; kind <= ROUTE_INDEX_SORTED && status == 0; kind++) {
+            configure_route_index((RouteIndexKind)kind);
+            if (reload_routing(path, NULL, NULL) == -1) {
+                fprintf(stderr, "loading %s failed\n", path);
+                status = 1;
+            } else if (run((RouteIndexKind)kind, sizes[s], present, absent, lookups) == -1) {
+                status = 1;
+            }
+        }
+    }
+    cleanup_routing();
+    remove(path);
+    free(present);
+    free(absent);
+    return status;
+}
@@ -0,0 +1,527 @@
+/*
+ * Autor: Guido Barosio
+ * Email: guido@bravo47.com
+ * Fecha: 2024-06-08
+ */
+
+/*
+ * loadgen: closed-loop HTTP load generator for http_server.
+ *
+ *   loadgen [-h host] [-p port] [-c connections] [-t threads] [-d seconds]
+ *           [-k 0|1] [-n routes] [-z exponent] [-l label] [-o output]
+ *   loadgen -g routes.tsv [-n routes]
+ *
+ * Every connection keeps exactly one request in flight. Keys are drawn
+ * from the route set "bench0000000".."bench<n-1>", uniformly or, with
+ * -z > 0, from a Zipf distribution of that exponent. With -k 0 each
+ * request opens a new connection and its latency includes the connect.
+ * -g writes the matching route set for ROUTES_FILE or yathr-mkdb.
+ *
+ * The result is one line of key=value pairs on stdout, also appended to
+ * the -o file.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+
+#define MAX_THREADS 64
+#define MAX_EVENTS 256
+#define RESPONSE_SIZE 4096
+#define REQUEST_SIZE 256
+
+// Log-linear latency histogram in microseconds: exact below 64, then 32
+// buckets per power of two (at most ~3% error), up to 2^63.
+#define SUB_BUCKETS 64
+#define HISTOGRAM_SIZE (SUB_BUCKETS + 58 * (SUB_BUCKETS / 2))
+
+typedef enum {
+    CONNECTING,
+    WRITING,
+    READING,
+    DRAINING        // response complete, waiting for the server's close
+} ClientState;
+
+typedef struct {
+    int fd;
+    ClientState state;
+    char request[REQUEST_SIZE];
+    size_t request_len;
+    size_t sent;
+    char response[RESPONSE_SIZE];
+    size_t received;
+    uint64_t started;
+} Client;
+
+typedef struct {
+    int id;
+    int connections;
+    uint64_t seed;
+    pthread_t thread;
+    uint64_t requests;
+    uint64_t errors;
+    uint64_t status_2xx_3xx;
+    uint64_t status_4xx;
+    uint64_t status_5xx;
+    uint64_t histogram[HISTOGRAM_SIZE];
+} Worker;
+
+static struct sockaddr_storage server_addr;
+static socklen_t server_addr_len;
+static const char *host = "127.0.0.1";
+static int keep_alive = 1;
+static int route_count = 10000;
+static double zipf_exponent = 0.0;
+static double *zipf_cdf = NULL;
+static uint64_t deadline_ns;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static int histogram_index(uint64_t value) {
+    if (value < SUB_BUCKETS) {
+        return (int)value;
+    }
+    int bit = 63 - __builtin_clzll(value);      // >= 6
+    int shift = bit - 5;
+    return SUB_BUCKETS + (bit - 6) * (SUB_BUCKETS / 2) + (int)((value >> shift) - SUB_BUCKETS / 2);
+}
+
+// Midpoint of the values that fall into bucket index
+static uint64_t histogram_value(int index) {
+    if (index < SUB_BUCKETS) {
+        return (uint64_t)index;
+    }
+    int bit = (index - SUB_BUCKETS) / (SUB_BUCKETS / 2) + 6;
+    int shift = bit - 5;
+    uint64_t low = ((uint64_t)((index - SUB_BUCKETS) % (SUB_BUCKETS / 2)) + SUB_BUCKETS / 2) << shift;
+    return low + ((1ull << shift) >> 1);
+}
+
+static uint64_t percentile(const uint64_t *histogram, uint64_t total, double fraction) {
+    uint64_t rank = (uint64_t)ceil(fraction * (double)total);
+    uint64_t seen = 0;
+    if (rank == 0) {
+        rank = 1;
+    }
+    for (int i = 0; i < HISTOGRAM_SIZE; i++) {
+        seen += histogram[i];
+        if (seen >= rank) {
+            return histogram_value(i);
+        }
+    }
+    return 0;
+}
+
+// xorshift64*
+static uint64_t next_random(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545F4914F6CDD1Dull;
+}
+
+static int build_zipf(void) {
+    zipf_cdf = malloc(sizeof(double) * (size_t)route_count);
+    if (zipf_cdf == NULL) {
+        return -1;
+    }
+    double sum = 0.0;
+    for (int i = 0; i < route_count; i++) {
+        sum += 1.0 / pow((double)(i + 1), zipf_exponent);
+        zipf_cdf[i] = sum;
+    }
+    for (int i = 0; i < route_count; i++) {
+        zipf_cdf[i] /= sum;
+    }
+    return 0;
+}
+
+static int pick_route(uint64_t *seed) {
+    if (zipf_cdf == NULL) {
+        return (int)(next_random(seed) % (uint64_t)route_count);
+    }
+    double u = (double)(next_random(seed) >> 11) / (double)(1ull << 53);
+    int low = 0, high = route_count - 1;
+    while (low < high) {
+        int mid = (low + high) / 2;
+        if (zipf_cdf[mid] < u) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+static void prepare_request(Worker *worker, Client *client) {
+    client->request_len = (size_t)snprintf(client->request, sizeof(client->request),
+        "GET /bench%07d HTTP/1.1\r\nHost: %s\r\n%s\r\n",
+        pick_route(&worker->seed), host, keep_alive ? "" : "Connection: close\r\n");
+    client->sent = 0;
+    client->received = 0;
+    client->started = now_ns();
+}
+
+// Returns 1 once the buffered response is complete (head plus
+// Content-Length bytes of body), 0 if more is needed, -1 if it is invalid.
+static int response_complete(Client *client, int *status) {
+    char *head_end = memmem(client->response, client->received, "\r\n\r\n", 4);
+    if (head_end == NULL) {
+        return client->received == RESPONSE_SIZE ? -1 : 0;
+    }
+    size_t head_len = (size_t)(head_end - client->response) + 4;
+
+    if (client->received < 12 || memcmp(client->response, "HTTP/1.", 7) != 0) {
+        return -1;
+    }
+    *status = atoi(client->response + 9);
+
+    size_t content_length = 0;
+    for (char *line = client->response; line < head_end; ) {
+        char *eol = memmem(line, (size_t)(head_end - line) + 2, "\r\n", 2);
+        if (eol - line > 15 && strncasecmp(line, "Content-Length:", 15) == 0) {
+            content_length = strtoul(line + 15, NULL, 10);
+        }
+        line = eol + 2;
+    }
+    if (head_len + content_length > RESPONSE_SIZE) {
+        return -1;
+    }
+    return client->received >= head_len + content_length;
+}
+
+static int client_connect(Worker *worker, Client *client, int epoll_fd) {
+    client->fd = socket(server_addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (client->fd == -1) {
+        return -1;
+    }
+    int one = 1;
+    setsockopt(client->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    prepare_request(worker, client);
+    client->state = CONNECTING;
+    if (connect(client->fd, (struct sockaddr *)&server_addr, server_addr_len) == -1 && errno != EINPROGRESS) {
+        close(client->fd);
+        return -1;
+    }
+
+    struct epoll_event ev = {.events = EPOLLOUT, .data.ptr = client};
+    return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client->fd, &ev);
+}
+
+static void client_reconnect(Worker *worker, Client *client, int epoll_fd) {
+    close(client->fd);
+    while (client_connect(worker, client, epoll_fd) == -1) {
+        worker->errors++;
+        if (now_ns() >= deadline_ns) {
+            client->fd = -1;
+            return;
+        }
+        usleep(1000);
+    }
+}
+
+// Sends what is left of the request; switches to reading once it is out.
+static int client_send(Client *client, int epoll_fd) {
+    while (client->sent < client->request_len) {
+        ssize_t n = send(client->fd, client->request + client->sent, client->request_len - client->sent, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                if (client->state != WRITING) {
+                    struct epoll_event ev = {.events = EPOLLOUT, .data.ptr = client};
+                    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, client->fd, &ev);
+                    client->state = WRITING;
+                }
+                return 0;
+            }
+            return -1;
+        }
+        client->sent += (size_t)n;
+    }
+    if (client->state != READING) {
+        struct epoll_event ev = {.events = EPOLLIN, .data.ptr = client};
+        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, client->fd, &ev);
+        client->state = READING;
+    }
+    return 0;
+}
+
+static void record_response(Worker *worker, Client *client, int status) {
+    uint64_t micros = (now_ns() - client->started) / 1000;
+    worker->histogram[histogram_index(micros)]++;
+    worker->requests++;
+    if (status >= 500) {
+        worker->status_5xx++;
+    } else if (status >= 400) {
+        worker->status_4xx++;
+    } else {
+        worker->status_2xx_3xx++;
+    }
+}
+
+// Returns -1 when the connection failed and must be replaced.
+static int client_receive(Worker *worker, Client *client, int epoll_fd) {
+    while (1) {
+        char discard[512];
+        char *dst = client->state == DRAINING ? discard : client->response + client->received;
+        size_t room = client->state == DRAINING ? sizeof(discard) : RESPONSE_SIZE - client->received;
+        ssize_t n = recv(client->fd, dst, room, 0);
+
+        if (n == 0) {
+            // Without keep-alive the server closes after the response; with
+            // it, a close before any byte of the response is the server
+            // ending the connection (KEEPALIVE_REQUESTS) and is retried
+            return client->state == DRAINING || client->received == 0 ? 1 : -1;
+        }
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 0;
+            }
+            // Same, when the close crossed our next request on the wire
+            return errno == ECONNRESET && client->received == 0 ? 1 : -1;
+        }
+        if (client->state == DRAINING) {
+            continue;
+        }
+
+        client->received += (size_t)n;
+        int status = 0;
+        int complete = response_complete(client, &status);
+        if (complete == -1) {
+            return -1;
+        }
+        if (complete) {
+            record_response(worker, client, status);
+            if (!keep_alive) {
+                // Let the server close first so TIME_WAIT stays on its side
+                client->state = DRAINING;
+                continue;
+            }
+            if (now_ns() >= deadline_ns) {
+                return 0;
+            }
+            prepare_request(worker, client);
+            return client_send(client, epoll_fd);
+        }
+    }
+}
+
+static void *worker_main(void *arg) {
+    Worker *worker = (Worker *)arg;
+    struct epoll_event events[MAX_EVENTS];
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    Client *clients = calloc((size_t)worker->connections, sizeof(Client));
+
+    if (epoll_fd == -1 || clients == NULL) {
+        fprintf(stderr, "worker %d: setup failed: %s\n", worker->id, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < worker->connections; i++) {
+        if (client_connect(worker, &clients[i], epoll_fd) == -1) {
+            fprintf(stderr, "worker %d: connect failed: %s\n", worker->id, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    while (now_ns() < deadline_ns) {
+        int n = epoll_wait(epoll_fd, events, MAX_EVENTS, 100);
+        for (int i = 0; i < n; i++) {
+            Client *client = events[i].data.ptr;
+            int rc = 0;
+
+            if (client->state == CONNECTING) {
+                int err = 0;
+                socklen_t len = sizeof(err);
+                getsockopt(client->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+                client->state = WRITING;
+                rc = err == 0 ? client_send(client, epoll_fd) : -1;
+            } else if (client->state == WRITING) {
+                rc = client_send(client, epoll_fd);
+            } else if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                rc = client_receive(worker, client, epoll_fd);
+            }
+
+            if (rc == -1) {
+                worker->errors++;
+            }
+            if (rc != 0 && now_ns() < deadline_ns) {
+                client_reconnect(worker, client, epoll_fd);
+            }
+        }
+    }
+
+    for (int i = 0; i < worker->connections; i++) {
+        if (clients[i].fd != -1) {
+            close(clients[i].fd);
+        }
+    }
+    free(clients);
+    close(epoll_fd);
+    return NULL;
+}
+
+static int resolve(const char *name, int port) {
+    struct addrinfo hints = {.ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM};
+    struct addrinfo *result;
+    char service[16];
+    snprintf(service, sizeof(service), "%d", port);
+    int rc = getaddrinfo(name, service, &hints, &result);
+    if (rc != 0) {
+        fprintf(stderr, "getaddrinfo %s: %s\n", name, gai_strerror(rc));
+        return -1;
+    }
+    memcpy(&server_addr, result->ai_addr, result->ai_addrlen);
+    server_addr_len = result->ai_addrlen;
+    freeaddrinfo(result);
+    return 0;
+}
+
+static int write_routes(const char *path) {
+    FILE *out = fopen(path, "w");
+    if (out == NULL) {
+        fprintf(stderr, "fopen %s failed: %s\n", path, strerror(errno));
+        return -1;
+    }
+    for (int i = 0; i < route_count; i++) {
+        fprintf(out, "bench%07d\thttps://example.com/bench/%d\n", i, i);
+    }
+    return fclose(out);
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "Usage: %s [-h host] [-p port] [-c connections] [-t threads] [-d seconds]\n"
+                    "          [-k 0|1] [-n routes] [-z exponent] [-l label] [-o output]\n"
+                    "       %s -g routes.tsv [-n routes]\n", name, name);
+}
+
+int main(int argc, char **argv) {
+    static Worker workers[MAX_THREADS];
+    int port = 8080, connections = 64, threads = 1;
+    double duration = 10.0;
+    const char *label = "bench", *output = NULL, *routes_path = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "h:p:c:t:d:k:n:z:l:o:g:")) != -1) {
+        switch (opt) {
+            case 'h': host = optarg; break;
+            case 'p': port = atoi(optarg); break;
+            case 'c': connections = atoi(optarg); break;
+            case 't': threads = atoi(optarg); break;
+            case 'd': duration = atof(optarg); break;
+            case 'k': keep_alive = atoi(optarg); break;
+            case 'n': route_count = atoi(optarg); break;
+            case 'z': zipf_exponent = atof(optarg); break;
+            case 'l': label = optarg; break;
+            case 'o': output = optarg; break;
+            case 'g': routes_path = optarg; break;
+            default: usage(argv[0]); return EXIT_FAILURE;
+        }
+    }
+    if (route_count < 1 || connections < 1 || threads < 1 || duration <= 0) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (routes_path) {
+        return write_routes(routes_path) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    if (threads > MAX_THREADS) threads = MAX_THREADS;
+    if (threads > connections) threads = connections;
+    if (resolve(host, port) == -1) {
+        return EXIT_FAILURE;
+    }
+    if (zipf_exponent > 0 && build_zipf() == -1) {
+        fprintf(stderr, "Out of memory\n");
+        return EXIT_FAILURE;
+    }
+
+    uint64_t started = now_ns();
+    deadline_ns = started + (uint64_t)(duration * 1e9);
+    for (int i = 0; i < threads; i++) {
+        workers[i].id = i;
+        workers[i].connections = connections / threads + (i < connections % threads);
+        workers[i].seed = 0x9E3779B97F4A7C15ull * (uint64_t)(i + 1);
+        if (pthread_create(&workers[i].thread, NULL, worker_main, &workers[i]) != 0) {
+            fprintf(stderr, "pthread_create failed\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+    static uint64_t histogram[HISTOGRAM_SIZE];
+    uint64_t requests = 0, errors = 0, ok = 0, client_errors = 0, server_errors = 0;
+    for (int i = 0; i < threads; i++) {
+        pthread_join(workers[i].thread, NULL);
+        requests += workers[i].requests;
+        errors += workers[i].errors;
+        ok += workers[i].status_2xx_3xx;
+        client_errors += workers[i].status_4xx;
+        server_errors += workers[i].status_5xx;
+        for (int b = 0; b < HISTOGRAM_SIZE; b++) {
+            histogram[b] += workers[i].histogram[b];
+        }
+    }
+    double elapsed = (double)(now_ns() - started) / 1e9;
+
+    uint64_t max = 0;
+    for (int b = HISTOGRAM_SIZE - 1; b >= 0; b--) {
+        if (histogram[b]) {
+            max = histogram_value(b);
+            break;
+        }
+    }
+
+    char distribution[32];
+    if (zipf_exponent > 0) {
+        snprintf(distribution, sizeof(distribution), "zipf:%.2f", zipf_exponent);
+    } else {
+        snprintf(distribution, sizeof(distribution), "uniform");
+    }
+
+    char line[1024];
+    snprintf(line, sizeof(line),
+             "label=%s connections=%d threads=%d keepalive=%d routes=%d distribution=%s duration_s=%.2f "
+             "requests=%llu rps=%.0f ok=%llu status_4xx=%llu status_5xx=%llu errors=%llu "
+             "p50_us=%llu p99_us=%llu p999_us=%llu max_us=%llu\n",
+             label, connections, threads, keep_alive, route_count, distribution, elapsed,
+             (unsigned long long)requests, (double)requests / elapsed,
+             (unsigned long long)ok, (unsigned long long)client_errors, (unsigned long long)server_errors,
+             (unsigned long long)errors,
+             (unsigned long long)percentile(histogram, requests, 0.50),
+             (unsigned long long)percentile(histogram, requests, 0.99),
+             (unsigned long long)percentile(histogram, requests, 0.999),
+             (unsigned long long)max);
+
+    fputs(line, stdout);
+    if (output) {
+        FILE *out = fopen(output, "a");
+        if (out == NULL) {
+            fprintf(stderr, "fopen %s failed: %s\n", output, strerror(errno));
+            return EXIT_FAILURE;
+        }
+        fputs(line, out);
+        fclose(out);
+    }
+    return requests > 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,104 @@
+/*
+ * Autor: Guido Barosio
+ * Email: guido@bravo47.com
+ * Fecha: 2024-06-08
+ */
+
+/*
+ * parser_bench: request head parser microbenchmark.
+ *
+ *   parser_bench [-n iterations]
+ *
+ * Parses a few representative request heads over and over with every
+ * scanner the CPU supports and prints one line of key=value pairs per
+ * scanner and request: nanoseconds per parse and input bytes per second.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../utils/http_parser.h"
+
+static const struct {
+    const char *name;
+    const char *text;
+} requests[] = {
+    {"curl",
+     "GET /google HTTP/1.1\r\n"
+     "Host: localhost:8080\r\n"
+     "User-Agent: curl/8.5.0\r\n"
+     "Accept: */*\r\n"
+     "\r\n"},
+    {"browser",
+     "GET /a/short/link?utm_source=newsletter&utm_medium=email HTTP/1.1\r\n"
+     "Host: go.example.com\r\n"
+     "User-Agent: Mozilla/5.0 (Macintosh; Intel Mac OS X 10_15_7) AppleWebKit/537.36 "
+     "(KHTML, like Gecko) Chrome/124.0.0.0 Safari/537.36\r\n"
+     "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,*/*;q=0.8\r\n"
+     "Accept-Language: en-US,en;q=0.9,es;q=0.8\r\n"
+     "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+     "Referer: https://mail.example.com/\r\n"
+     "Cookie: session=8f14e45fceea167a5a36dedd4bea2543; theme=dark; consent=1\r\n"
+     "Sec-Fetch-Dest: document\r\n"
+     "Sec-Fetch-Mode: navigate\r\n"
+     "Upgrade-Insecure-Requests: 1\r\n"
+     "Connection: keep-alive\r\n"
+     "\r\n"},
+    {"loadgen",
+     "GET /bench0012345 HTTP/1.1\r\n"
+     "Host: 127.0.0.1\r\n"
+     "\r\n"},
+};
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv) {
+    long iterations = 5000000;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:")) != -1) {
+        if (opt == 'n') {
+            iterations = atol(optarg);
+        } else {
+            fprintf(stderr, "usage: %s [-n iterations]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    for (int kind = 0; kind < HTTP_SCAN_COUNT; kind++) {
+        if (http_parser_select((HttpScanKind)kind) == -1) {
+            continue;
+        }
+        for (size_t r = 0; r < sizeof(requests) / sizeof(requests[0]); r++) {
+            const char *text = requests[r].text;
+            size_t len = strlen(text);
+            HttpHead head;
+            long sink = 0;
+
+            double started = now_seconds();
+            for (long i = 0; i < iterations; i++) {
+                // Keep the compiler from hoisting the call out of the loop
+                __asm__ volatile("" : : "r"(text) : "memory");
+                sink += http_parse_head(text, len, &head, NULL);
+            }
+            double elapsed = now_seconds() - started;
+
+            if (sink != (long)len * iterations) {
+                fprintf(stderr, "%s: unexpected parse result\n", requests[r].name);
+                return 1;
+            }
+            printf("scanner=%s request=%s bytes=%zu ns_per_parse=%.1f mb_per_s=%.0f\n",
+                   http_scan_name((HttpScanKind)kind), requests[r].name, len,
+                   elapsed * 1e9 / iterations, len * iterations / elapsed / 1e6);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,125 @@
+#!/usr/bin/env bash
+#
+# Benchmark harness for YATHR.
+#
+# Starts ./http_server on a generated route set in a scratch directory and
+# runs bench/loadgen through a fixed set of scenarios. Each scenario
+# appends one key=value line to bench_output.txt. Run from the project
+# root, or via `make bench`.
+#
+# Environment:
+#   BENCH_DURATION     seconds per scenario (default 10)
+#   BENCH_CONNECTIONS  concurrent connections (default 256)
+#   BENCH_THREADS      load generator threads (default 2)
+#   BENCH_ROUTES       size of the generated route set (default 100000)
+#   BENCH_PORT         server port (default 18080)
+#   BENCH_WORKERS      server WORKERS (default: all CPUs)
+#   BENCH_IO_URING     1 to run the server on the io_uring backend
+#   BENCH_IN_MEMORY    1 to load the routes with ROUTES_FILE instead of
+#                      serving them from a ROUTES_CDB database
+#   BENCH_BATCH_LOOKUPS  1 to run the server with BATCH_LOOKUPS
+#   BENCH_BASELINE     earlier bench_output.txt to compare against; the run
+#                      fails if any scenario's rps drops more than
+#                      BENCH_TOLERANCE percent (default 10)
+#
+
+set -u
+
+DURATION=${BENCH_DURATION:-10}
+CONNECTIONS=${BENCH_CONNECTIONS:-256}
+THREADS=${BENCH_THREADS:-2}
+ROUTES=${BENCH_ROUTES:-100000}
+PORT=${BENCH_PORT:-18080}
+TOLERANCE=${BENCH_TOLERANCE:-10}
+OUTPUT=bench_output.txt
+
+ROOT=$(pwd)
+WORKDIR=$(mktemp -d)
+SERVER_PID=""
+
+cleanup() {
+    if [ -n "$SERVER_PID" ]; then
+        kill "$SERVER_PID" 2>/dev/null || true
+        wait "$SERVER_PID" 2>/dev/null || true
+    fi
+    rm -rf "$WORKDIR"
+}
+trap cleanup EXIT
+
+# ── start server ─────────────────────────────────────────────────────
+
+./bench/loadgen -g "$WORKDIR/routes.tsv" -n "$ROUTES" || exit 1
+./yathr-mkdb "$WORKDIR/routes.tsv" "$WORKDIR/routes.cdb" >/dev/null || exit 1
+
+{
+    echo "SERVER_PORT=$PORT"
+    if [ "${BENCH_IN_MEMORY:-0}" = 1 ]; then
+        echo "ROUTES_FILE=$WORKDIR/routes.tsv"
+    else
+        echo "ROUTES_CDB=$WORKDIR/routes.cdb"
+    fi
+    echo "ACCESS_LOG=$WORKDIR/access.log"
+    [ -n "${BENCH_WORKERS:-}" ] && echo "WORKERS=$BENCH_WORKERS"
+    [ -n "${BENCH_IO_URING:-}" ] && echo "IO_URING=$BENCH_IO_URING"
+    [ -n "${BENCH_BATCH_LOOKUPS:-}" ] && echo "BATCH_LOOKUPS=$BENCH_BATCH_LOOKUPS"
+} > "$WORKDIR/config.txt"
+cp zlog.conf "$WORKDIR/"
+
+(cd "$WORKDIR" && exec "$ROOT/http_server" >/dev/null 2>&1) &
+SERVER_PID=$!
+
+ready=0
+for i in $(seq 1 100); do
+    if curl -s --max-time 0.1 -o /dev/null "http://127.0.0.1:$PORT/" 2>/dev/null; then
+        ready=1
+        break
+    fi
+    sleep 0.1
+done
+if [ "$ready" -eq 0 ]; then
+    echo "FATAL: server did not start within 10 s"
+    exit 1
+fi
+
+# ── scenarios ────────────────────────────────────────────────────────
+
+# Keep the baseline readable even when it is the file being rewritten
+if [ -n "${BENCH_BASELINE:-}" ]; then
+    cp "$BENCH_BASELINE" "$WORKDIR/baseline.txt" || exit 1
+fi
+: > "$OUTPUT"
+
+run() {
+    local label="$1"
+    shift
+    ./bench/loadgen -p "$PORT" -c "$CONNECTIONS" -t "$THREADS" -d "$DURATION" -n "$ROUTES" \
+        -l "$label" -o "$OUTPUT" "$@" || exit 1
+}
+
+run keepalive-uniform -k 1
+run keepalive-zipf -k 1 -z 0.99
+run close-uniform -k 0 -c $((CONNECTIONS < 64 ? CONNECTIONS : 64))
+
+# ── regression check ─────────────────────────────────────────────────
+
+if [ -n "${BENCH_BASELINE:-}" ]; then
+    awk -v tolerance="$TOLERANCE" '
+        function field(line, key,    n, parts, i, kv) {
+            n = split(line, parts, " ")
+            for (i = 1; i <= n; i++) {
+                split(parts[i], kv, "=")
+                if (kv[1] == key) return kv[2]
+            }
+            return ""
+        }
+        FNR == NR { baseline[field($0, "label")] = field($0, "rps"); next }
+        {
+            label = field($0, "label")
+            if (!(label in baseline) || baseline[label] == 0) next
+            change = (field($0, "rps") - baseline[label]) * 100 / baseline[label]
+            printf "%-20s %+.1f%% rps\n", label, change
+            if (change < -tolerance) failed = 1
+        }
+        END { exit failed }
+    ' "$WORKDIR/baseline.txt" "$OUTPUT" || { echo "FAIL: throughput regressed more than $TOLERANCE%"; exit 1; }
+fi
@@ -0,0 +1,329 @@
+/*
+ * Autor: Guido Barosio
+ * Email: guido@bravo47.com
+ * Fecha: 2024-06-08
+ */
+
+#include "connection.h"
+#include "utils/logs.h"
+#include "utils/metrics.h"
+#include "utils/latency.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+
+#define POOL_GROW 64
+
+// Connections are indexed by fd. Descriptors are process-wide, so one
+// table serves every worker; each fd is only ever touched by the worker
+// that accepted it.
+static Connection **connections = NULL;
+static int connections_size = 0;
+static int idle_timeout = 5;
+static int request_timeout = 10;
+static int send_timeout = 30;
+static unsigned int max_requests = 100;
+
+int init_connections(int keepalive_timeout, int header_timeout, int write_timeout, int max_requests_per_connection) {
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == -1) {
+        log_error("getrlimit failed: %s", strerror(errno));
+        return -1;
+    }
+
+    connections_size = limit.rlim_cur == RLIM_INFINITY || limit.rlim_cur > 1048576
+                       ? 1048576 : (int)limit.rlim_cur;
+    connections = calloc(connections_size, sizeof(Connection *));
+    if (connections == NULL) {
+        log_error("Failed to allocate connection table for %d fds", connections_size);
+        return -1;
+    }
+
+    if (keepalive_timeout > 0) {
+        idle_timeout = keepalive_timeout;
+    }
+    if (header_timeout > 0) {
+        request_timeout = header_timeout;
+    }
+    if (write_timeout > 0) {
+        send_timeout = write_timeout;
+    }
+    if (max_requests_per_connection > 0) {
+        max_requests = (unsigned int)max_requests_per_connection;
+    }
+    return 0;
+}
+
+static Connection *pool_get(ConnectionPool *pool) {
+    if (pool->free == NULL) {
+        Connection *slab = calloc(POOL_GROW, sizeof(Connection));
+        if (slab == NULL) {
+            return NULL;
+        }
+        for (int i = 0; i < POOL_GROW; i++) {
+            slab[i].next = pool->free;
+            pool->free = &slab[i];
+        }
+    }
+    Connection *conn = pool->free;
+    pool->free = conn->next;
+    return conn;
+}
+
+Connection *connection_open(ConnectionPool *pool, int fd) {
+    if (fd < 0 || fd >= connections_size) {
+        return NULL;
+    }
+
+    Connection *conn = pool_get(pool);
+    if (conn == NULL) {
+        log_error("Failed to allocate connection context for fd %d", fd);
+        return NULL;
+    }
+    memset(conn, 0, sizeof(*conn));
+    conn->fd = fd;
+    conn->pool = pool;
+    conn->generation = ++pool->generation;
+    conn->state = CONN_IDLE;
+    conn->held_head = conn->held_tail = -1;
+    conn->opened_at = latency_now();
+    // Until its first request arrives, a new connection is held to the
+    // header deadline
+    conn->deadline = DEADLINE_HEADER;
+    timer_schedule(&pool->timers, &conn->timer, pool->timers.now + request_timeout);
+    connections[fd] = conn;
+    metric_inc(METRIC_CONNECTIONS_OPENED);
+    return conn;
+}
+
+Connection *connection_get(int fd) {
+    if (fd < 0 || fd >= connections_size) {
+        return NULL;
+    }
+    return connections[fd];
+}
+
+// Returns the connection's read buffer, taking one from the pool if the
+// connection does not hold one yet. Buffers hold READ_BUFFER_SIZE bytes.
+char *connection_buffer(ConnectionPool *pool, Connection *conn) {
+    if (conn->buffer == NULL) {
+        if (pool->free_buffers) {
+            conn->buffer = pool->free_buffers;
+            pool->free_buffers = *(char **)conn->buffer;
+        } else {
+            conn->buffer = malloc(READ_BUFFER_SIZE);
+        }
+    }
+    return conn->buffer;
+}
+
+static void release_buffer(ConnectionPool *pool, Connection *conn) {
+    if (conn->buffer) {
+        *(char **)conn->buffer = pool->free_buffers;
+        pool->free_buffers = conn->buffer;
+        conn->buffer = NULL;
+    }
+}
+
+static void release_output(ConnectionPool *pool, Connection *conn) {
+    if (conn->output) {
+        *(char **)conn->output = pool->free_outputs;
+        pool->free_outputs = conn->output;
+        conn->output = NULL;
+    }
+    conn->output_length = conn->output_sent = 0;
+}
+
+// Drops the parsed requests from the read buffer. A trailing partial
+// request is moved to the front; an idle connection gives its buffer back.
+void connection_consume(ConnectionPool *pool, Connection *conn) {
+    if (conn->offset == conn->length) {
+        conn->length = conn->offset = 0;
+        conn->state = CONN_IDLE;
+        release_buffer(pool, conn);
+        return;
+    }
+
+    if (conn->offset > 0) {
+        memmove(conn->buffer, conn->buffer + conn->offset, conn->length - conn->offset);
+        conn->length -= conn->offset;
+        conn->offset = 0;
+        // What is left is the start of the next request: its header
+        // deadline starts now
+        conn->deadline = DEADLINE_NONE;
+    }
+    conn->state = CONN_READING;
+}
+
+// Returns room for len more bytes at the end of the output queue, or NULL
+// when the response would exceed the connection's output budget.
+char *connection_reserve(Connection *conn, size_t len) {
+    ConnectionPool *pool = conn->pool;
+
+    if (conn->output == NULL) {
+        if (pool->free_outputs) {
+            conn->output = pool->free_outputs;
+            pool->free_outputs = *(char **)conn->output;
+        } else if ((conn->output = malloc(OUTPUT_BUFFER_SIZE)) == NULL) {
+            return NULL;
+        }
+    }
+
+    if (conn->output_length + len > OUTPUT_BUFFER_SIZE && conn->output_sent > 0) {
+        memmove(conn->output, conn->output + conn->output_sent, conn->output_length - conn->output_sent);
+        conn->output_length -= conn->output_sent;
+        conn->output_sent = 0;
+    }
+    if (conn->output_length + len > OUTPUT_BUFFER_SIZE) {
+        return NULL;
+    }
+
+    char *p = conn->output + conn->output_length;
+    conn->output_length += len;
+    return p;
+}
+
+int connection_write(Connection *conn, const char *data, size_t len) {
+    char *p = connection_reserve(conn, len);
+    if (p == NULL) {
+        return -1;
+    }
+    memcpy(p, data, len);
+    return 0;
+}
+
+// True once half the output budget is queued: request processing pauses
+// until the client drains it, so a client that pipelines requests without
+// reading responses cannot grow the queue without bound. Also true while
+// a deferred response still does not fit behind what is queued.
+int connection_output_full(const Connection *conn) {
+    size_t queued = conn->output_length - conn->output_sent;
+    return queued >= OUTPUT_BUFFER_SIZE / 2 || queued + conn->output_wanted > OUTPUT_BUFFER_SIZE;
+}
+
+// Called when connection_reserve() refused len bytes. Returns 1 when they
+// fit once the queued output is sent: processing then pauses until it is,
+// and the request is answered again. Returns 0 when len is more than even
+// an empty output buffer takes.
+int connection_defer(Connection *conn, size_t len) {
+    if (len > OUTPUT_BUFFER_SIZE || conn->output_sent == conn->output_length) {
+        return 0;
+    }
+    conn->output_wanted = len;
+    return 1;
+}
+
+// Sends as much queued output as the socket accepts. Returns 1 when the
+// queue is empty, 0 when the socket would block with bytes still queued
+// and -1 on error.
+int connection_flush(Connection *conn) {
+    while (conn->output_sent < conn->output_length) {
+        ssize_t sent = send(conn->fd, conn->output + conn->output_sent,
+                            conn->output_length - conn->output_sent, 0);
+        if (sent == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 0;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        conn->output_sent += sent;
+        metric_add(METRIC_BYTES_SENT, sent);
+    }
+    release_output(conn->pool, conn);
+    return 1;
+}
+
+// Accounts for len bytes sent by an asynchronous send of the queued
+// output. Returns 1 once the queue is empty.
+int connection_sent(Connection *conn, size_t len) {
+    conn->output_sent += len;
+    metric_add(METRIC_BYTES_SENT, len);
+    if (conn->output_sent < conn->output_length) {
+        return 0;
+    }
+    release_output(conn->pool, conn);
+    return 1;
+}
+
+// Marks activity: sets the deadline for what the connection waits on
+// now. Queued output must progress within the write timeout and an idle
+// connection gets the keep-alive timeout, both counted from now. A
+// partial request keeps the deadline set when its first bytes arrived,
+// so a client trickling a header byte at a time cannot extend it.
+void connection_touch(ConnectionPool *pool, Connection *conn) {
+    ConnectionDeadline deadline;
+    int timeout;
+
+    if (conn->output_length > conn->output_sent) {
+        deadline = DEADLINE_WRITE;
+        timeout = send_timeout;
+    } else if (conn->state == CONN_READING) {
+        if (conn->deadline == DEADLINE_HEADER && timer_pending(&conn->timer)) {
+            return;
+        }
+        deadline = DEADLINE_HEADER;
+        timeout = request_timeout;
+    } else {
+        if (conn->deadline == DEADLINE_HEADER && conn->requests == 0 && timer_pending(&conn->timer)) {
+            return;     // new connection, still waiting for its first request
+        }
+        deadline = DEADLINE_IDLE;
+        timeout = idle_timeout;
+    }
+    conn->deadline = deadline;
+    timer_schedule(&pool->timers, &conn->timer, pool->timers.now + timeout);
+}
+
+// Cancels the connection's deadline, so it is no longer expired.
+void connection_detach(ConnectionPool *pool, Connection *conn) {
+    timer_cancel(&pool->timers, &conn->timer);
+    conn->deadline = DEADLINE_NONE;
+}
+
+void connection_close(ConnectionPool *pool, Connection *conn) {
+    if (pool->close_handler) {
+        connection_detach(pool, conn);
+        pool->close_handler(pool, conn);
+        return;
+    }
+    int fd = conn->fd;
+    connection_release(pool, conn);
+    close(fd);
+}
+
+// Recycles the connection's context and buffers without closing its
+// descriptor.
+void connection_release(ConnectionPool *pool, Connection *conn) {
+    connection_detach(pool, conn);
+    release_buffer(pool, conn);
+    release_output(pool, conn);
+    connections[conn->fd] = NULL;
+    conn->next = pool->free;
+    pool->free = conn;
+    metric_inc(METRIC_CONNECTIONS_CLOSED);
+}
+
+// Returns 1 while the connection may serve another request after the
+// current one.
+int connection_keep_alive(const Connection *conn) {
+    return conn->requests < max_requests;
+}
+
+static void expire_connection(TimerNode *node, void *ctx) {
+    ConnectionPool *pool = ctx;
+    Connection *conn = (Connection *)((char *)node - offsetof(Connection, timer));
+    conn->deadline = DEADLINE_NONE;
+    connection_close(pool, conn);
+}
+
+// Advances the worker's timing wheel to now (in seconds from a monotonic
+// clock) and closes the connections whose deadline has passed.
+void expire_connections(ConnectionPool *pool, uint64_t now) {
+    timer_wheel_advance(&pool->timers, now, expire_connection, pool);
+}
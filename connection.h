@@ -0,0 +1,102 @@
+/*
+ * Autor: Guido Barosio
+ * Email: guido@bravo47.com
+ * Fecha: 2024-06-08
+ */
+
+#ifndef CONNECTION_H
+#define CONNECTION_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "utils/http_parser.h"
+#include "utils/timer_wheel.h"
+
+#define READ_BUFFER_SIZE 8192
+#define OUTPUT_BUFFER_SIZE 16384    // per-connection budget of unsent response bytes
+
+typedef enum {
+    CONN_IDLE,      // keep-alive, no request bytes pending
+    CONN_READING,   // part of a request has arrived
+    CONN_WRITING    // responses being sent
+} ConnectionState;
+
+// The timeout a connection's timer currently enforces.
+typedef enum {
+    DEADLINE_NONE,
+    DEADLINE_HEADER,    // a request has started arriving (or none yet on a new connection)
+    DEADLINE_IDLE,      // keep-alive, between requests
+    DEADLINE_WRITE      // responses queued, the client is not reading
+} ConnectionDeadline;
+
+struct ConnectionPool;
+
+typedef struct Connection {
+    int fd;
+    ConnectionState state;
+    unsigned int requests;      // requests served on this connection
+    char *buffer;               // read buffer, only held while bytes are pending
+    size_t length;              // bytes in buffer
+    size_t offset;              // start of the first unparsed request
+    HttpScan scan;              // search for the end of the head at offset, while it arrives
+    char *output;               // queued response bytes, only held while unsent
+    size_t output_length;
+    size_t output_sent;
+    size_t output_wanted;       // room a deferred response waits for, see connection_defer()
+    int close_after_write;      // close once the queued output is sent
+    uint64_t opened_at;         // latency_now() at accept, 0 once its first bytes are processed
+    // Completion-based backends (io_uring) only
+    unsigned int pending;       // submitted operations not completed yet
+    unsigned char receiving;    // a multishot receive is armed
+    unsigned char sending;      // the queued output is being sent
+    unsigned char cancelling;   // the receive is being cancelled
+    unsigned char closing;      // ending, released once nothing is in flight
+    uint32_t generation;        // tells this connection from earlier ones on the fd
+    int held_head;              // received buffers not yet copied into buffer
+    int held_tail;
+    unsigned int held_offset;   // bytes of the first held buffer already copied
+    uint64_t send_started;      // latency_now() when the send in flight was submitted
+    struct ConnectionPool *pool;
+    TimerNode timer;            // the current deadline, see ConnectionPool
+    ConnectionDeadline deadline;
+    struct Connection *next;    // free list link
+} Connection;
+
+// Per-worker connection contexts. Every open connection has one deadline
+// on the worker's timing wheel, counted in seconds: a request head must
+// arrive within HEADER_TIMEOUT of its first bytes, an idle keep-alive
+// connection is closed after KEEPALIVE_TIMEOUT and queued output must
+// make progress within WRITE_TIMEOUT. Stale connections are found without
+// scanning. Closed contexts and read buffers are recycled through
+// free lists owned by the worker, so no locking is needed. A backend that
+// has operations in flight on a descriptor sets close_handler to take
+// over closing; it calls connection_release() once they have completed.
+typedef struct ConnectionPool {
+    TimerWheel timers;
+    Connection *free;
+    char *free_buffers;
+    char *free_outputs;
+    void (*close_handler)(struct ConnectionPool *pool, Connection *conn);
+    void *backend;
+    uint32_t generation;        // of the connection opened last
+} ConnectionPool;
+
+int init_connections(int keepalive_timeout, int header_timeout, int write_timeout, int max_requests);
+Connection *connection_open(ConnectionPool *pool, int fd);
+Connection *connection_get(int fd);
+char *connection_buffer(ConnectionPool *pool, Connection *conn);
+void connection_consume(ConnectionPool *pool, Connection *conn);
+char *connection_reserve(Connection *conn, size_t len);
+int connection_write(Connection *conn, const char *data, size_t len);
+int connection_output_full(const Connection *conn);
+int connection_defer(Connection *conn, size_t len);
+int connection_flush(Connection *conn);
+int connection_sent(Connection *conn, size_t len);
+void connection_touch(ConnectionPool *pool, Connection *conn);
+void connection_detach(ConnectionPool *pool, Connection *conn);
+void connection_close(ConnectionPool *pool, Connection *conn);
+void connection_release(ConnectionPool *pool, Connection *conn);
+int connection_keep_alive(const Connection *conn);
+void expire_connections(ConnectionPool *pool, uint64_t now);
+
+#endif // CONNECTION_H
@@ -9,60 +9,207 @@
 #include "server.h"
 #include "plugins/plugin.h"
 #include "utils/logs.h"
+#include "utils/access_log.h"
+#include "utils/metrics.h"
+#include "utils/latency.h"
+#include "utils/response.h"
+#include "utils/http_parser.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
-#include <strings.h>
 #include <unistd.h>
-#include <sys/socket.h>
 
-void handle_request(int client_socket, const char *method, const char *path, const char *auth_header) {
-    RequestData request_data = {method, path, auth_header, client_socket, NULL};
+// Parses one request from the start of buffer (see utils/http_parser.c).
+// On success request is filled and the number of bytes the request
+// occupies (request line, headers and Content-Length body) is returned,
+// so pipelined requests can be parsed one after another. The parser only
+// reads the buffer; method and path are NUL-terminated here afterwards
+// because plugins and the access log take them as C strings.
+// Returns 0 when the request is incomplete and -1 when it is malformed.
+// scan carries the search for the end of a head arriving in several
+// reads from one call to the next.
+int parse_request(char *buffer, size_t len, HttpRequest *request, HttpScan *scan) {
+    HttpHead head;
+    long head_len = http_parse_head(buffer, len, &head, scan);
+    if (head_len <= 0) {
+        return (int)head_len;
+    }
+
+    size_t request_len = (size_t)head_len;
+    if (head.minor_version < 0) {
+        // Request line without a version: a single request, then close
+        request->minor_version = 0;
+        request->keep_alive = 0;
+    } else {
+        request->minor_version = head.minor_version;
+        request->keep_alive = head.minor_version >= 1;
+        if (head.connection == HTTP_CONNECTION_CLOSE) {
+            request->keep_alive = 0;
+        } else if (head.connection == HTTP_CONNECTION_KEEP_ALIVE) {
+            request->keep_alive = 1;
+        }
+        if (head.chunked) {
+            // Chunked bodies are not supported: answer and close
+            request->keep_alive = 0;
+        }
+        if (head.content_length > len - request_len) {
+            return 0;
+        }
+        request_len += head.content_length;
+    }
+
+    request->method_sep = buffer[head.method_len];
+    request->path_sep = head.path[head.path_len];
+    buffer[head.method_len] = '\0';
+    ((char *)head.path)[head.path_len] = '\0';
+    request->method = head.method;
+    request->path = head.path;
+    request->path_len = head.path_len;
+    request->host = head.host;
+    request->host_len = head.host_len;
+    return (int)request_len;
+}
+
+// Undoes the NUL-termination of parse_request(), so the request at the
+// start of buffer parses again.
+void restore_request(char *buffer, const HttpRequest *request) {
+    buffer[strlen(request->method)] = request->method_sep;
+    ((char *)request->path)[request->path_len] = request->path_sep;
+}
+
+void send_bad_request(Connection *conn) {
+    static const char bad_request[] = "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+    connection_write(conn, bad_request, sizeof(bad_request) - 1);
+    metric_inc(METRIC_BAD_REQUESTS);
+}
+
+static void send_server_error(Connection *conn) {
+    static const char server_error[] =
+        "HTTP/1.1 500 Internal Server Error\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+    connection_write(conn, server_error, sizeof(server_error) - 1);
+    metric_inc(METRIC_SERVER_ERRORS);
+}
 
-    execute_plugins(PRE_ROUTING, &request_data);
+// Final header line telling the client whether the connection persists.
+// Only needed when it differs from the version's default.
+static const char *connection_header(const HttpRequest *request, size_t *len) {
+    static const char keep_alive[] = "Connection: keep-alive\r\n\r\n";
+    static const char close_header[] = "Connection: close\r\n\r\n";
+    static const char none[] = "\r\n";
 
-    // Skip leading '/' for routing lookup (optimized: avoid strlen)
+    if (request->keep_alive && request->minor_version == 0) {
+        *len = sizeof(keep_alive) - 1;
+        return keep_alive;
+    }
+    if (!request->keep_alive && request->minor_version >= 1) {
+        *len = sizeof(close_header) - 1;
+        return close_header;
+    }
+    *len = sizeof(none) - 1;
+    return none;
+}
+
+// Queues the response for one parsed request on the connection. Returns 1
+// when the connection should stay open for further requests and 0 when it
+// must be closed once the output is sent. Returns -1, having answered
+// nothing, when the response only fits once the output queued ahead of it
+// is sent; the request is handled again then, without rerunning the
+// PRE_ROUTING plugins.
+int handle_request(Connection *conn, const HttpRequest *request) {
+    const char *path = request->path;
+    RequestData request_data = {request->method, path, NULL, conn->fd, NULL, NULL};
+
+    if (conn->output_wanted == 0) {
+        execute_plugins(PRE_ROUTING, &request_data);
+    }
+    uint64_t routing_started = latency_now();
+    latency_record(LATENCY_PRE_ROUTING, routing_started - request->parsed_at);
+
+    // Skip leading '/' for routing lookup; the key is a slice of the path
     const char *key = path;
-    if (path && *path == '/') {
-        key = path + 1;
-        // Handle empty path case
-        if (*key == '\0') {
-            key = NULL;
-        }
+    size_t key_len = request->path_len;
+    if (key_len > 0 && *key == '/') {
+        key++;
+        key_len--;
     }
-    const char *redirect_url = key ? find_redirect(key) : NULL;
-    
-    if (redirect_url) {
-        // Optimized response formatting: avoid snprintf overhead
-        static const char header[] = "HTTP/1.1 302 Found\r\nLocation: ";
-        static const char footer[] = "\r\nContent-Length: 0\r\n\r\n";
-        size_t url_len = strlen(redirect_url);
-        size_t header_len = sizeof(header) - 1;
-        size_t footer_len = sizeof(footer) - 1;
-        size_t total_len = header_len + url_len + footer_len;
-        
-        if (total_len < BUFFER_SIZE) {
-            char response[BUFFER_SIZE];
-            char *p = response;
-            memcpy(p, header, header_len);
-            p += header_len;
-            memcpy(p, redirect_url, url_len);
-            p += url_len;
-            memcpy(p, footer, footer_len);
-            p += footer_len;
-            send(client_socket, response, total_len, 0);
+    Route route;
+    int found = key_len > 0 && find_route(request->host, request->host_len, key, key_len, &route);
+    uint64_t routed = latency_now();
+    latency_record(LATENCY_LOOKUP, routed - routing_started);
+
+    size_t trailer_len;
+    const char *trailer = connection_header(request, &trailer_len);
+    int queued = 0;
+
+    if (found) {
+        // The prebuilt response ends with the empty line; the connection
+        // header, when one is needed, goes in front of it. Otherwise
+        // (database values without a response and passthrough rules) the
+        // head is put together from its pieces, whatever their length, in
+        // one reservation so it is queued whole or not at all
+        static const char tail[] = "\r\nContent-Length: 0\r\n";
+        size_t header_len = sizeof(REDIRECT_HEADER) - 1;
+        size_t head_len = route.response ? route.response_len - 2
+                                         : header_len + route.url_len + route.suffix_len + sizeof(tail) - 1;
+        char *p = connection_reserve(conn, head_len + trailer_len);
+        if (p == NULL && connection_defer(conn, head_len + trailer_len)) {
+            return -1;
+        }
+        if (p && route.response) {
+            memcpy(p, route.response, head_len);
+            memcpy(p + head_len, trailer, trailer_len);
+        } else if (p) {
+            char *w = p;
+            memcpy(w, REDIRECT_HEADER, header_len);
+            w += header_len;
+            memcpy(w, route.url, route.url_len);
+            w += route.url_len;
+            memcpy(w, route.suffix, route.suffix_len);
+            w += route.suffix_len;
+            memcpy(w, tail, sizeof(tail) - 1);
+            w += sizeof(tail) - 1;
+            memcpy(w, trailer, trailer_len);
+        }
+        if (p) {
+            queued = 1;
+            metric_inc(METRIC_REDIRECTS);
+            if (access_log_wants(302)) {
+                access_log_record(302, request->method, path, route.url);
+            }
         } else {
-            // Fallback for very long URLs
-            char response[BUFFER_SIZE];
-            snprintf(response, sizeof(response), "HTTP/1.1 302 Found\r\nLocation: %s\r\nContent-Length: 0\r\n\r\n", redirect_url);
-            send(client_socket, response, strlen(response), 0);
+            // Longer than even an empty output buffer takes: a Location
+            // cut short would send the client elsewhere, so refuse instead
+            log_warning("Redirect for %.*s is %zu bytes long and does not fit the output buffer, answered 500",
+                        (int)(key_len < 64 ? key_len : 64), key, route.url_len + route.suffix_len);
+            send_server_error(conn);
+            if (access_log_wants(500)) {
+                access_log_record(500, request->method, path, NULL);
+            }
         }
-        log_info("Redirected %s to %s", path, redirect_url);
     } else {
-        static const char not_found[] = "HTTP/1.1 404 Not Found\r\nContent-Type: text/plain\r\nContent-Length: 9\r\n\r\nNot Found";
-        send(client_socket, not_found, sizeof(not_found) - 1, 0);
-        log_warning("Path not found: %s", path);
+        static const char not_found[] = "HTTP/1.1 404 Not Found\r\nContent-Type: text/plain\r\nContent-Length: 9\r\n";
+        static const char body[] = "Not Found";
+        char *p = connection_reserve(conn, sizeof(not_found) - 1 + trailer_len + sizeof(body) - 1);
+        if (p) {
+            memcpy(p, not_found, sizeof(not_found) - 1);
+            p += sizeof(not_found) - 1;
+            memcpy(p, trailer, trailer_len);
+            p += trailer_len;
+            memcpy(p, body, sizeof(body) - 1);
+            queued = 1;
+        }
+        metric_inc(METRIC_NOT_FOUND);
+        if (access_log_wants(404)) {
+            access_log_record(404, request->method, path, NULL);
+        }
     }
 
+    conn->output_wanted = 0;
+
+    uint64_t responded = latency_now();
+    latency_record(LATENCY_RESPOND, responded - routed);
+
     execute_plugins(POST_ROUTING, &request_data);
-    close(client_socket);
+    latency_record(LATENCY_POST_ROUTING, latency_now() - responded);
+    return queued && request->keep_alive;
 }
@@ -7,6 +7,26 @@
 #ifndef HTTP_H
 #define HTTP_H
 
-void handle_request(int client_socket, const char *method, const char *path, const char *auth_header);
+#include <stddef.h>
+#include <stdint.h>
+#include "connection.h"
+
+typedef struct {
+    const char *method;
+    const char *path;
+    size_t path_len;
+    const char *host;   // Host header value, not NUL-terminated; NULL without one
+    size_t host_len;
+    int minor_version;  // x in HTTP/1.x, 0 for requests without a version
+    int keep_alive;     // 1 when the connection stays open after the response
+    uint64_t parsed_at; // latency_now() once parsed, for the phase histograms
+    char method_sep;    // the bytes the NULs ending method and path replaced
+    char path_sep;
+} HttpRequest;
+
+int parse_request(char *buffer, size_t len, HttpRequest *request, HttpScan *scan);
+void restore_request(char *buffer, const HttpRequest *request);
+void send_bad_request(Connection *conn);
+int handle_request(Connection *conn, const HttpRequest *request);
 
 #endif // HTTP_H
@@ -7,7 +7,17 @@
 #include "platform.h"
 #include "server.h"
 #include "http.h"
+#include "connection.h"
+#include "routing.h"
 #include "utils/socket.h"
+#include "utils/logs.h"
+#include "utils/metrics.h"
+#include "utils/latency.h"
+#include "utils/http_parser.h"
+#ifdef __linux__
+#include "utils/uring.h"
+#include <sys/socket.h>
+#endif
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -17,87 +27,892 @@
 #include <errno.h>
 #include <arpa/inet.h>
 
+static void accept_connections(Worker *worker) {
+    struct sockaddr_in address;
+    socklen_t addrlen = sizeof(address);
+    while (1) {
+        int new_socket = accept(worker->server_fd, (struct sockaddr *)&address, &addrlen);
+        if (new_socket == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            } else {
+                log_warning("accept failed: %s", strerror(errno));
+                metric_inc(METRIC_ACCEPT_ERRORS);
+                break;
+            }
+        }
+        if (connection_open(&worker->connections, new_socket) == NULL) {
+            close(new_socket);
+            continue;
+        }
+        set_nonblocking(new_socket);
+        add_to_event_loop(worker->loop_fd, new_socket);
+    }
+}
+
+static void close_client(Worker *worker, int fd) {
+    Connection *conn = connection_get(fd);
+    if (conn) {
+        connection_close(&worker->connections, conn);
+    } else {
+        close(fd);
+    }
+}
+
+// Queues responses for the complete requests in the connection's buffer,
+// in order, so pipelined requests are served from a single read. A partial
+// request stays buffered and parsing resumes when more bytes arrive.
+// Stops early once the output budget fills up, a response has to wait for
+// the queued output to be sent, or a response asks for the connection to
+// be closed.
+static void process_requests(Connection *conn) {
+    while (conn->offset < conn->length && !conn->close_after_write && !connection_output_full(conn)) {
+        char *start = conn->buffer + conn->offset;
+        size_t available = conn->length - conn->offset;
+        uint64_t started = latency_now();
+
+        if (conn->opened_at) {
+            latency_record(LATENCY_FIRST_BYTE, started - conn->opened_at);
+            conn->opened_at = 0;
+        }
+
+        HttpRequest request;
+        int consumed = parse_request(start, available, &request, &conn->scan);
+        if (consumed == 0) {
+            // Head or body still arriving
+            return;
+        }
+        if (consumed < 0) {
+            send_bad_request(conn);
+            conn->close_after_write = 1;
+            return;
+        }
+        request.parsed_at = latency_now();
+        latency_record(LATENCY_PARSE, request.parsed_at - started);
+
+        conn->requests++;
+        if (!connection_keep_alive(conn)) {
+            request.keep_alive = 0;
+        }
+        int keep = handle_request(conn, &request);
+        if (keep < 0) {
+            // No room for the response until the queued output is sent:
+            // the request stays in the buffer and is parsed again then
+            restore_request(start, &request);
+            conn->requests--;
+            return;
+        }
+        conn->offset += consumed;
+        if (!keep) {
+            conn->close_after_write = 1;
+        }
+        latency_record(LATENCY_TOTAL, latency_now() - started);
+    }
+}
+
+// Sends queued output. If the socket cannot take all of it, waits for
+// writability instead of reading: the client has to drain responses
+// before more of its requests are processed. Returns 0 if the connection
+// was closed or is waiting to write.
+static int flush_output(Worker *worker, Connection *conn) {
+    int queued = conn->output_length > conn->output_sent;
+    uint64_t started = latency_now();
+    int flushed = connection_flush(conn);
+    if (queued) {
+        latency_record(LATENCY_SEND, latency_now() - started);
+    }
+    if (flushed < 0 || (flushed > 0 && conn->close_after_write)) {
+        connection_close(&worker->connections, conn);
+        return 0;
+    }
+    if (flushed == 0) {
+        if (conn->state != CONN_WRITING) {
+            conn->state = CONN_WRITING;
+            modify_event_loop(worker->loop_fd, conn->fd, EVENT_WRITE);
+        }
+        connection_touch(&worker->connections, conn);
+        return 0;
+    }
+    return 1;
+}
+
+// The socket is edge-triggered, so read until EAGAIN: bytes left unread
+// now would never be signalled again.
+static void handle_client(Worker *worker, int fd) {
+    ConnectionPool *pool = &worker->connections;
+    Connection *conn = connection_get(fd);
+    if (conn == NULL) {
+        close(fd);
+        return;
+    }
+
+    while (1) {
+        char *buffer = connection_buffer(pool, conn);
+        if (buffer == NULL) {
+            connection_close(pool, conn);
+            return;
+        }
+
+        process_requests(conn);
+        if (connection_output_full(conn) || conn->close_after_write) {
+            if (!flush_output(worker, conn)) {
+                return;
+            }
+            continue;
+        }
+        connection_consume(pool, conn);
+
+        if (conn->length == READ_BUFFER_SIZE) {
+            // Request head or body larger than the read buffer
+            send_bad_request(conn);
+            conn->close_after_write = 1;
+            break;
+        }
+
+        ssize_t valread = read(fd, buffer + conn->length, READ_BUFFER_SIZE - conn->length);
+        if (valread == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            // A reset is the client going away, counted with the other
+            // closes; anything else is worth a warning
+            if (errno != ECONNRESET) {
+                log_warning("read from fd %d failed: %s", fd, strerror(errno));
+            }
+            connection_close(pool, conn);
+            return;
+        }
+        if (valread == 0) {
+            connection_close(pool, conn);
+            return;
+        }
+        conn->length += valread;
+    }
+
+    if (!flush_output(worker, conn)) {
+        return;
+    }
+    connection_consume(pool, conn);
+    connection_touch(pool, conn);
+}
+
+// First half of a batched event: takes one read from a readable
+// connection and, if a request head is complete, starts the lookup for
+// its path. handle_client() later serves the connection as usual, with
+// the bytes already buffered; it reads on to EAGAIN, so the edge-triggered
+// contract still holds. Returns 1 when prefetch was started.
+static int read_ahead(Worker *worker, int fd, RoutePrefetch *prefetch) {
+    ConnectionPool *pool = &worker->connections;
+    Connection *conn = connection_get(fd);
+    if (conn == NULL || conn->state == CONN_WRITING || conn->close_after_write || conn->length == READ_BUFFER_SIZE) {
+        return 0;
+    }
+    char *buffer = connection_buffer(pool, conn);
+    if (buffer == NULL) {
+        return 0;
+    }
+
+    // An error or end of file is seen again by handle_client()'s read
+    ssize_t valread = read(fd, buffer + conn->length, READ_BUFFER_SIZE - conn->length);
+    if (valread > 0) {
+        conn->length += valread;
+    }
+
+    const char *start = buffer + conn->offset;
+    size_t available = conn->length - conn->offset;
+    HttpHead head;
+    if (http_parse_head(start, available, &head, &conn->scan) <= 0) {
+        return 0;
+    }
+    const char *key = head.path;
+    size_t key_len = head.path_len;
+    if (key_len > 0 && *key == '/') {
+        key++;
+        key_len--;
+    }
+    if (key_len == 0) {
+        return 0;
+    }
+    route_prefetch_start(prefetch, head.host, head.host_len, key, key_len);
+    return 1;
+}
+
+// Group prefetching: each step of every lookup in the batch is issued
+// before any of them waits on the next, so their misses overlap.
+static void prefetch_routes(RoutePrefetch *prefetches, int count) {
+    while (count > 0) {
+        int pending = 0;
+        for (int i = 0; i < count; i++) {
+            if (route_prefetch_step(&prefetches[i])) {
+                prefetches[pending++] = prefetches[i];
+            }
+        }
+        count = pending;
+    }
+}
+
+// Called when a connection waiting on EPOLLOUT/EVFILT_WRITE can take more
+// output. Once the queue drains, reading resumes where it was paused.
+static void handle_writable(Worker *worker, int fd) {
+    Connection *conn = connection_get(fd);
+    if (conn == NULL) {
+        close(fd);
+        return;
+    }
+
+    if (!flush_output(worker, conn)) {
+        return;
+    }
+    conn->state = CONN_READING;
+    modify_event_loop(worker->loop_fd, fd, EVENT_READ);
+    handle_client(worker, fd);
+}
+
 #ifdef __linux__
 
+// io_uring backend. Instead of readiness events the loop gets completions:
+// one multishot accept per listener, one multishot receive per connection
+// drawing from a ring of provided buffers, and sends queued straight from
+// the output buffer. A connection that ends is closed once the last
+// operation in flight on it has completed, never before: the descriptor's
+// number could otherwise be reused by an accept while completions for the
+// old connection are still on their way. All of a loop iteration's
+// submissions go to the kernel in the same io_uring_enter() that waits for
+// the next completions.
+
+#define URING_ENTRIES 4096
+#define URING_BUFFERS 1024          // provided receive buffers per loop, power of two
+#define URING_BUFFER_SIZE 2048
+#define URING_BUFFER_GROUP 0
+
+enum {
+    OP_ACCEPT = 1,
+    OP_RECV,
+    OP_SEND,
+    OP_CLOSE,
+    OP_CANCEL
+};
+
+// A submission's user_data: the operation, the low 24 bits of the
+// connection's generation and its descriptor, which indexes the
+// connection table. A completion whose generation does not match the
+// connection found there belongs to an earlier one and is dropped.
+#define USER_DATA(op, generation, fd) \
+    (((uint64_t)(op) << 56) | ((uint64_t)((generation) & 0xffffff) << 32) | (uint32_t)(fd))
+#define USER_DATA_OP(data) ((int)((data) >> 56))
+#define USER_DATA_GENERATION(data) ((uint32_t)((data) >> 32) & 0xffffff)
+#define USER_DATA_FD(data) ((int)(uint32_t)(data))
+#define CONN_DATA(op, conn) USER_DATA(op, (conn)->generation, (conn)->fd)
+
+// A connection waiting for receive buffers, by descriptor and generation
+// so that a connection closed meanwhile is not mistaken for a new one.
+typedef struct {
+    int fd;
+    uint32_t generation;
+} StarvedConnection;
+
+typedef struct {
+    Uring ring;
+    int server_fd;
+    int *held_next;             // per buffer id: next held buffer of the same connection
+    unsigned int *held_length;
+    StarvedConnection *starved; // connections whose receive ran out of buffers
+    int starved_count;
+    int starved_capacity;
+    int recycled;               // buffers were recycled this iteration
+    ConnectionPool *pool;       // the worker's connections, once it has run
+} UringLoop;
+
+static int use_io_uring = 0;
+static int use_sqpoll = 0;
+
+// Loops by descriptor; filled in by the main thread before workers start
+static UringLoop **uring_loops = NULL;
+static int uring_loops_size = 0;
+
+static UringLoop *uring_loop(int loop_fd) {
+    return loop_fd >= 0 && loop_fd < uring_loops_size ? uring_loops[loop_fd] : NULL;
+}
+
+static int uring_create(void) {
+    UringLoop *loop = calloc(1, sizeof(UringLoop));
+    if (loop == NULL) {
+        return -1;
+    }
+    loop->server_fd = -1;
+    loop->held_next = calloc(URING_BUFFERS, sizeof(int));
+    loop->held_length = calloc(URING_BUFFERS, sizeof(unsigned int));
+    if (loop->held_next == NULL || loop->held_length == NULL) {
+        goto fail;
+    }
+    if (uring_init(&loop->ring, URING_ENTRIES, use_sqpoll) == -1) {
+        goto fail;
+    }
+    if (uring_setup_buffers(&loop->ring, URING_BUFFERS, URING_BUFFER_SIZE, URING_BUFFER_GROUP) == -1) {
+        uring_exit(&loop->ring);
+        goto fail;
+    }
+
+    int fd = loop->ring.fd;
+    if (fd >= uring_loops_size) {
+        int size = fd + 16;
+        UringLoop **loops = realloc(uring_loops, size * sizeof(UringLoop *));
+        if (loops == NULL) {
+            uring_exit(&loop->ring);
+            goto fail;
+        }
+        memset(loops + uring_loops_size, 0, (size - uring_loops_size) * sizeof(UringLoop *));
+        uring_loops = loops;
+        uring_loops_size = size;
+    }
+    uring_loops[fd] = loop;
+    return fd;
+
+fail:
+    free(loop->held_next);
+    free(loop->held_length);
+    free(loop);
+    return -1;
+}
+
+static void arm_accept(UringLoop *loop) {
+    struct io_uring_sqe *sqe = uring_get_sqe(&loop->ring);
+    if (sqe == NULL) {
+        log_error("io_uring: cannot queue accept on fd %d", loop->server_fd);
+        return;
+    }
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = loop->server_fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = USER_DATA(OP_ACCEPT, 0, loop->server_fd);
+}
+
+// Last resort when the submission ring is full: shutting the socket down
+// ends whatever is in flight on it; the descriptor is closed once those
+// operations have completed.
+static void abort_connection(Connection *conn) {
+    conn->closing = 1;
+    shutdown(conn->fd, SHUT_RDWR);
+}
+
+static int arm_receive(UringLoop *loop, Connection *conn) {
+    struct io_uring_sqe *sqe = uring_get_sqe(&loop->ring);
+    if (sqe == NULL) {
+        return -1;
+    }
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = conn->fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUFFER_GROUP;
+    sqe->user_data = CONN_DATA(OP_RECV, conn);
+    conn->receiving = 1;
+    conn->pending++;
+    return 0;
+}
+
+static int cancel_receive(UringLoop *loop, Connection *conn) {
+    struct io_uring_sqe *sqe = uring_get_sqe(&loop->ring);
+    if (sqe == NULL) {
+        return -1;
+    }
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = CONN_DATA(OP_RECV, conn);
+    sqe->user_data = CONN_DATA(OP_CANCEL, conn);
+    conn->cancelling = 1;
+    conn->pending++;
+    return 0;
+}
+
+// Ends the connection. Operations still in flight keep it, so the
+// receive is cancelled and, without keep_send, everything else is: a
+// response still being sent goes out in full before the FIN. With
+// nothing in flight a no-op stands in, so that every connection is
+// finished by the completion that leaves it with none (see
+// handle_completion()) and closed by finish_close().
+static int submit_close(UringLoop *loop, Connection *conn, int keep_send) {
+    int cancel = conn->receiving || (conn->sending && !keep_send);
+    if (!cancel && conn->pending > 0) {
+        conn->closing = 1;
+        return 0;
+    }
+    struct io_uring_sqe *sqe = uring_get_sqe(&loop->ring);
+    if (sqe == NULL) {
+        return -1;
+    }
+    if (!cancel) {
+        sqe->opcode = IORING_OP_NOP;
+    } else if (keep_send) {
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr = CONN_DATA(OP_RECV, conn);
+    } else {
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = conn->fd;
+        sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+    }
+    sqe->user_data = CONN_DATA(OP_CANCEL, conn);
+    conn->pending++;
+    conn->closing = 1;
+    return 0;
+}
+
+static void uring_close_handler(ConnectionPool *pool, Connection *conn) {
+    if (conn->closing) {
+        return;
+    }
+    if (submit_close((UringLoop *)pool->backend, conn, 0) == -1) {
+        abort_connection(conn);
+    }
+}
+
+// Sends the queued output; when the connection ends with this response,
+// the receive is cancelled in the same submission and the close follows
+// the send's completion.
+static int submit_send(UringLoop *loop, ConnectionPool *pool, Connection *conn) {
+    int last = conn->close_after_write;
+    if (uring_reserve(&loop->ring, last ? 2 : 1) == -1) {
+        return -1;
+    }
+    struct io_uring_sqe *sqe = uring_get_sqe(&loop->ring);
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = conn->fd;
+    sqe->addr = (uint64_t)(uintptr_t)(conn->output + conn->output_sent);
+    sqe->len = (uint32_t)(conn->output_length - conn->output_sent);
+    // Wait for the whole response rather than completing short
+    sqe->msg_flags = MSG_WAITALL | MSG_NOSIGNAL;
+    sqe->user_data = CONN_DATA(OP_SEND, conn);
+    conn->sending = 1;
+    conn->pending++;
+    conn->send_started = latency_now();
+    if (last) {
+        connection_detach(pool, conn);
+        submit_close(loop, conn, 1);
+    }
+    return 0;
+}
+
+static void hold_buffer(UringLoop *loop, Connection *conn, int id, unsigned int length) {
+    loop->held_next[id] = -1;
+    loop->held_length[id] = length;
+    if (conn->held_tail == -1) {
+        conn->held_head = id;
+        conn->held_offset = 0;
+    } else {
+        loop->held_next[conn->held_tail] = id;
+    }
+    conn->held_tail = id;
+}
+
+static void recycle_held(UringLoop *loop, Connection *conn) {
+    int id = conn->held_head;
+    conn->held_head = loop->held_next[id];
+    conn->held_offset = 0;
+    if (conn->held_head == -1) {
+        conn->held_tail = -1;
+    }
+    uring_recycle_buffer(&loop->ring, id);
+    loop->recycled = 1;
+}
+
+// Copies held receive buffers into the read buffer as far as it has room.
+static int absorb_held(UringLoop *loop, ConnectionPool *pool, Connection *conn) {
+    while (conn->held_head != -1) {
+        char *buffer = connection_buffer(pool, conn);
+        if (buffer == NULL) {
+            return -1;
+        }
+        size_t room = READ_BUFFER_SIZE - conn->length;
+        if (room == 0) {
+            break;
+        }
+        int id = conn->held_head;
+        size_t available = loop->held_length[id] - conn->held_offset;
+        size_t n = available < room ? available : room;
+        memcpy(buffer + conn->length, uring_buffer(&loop->ring, id) + conn->held_offset, n);
+        conn->length += n;
+        conn->held_offset += n;
+        if (conn->held_offset == loop->held_length[id]) {
+            recycle_held(loop, conn);
+        }
+    }
+    return 0;
+}
+
+// Completes the close once nothing is in flight on the connection: with
+// the connection released no completion can refer to the descriptor any
+// more, so it is closed, in the next submission when there is room.
+static void finish_close(UringLoop *loop, ConnectionPool *pool, Connection *conn) {
+    int fd = conn->fd;
+    while (conn->held_head != -1) {
+        recycle_held(loop, conn);
+    }
+    connection_release(pool, conn);
+
+    struct io_uring_sqe *sqe = uring_get_sqe(&loop->ring);
+    if (sqe == NULL) {
+        close(fd);
+        return;
+    }
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->fd = fd;
+    sqe->user_data = USER_DATA(OP_CLOSE, 0, fd);
+}
+
+// Moves a connection forward after a completion: copies in received data,
+// answers complete requests unless a send is still in flight, sends the
+// responses, and keeps receiving unless the read buffer is full.
+static void service_connection(UringLoop *loop, ConnectionPool *pool, Connection *conn) {
+    if (conn->closing) {
+        return;
+    }
+
+    while (1) {
+        if (absorb_held(loop, pool, conn) == -1) {
+            connection_close(pool, conn);
+            return;
+        }
+        if (conn->sending) {
+            break;
+        }
+        process_requests(conn);
+        connection_consume(pool, conn);
+        if (conn->output_length > conn->output_sent || conn->close_after_write) {
+            break;
+        }
+        if (conn->length == READ_BUFFER_SIZE) {
+            // Request head or body larger than the read buffer
+            send_bad_request(conn);
+            conn->close_after_write = 1;
+            break;
+        }
+        if (conn->held_head == -1) {
+            break;
+        }
+    }
+
+    if (!conn->sending) {
+        if (conn->output_length > conn->output_sent) {
+            if (submit_send(loop, pool, conn) == -1) {
+                connection_close(pool, conn);
+                return;
+            }
+        } else if (conn->close_after_write) {
+            connection_close(pool, conn);
+            return;
+        }
+    }
+    if (conn->closing) {
+        return;
+    }
+
+    if (conn->held_head == -1) {
+        if (!conn->receiving && arm_receive(loop, conn) == -1) {
+            connection_close(pool, conn);
+            return;
+        }
+    } else if (conn->receiving && !conn->cancelling) {
+        // Read buffer full: stop receiving until it drains, like a
+        // readiness loop that stops reading
+        if (cancel_receive(loop, conn) == -1) {
+            connection_close(pool, conn);
+            return;
+        }
+    }
+    connection_touch(pool, conn);
+}
+
+static void starve_connection(UringLoop *loop, Connection *conn) {
+    if (loop->starved_count == loop->starved_capacity) {
+        int capacity = loop->starved_capacity ? loop->starved_capacity * 2 : 64;
+        StarvedConnection *starved = realloc(loop->starved, capacity * sizeof(StarvedConnection));
+        if (starved == NULL) {
+            connection_close(conn->pool, conn);
+            return;
+        }
+        loop->starved = starved;
+        loop->starved_capacity = capacity;
+    }
+    loop->starved[loop->starved_count++] = (StarvedConnection){conn->fd, conn->generation};
+}
+
+// Re-arms receives that stopped for lack of buffers, once some came back.
+static void rearm_starved(UringLoop *loop) {
+    int count = loop->starved_count;
+    loop->starved_count = 0;
+    for (int i = 0; i < count; i++) {
+        Connection *conn = connection_get(loop->starved[i].fd);
+        if (conn && conn->pool == loop->pool && conn->generation == loop->starved[i].generation &&
+            !conn->closing && !conn->receiving && conn->held_head == -1 && arm_receive(loop, conn) == -1) {
+            connection_close(conn->pool, conn);
+        }
+    }
+}
+
+static void handle_accept(UringLoop *loop, Worker *worker, const CompletionEvent *ev) {
+    if (!(ev->flags & IORING_CQE_F_MORE)) {
+        arm_accept(loop);
+    }
+    if (ev->res < 0) {
+        if (ev->res != -EAGAIN && ev->res != -ECANCELED) {
+            log_warning("io_uring accept failed: %s", strerror(-ev->res));
+            metric_inc(METRIC_ACCEPT_ERRORS);
+        }
+        return;
+    }
+
+    Connection *conn = connection_open(&worker->connections, ev->res);
+    if (conn == NULL) {
+        close(ev->res);
+        return;
+    }
+    if (arm_receive(loop, conn) == -1) {
+        connection_release(&worker->connections, conn);
+        close(ev->res);
+    }
+}
+
+static void handle_receive(UringLoop *loop, Worker *worker, Connection *conn, const CompletionEvent *ev) {
+    ConnectionPool *pool = &worker->connections;
+
+    if (!(ev->flags & IORING_CQE_F_MORE)) {
+        conn->receiving = 0;
+        conn->cancelling = 0;
+        conn->pending--;
+    }
+    if (ev->flags & IORING_CQE_F_BUFFER) {
+        int id = (int)(ev->flags >> IORING_CQE_BUFFER_SHIFT);
+        if (ev->res > 0 && !conn->closing) {
+            hold_buffer(loop, conn, id, (unsigned int)ev->res);
+        } else {
+            uring_recycle_buffer(&loop->ring, id);
+            loop->recycled = 1;
+        }
+    }
+
+    if (conn->closing) {
+        return;
+    }
+    if (ev->res > 0) {
+        service_connection(loop, pool, conn);
+    } else if (ev->res == 0) {
+        connection_close(pool, conn);
+    } else if (ev->res == -ENOBUFS) {
+        starve_connection(loop, conn);
+    } else if (ev->res == -ECANCELED) {
+        // Paused by cancel_receive(); service re-arms once drained
+        service_connection(loop, pool, conn);
+    } else {
+        connection_close(pool, conn);
+    }
+}
+
+static void handle_completion(Worker *worker, const CompletionEvent *ev) {
+    UringLoop *loop = uring_loop(worker->loop_fd);
+    ConnectionPool *pool = &worker->connections;
+    int op = USER_DATA_OP(ev->user_data);
+    int fd = USER_DATA_FD(ev->user_data);
+
+    if (pool->close_handler == NULL) {
+        pool->close_handler = uring_close_handler;
+        pool->backend = loop;
+        loop->pool = pool;
+    }
+    if (op == OP_ACCEPT) {
+        handle_accept(loop, worker, ev);
+        return;
+    }
+
+    if (op == OP_CLOSE) {
+        // Queued by finish_close(), after the connection was released
+        if (ev->res < 0) {
+            log_warning("io_uring close of fd %d failed: %s", fd, strerror(-ev->res));
+        }
+        return;
+    }
+
+    // Connections are only released, and their descriptors closed, once
+    // nothing is in flight on them, so a completion should always find
+    // its own. Should one not, it must not touch whichever connection
+    // holds the descriptor now; only its buffer is taken back.
+    Connection *conn = connection_get(fd);
+    if (conn == NULL || conn->pool != pool || (conn->generation & 0xffffff) != USER_DATA_GENERATION(ev->user_data)) {
+        if (ev->flags & IORING_CQE_F_BUFFER) {
+            uring_recycle_buffer(&loop->ring, (int)(ev->flags >> IORING_CQE_BUFFER_SHIFT));
+            loop->recycled = 1;
+        }
+        return;
+    }
+
+    switch (op) {
+        case OP_RECV:
+            handle_receive(loop, worker, conn, ev);
+            break;
+        case OP_SEND:
+            conn->pending--;
+            conn->sending = 0;
+            latency_record(LATENCY_SEND, latency_now() - conn->send_started);
+            if (ev->res < 0) {
+                connection_close(pool, conn);
+            } else if (!connection_sent(conn, (size_t)ev->res) || !conn->closing) {
+                service_connection(loop, pool, conn);
+            }
+            break;
+        default:
+            conn->pending--;
+            break;
+    }
+
+    if (conn->closing && conn->pending == 0) {
+        finish_close(loop, pool, conn);
+    }
+}
+
+static int uring_wait_for_events(UringLoop *loop, Event *events, int max_events, int timeout_ms) {
+    if (loop->recycled) {
+        uring_publish_buffers(&loop->ring);
+        loop->recycled = 0;
+        rearm_starved(loop);
+    }
+    if (uring_wait(&loop->ring, timeout_ms) == -1) {
+        return -1;
+    }
+
+    int count = 0;
+    struct io_uring_cqe *cqe;
+    while (count < max_events && (cqe = uring_peek_cqe(&loop->ring)) != NULL) {
+        events[count].completion.user_data = cqe->user_data;
+        events[count].completion.res = cqe->res;
+        events[count].completion.flags = cqe->flags;
+        uring_cqe_seen(&loop->ring);
+        count++;
+    }
+    return count;
+}
+
+// Chooses the backend for loops created afterwards. io_uring falls back to
+// epoll when the kernel does not offer it.
+void configure_event_loop(int io_uring, int sqpoll) {
+    use_io_uring = io_uring;
+    use_sqpoll = sqpoll;
+}
+
 int create_event_loop() {
+    if (use_io_uring) {
+        int fd = uring_create();
+        if (fd != -1) {
+            return fd;
+        }
+        log_warning("io_uring unavailable (%s), using epoll", strerror(errno));
+        use_io_uring = 0;
+    }
     return epoll_create1(0);
 }
 
 int add_to_event_loop(int loop_fd, int fd) {
+    UringLoop *loop = uring_loop(loop_fd);
+    if (loop) {
+        // Only listeners are added explicitly; connections are armed as
+        // they are accepted
+        loop->server_fd = fd;
+        arm_accept(loop);
+        return 0;
+    }
+
     struct epoll_event ev;
     ev.events = EPOLLIN | EPOLLET;
     ev.data.fd = fd;
     return epoll_ctl(loop_fd, EPOLL_CTL_ADD, fd, &ev);
 }
 
-int wait_for_events(int loop_fd, void *events, int max_events) {
-    return epoll_wait(loop_fd, (struct epoll_event *)events, max_events, -1);
+int modify_event_loop(int loop_fd, int fd, int events) {
+    if (uring_loop(loop_fd)) {
+        return 0;
+    }
+
+    struct epoll_event ev;
+    ev.events = EPOLLET;
+    if (events & EVENT_READ) ev.events |= EPOLLIN;
+    if (events & EVENT_WRITE) ev.events |= EPOLLOUT;
+    ev.data.fd = fd;
+    return epoll_ctl(loop_fd, EPOLL_CTL_MOD, fd, &ev);
 }
 
-void handle_event(int loop_fd, void *event, int server_fd, char *buffer, size_t buffer_size) {
-    struct epoll_event *ev = (struct epoll_event *)event;
-    int fd = ev->data.fd;
+int wait_for_events(int loop_fd, void *events, int max_events, int timeout_ms) {
+    UringLoop *loop = uring_loop(loop_fd);
+    if (loop) {
+        return uring_wait_for_events(loop, (Event *)events, max_events, timeout_ms);
+    }
+    // epoll fills a packed epoll_event array; spread it out into Event
+    // slots, back to front so nothing is overwritten before it is moved
+    int count = epoll_wait(loop_fd, (struct epoll_event *)events, max_events, timeout_ms);
+    for (int i = count - 1; i > 0; i--) {
+        memmove(&((Event *)events)[i].epoll, &((struct epoll_event *)events)[i], sizeof(struct epoll_event));
+    }
+    return count;
+}
 
-    if (ev->events & (EPOLLERR | EPOLLHUP) || !(ev->events & EPOLLIN)) {
-        close(fd);
+// Reads ahead on the readable connections among events and brings the
+// route table lines their requests need into cache before handle_event()
+// serves them. Completion events carry their data already and are left
+// alone.
+void prefetch_events(Worker *worker, void *events, int count) {
+    if (uring_loop(worker->loop_fd)) {
         return;
     }
 
-    if (fd == server_fd) {
-        struct sockaddr_in address;
-        socklen_t addrlen = sizeof(address);
-        while (1) {
-            int new_socket = accept(server_fd, (struct sockaddr *)&address, &addrlen);
-            if (new_socket == -1) {
-                if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                    break;
-                } else {
-                    perror("accept");
-                    break;
-                }
-            }
-            set_nonblocking(new_socket);
-            add_to_event_loop(loop_fd, new_socket);
+    RoutePrefetch prefetches[PREFETCH_BATCH];
+    int started = 0;
+    for (int i = 0; i < count; i++) {
+        const struct epoll_event *ev = &((Event *)events)[i].epoll;
+        if (ev->data.fd == worker->server_fd || (ev->events & (EPOLLERR | EPOLLHUP | EPOLLOUT)) ||
+            !(ev->events & EPOLLIN)) {
+            continue;
         }
-    } else {
-        int valread = read(fd, buffer, buffer_size);
-        if (valread <= 0) {
-            if (valread == 0) {
-                printf("Client disconnected\n");
-            } else {
-                perror("read");
-            }
-            close(fd);
-        } else {
-            buffer[valread] = '\0';
-            // Optimized manual HTTP parsing (much faster than sscanf)
-            char *line_end = (char *)memchr(buffer, '\n', valread);
-            if (line_end) {
-                *line_end = '\0';
-            }
-            
-            // Parse method (GET, POST, etc.)
-            char *method_start = buffer;
-            char *method_end = method_start;
-            while (*method_end && *method_end != ' ' && *method_end != '\t') method_end++;
-            if (*method_end) *method_end++ = '\0';
-            
-            // Skip whitespace
-            while (*method_end == ' ' || *method_end == '\t') method_end++;
-            
-            // Parse path
-            char *path_start = method_end;
-            char *path_end = path_start;
-            while (*path_end && *path_end != ' ' && *path_end != '\t' && *path_end != '?') path_end++;
-            if (*path_end) *path_end = '\0';
-            
-            handle_request(fd, method_start, path_start, NULL);
+        started += read_ahead(worker, ev->data.fd, &prefetches[started]);
+        if (started == PREFETCH_BATCH) {
+            prefetch_routes(prefetches, started);
+            started = 0;
         }
     }
+    prefetch_routes(prefetches, started);
+}
+
+void handle_event(Worker *worker, void *event) {
+    if (uring_loop(worker->loop_fd)) {
+        handle_completion(worker, &((Event *)event)->completion);
+        return;
+    }
+
+    struct epoll_event *ev = (struct epoll_event *)event;
+    int fd = ev->data.fd;
+
+    if (ev->events & (EPOLLERR | EPOLLHUP)) {
+        close_client(worker, fd);
+        return;
+    }
+
+    if (fd == worker->server_fd) {
+        accept_connections(worker);
+    } else if (ev->events & EPOLLOUT) {
+        handle_writable(worker, fd);
+    } else if (ev->events & EPOLLIN) {
+        handle_client(worker, fd);
+    }
 }
 
 #else
 
+void configure_event_loop(int io_uring, int sqpoll) {
+    (void)sqpoll;
+    if (io_uring) {
+        log_warning("io_uring is Linux-only, using kqueue");
+    }
+}
+
 int create_event_loop() {
     return kqueue();
 }
@@ -108,69 +923,50 @@ int add_to_event_loop(int loop_fd, int fd) {
     return kevent(loop_fd, &change_event, 1, NULL, 0, NULL);
 }
 
-int wait_for_events(int loop_fd, void *events, int max_events) {
-    return kevent(loop_fd, NULL, 0, (struct kevent *)events, max_events, NULL);
+int modify_event_loop(int loop_fd, int fd, int events) {
+    struct kevent changes[2];
+    EV_SET(&changes[0], fd, EVFILT_READ, (events & EVENT_READ) ? EV_ENABLE : EV_DISABLE, 0, 0, NULL);
+    EV_SET(&changes[1], fd, EVFILT_WRITE, EV_ADD | ((events & EVENT_WRITE) ? EV_ENABLE : EV_DISABLE), 0, 0, NULL);
+    return kevent(loop_fd, changes, 2, NULL, 0, NULL);
+}
+
+int wait_for_events(int loop_fd, void *events, int max_events, int timeout_ms) {
+    struct timespec timeout = {timeout_ms / 1000, (timeout_ms % 1000) * 1000000L};
+    return kevent(loop_fd, NULL, 0, (struct kevent *)events, max_events, timeout_ms < 0 ? NULL : &timeout);
+}
+
+void prefetch_events(Worker *worker, void *events, int count) {
+    RoutePrefetch prefetches[PREFETCH_BATCH];
+    int started = 0;
+    for (int i = 0; i < count; i++) {
+        const struct kevent *ev = &((struct kevent *)events)[i];
+        if ((int)ev->ident == worker->server_fd || (ev->flags & EV_ERROR) || ev->filter != EVFILT_READ) {
+            continue;
+        }
+        started += read_ahead(worker, (int)ev->ident, &prefetches[started]);
+        if (started == PREFETCH_BATCH) {
+            prefetch_routes(prefetches, started);
+            started = 0;
+        }
+    }
+    prefetch_routes(prefetches, started);
 }
 
-void handle_event(int loop_fd, void *event, int server_fd, char *buffer, size_t buffer_size) {
+void handle_event(Worker *worker, void *event) {
     struct kevent *ev = (struct kevent *)event;
     int fd = ev->ident;
 
     if (ev->flags & EV_ERROR) {
-        close(fd);
+        close_client(worker, fd);
         return;
     }
 
-    if (fd == server_fd) {
-        struct sockaddr_in address;
-        socklen_t addrlen = sizeof(address);
-        while (1) {
-            int new_socket = accept(server_fd, (struct sockaddr *)&address, &addrlen);
-            if (new_socket == -1) {
-                if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                    break;
-                } else {
-                    perror("accept");
-                    break;
-                }
-            }
-            set_nonblocking(new_socket);
-            add_to_event_loop(loop_fd, new_socket);
-        }
+    if (fd == worker->server_fd) {
+        accept_connections(worker);
+    } else if (ev->filter == EVFILT_WRITE) {
+        handle_writable(worker, fd);
     } else {
-        int valread = read(fd, buffer, buffer_size);
-        if (valread <= 0) {
-            if (valread == 0) {
-                printf("Client disconnected\n");
-            } else {
-                perror("read");
-            }
-            close(fd);
-        } else {
-            buffer[valread] = '\0';
-            // Optimized manual HTTP parsing (much faster than sscanf)
-            char *line_end = (char *)memchr(buffer, '\n', valread);
-            if (line_end) {
-                *line_end = '\0';
-            }
-            
-            // Parse method (GET, POST, etc.)
-            char *method_start = buffer;
-            char *method_end = method_start;
-            while (*method_end && *method_end != ' ' && *method_end != '\t') method_end++;
-            if (*method_end) *method_end++ = '\0';
-            
-            // Skip whitespace
-            while (*method_end == ' ' || *method_end == '\t') method_end++;
-            
-            // Parse path
-            char *path_start = method_end;
-            char *path_end = path_start;
-            while (*path_end && *path_end != ' ' && *path_end != '\t' && *path_end != '?') path_end++;
-            if (*path_end) *path_end = '\0';
-            
-            handle_request(fd, method_start, path_start, NULL);
-        }
+        handle_client(worker, fd);
     }
 }
 
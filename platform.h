@@ -2,17 +2,47 @@
 #define PLATFORM_H
 
 #include <sys/types.h>
+#include "server.h"
 
 #ifdef __linux__
+#include <stdint.h>
 #include <sys/epoll.h>
 #else
 #include <sys/event.h>
 #endif
 
+// Events read ahead and prefetched together by prefetch_events(): enough
+// lookups to overlap their cache misses, few enough sockets that their
+// kernel state is still in cache when the batch is served.
+#define PREFETCH_BATCH 16
+
+// Interest flags for modify_event_loop()
+#define EVENT_READ  1
+#define EVENT_WRITE 2
+
+// What wait_for_events() fills in: a readiness event, or on Linux with
+// the io_uring backend a copy of a completion.
+#ifdef __linux__
+typedef struct {
+    uint64_t user_data;
+    int32_t res;
+    uint32_t flags;
+} CompletionEvent;
+
+typedef union {
+    struct epoll_event epoll;
+    CompletionEvent completion;
+} Event;
+#else
+typedef struct kevent Event;
+#endif
+
+void configure_event_loop(int io_uring, int sqpoll);
 int create_event_loop();
 int add_to_event_loop(int loop_fd, int fd);
-int wait_for_events(int loop_fd, void *events, int max_events);
-void handle_event(int loop_fd, void *event, int server_fd, char *buffer, size_t buffer_size);
+int modify_event_loop(int loop_fd, int fd, int events);
+int wait_for_events(int loop_fd, void *events, int max_events, int timeout_ms);
+void prefetch_events(Worker *worker, void *events, int count);
+void handle_event(Worker *worker, void *event);
 
 #endif // PLATFORM_H
-
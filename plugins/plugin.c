@@ -6,50 +6,250 @@
 
 #include "plugin.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <time.h>
 #include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdatomic.h>
 
 #define MAX_PLUGINS 128
+#define MAX_PLUGIN_THREADS 64
+#define SNAPSHOT_METHOD_SIZE 16
+#define SNAPSHOT_PATH_SIZE 256
+#define IDLE_SPINS 64
 
 typedef struct {
     const char *name;
     PluginType type;
+    PluginMode mode;
     PluginFunction execute;
 } Plugin;
 
+// Copy of a request handed to the pool: the loop reuses its buffers as
+// soon as the response is queued.
+typedef struct {
+    PluginType type;
+    int client_socket;
+    char method[SNAPSHOT_METHOD_SIZE];
+    char path[SNAPSHOT_PATH_SIZE];
+} RequestSnapshot;
+
+typedef struct {
+    atomic_size_t sequence;
+    RequestSnapshot snapshot;
+} RingSlot;
+
+// Bounded lock-free multi-producer single-consumer ring (Vyukov style):
+// every event loop may publish, only the owning pool thread consumes.
+// Each slot's sequence number says whether it is free for the producer
+// at a position or holds data for the consumer.
+typedef struct {
+    RingSlot *slots;
+    size_t mask;
+    _Alignas(64) atomic_size_t enqueue_pos;
+    _Alignas(64) size_t dequeue_pos;
+    atomic_int sleeping;
+    pthread_mutex_t lock;
+    pthread_cond_t wakeup;
+    pthread_t thread;
+} SnapshotRing;
+
 static Plugin plugins[MAX_PLUGINS];
 static int plugin_count = 0;
+static int async_counts[2] = {0, 0};
+
+static SnapshotRing rings[MAX_PLUGIN_THREADS];
+static int ring_count = 0;
+static atomic_int next_ring = 0;
+static atomic_ulong dropped = 0;
+static __thread int producer_ring = -1;
 
-void register_plugin(const char *name, PluginType type, PluginFunction execute) {
+void register_plugin(const char *name, PluginType type, PluginMode mode, PluginFunction execute) {
     if (plugin_count < MAX_PLUGINS) {
+        if (mode == PLUGIN_ASYNC && type != POST_ROUTING) {
+            // PRE_ROUTING plugins run before the lookup, so they must finish first
+            fprintf(stderr, "Plugin %s: only POST_ROUTING plugins can be async, running inline\n", name);
+            mode = PLUGIN_INLINE;
+        }
         plugins[plugin_count].name = name;
         plugins[plugin_count].type = type;
+        plugins[plugin_count].mode = mode;
         plugins[plugin_count].execute = execute;
+        if (mode == PLUGIN_ASYNC) {
+            async_counts[type]++;
+        }
         plugin_count++;
     } else {
         fprintf(stderr, "Max plugins reached\n");
     }
 }
 
-void *plugin_thread(void *arg) {
-    RequestData* request_data = (RequestData*)arg;
-    Plugin *plugin = (Plugin *)request_data->plugin;
-    plugin->execute(request_data);
+static void run_async_plugins(RequestSnapshot *snapshot) {
+    RequestData request_data = {snapshot->method, snapshot->path, NULL, snapshot->client_socket, NULL, NULL};
+    for (int i = 0; i < plugin_count; i++) {
+        if (plugins[i].type == snapshot->type && plugins[i].mode == PLUGIN_ASYNC) {
+            request_data.plugin = &plugins[i];
+            plugins[i].execute(&request_data);
+        }
+    }
+}
+
+// Takes the next snapshot if one is ready. Only the owning thread calls it.
+static int ring_pop(SnapshotRing *ring, RequestSnapshot *out) {
+    RingSlot *slot = &ring->slots[ring->dequeue_pos & ring->mask];
+    size_t sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+    if (sequence != ring->dequeue_pos + 1) {
+        return 0;
+    }
+    *out = slot->snapshot;
+    atomic_store_explicit(&slot->sequence, ring->dequeue_pos + ring->mask + 1, memory_order_release);
+    ring->dequeue_pos++;
+    return 1;
+}
+
+static int ring_push(SnapshotRing *ring, PluginType type, const RequestData *request_data) {
+    size_t pos = atomic_load_explicit(&ring->enqueue_pos, memory_order_relaxed);
+    RingSlot *slot;
+
+    while (1) {
+        slot = &ring->slots[pos & ring->mask];
+        size_t sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+        intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&ring->enqueue_pos, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return 0;  // Full
+        } else {
+            pos = atomic_load_explicit(&ring->enqueue_pos, memory_order_relaxed);
+        }
+    }
+
+    RequestSnapshot *snapshot = &slot->snapshot;
+    snapshot->type = type;
+    snapshot->client_socket = request_data->client_socket;
+    snprintf(snapshot->method, sizeof(snapshot->method), "%s", request_data->method ? request_data->method : "");
+    snprintf(snapshot->path, sizeof(snapshot->path), "%s", request_data->path ? request_data->path : "");
+    atomic_store_explicit(&slot->sequence, pos + 1, memory_order_release);
+
+    // Pairs with the fence in plugin_worker: either the consumer sees the
+    // new slot or we see it asleep and wake it.
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&ring->sleeping, memory_order_relaxed)) {
+        pthread_mutex_lock(&ring->lock);
+        pthread_cond_signal(&ring->wakeup);
+        pthread_mutex_unlock(&ring->lock);
+    }
+    return 1;
+}
+
+static void *plugin_worker(void *arg) {
+    SnapshotRing *ring = (SnapshotRing *)arg;
+    RequestSnapshot snapshot;
+    int idle = 0;
+
+    while (1) {
+        if (ring_pop(ring, &snapshot)) {
+            run_async_plugins(&snapshot);
+            idle = 0;
+            continue;
+        }
+        if (++idle < IDLE_SPINS) {
+            sched_yield();
+            continue;
+        }
+
+        pthread_mutex_lock(&ring->lock);
+        atomic_store_explicit(&ring->sleeping, 1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_seq_cst);
+        RingSlot *slot = &ring->slots[ring->dequeue_pos & ring->mask];
+        if (atomic_load_explicit(&slot->sequence, memory_order_acquire) != ring->dequeue_pos + 1) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += 1;
+            pthread_cond_timedwait(&ring->wakeup, &ring->lock, &deadline);
+        }
+        atomic_store_explicit(&ring->sleeping, 0, memory_order_relaxed);
+        pthread_mutex_unlock(&ring->lock);
+        idle = 0;
+    }
     return NULL;
 }
 
-void execute_plugins(PluginType type, RequestData *request_data) {
-    pthread_t threads[MAX_PLUGINS];
-    int thread_count = 0;
+// Starts the async plugin pool: threads consumers, each draining its own
+// ring of queue_size snapshots (rounded up to a power of two). Nothing is
+// started when no async plugin is registered.
+int init_plugins(int threads, int queue_size) {
+    if (async_counts[POST_ROUTING] == 0) {
+        return 0;
+    }
+    if (threads < 1) threads = 1;
+    if (threads > MAX_PLUGIN_THREADS) threads = MAX_PLUGIN_THREADS;
+
+    size_t capacity = 2;
+    while (capacity < (size_t)queue_size) capacity <<= 1;
+
+    // Pool threads start with every signal blocked, whatever the caller's
+    // mask: signals are the main thread's to take
+    sigset_t all, saved;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &saved);
+    int started = 0;
 
+    for (int i = 0; i < threads; i++) {
+        SnapshotRing *ring = &rings[i];
+        ring->slots = calloc(capacity, sizeof(RingSlot));
+        if (ring->slots == NULL) {
+            break;
+        }
+        for (size_t j = 0; j < capacity; j++) {
+            atomic_init(&ring->slots[j].sequence, j);
+        }
+        ring->mask = capacity - 1;
+        atomic_init(&ring->enqueue_pos, 0);
+        ring->dequeue_pos = 0;
+        atomic_init(&ring->sleeping, 0);
+        pthread_mutex_init(&ring->lock, NULL);
+        pthread_cond_init(&ring->wakeup, NULL);
+        int rc = pthread_create(&ring->thread, NULL, plugin_worker, ring);
+        if (rc != 0) {
+            fprintf(stderr, "pthread_create for plugin thread failed: %s\n", strerror(rc));
+            break;
+        }
+        ring_count++;
+        started++;
+    }
+    pthread_sigmask(SIG_SETMASK, &saved, NULL);
+    return started == threads ? 0 : -1;
+}
+
+void execute_plugins(PluginType type, RequestData *request_data) {
     for (int i = 0; i < plugin_count; i++) {
-        if (plugins[i].type == type) {
+        if (plugins[i].type == type && plugins[i].mode == PLUGIN_INLINE) {
             request_data->plugin = &plugins[i];
-            pthread_create(&threads[thread_count++], NULL, plugin_thread, request_data);
+            plugins[i].execute(request_data);
         }
     }
 
-    for (int i = 0; i < thread_count; i++) {
-        pthread_join(threads[i], NULL);
+    if (async_counts[type] > 0 && ring_count > 0) {
+        // Each producing thread sticks to one ring, spreading loops over the pool
+        if (producer_ring < 0) {
+            producer_ring = atomic_fetch_add(&next_ring, 1) % ring_count;
+        }
+        if (!ring_push(&rings[producer_ring], type, request_data)) {
+            // Never block the loop on a slow plugin: drop the snapshot
+            atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+        }
     }
 }
+
+// Snapshots dropped because an async plugin thread fell behind.
+unsigned long plugin_dropped(void) {
+    return atomic_load_explicit(&dropped, memory_order_relaxed);
+}
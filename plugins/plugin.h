@@ -8,10 +8,20 @@ typedef enum {
     POST_ROUTING
 } PluginType;
 
+// INLINE plugins run synchronously on the event loop and see the live
+// request. ASYNC plugins (POST_ROUTING only) run on the plugin thread pool
+// with a copy of the request; they must not use client_socket, which may
+// already be closed or reused by the time they run.
+typedef enum {
+    PLUGIN_INLINE,
+    PLUGIN_ASYNC
+} PluginMode;
+
 typedef void (*PluginFunction)(RequestData *request_data);
 
-void register_plugin(const char *name, PluginType type, PluginFunction function);
+void register_plugin(const char *name, PluginType type, PluginMode mode, PluginFunction function);
+int init_plugins(int threads, int queue_size);
 void execute_plugins(PluginType type, RequestData *request_data);
+unsigned long plugin_dropped(void);
 
 #endif // PLUGIN_H
-
@@ -15,5 +15,5 @@ void post_routing_logic(RequestData *request_data) {
 // Registrar el plugin
 __attribute__((constructor))
 void register_post_routing_plugin() {
-    register_plugin("PostRoutingPlugin", POST_ROUTING, post_routing_logic);
+    register_plugin("PostRoutingPlugin", POST_ROUTING, PLUGIN_ASYNC, post_routing_logic);
 }
@@ -15,5 +15,5 @@ void pre_routing_logic(RequestData *request_data) {
 // Registrar el plugin
 __attribute__((constructor))
 void register_pre_routing_plugin() {
-    register_plugin("PreRoutingPlugin", PRE_ROUTING, pre_routing_logic);
+    register_plugin("PreRoutingPlugin", PRE_ROUTING, PLUGIN_INLINE, pre_routing_logic);
 }
@@ -5,16 +5,57 @@
  */
 
 #include "routing.h"
+#include "utils/arena.h"
+#include "utils/bloom.h"
+#include "utils/cdb.h"
+#include "utils/hash.h"
+#include "utils/hot_cache.h"
+#include "utils/prefix_trie.h"
+#include "utils/qsbr.h"
+#include "utils/response.h"
+#include "utils/routes_file.h"
+#include "utils/route_image.h"
+#include "utils/sorted_index.h"
+#include "utils/logs.h"
+#include "utils/metrics.h"
 #include <string.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stddef.h>
 #include <stdlib.h>
+#include <unistd.h>
 
+// An entry's strings sit back to back in the table's arena: the key, then
+// the URL, its NUL and the prebuilt response (the layout yathr-mkdb
+// writes to the database), so a hit reads one contiguous run of bytes and
+// the entry itself is 16 bytes with no allocation of its own.
 typedef struct {
-    char *key;
-    char *url;
+    ArenaRef offset;        // of the key in the arena
+    uint32_t url_len;       // the response is redirect_response_size(url_len)
+    uint16_t key_len;       // requests are far shorter
+    uint16_t ns;            // namespace, DEFAULT_NAMESPACE or a host's
 } Redirect;
 
-// Default entries for initialization (sorted alphabetically)
+// A Host with routes of its own. Its keys are hashed with seed mixed in,
+// so the namespaces share one index and one filter without colliding.
+typedef struct {
+    ArenaRef host;          // normalized name, in the arena
+    uint32_t host_len;
+    uint64_t seed;
+} Namespace;
+
+// A prefix rule: a key ending in ROUTE_PREFIX_WILDCARD redirects every
+// request whose key starts with the rest of it, stored like an entry
+// without the wildcard. With passthrough (its URL ended in the wildcard
+// too, also dropped) the part of the key past the prefix is appended to
+// the URL.
+typedef struct {
+    Redirect r;
+    uint32_t passthrough;
+} PrefixRule;
+
+// Default entries for initialization
 static const struct {
     const char *key;
     const char *url;
@@ -43,198 +84,1257 @@ static const struct {
 
 #define DEFAULT_REDIRECTS_COUNT (sizeof(default_redirects) / sizeof(default_redirects[0]))
 #define INITIAL_CAPACITY 32
+#define MIN_INDEX_SIZE 64
+#define MAX_LOAD_THREADS 16
+#define DEFAULT_NAMESPACE 0
+#define MAX_NAMESPACES UINT16_MAX
+#define DATABASE_KEY_MAX 4096
+#define RULE_KEY_MAX 4096
 
-static Redirect *redirects = NULL;
-static size_t redirects_count = 0;
-static size_t redirects_capacity = 0;
-static int routing_initialized = 0;
-
-// Find insertion position for maintaining sorted order (optimized binary search)
-// Returns insertion position. If *exists is not NULL, sets it to 1 if key exists, 0 otherwise
-static int find_insert_position(const char *key, int *exists) {
-    int left = 0;
-    int right = (int)redirects_count - 1;
-    int cmp = 0;
-    
-    // Optimized binary search with reduced comparisons
-    while (left < right) {
-        int mid = left + ((right - left) >> 1); // Use bit shift instead of division
-        cmp = strcmp(redirects[mid].key, key);
-        
-        if (cmp < 0) {
-            left = mid + 1;
-        } else if (cmp > 0) {
-            right = mid;
-        } else {
-            // Found exact match
-            if (exists) *exists = 1;
-            return mid;
+// Index slot: entry number, 16 bits of the key's hash as a fingerprint
+// and the slot's distance from its home position. Eight slots share a
+// cache line, and a probe only dereferences the key when the fingerprint
+// matches, so a lookup typically touches the slot's line and the entry.
+typedef struct {
+    uint32_t entry;
+    uint16_t fingerprint;
+    uint16_t distance;      // probe distance + 1; 0 marks an empty slot
+} Slot;
+
+// A complete routing snapshot: the entries, an open-addressing index over
+// them with Robin Hood probing (an entry far from its home slot displaces
+// one closer to home, which keeps probe sequences short and lets a lookup
+// stop as soon as it passes the slot where the key would have been
+// placed) or, when configured, a sorted index over them instead, the
+// arena holding the entries' strings, the optional file-backed sources
+// consulted after the in-memory entries, a Bloom filter
+// over the keys of both that turns most misses away before either is
+// touched, the namespaces: namespace n (from 1) is namespaces[n - 1],
+// found by host through a small open-addressing table of their numbers,
+// and the prefix rules, with a trie over their namespace (two bytes,
+// big-endian) and key that is only consulted once every exact source has
+// missed.
+typedef struct {
+    Redirect *entries;
+    size_t count;
+    size_t capacity;
+    StringArena strings;
+    Namespace *namespaces;
+    size_t namespace_count;
+    uint16_t *hosts;        // namespace numbers, 0 marks an empty slot
+    size_t host_mask;
+    Slot *slots;            // NULL when the sorted index is used
+    size_t mask;
+    SortedIndex sorted;
+    RouteImage image;
+    Cdb database;
+    BloomFilter filter;
+    size_t filter_keys;     // keys the filter was sized for
+    PrefixRule *rules;
+    size_t rule_count;
+    size_t rule_capacity;
+    PrefixTrie trie;        // values are rule numbers
+    size_t duplicates;      // entries and rules overridden by a later one for their key
+    uint64_t generation;    // changes with every change to the table
+} RouteTable;
+
+// Filter size in bits per key; 0 disables the filter.
+static int filter_bits_per_key = 10;
+
+// Read route images in whole when they are opened instead of page by page.
+static int image_populate = 0;
+
+// Index built over the in-memory entries of tables created from now on.
+static RouteIndexKind index_kind = ROUTE_INDEX_HASH;
+
+// Entries in the calling thread's route cache (see route_cache_register()).
+static size_t cache_entries = 1024;
+
+static __thread HotCache *route_cache = NULL;
+
+// Source of table generations; 0 is never handed out.
+static atomic_uint_fast64_t generations = 0;
+
+// The published snapshot. Event loops only ever read it; a reload builds
+// a new table, swaps the pointer and frees the old one after every loop
+// has passed a quiescent point (see utils/qsbr.h).
+static _Atomic(RouteTable *) current_table = NULL;
+
+// Home slot from the low bits, fingerprint from the high bits, so the
+// fingerprint still tells apart keys that share a home slot.
+static uint16_t fingerprint_of(uint64_t hash) {
+    return (uint16_t)(hash >> 48);
+}
+
+// Gives the table a generation of its own, which tells the route caches
+// that whatever they hold from it is stale.
+static void table_changed(RouteTable *table) {
+    table->generation = atomic_fetch_add(&generations, 1) + 1;
+}
+
+static const char *entry_key(const RouteTable *table, const Redirect *r) {
+    return arena_at(&table->strings, r->offset);
+}
+
+static const char *entry_url(const RouteTable *table, const Redirect *r) {
+    return arena_at(&table->strings, r->offset) + r->key_len;
+}
+
+// The seed only depends on the host name, so the filter can hash a
+// database record without a table at hand. Never 0, which is the default
+// namespace's.
+static uint64_t namespace_seed(const char *host, size_t host_len) {
+    return hash_bytes(host, host_len) | 1;
+}
+
+static uint64_t route_hash(const RouteTable *table, uint16_t ns, const char *key, size_t key_len) {
+    uint64_t hash = hash_bytes(key, key_len);
+    return ns == DEFAULT_NAMESPACE ? hash : hash ^ table->namespaces[ns - 1].seed;
+}
+
+// Returns the namespace of a normalized host name, or DEFAULT_NAMESPACE
+// when it has none.
+static uint16_t namespace_find(const RouteTable *table, const char *host, size_t host_len) {
+    if (table->hosts == NULL) {
+        return DEFAULT_NAMESPACE;
+    }
+    for (size_t pos = (size_t)hash_bytes(host, host_len) & table->host_mask; ; pos = (pos + 1) & table->host_mask) {
+        uint16_t ns = table->hosts[pos];
+        if (ns == DEFAULT_NAMESPACE) {
+            return DEFAULT_NAMESPACE;
+        }
+        const Namespace *n = &table->namespaces[ns - 1];
+        if (n->host_len == host_len && memcmp(arena_at(&table->strings, n->host), host, host_len) == 0) {
+            return ns;
         }
     }
-    
-    // Final check for equality when left == right
-    if (left < (int)redirects_count) {
-        cmp = strcmp(redirects[left].key, key);
-        if (cmp == 0) {
-            if (exists) *exists = 1;
-            return left;
-        } else if (cmp > 0) {
-            // Key is less than redirects[left], insert at left
-            if (exists) *exists = 0;
-            return left;
+}
+
+static void hosts_place(RouteTable *table, uint16_t ns) {
+    const Namespace *n = &table->namespaces[ns - 1];
+    size_t pos = (size_t)hash_bytes(arena_at(&table->strings, n->host), n->host_len) & table->host_mask;
+    while (table->hosts[pos] != DEFAULT_NAMESPACE) {
+        pos = (pos + 1) & table->host_mask;
+    }
+    table->hosts[pos] = ns;
+}
+
+// Returns the namespace of a normalized host name, adding one if needed,
+// or -1 when out of memory or namespaces.
+static long namespace_add(RouteTable *table, const char *host, size_t host_len) {
+    uint16_t ns = namespace_find(table, host, host_len);
+    if (ns != DEFAULT_NAMESPACE) {
+        return ns;
+    }
+    if (table->namespace_count == MAX_NAMESPACES) {
+        errno = ENOSPC;
+        return -1;
+    }
+
+    // Keep the host table at most half full
+    size_t count = table->namespace_count + 1;
+    if (table->hosts == NULL || count * 2 > table->host_mask + 1) {
+        size_t size = 16;
+        while (size < count * 2) {
+            size <<= 1;
+        }
+        uint16_t *hosts = calloc(size, sizeof(uint16_t));
+        if (hosts == NULL) {
+            return -1;
+        }
+        free(table->hosts);
+        table->hosts = hosts;
+        table->host_mask = size - 1;
+        for (size_t i = 1; i < count; i++) {
+            hosts_place(table, (uint16_t)i);
         }
-        // else: cmp < 0, key is greater than redirects[left], insert after it
-        if (exists) *exists = 0;
-        return left + 1;
     }
-    
-    if (exists) *exists = 0;
-    return left; // Array is empty; left == redirects_count == 0
+
+    Namespace *namespaces = realloc(table->namespaces, count * sizeof(Namespace));
+    if (namespaces == NULL) {
+        return -1;
+    }
+    table->namespaces = namespaces;
+    ArenaRef offset;
+    if (arena_alloc(&table->strings, host_len, &offset) == -1) {
+        return -1;
+    }
+    memcpy(arena_at(&table->strings, offset), host, host_len);
+    namespaces[count - 1] = (Namespace){offset, (uint32_t)host_len, namespace_seed(host, host_len)};
+    table->namespace_count = count;
+    hosts_place(table, (uint16_t)count);
+    return (long)count;
+}
+
+// Adds the namespaces of a NUL-separated host list, as the route
+// compilers write it.
+static int namespaces_from_list(RouteTable *table, const char *names, size_t len) {
+    const char *end = names ? names + len : NULL;
+    for (const char *p = names; p && p < end; ) {
+        const char *nul = memchr(p, '\0', end - p);
+        size_t host_len = (nul ? nul : end) - p;
+        if (host_len > 0 && host_len <= HOST_NAME_MAX_LEN && namespace_add(table, p, host_len) == -1) {
+            return 0;
+        }
+        p += host_len + 1;
+    }
+    return 1;
+}
+
+// Adds the namespaces of the hosts the database has routes for.
+static int namespaces_from_database(RouteTable *table) {
+    size_t len;
+    const char *names = cdb_find(&table->database, ROUTE_HOSTS_KEY, ROUTE_HOSTS_KEY_LEN, &len);
+    return namespaces_from_list(table, names, len);
+}
+
+static int namespaces_from_image(RouteTable *table) {
+    const RouteImageHeader *header = table->image.header;
+    if (header == NULL || header->hosts_size == 0) {
+        return 1;
+    }
+    return namespaces_from_list(table, (const char *)table->image.map + header->hosts, header->hosts_size);
+}
+
+static void index_place(RouteTable *table, uint32_t entry, uint64_t hash) {
+    Slot incoming = {entry, fingerprint_of(hash), 1};
+    size_t pos = (size_t)hash & table->mask;
+
+    while (1) {
+        Slot *slot = &table->slots[pos];
+        if (slot->distance == 0) {
+            *slot = incoming;
+            return;
+        }
+        if (slot->distance < incoming.distance) {
+            Slot displaced = *slot;
+            *slot = incoming;
+            incoming = displaced;
+        }
+        pos = (pos + 1) & table->mask;
+        incoming.distance++;
+    }
+}
+
+static long slots_find(const RouteTable *table, uint16_t ns, const char *key, size_t key_len, uint64_t hash) {
+    if (table->slots == NULL) {
+        return -1;
+    }
+
+    uint16_t fingerprint = fingerprint_of(hash);
+    size_t pos = (size_t)hash & table->mask;
+
+    for (uint16_t distance = 1; ; distance++) {
+        const Slot *slot = &table->slots[pos];
+        // Robin Hood invariant: the key would sit before any slot that is
+        // closer to its own home than we are to ours
+        if (slot->distance < distance) {
+            return -1;
+        }
+        if (slot->fingerprint == fingerprint) {
+            const Redirect *r = &table->entries[slot->entry];
+            if (r->key_len == key_len && r->ns == ns && memcmp(entry_key(table, r), key, key_len) == 0) {
+                return slot->entry;
+            }
+        }
+        pos = (pos + 1) & table->mask;
+    }
+}
+
+typedef struct {
+    const RouteTable *table;
+    const char *key;
+    size_t key_len;
+} KeyProbe;
+
+// Orders an entry's key against the one searched for, ignoring the
+// namespace: the search only asks about entries with the same prefix,
+// which includes it.
+static int entry_compare(const void *ctx, uint32_t entry) {
+    const KeyProbe *probe = ctx;
+    const Redirect *r = &probe->table->entries[entry];
+    size_t len = r->key_len < probe->key_len ? r->key_len : probe->key_len;
+    int cmp = memcmp(entry_key(probe->table, r), probe->key, len);
+    if (cmp != 0) {
+        return cmp;
+    }
+    return (r->key_len > probe->key_len) - (r->key_len < probe->key_len);
+}
+
+static long sorted_find(const RouteTable *table, uint16_t ns, const char *key, size_t key_len) {
+    KeyProbe probe = {table, key, key_len};
+    size_t pos = sorted_index_lower_bound(&table->sorted, sorted_prefix(ns, key, key_len), entry_compare, &probe);
+    if (pos != 0 && entry_compare(&probe, table->sorted.values[pos]) == 0 &&
+        table->entries[table->sorted.values[pos]].ns == ns) {
+        return table->sorted.values[pos];
+    }
+    return -1;
+}
+
+// Returns the entry index for key in namespace ns, or -1.
+static long index_find(const RouteTable *table, uint16_t ns, const char *key, size_t key_len, uint64_t hash) {
+    if (table->sorted.nodes) {
+        long entry = sorted_find(table, ns, key, key_len);
+        if (entry >= 0 || table->slots == NULL) {
+            return entry;
+        }
+    }
+    return slots_find(table, ns, key, key_len, hash);
+}
+
+// Smallest power of two slot count holding count entries at 75% load.
+static size_t index_size(size_t count) {
+    size_t size = MIN_INDEX_SIZE;
+    while (size * 3 / 4 < count) {
+        size <<= 1;
+    }
+    return size;
+}
+
+// Indexes the entries appended since the sorted index was built in hash
+// slots of their own, with room for count of them.
+static int tail_rebuild(RouteTable *table, size_t count) {
+    size_t size = index_size(count);
+    Slot *slots = calloc(size, sizeof(Slot));
+    if (slots == NULL) {
+        return 0;
+    }
+    free(table->slots);
+    table->slots = slots;
+    table->mask = size - 1;
+    for (size_t i = table->sorted.count; i < table->count; i++) {
+        const Redirect *r = &table->entries[i];
+        index_place(table, (uint32_t)i, route_hash(table, r->ns, entry_key(table, r), r->key_len));
+    }
+    return 1;
+}
+
+// Replaces the hash slots with a sorted index over the (deduplicated)
+// entries. Keys added to the table later go to slots of their own until
+// there are enough of them to merge (see table_add()).
+static int sorted_rebuild(RouteTable *table) {
+    SortedIndexItem *items = malloc((table->count ? table->count : 1) * sizeof(SortedIndexItem));
+    if (items == NULL) {
+        return 0;
+    }
+    for (size_t i = 0; i < table->count; i++) {
+        const Redirect *r = &table->entries[i];
+        const char *key = entry_key(table, r);
+        items[i] = (SortedIndexItem){sorted_prefix(r->ns, key, r->key_len), key, r->key_len, (uint32_t)i};
+    }
+    int built = sorted_index_build(&table->sorted, items, table->count) == 0;
+    free(items);
+    if (!built) {
+        // The old one no longer matches the entries; the slots still do
+        sorted_index_free(&table->sorted);
+        return 0;
+    }
+    free(table->slots);
+    table->slots = NULL;
+    table->mask = 0;
+    return 1;
+}
+
+// Rebuilds the index with room for at least count entries at 75% load
+// and indexes the entries in order. A key listed more than once keeps the
+// position of its first entry and the value of its last; the others are
+// dropped and counted, which lets a bulk load append blindly and index
+// once. With
+// the sorted index configured, the hash slots only serve to find those
+// duplicates and are then replaced.
+static int index_rebuild(RouteTable *table, size_t count) {
+    size_t size = index_size(count);
+    Slot *slots = calloc(size, sizeof(Slot));
+    if (slots == NULL) {
+        return 0;
+    }
+    free(table->slots);
+    table->slots = slots;
+    table->mask = size - 1;
+
+    size_t kept = 0;
+    for (size_t i = 0; i < table->count; i++) {
+        Redirect r = table->entries[i];
+        const char *key = entry_key(table, &r);
+        uint64_t hash = route_hash(table, r.ns, key, r.key_len);
+        long existing = slots_find(table, r.ns, key, r.key_len, hash);
+        if (existing >= 0) {
+            table->entries[existing] = r;
+            table->duplicates++;
+            continue;
+        }
+        table->entries[kept] = r;
+        index_place(table, (uint32_t)kept, hash);
+        kept++;
+    }
+    table->count = kept;
+    if (index_kind == ROUTE_INDEX_SORTED) {
+        return sorted_rebuild(table);
+    }
+    sorted_index_free(&table->sorted);
+    return 1;
 }
 
 // Ensure capacity for at least one more entry
-static int ensure_capacity(void) {
-    if (redirects_count >= redirects_capacity) {
-        size_t new_capacity = redirects_capacity == 0 ? INITIAL_CAPACITY : redirects_capacity * 2;
-        Redirect *new_redirects = realloc(redirects, new_capacity * sizeof(Redirect));
-        if (new_redirects == NULL) {
+static int ensure_capacity(RouteTable *table) {
+    if (table->count >= table->capacity) {
+        size_t new_capacity = table->capacity == 0 ? INITIAL_CAPACITY : table->capacity * 2;
+        Redirect *new_entries = realloc(table->entries, new_capacity * sizeof(Redirect));
+        if (new_entries == NULL) {
             return 0; // Allocation failed
         }
-        redirects = new_redirects;
-        redirects_capacity = new_capacity;
+        table->entries = new_entries;
+        table->capacity = new_capacity;
     }
     return 1; // Success
 }
 
-void init_routing(void) {
-    if (routing_initialized) {
+static void table_free(RouteTable *table) {
+    if (table == NULL) {
         return;
     }
-    
-    redirects_capacity = INITIAL_CAPACITY;
-    redirects = malloc(redirects_capacity * sizeof(Redirect));
-    if (redirects == NULL) {
+    free(table->entries);
+    free(table->namespaces);
+    free(table->hosts);
+    arena_free(&table->strings);
+    route_image_close(&table->image);
+    free(table->slots);
+    sorted_index_free(&table->sorted);
+    cdb_close(&table->database);
+    bloom_free(&table->filter);
+    free(table->rules);
+    prefix_trie_free(&table->trie);
+    free(table);
+}
+
+// Database keys for a host are "host\0key" (see tools/mkdb.c).
+static int filter_add_record(void *ctx, const char *key, size_t key_len, const char *value, size_t value_len) {
+    (void)value;
+    (void)value_len;
+    const char *nul = memchr(key, '\0', key_len);
+    if (nul == NULL) {
+        bloom_add((BloomFilter *)ctx, hash_bytes(key, key_len));
+    } else if (nul > key) {
+        size_t host_len = nul - key;
+        bloom_add((BloomFilter *)ctx, hash_bytes(nul + 1, key_len - host_len - 1) ^ namespace_seed(key, host_len));
+    }
+    return 0;
+}
+
+// (Re)builds the filter over the in-memory keys and the database's, sized
+// for room keys (at least as many as there are). On failure the table
+// goes without a filter, which only costs speed.
+static void filter_build(RouteTable *table, size_t room) {
+    bloom_free(&table->filter);
+    table->filter_keys = 0;
+    if (filter_bits_per_key <= 0) {
+        return;
+    }
+
+    size_t keys = table->count + cdb_count(&table->database);
+    if (room > keys) {
+        keys = room;
+    }
+    if (bloom_init(&table->filter, keys, filter_bits_per_key) == -1) {
+        log_warning("Route filter: out of memory for %zu keys, lookups go unfiltered", keys);
+        return;
+    }
+    for (size_t i = 0; i < table->count; i++) {
+        const Redirect *r = &table->entries[i];
+        bloom_add(&table->filter, route_hash(table, r->ns, entry_key(table, r), r->key_len));
+    }
+    if (cdb_foreach(&table->database, filter_add_record, &table->filter) < 0) {
+        // Keys past the damage are not in the filter; rather than reject
+        // them, go without
+        log_warning("Route filter: database records unreadable, lookups go unfiltered");
+        bloom_free(&table->filter);
         return;
     }
+    table->filter_keys = keys;
+}
+
+// Copies a route's strings into the arena and points r at them. Key and
+// URL are slices, not NUL-terminated.
+static int entry_store(RouteTable *table, Redirect *r, uint16_t ns, const char *key, size_t key_len,
+                       const char *url, size_t url_len) {
+    if (key_len > UINT16_MAX) {
+        errno = ENAMETOOLONG;
+        return 0;
+    }
+    ArenaRef offset;
+    if (arena_alloc(&table->strings, key_len + url_len + 1 + redirect_response_size(url_len), &offset) == -1) {
+        return 0;
+    }
+    char *p = arena_at(&table->strings, offset);
+    memcpy(p, key, key_len);
+    p += key_len;
+    memcpy(p, url, url_len);
+    p[url_len] = '\0';
+    format_redirect_response(p + url_len + 1, url, url_len);
+
+    r->offset = offset;
+    r->url_len = (uint32_t)url_len;
+    r->key_len = (uint16_t)key_len;
+    r->ns = ns;
+    return 1;
+}
+
+// Appends a route without indexing it: bulk loads append everything and
+// then index once with index_rebuild(), which also resolves duplicates.
+static int table_append(RouteTable *table, uint16_t ns, const char *key, size_t key_len,
+                        const char *url, size_t url_len) {
+    if (!ensure_capacity(table) || !entry_store(table, &table->entries[table->count], ns, key, key_len, url, url_len)) {
+        return 0;
+    }
+    table->count++;
+    return 1;
+}
+
+// Writes the trie key of a rule, or of a key looked up against the rules:
+// the namespace, then key, cut at RULE_KEY_MAX bytes (no rule is longer,
+// so the cut never changes which one matches). Returns its length.
+static size_t rule_trie_key(uint16_t ns, const char *key, size_t key_len, char buffer[2 + RULE_KEY_MAX]) {
+    size_t len = key_len < RULE_KEY_MAX ? key_len : RULE_KEY_MAX;
+    buffer[0] = (char)(ns >> 8);
+    buffer[1] = (char)(ns & 0xff);
+    memcpy(buffer + 2, key, len);
+    return 2 + len;
+}
+
+// Appends a prefix rule without indexing it; see rules_rebuild(). Key is
+// the prefix, without the wildcard, and url as written, with the one
+// that asks for passthrough. Both are slices, not NUL-terminated.
+static int rule_append(RouteTable *table, uint16_t ns, const char *key, size_t key_len,
+                       const char *url, size_t url_len) {
+    if (key_len > RULE_KEY_MAX) {
+        errno = ENAMETOOLONG;
+        return 0;
+    }
+    if (table->rule_count == table->rule_capacity) {
+        size_t capacity = table->rule_capacity ? table->rule_capacity * 2 : INITIAL_CAPACITY;
+        PrefixRule *rules = realloc(table->rules, capacity * sizeof(PrefixRule));
+        if (rules == NULL) {
+            return 0;
+        }
+        table->rules = rules;
+        table->rule_capacity = capacity;
+    }
+    PrefixRule *rule = &table->rules[table->rule_count];
+    rule->passthrough = url_len > 1 && url[url_len - 1] == ROUTE_PREFIX_WILDCARD;
+    if (!entry_store(table, &rule->r, ns, key, key_len, url, url_len - rule->passthrough)) {
+        return 0;
+    }
+    table->rule_count++;
+    return 1;
+}
+
+static int rule_index(RouteTable *table, size_t n) {
+    const Redirect *r = &table->rules[n].r;
+    char trie_key[2 + RULE_KEY_MAX];
+    size_t len = rule_trie_key(r->ns, entry_key(table, r), r->key_len, trie_key);
+    return prefix_trie_insert(&table->trie, trie_key, len, (uint32_t)n) == 0;
+}
+
+// Builds the trie over the rules in order, so that of two rules with the
+// same prefix the later one wins; the earlier ones are counted.
+static int rules_rebuild(RouteTable *table) {
+    prefix_trie_free(&table->trie);
+    for (size_t n = 0; n < table->rule_count; n++) {
+        const Redirect *r = &table->rules[n].r;
+        char trie_key[2 + RULE_KEY_MAX];
+        size_t len = rule_trie_key(r->ns, entry_key(table, r), r->key_len, trie_key);
+        size_t matched;
+        if (prefix_trie_longest(&table->trie, trie_key, len, &matched) != PREFIX_TRIE_NONE && matched == len) {
+            table->duplicates++;
+        }
+        if (!rule_index(table, n)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int table_append_route(void *ctx, const RouteLine *route) {
+    RouteTable *table = ctx;
+    long ns = DEFAULT_NAMESPACE;
+    if (route->host) {
+        char host[HOST_NAME_MAX_LEN];
+        long host_len = normalize_host(route->host, route->host_len, host);
+        if (host_len < 0) {
+            errno = EINVAL;
+            return -1;
+        }
+        if ((ns = namespace_add(table, host, host_len)) == -1) {
+            return -1;
+        }
+    }
+    if (is_prefix_rule(route->key, route->key_len)) {
+        return rule_append(table, (uint16_t)ns, route->key, route->key_len - 1, route->url, route->url_len) ? 0 : -1;
+    }
+    return table_append(table, (uint16_t)ns, route->key, route->key_len, route->url, route->url_len) ? 0 : -1;
+}
+
+// Adds or replaces a route in an indexed table. Key and URL are slices,
+// not NUL-terminated.
+static int table_add(RouteTable *table, uint16_t ns, const char *key, size_t key_len, const char *url, size_t url_len) {
+    uint64_t hash = route_hash(table, ns, key, key_len);
+    long existing = index_find(table, ns, key, key_len, hash);
+    if (existing >= 0) {
+        // Key exists: store the new strings; the old ones stay in the
+        // arena, unreachable, until the table is freed
+        return entry_store(table, &table->entries[existing], ns, key, key_len, url, url_len);
+    }
     
-    // Add all default entries (already sorted)
-    for (size_t i = 0; i < DEFAULT_REDIRECTS_COUNT; i++) {
-        redirects[i].key = strdup(default_redirects[i].key);
-        redirects[i].url = strdup(default_redirects[i].url);
-        if (redirects[i].key == NULL || redirects[i].url == NULL) {
-            // Free allocated memory on failure
-            for (size_t j = 0; j < i; j++) {
-                free(redirects[j].key);
-                free(redirects[j].url);
+    // A sorted index is built whole: new keys go to hash slots over the
+    // entries appended since, and are merged into it once they reach an
+    // eighth of it, which keeps each insertion O(log n) amortized
+    size_t tail = table->count + 1 - table->sorted.count;
+    if (table->sorted.nodes && tail > MIN_INDEX_SIZE && tail > table->sorted.count / 8) {
+        if (!table_append(table, ns, key, key_len, url, url_len) || !index_rebuild(table, table->count)) {
+            return 0;
+        }
+    } else {
+        if (table->sorted.nodes) {
+            if ((table->slots == NULL || tail > (table->mask + 1) * 3 / 4) && !tail_rebuild(table, tail)) {
+                return 0;
             }
-            free(redirects);
-            redirects = NULL;
-            redirects_capacity = 0;
-            return;
+        } else if ((table->count + 1) > (table->mask + 1) * 3 / 4 && !index_rebuild(table, table->count + 1)) {
+            return 0; // Allocation failed
+        }
+        
+        // Append the entry and index it: O(1) amortized, nothing is shifted
+        if (!table_append(table, ns, key, key_len, url, url_len)) {
+            return 0;
         }
+        index_place(table, (uint32_t)(table->count - 1), hash);
+    }
+
+    if (table->filter.blocks) {
+        // Past the keys it was sized for the false-positive rate climbs:
+        // rebuild it with room to grow
+        size_t keys = table->count + cdb_count(&table->database);
+        if (keys > table->filter_keys) {
+            filter_build(table, 2 * keys);
+        } else {
+            bloom_add(&table->filter, hash);
+        }
+    }
+    return 1; // Success
+}
+
+// Appends the routes and rules of part, which has no index, filter or
+// database, and frees it.
+static int table_merge(RouteTable *table, RouteTable *part) {
+    if (part->count == 0 && part->rule_count == 0) {
+        // A piece of nothing but comments and blank lines, or none at all
+        table_free(part);
+        return 1;
+    }
+    if (table->count + part->count > table->capacity) {
+        Redirect *entries = realloc(table->entries, (table->count + part->count) * sizeof(Redirect));
+        if (entries == NULL) {
+            return 0;
+        }
+        table->entries = entries;
+        table->capacity = table->count + part->count;
+    }
+
+    // The part numbered its namespaces on its own
+    uint16_t *remap = malloc((part->namespace_count + 1) * sizeof(uint16_t));
+    if (remap == NULL) {
+        return 0;
+    }
+    remap[DEFAULT_NAMESPACE] = DEFAULT_NAMESPACE;
+    for (size_t n = 0; n < part->namespace_count; n++) {
+        const Namespace *ns = &part->namespaces[n];
+        long id = namespace_add(table, arena_at(&part->strings, ns->host), ns->host_len);
+        if (id == -1) {
+            free(remap);
+            return 0;
+        }
+        remap[n + 1] = (uint16_t)id;
+    }
+
+    // The part's strings stay where they are, in chunks now the table's
+    uint32_t chunk_base;
+    if (arena_adopt(&table->strings, &part->strings, &chunk_base) == -1) {
+        free(remap);
+        return 0;
     }
+    ArenaRef base = (ArenaRef)chunk_base << 32;
+    for (size_t i = 0; i < part->count; i++) {
+        Redirect r = part->entries[i];
+        r.offset += base;
+        r.ns = remap[r.ns];
+        table->entries[table->count++] = r;
+    }
+    if (part->rule_count > 0) {
+        PrefixRule *rules = realloc(table->rules, (table->rule_count + part->rule_count) * sizeof(PrefixRule));
+        if (rules == NULL) {
+            free(remap);
+            return 0;
+        }
+        table->rules = rules;
+        table->rule_capacity = table->rule_count + part->rule_count;
+        for (size_t i = 0; i < part->rule_count; i++) {
+            PrefixRule rule = part->rules[i];
+            rule.r.offset += base;
+            rule.r.ns = remap[rule.r.ns];
+            table->rules[table->rule_count++] = rule;
+        }
+    }
+    free(remap);
+    table_free(part);
+    return 1;
+}
+
+// Appends every route in the routes file to table, unindexed. The file is
+// parsed in pieces on up to one thread per CPU, each into a table of its
+// own; those are then merged in file order so later lines still override
+// earlier ones. Returns the number of routes, or -1 with errno set.
+static long table_load_file(RouteTable *table, const char *path, size_t *skipped) {
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads < 1) {
+        threads = 1;
+    }
+    if (threads > MAX_LOAD_THREADS) {
+        threads = MAX_LOAD_THREADS;
+    }
+
+    // The first piece goes straight into table; it holds the defaults,
+    // which come before the file
+    void *parts[MAX_LOAD_THREADS] = {table};
+    for (long i = 1; i < threads; i++) {
+        parts[i] = calloc(1, sizeof(RouteTable));
+        if (parts[i] == NULL) {
+            threads = i;
+            break;
+        }
+    }
+
+    long routes = read_routes_file_chunked(path, table_append_route, parts, (int)threads, skipped);
+    int error = errno;
+    for (long i = 1; i < threads; i++) {
+        if (routes >= 0 && !table_merge(table, parts[i])) {
+            routes = -1;
+            error = ENOMEM;
+            table_free(parts[i]);
+        } else if (routes < 0) {
+            table_free(parts[i]);
+        }
+    }
+    errno = error;
+    return routes;
+}
+
+// Creates a table holding the default entries, not yet indexed: append
+// any more routes with table_append() and then call index_rebuild().
+static RouteTable *table_create(void) {
+    RouteTable *table = calloc(1, sizeof(RouteTable));
+    if (table == NULL) {
+        return NULL;
+    }
+    table_changed(table);
     
-    redirects_count = DEFAULT_REDIRECTS_COUNT;
-    routing_initialized = 1;
+    for (size_t i = 0; i < DEFAULT_REDIRECTS_COUNT; i++) {
+        const char *key = default_redirects[i].key;
+        const char *url = default_redirects[i].url;
+        if (!table_append(table, DEFAULT_NAMESPACE, key, strlen(key), url, strlen(url))) {
+            table_free(table);
+            return NULL;
+        }
+    }
+    return table;
+}
+
+// Publishes table and reclaims the previous snapshot once no event loop
+// can still be reading it.
+static void table_publish(RouteTable *table) {
+    RouteTable *old = atomic_exchange_explicit(&current_table, table, memory_order_acq_rel);
+    if (old) {
+        qsbr_synchronize();
+        table_free(old);
+    }
+}
+
+void init_routing(void) {
+    if (atomic_load_explicit(&current_table, memory_order_acquire)) {
+        return;
+    }
+    
+    RouteTable *table = table_create();
+    if (table && !index_rebuild(table, table->count)) {
+        table_free(table);
+        table = NULL;
+    }
+    if (table) {
+        filter_build(table, 0);
+        atomic_store_explicit(&current_table, table, memory_order_release);
+    }
+}
+
+// Sets the size of the filters built from now on, in bits per key (about
+// 1% false positives at 10, 0.1% at 16); 0 disables them.
+void configure_route_filter(int bits_per_key) {
+    filter_bits_per_key = bits_per_key > 0 ? bits_per_key : 0;
+}
+
+// With populate, route images are read in whole when opened (MAP_POPULATE)
+// so the first lookups do not fault pages in; otherwise they are paged in
+// as lookups reach them and opening costs nothing whatever their size.
+void configure_route_image(int populate) {
+    image_populate = populate;
+}
+
+// Sets the index built over the in-memory routes of tables created from
+// now on. The hash table answers a lookup in about one cache miss; the
+// sorted index takes about log2(n) comparisons, with the misses of four
+// levels overlapped, and keeps the keys in order.
+void configure_route_index(RouteIndexKind kind) {
+    index_kind = kind;
+}
+
+const char *route_index_name(RouteIndexKind kind) {
+    return kind == ROUTE_INDEX_SORTED ? "sorted" : "hash";
 }
 
+// Sets the size of the route caches registered from now on, in entries
+// of 128 bytes; 0 disables them.
+void configure_route_cache(size_t entries) {
+    cache_entries = entries;
+}
+
+// Gives the calling thread a route cache of its own, for the lifetime of
+// the thread or until route_cache_release(). Only tables with a route
+// image or database use it. Returns 0, or -1 when out of memory, leaving
+// the thread without one.
+int route_cache_register(void) {
+    if (route_cache || cache_entries == 0) {
+        return 0;
+    }
+    HotCache *cache = malloc(sizeof(HotCache));
+    if (cache == NULL || hot_cache_init(cache, cache_entries) == -1) {
+        free(cache);
+        return -1;
+    }
+    route_cache = cache;
+    return 0;
+}
+
+void route_cache_release(void) {
+    if (route_cache) {
+        hot_cache_free(route_cache);
+        free(route_cache);
+        route_cache = NULL;
+    }
+}
+
+static RouteTable *writable_table(void) {
+    init_routing();
+    return atomic_load_explicit(&current_table, memory_order_acquire);
+}
+
+// Updates the live table in place. Meant for start-up and tests: use
+// reload_routing() to change routes while event loops are serving.
 int add_redirect(const char *key, const char *url) {
+    return add_host_redirect(NULL, key, url);
+}
+
+// Like add_redirect(), for requests to host only. A NULL host is the
+// default namespace. A key ending in ROUTE_PREFIX_WILDCARD adds a prefix
+// rule (see utils/routes_file.h).
+int add_host_redirect(const char *host, const char *key, const char *url) {
     if (key == NULL || url == NULL) {
         return 0; // Invalid parameters
     }
     
-    if (!routing_initialized) {
-        init_routing();
+    RouteTable *table = writable_table();
+    if (table == NULL) {
+        return 0;
     }
+    table_changed(table);
+    long ns = DEFAULT_NAMESPACE;
+    if (host) {
+        char name[HOST_NAME_MAX_LEN];
+        long name_len = normalize_host(host, strlen(host), name);
+        if (name_len < 0 || (ns = namespace_add(table, name, name_len)) == -1) {
+            return 0;
+        }
+    }
+    size_t key_len = strlen(key);
+    if (is_prefix_rule(key, key_len)) {
+        return rule_append(table, (uint16_t)ns, key, key_len - 1, url, strlen(url)) &&
+               rule_index(table, table->rule_count - 1);
+    }
+    return table_add(table, (uint16_t)ns, key, key_len, url, strlen(url));
+}
+
+// The key a file-backed source stores a route under: the key itself in
+// the default namespace, "host\0key" in a host's. Returns its length, or 0
+// when it does not fit in buffer.
+static size_t source_key(const RouteTable *table, uint16_t ns, const char *key, size_t key_len,
+                         char *buffer, size_t size, const char **out) {
+    if (ns == DEFAULT_NAMESPACE) {
+        *out = key;
+        return key_len;
+    }
+    const Namespace *n = &table->namespaces[ns - 1];
+    size_t len = n->host_len + 1 + key_len;
+    if (len > size) {
+        return 0;
+    }
+    memcpy(buffer, arena_at(&table->strings, n->host), n->host_len);
+    buffer[n->host_len] = '\0';
+    memcpy(buffer + n->host_len + 1, key, key_len);
+    *out = buffer;
+    return len;
+}
+
+// The calling thread's route cache, emptied first if it holds routes of
+// another table, or NULL when the thread has none or the table has no
+// mapped source to spare lookups in.
+static HotCache *cache_for(const RouteTable *table) {
+    HotCache *cache = route_cache;
+    if (cache == NULL || (table->image.map == NULL && table->database.map == NULL)) {
+        return NULL;
+    }
+    if (cache->generation != table->generation) {
+        hot_cache_clear(cache, table->generation);
+    }
+    return cache;
+}
+
+// Looks key up in one namespace: the in-memory entries, the route image,
+// then the database, where a host's keys are stored as "host\0key". The
+// filter covers the entries and the database; the image's own
+// fingerprints turn its misses away, so the filter never has to be built
+// over it and opening an image stays instant. Routes found in the image
+// or the database go to the thread's route cache, which is asked first:
+// a key it holds was missing from the entries when it was cached, and
+// the generation check ensures it still is.
+static int namespace_lookup(const RouteTable *table, uint16_t ns, const char *key, size_t key_len, Route *route) {
+    uint64_t hash = route_hash(table, ns, key, key_len);
+    HotCache *cache = cache_for(table);
+    if (cache) {
+        const HotCacheEntry *hot = hot_cache_find(cache, hash, ns, key, key_len);
+        if (hot) {
+            metric_inc(METRIC_ROUTE_CACHE_HITS);
+            route->url = hot->url;
+            route->url_len = hot->url_len;
+            route->response = hot->response;
+            route->response_len = hot->response_len;
+            return 1;
+        }
+        metric_inc(METRIC_ROUTE_CACHE_MISSES);
+    }
+
+    int maybe = table->filter.blocks == NULL || bloom_maybe_contains(&table->filter, hash);
     
-    // Find insertion position and check if key exists (optimized: single search)
-    int exists = 0;
-    int pos = find_insert_position(key, &exists);
-    if (exists) {
-        // Key exists, update URL
-        free(redirects[pos].url);
-        redirects[pos].url = strdup(url);
-        return redirects[pos].url != NULL ? 1 : 0;
+    long entry = maybe ? index_find(table, ns, key, key_len, hash) : -1;
+    if (entry >= 0) {
+        const Redirect *r = &table->entries[entry];
+        route->url = entry_url(table, r);
+        route->url_len = r->url_len;
+        route->response = route->url + r->url_len + 1;
+        route->response_len = redirect_response_size(r->url_len);
+        return 1;
     }
     
-    // Ensure we have capacity
-    if (!ensure_capacity()) {
-        return 0; // Allocation failed
+    char composite[DATABASE_KEY_MAX];
+    const char *source = NULL;
+    size_t source_len = 0;
+    if (table->image.map || (maybe && table->database.map)) {
+        source_len = source_key(table, ns, key, key_len, composite, sizeof(composite), &source);
     }
     
-    // Shift elements to make room for new entry
-    for (int i = (int)redirects_count; i > pos; i--) {
-        redirects[i] = redirects[i - 1];
+    if (table->image.map && source_len > 0) {
+        const char *url = route_image_find(&table->image, source, source_len, &route->url_len, &route->response_len);
+        if (url) {
+            route->url = url;
+            route->response = url + route->url_len + 1;
+            if (cache) {
+                hot_cache_insert(cache, hash, ns, key, key_len, route->url, route->url_len, route->response,
+                                 route->response_len);
+            }
+            return 1;
+        }
     }
     
-    // Insert new entry at the correct sorted position
-    redirects[pos].key = strdup(key);
-    redirects[pos].url = strdup(url);
+    if (!maybe) {
+        metric_inc(METRIC_FILTER_REJECTED);
+        return 0;
+    }
     
-    if (redirects[pos].key == NULL || redirects[pos].url == NULL) {
-        // Free on failure and restore array
-        if (redirects[pos].key != NULL) free(redirects[pos].key);
-        if (redirects[pos].url != NULL) free(redirects[pos].url);
-        for (int i = pos; i < (int)redirects_count; i++) {
-            redirects[i] = redirects[i + 1];
+    if (table->database.map && source_len > 0) {
+        size_t value_len;
+        const char *value = cdb_find(&table->database, source, source_len, &value_len);
+        // yathr-mkdb stores the URL NUL-terminated, followed by its
+        // response; files written before responses were prebuilt hold the
+        // URL alone. A value without a NUL is unusable.
+        const char *nul = value ? memchr(value, '\0', value_len) : NULL;
+        if (nul && nul > value) {
+            route->url = value;
+            route->url_len = nul - value;
+            route->response_len = value_len - route->url_len - 1;
+            route->response = route->response_len > 0 ? nul + 1 : NULL;
+            if (cache) {
+                hot_cache_insert(cache, hash, ns, key, key_len, route->url, route->url_len, route->response,
+                                 route->response_len);
+            }
+            return 1;
         }
+    }
+    
+    if (table->filter.blocks) {
+        metric_inc(METRIC_FILTER_FALSE_POSITIVES);
+    }
+    return 0;
+}
+
+// Looks key up among the prefix rules of namespace ns, for the longest
+// prefix of it that has one. A passthrough rule that leaves part of the
+// key over returns it as the route's suffix, with no prebuilt response;
+// a suffix with control characters, which would end the Location header,
+// is not routed.
+static int rule_lookup(const RouteTable *table, uint16_t ns, const char *key, size_t key_len, Route *route) {
+    if (table->rule_count == 0) {
+        return 0;
+    }
+    char trie_key[2 + RULE_KEY_MAX];
+    size_t matched;
+    uint32_t n = prefix_trie_longest(&table->trie, trie_key, rule_trie_key(ns, key, key_len, trie_key), &matched);
+    if (n == PREFIX_TRIE_NONE) {
         return 0;
     }
+
+    const PrefixRule *rule = &table->rules[n];
+    route->url = entry_url(table, &rule->r);
+    route->url_len = rule->r.url_len;
+    route->response = route->url + rule->r.url_len + 1;
+    route->response_len = redirect_response_size(rule->r.url_len);
+    matched -= 2;
+    if (rule->passthrough && matched < key_len) {
+        for (size_t i = matched; i < key_len; i++) {
+            unsigned char c = (unsigned char)key[i];
+            if (c < 0x20 || c == 0x7f) {
+                return 0;
+            }
+        }
+        route->suffix = key + matched;
+        route->suffix_len = key_len - matched;
+        route->response = NULL;
+        route->response_len = 0;
+    }
+    return 1;
+}
+
+// Looks up key (a slice, not NUL-terminated) for a request to host (its
+// Host header, or NULL) and fills route. A host with routes of its own is
+// tried first, then the default namespace, which also serves every host
+// without any; within each, the exact routes come before the prefix
+// rules, which are only searched when none of them has the key. Returns 1
+// when the key is routed and 0 otherwise.
+int find_route(const char *host, size_t host_len, const char *key, size_t key_len, Route *route) {
+    RouteTable *table = atomic_load_explicit(&current_table, memory_order_acquire);
+    if (table == NULL) {
+        // Lazy initialization if not already initialized
+        table = writable_table();
+        if (table == NULL) {
+            return 0; // Initialization failed
+        }
+    }
     
-    redirects_count++;
-    return 1; // Success
+    route->suffix = key + key_len;
+    route->suffix_len = 0;
+    if (host && table->namespace_count > 0) {
+        char name[HOST_NAME_MAX_LEN];
+        long name_len = normalize_host(host, host_len, name);
+        uint16_t ns = name_len > 0 ? namespace_find(table, name, name_len) : DEFAULT_NAMESPACE;
+        if (ns != DEFAULT_NAMESPACE &&
+            (namespace_lookup(table, ns, key, key_len, route) || rule_lookup(table, ns, key, key_len, route))) {
+            return 1;
+        }
+    }
+    return namespace_lookup(table, DEFAULT_NAMESPACE, key, key_len, route) ||
+           rule_lookup(table, DEFAULT_NAMESPACE, key, key_len, route);
+}
+
+// Stages of a RoutePrefetch, each named for what it reads next.
+enum {
+    PREFETCH_DONE,
+    PREFETCH_SLOTS,
+    PREFETCH_ENTRY
+};
+
+void route_prefetch_start(RoutePrefetch *prefetch, const char *host, size_t host_len, const char *key, size_t key_len) {
+    const RouteTable *table = atomic_load_explicit(&current_table, memory_order_acquire);
+    prefetch->stage = PREFETCH_DONE;
+    if (table == NULL || table->slots == NULL) {
+        return;
+    }
+
+    uint16_t ns = DEFAULT_NAMESPACE;
+    if (host && table->namespace_count > 0) {
+        char name[HOST_NAME_MAX_LEN];
+        long name_len = normalize_host(host, host_len, name);
+        if (name_len > 0) {
+            ns = namespace_find(table, name, name_len);
+        }
+    }
+    prefetch->table = table;
+    prefetch->ns = ns;
+    prefetch->key = key;
+    prefetch->key_len = key_len;
+    prefetch->hash = route_hash(table, ns, key, key_len);
+    if (table->filter.blocks) {
+        __builtin_prefetch(bloom_block(&table->filter, prefetch->hash));
+    }
+    __builtin_prefetch(&table->slots[(size_t)prefetch->hash & table->mask]);
+    prefetch->stage = PREFETCH_SLOTS;
+}
+
+// Returns 1 while there is a further step to take.
+int route_prefetch_step(RoutePrefetch *prefetch) {
+    const RouteTable *table = prefetch->table;
+
+    if (prefetch->stage == PREFETCH_SLOTS) {
+        prefetch->stage = PREFETCH_DONE;
+        if (table->filter.blocks && !bloom_maybe_contains(&table->filter, prefetch->hash)) {
+            return 0;
+        }
+        // The first slot with a matching fingerprint, as index_find() would
+        uint16_t fingerprint = fingerprint_of(prefetch->hash);
+        size_t pos = (size_t)prefetch->hash & table->mask;
+        for (uint16_t distance = 1; table->slots[pos].distance >= distance; distance++) {
+            if (table->slots[pos].fingerprint == fingerprint) {
+                prefetch->entry = table->slots[pos].entry;
+                __builtin_prefetch(&table->entries[prefetch->entry]);
+                prefetch->stage = PREFETCH_ENTRY;
+                return 1;
+            }
+            pos = (pos + 1) & table->mask;
+        }
+        return 0;
+    }
+
+    if (prefetch->stage == PREFETCH_ENTRY) {
+        // The key and, a few lines on for long URLs, the response
+        const Redirect *r = &table->entries[prefetch->entry];
+        const char *key = entry_key(table, r);
+        __builtin_prefetch(key);
+        __builtin_prefetch(key + r->key_len + r->url_len + 1);
+        prefetch->stage = PREFETCH_DONE;
+    }
+    return 0;
 }
 
 const char *find_redirect(const char *key) {
-    if (key == NULL) {
+    Route route;
+    if (key == NULL || !find_route(NULL, 0, key, strlen(key), &route)) {
         return NULL;
     }
+    return route.url;
+}
+
+// Maps a cdb file built by yathr-mkdb into the live table. Its routes are
+// served after the in-memory entries, so add_redirect() can override them.
+int open_route_database(const char *path) {
+    Cdb database;
+    RouteTable *table = writable_table();
+    if (path == NULL || table == NULL || cdb_open(&database, path) == -1) {
+        return -1;
+    }
+    cdb_close(&table->database);
+    table->database = database;
+    table_changed(table);
+    if (!namespaces_from_database(table)) {
+        return -1;
+    }
+    filter_build(table, 0);
+    return 0;
+}
+
+void close_route_database(void) {
+    RouteTable *table = atomic_load_explicit(&current_table, memory_order_acquire);
+    if (table) {
+        cdb_close(&table->database);
+        table_changed(table);
+        filter_build(table, 0);
+    }
+}
+
+// Builds a fresh table from the defaults, the routes file, the route image
+// and the cdb file (any may be NULL) and publishes it with a single
+// pointer swap. Event loops keep serving from the old table until they
+// next pass a quiescent point; it is freed after that. On failure the
+// current table stays.
+int reload_routing(const char *routes_file, const char *image_path, const char *database_path) {
+    RouteTable *table = table_create();
+    if (table == NULL) {
+        log_error("Route reload: out of memory");
+        return -1;
+    }
     
-    // Lazy initialization if not already initialized
-    if (!routing_initialized) {
-        init_routing();
-        if (!routing_initialized) {
-            return NULL; // Initialization failed
+    if (routes_file) {
+        size_t skipped = 0;
+        long routes = table_load_file(table, routes_file, &skipped);
+        if (routes < 0) {
+            log_error("Route reload: reading %s failed: %s", routes_file, strerror(errno));
+            table_free(table);
+            return -1;
+        }
+        if (skipped > 0) {
+            log_warning("Route reload: %zu malformed lines in %s skipped", skipped, routes_file);
         }
     }
     
-    if (redirects_count == 0) {
-        return NULL;
+    // One pass over everything appended, sized once, instead of growing
+    // the index as the file is read. It finds the keys listed more than
+    // once, within a piece of the file or across pieces alike.
+    if (!index_rebuild(table, table->count) || !rules_rebuild(table)) {
+        log_error("Route reload: out of memory");
+        table_free(table);
+        return -1;
+    }
+    if (table->duplicates > 0) {
+        log_warning("Route reload: %zu routes in %s overridden by a later line for the same key",
+                    table->duplicates, routes_file);
     }
     
-    // Optimized binary search using bit shift (same as find_insert_position)
-    int left = 0;
-    int right = (int)redirects_count - 1;
+    if (image_path && route_image_open(&table->image, image_path, image_populate) == -1) {
+        log_error("Route reload: opening %s failed: %s", image_path,
+                  errno == EINVAL ? "not a valid route image" : strerror(errno));
+        table_free(table);
+        return -1;
+    }
+    if (!namespaces_from_image(table)) {
+        log_error("Route reload: reading the hosts of %s failed: %s", image_path, strerror(errno));
+        table_free(table);
+        return -1;
+    }
     
-    while (left <= right) {
-        int mid = left + ((right - left) >> 1); // Use bit shift instead of division
-        int cmp = strcmp(redirects[mid].key, key);
-        
-        if (cmp == 0) {
-            return redirects[mid].url;
-        } else if (cmp < 0) {
-            left = mid + 1;
-        } else {
-            right = mid - 1;
-        }
+    if (database_path && cdb_open(&table->database, database_path) == -1) {
+        log_error("Route reload: opening %s failed: %s", database_path, strerror(errno));
+        table_free(table);
+        return -1;
+    }
+    if (!namespaces_from_database(table)) {
+        log_error("Route reload: reading the hosts of %s failed: %s", database_path, strerror(errno));
+        table_free(table);
+        return -1;
     }
     
-    return NULL;
+    filter_build(table, 0);
+    log_info("Route reload: %zu routes and %zu prefix rules in memory (%zu KiB of strings, %s index), "
+             "%zu host namespaces%s%s%s%s",
+             table->count, table->rule_count, table->strings.used / 1024, route_index_name(index_kind),
+             table->namespace_count, image_path ? ", image " : "", image_path ? image_path : "",
+             database_path ? ", database " : "", database_path ? database_path : "");
+    table_publish(table);
+    return 0;
 }
 
 void cleanup_routing(void) {
-    if (!routing_initialized) {
-        return;
-    }
-    
-    for (size_t i = 0; i < redirects_count; i++) {
-        free(redirects[i].key);
-        free(redirects[i].url);
-    }
-    
-    free(redirects);
-    redirects = NULL;
-    redirects_count = 0;
-    redirects_capacity = 0;
-    routing_initialized = 0;
+    RouteTable *table = atomic_exchange_explicit(&current_table, NULL, memory_order_acq_rel);
+    table_free(table);
 }
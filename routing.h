@@ -7,9 +7,64 @@
 #ifndef ROUTING_H
 #define ROUTING_H
 
+#include <stddef.h>
+#include <stdint.h>
+
+// A route as served: its URL and the complete 302 response for it (see
+// utils/response.h). Both point into the route table or the mapped
+// image or database and stay valid until the caller's next quiescent point.
+// A prefix rule with passthrough adds the rest of the key as the suffix,
+// which the Location header carries after the URL; the response, built
+// for the URL alone, is then NULL.
+typedef struct {
+    const char *url;        // NUL-terminated
+    size_t url_len;
+    const char *response;   // NULL for database values without one
+    size_t response_len;
+    const char *suffix;     // a slice of the key looked up
+    size_t suffix_len;
+} Route;
+
+// A lookup taken in steps, so a batch of them overlaps its cache misses
+// instead of stalling on each in turn: route_prefetch_start() hashes the
+// key and prefetches its filter block and index slots, every
+// route_prefetch_step() reads what the previous one fetched and
+// prefetches the next level, until it returns 0. Running each step over
+// the whole batch before the next, then find_route() for each key, finds
+// the table in cache. Valid until the caller's next quiescent point.
+typedef struct {
+    const void *table;
+    uint64_t hash;
+    const char *key;
+    size_t key_len;
+    uint32_t entry;
+    uint16_t ns;
+    uint8_t stage;
+} RoutePrefetch;
+
+// Index over the in-memory routes (see configure_route_index()).
+typedef enum {
+    ROUTE_INDEX_HASH,       // Robin Hood hash table, the default
+    ROUTE_INDEX_SORTED      // Eytzinger-ordered sorted array
+} RouteIndexKind;
+
+void route_prefetch_start(RoutePrefetch *prefetch, const char *host, size_t host_len, const char *key, size_t key_len);
+int route_prefetch_step(RoutePrefetch *prefetch);
+int find_route(const char *host, size_t host_len, const char *key, size_t key_len, Route *route);
 const char *find_redirect(const char *key);
 int add_redirect(const char *key, const char *url);
+int add_host_redirect(const char *host, const char *key, const char *url);
 void init_routing(void);
+void configure_route_filter(int bits_per_key);
+void configure_route_image(int populate);
+void configure_route_index(RouteIndexKind kind);
+const char *route_index_name(RouteIndexKind kind);
+void configure_route_cache(size_t entries);
+int route_cache_register(void);
+void route_cache_release(void);
 void cleanup_routing(void);
+int open_route_database(const char *path);
+void close_route_database(void);
+int reload_routing(const char *routes_file, const char *image_path, const char *database_path);
 
 #endif // ROUTING_H
@@ -4,36 +4,219 @@
  * Fecha: 2024-06-08
  */
 
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <errno.h>
 #include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <signal.h>
 #ifdef __linux__
-#include <sys/epoll.h>
-#else
-#include <sys/event.h>
+#include <sched.h>
 #endif
 #include "server.h"
 #include "platform.h"
 #include "routing.h"
+#include "connection.h"
+#include "admin.h"
+#include "plugins/plugin.h"
 #include "utils/logs.h"
 #include "utils/config.h"
 #include "utils/socket.h"
+#include "utils/qsbr.h"
+#include "utils/access_log.h"
+#include "utils/metrics.h"
+#include "utils/latency.h"
+#include "utils/http_parser.h"
 
 #define MAX_EVENTS 1024
+#define MAX_WORKERS 256
+#define SWEEP_INTERVAL_MS 1000
 
-int main() {
-    int server_fd = -1, loop_fd = -1, nev;
+static void pin_to_cpu(Worker *worker) {
 #ifdef __linux__
-    struct epoll_event events[MAX_EVENTS];
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(worker->cpu, &set);
+    int rc = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (rc != 0) {
+        log_warning("Worker %d: pinning to CPU %d failed: %s", worker->id, worker->cpu, strerror(rc));
+    }
 #else
-    struct kevent events[MAX_EVENTS];
+    (void)worker;
 #endif
-    char buffer[BUFFER_SIZE];
+}
+
+// Whole seconds from a clock that never jumps, for connection deadlines.
+static uint64_t monotonic_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec;
+}
+
+static void *worker_main(void *arg) {
+    Worker *worker = (Worker *)arg;
+    int nev;
+    Event events[MAX_EVENTS];
+    uint64_t last_sweep = monotonic_seconds();
+
+    // Deadlines are set relative to the wheel's clock: start it at now
+    expire_connections(&worker->connections, last_sweep);
+
+    if (worker->cpu >= 0) {
+        pin_to_cpu(worker);
+    }
+
+    int reader = qsbr_register();
+    if (reader == -1) {
+        log_error("Worker %d: too many route table readers", worker->id);
+        exit(EXIT_FAILURE);
+    }
+
+    if (metrics_register() == -1) {
+        log_warning("Worker %d: no metric block left, sharing the fallback", worker->id);
+    }
+    if (latency_register() == -1) {
+        log_warning("Worker %d: latency histograms unavailable", worker->id);
+    }
+    if (route_cache_register() == -1) {
+        log_warning("Worker %d: out of memory for the route cache, looking every route up", worker->id);
+    }
+
+    log_info("Worker %d: event loop started", worker->id);
+
+    while (1) {
+        // Blocked in the wait, the loop holds no route table: a reload
+        // never has to wait for an idle worker
+        qsbr_offline(reader);
+        nev = wait_for_events(worker->loop_fd, events, MAX_EVENTS, SWEEP_INTERVAL_MS);
+        qsbr_online(reader);
+        if (nev < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            log_error("Worker %d: wait_for_events failed: %s", worker->id, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+
+        for (int i = 0; i < nev; i += PREFETCH_BATCH) {
+            int end = nev - i < PREFETCH_BATCH ? nev : i + PREFETCH_BATCH;
+            if (worker->batch_lookups) {
+                prefetch_events(worker, &events[i], end - i);
+            }
+            for (int j = i; j < end; j++) {
+                handle_event(worker, &events[j]);
+            }
+        }
+
+        uint64_t now = monotonic_seconds();
+        if (now != last_sweep) {
+            expire_connections(&worker->connections, now);
+            last_sweep = now;
+        }
+    }
+
+    return NULL;
+}
+
+// Creates the worker's listener and event loop. With SO_REUSEPORT (Linux)
+// every worker binds its own listener and the kernel spreads connections
+// across them; elsewhere the workers share the first listener.
+static int setup_worker(Worker *worker, int port, int shared_fd) {
+    if (shared_fd == -1) {
+        worker->server_fd = create_server_socket(port);
+        if (worker->server_fd == -1) {
+            log_error("Failed to create server socket");
+            return -1;
+        }
+    } else {
+        worker->server_fd = shared_fd;
+    }
+
+    if ((worker->loop_fd = create_event_loop()) == -1) {
+        log_error("create_event_loop failed: %s", strerror(errno));
+        return -1;
+    }
+
+    if (add_to_event_loop(worker->loop_fd, worker->server_fd) == -1) {
+        log_error("add_to_event_loop failed: %s", strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+// Loads the route sources named in the config. ROUTES_FILE, ROUTES_IMAGE
+// and ROUTES_CDB are all optional; the built-in defaults are always present.
+static int load_routes(void) {
+    char routes_file[1024];
+    char routes_image[1024];
+    char routes_cdb[1024];
+    int have_file = read_string_from_config("config.txt", "ROUTES_FILE", routes_file, sizeof(routes_file)) == 0;
+    int have_image = read_string_from_config("config.txt", "ROUTES_IMAGE", routes_image, sizeof(routes_image)) == 0;
+    int have_cdb = read_string_from_config("config.txt", "ROUTES_CDB", routes_cdb, sizeof(routes_cdb)) == 0;
+
+    return reload_routing(have_file ? routes_file : NULL, have_image ? routes_image : NULL,
+                          have_cdb ? routes_cdb : NULL);
+}
+
+// ROUTE_INDEX is "hash" (the default) or "sorted".
+static int configure_index(void) {
+    char name[16];
+    if (read_string_from_config("config.txt", "ROUTE_INDEX", name, sizeof(name)) == -1 ||
+        strcmp(name, route_index_name(ROUTE_INDEX_HASH)) == 0) {
+        configure_route_index(ROUTE_INDEX_HASH);
+    } else if (strcmp(name, route_index_name(ROUTE_INDEX_SORTED)) == 0) {
+        configure_route_index(ROUTE_INDEX_SORTED);
+    } else {
+        log_error("Unknown ROUTE_INDEX %s: expected hash or sorted", name);
+        return -1;
+    }
+    return 0;
+}
+
+static int open_access_log(void) {
+    char path[1024];
+    if (read_string_from_config("config.txt", "ACCESS_LOG", path, sizeof(path)) == -1) {
+        snprintf(path, sizeof(path), "access.log");
+    }
+    return init_access_log(path, read_int_from_config("config.txt", "ACCESS_LOG_LEVEL", ACCESS_LOG_ALL));
+}
+
+int main() {
+    static Worker workers[MAX_WORKERS];
+
+    // SIGHUP and SIGUSR1 are taken synchronously by the main thread below.
+    // Block them before anything starts a thread (the route loader, the
+    // access log writer, the plugin pool, the workers): every thread
+    // inherits the mask, and one without it would be killed by the signal's
+    // default action, taking the server with it
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGHUP);
+    sigaddset(&signals, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
 
     init_logs();
+    configure_route_filter(read_int_from_config("config.txt", "ROUTE_FILTER_BITS", 10));
+    configure_route_image(read_int_from_config("config.txt", "ROUTES_IMAGE_POPULATE", 0));
+    int cache_entries = read_int_from_config("config.txt", "ROUTE_CACHE_ENTRIES", 1024);
+    configure_route_cache(cache_entries > 0 ? (size_t)cache_entries : 0);
+    if (configure_index() == -1) {
+        exit(EXIT_FAILURE);
+    }
     init_routing();
+    init_latency();
+    init_http_parser();
+    log_info("HTTP parser: %s scanner", http_scan_name(http_parser_selected()));
+
+    // A client resetting its connection must fail send(), not kill the server
+    signal(SIGPIPE, SIG_IGN);
 
     int port = read_port_from_config("config.txt");
     if (port == -1) {
@@ -41,42 +224,103 @@ int main() {
         exit(EXIT_FAILURE);
     }
 
-    server_fd = create_server_socket(port);
-    if (server_fd == -1) {
-        log_error("Failed to create server socket");
+    if (load_routes() == -1) {
+        log_error("Failed to load routes");
         exit(EXIT_FAILURE);
     }
 
-    if ((loop_fd = create_event_loop()) == -1) {
-        log_error("create_event_loop failed: %s", strerror(errno));
-        close(server_fd);
+    if (open_access_log() == -1) {
         exit(EXIT_FAILURE);
     }
 
-    if (add_to_event_loop(loop_fd, server_fd) == -1) {
-        log_error("add_to_event_loop failed: %s", strerror(errno));
-        close(server_fd);
-        close(loop_fd);
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus < 1) {
+        cpus = 1;
+    }
+
+    int worker_count = read_int_from_config("config.txt", "WORKERS", 0);
+    if (worker_count <= 0) {
+        worker_count = (int)cpus;
+    }
+    if (worker_count > MAX_WORKERS) {
+        worker_count = MAX_WORKERS;
+    }
+    int pin = read_int_from_config("config.txt", "CPU_AFFINITY", 0);
+    int batch_lookups = read_int_from_config("config.txt", "BATCH_LOOKUPS", 0);
+
+    if (init_connections(read_int_from_config("config.txt", "KEEPALIVE_TIMEOUT", 5),
+                         read_int_from_config("config.txt", "HEADER_TIMEOUT", 10),
+                         read_int_from_config("config.txt", "WRITE_TIMEOUT", 30),
+                         read_int_from_config("config.txt", "KEEPALIVE_REQUESTS", 100)) == -1) {
         exit(EXIT_FAILURE);
     }
 
-    log_info("Event loop started");
+    if (init_plugins(read_int_from_config("config.txt", "PLUGIN_THREADS", 1),
+                     read_int_from_config("config.txt", "PLUGIN_QUEUE_SIZE", 4096)) == -1) {
+        log_error("Failed to start plugin threads");
+        exit(EXIT_FAILURE);
+    }
 
-    while (1) {
-        nev = wait_for_events(loop_fd, events, MAX_EVENTS);
-        if (nev < 0) {
-            log_error("wait_for_events failed: %s", strerror(errno));
-            close(server_fd);
-            close(loop_fd);
+    configure_event_loop(read_int_from_config("config.txt", "IO_URING", 0),
+                         read_int_from_config("config.txt", "IO_URING_SQPOLL", 0));
+
+    for (int i = 0; i < worker_count; i++) {
+        Worker *worker = &workers[i];
+        worker->id = i;
+        worker->cpu = pin ? (int)(i % cpus) : -1;
+        worker->batch_lookups = batch_lookups;
+#ifdef __linux__
+        int shared_fd = -1;
+#else
+        int shared_fd = i == 0 ? -1 : workers[0].server_fd;
+#endif
+        if (setup_worker(worker, port, shared_fd) == -1) {
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    int admin_port = read_int_from_config("config.txt", "ADMIN_PORT", 0);
+    if (admin_port > 0) {
+        // SO_REUSEPORT would quietly add it to the workers' listeners
+        if (admin_port == port) {
+            log_error("ADMIN_PORT must differ from SERVER_PORT");
+            exit(EXIT_FAILURE);
+        }
+        if (start_admin_server(admin_port) == -1) {
             exit(EXIT_FAILURE);
         }
+    }
 
-        for (int i = 0; i < nev; i++) {
-            handle_event(loop_fd, &events[i], server_fd, buffer, BUFFER_SIZE);
+    for (int i = 0; i < worker_count; i++) {
+        int rc = pthread_create(&workers[i].thread, NULL, worker_main, &workers[i]);
+        if (rc != 0) {
+            log_error("pthread_create for worker %d failed: %s", i, strerror(rc));
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    log_info("Started %d workers", worker_count);
+
+    // The workers never return; the main thread stays behind to rebuild
+    // the route table and reopen the access log on SIGHUP, and to log the
+    // latency percentiles on SIGUSR1, without stopping them
+    while (1) {
+        int sig;
+        if (sigwait(&signals, &sig) != 0) {
+            continue;
+        }
+        if (sig == SIGHUP) {
+            log_info("SIGHUP: reloading routes and reopening the access log");
+            if (load_routes() == -1) {
+                log_warning("Route reload failed, still serving the previous table");
+            }
+            if (open_access_log() == -1) {
+                log_warning("Access log reopen failed, keeping the previous file");
+            }
+        } else if (sig == SIGUSR1) {
+            latency_dump();
         }
     }
 
-    close(server_fd);
-    close(loop_fd);
     return 0;
 }
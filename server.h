@@ -1,6 +1,9 @@
 #ifndef SERVER_H
 #define SERVER_H
 
+#include <pthread.h>
+#include "connection.h"
+
 #define BUFFER_SIZE 8192
 
 typedef struct {
@@ -12,5 +15,16 @@ typedef struct {
     void *plugin;  // Agregar este campo
 } RequestData;
 
-#endif // SERVER_H
+// One event loop per core: every worker owns its listener, its loop
+// instance and its events array, so workers never share hot state.
+typedef struct {
+    int id;
+    int cpu;            // CPU to pin to, -1 for no affinity
+    int server_fd;
+    int loop_fd;
+    int batch_lookups;  // read a whole batch of events and prefetch its routes before serving it
+    ConnectionPool connections;
+    pthread_t thread;
+} Worker;
 
+#endif // SERVER_H
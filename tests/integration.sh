@@ -5,11 +5,17 @@
 # Starts ./http_server, fires curl requests, and checks HTTP status codes
 # and headers.  Must be run from the project root (where config.txt and
 # zlog.conf live), or via `make test` which handles this automatically.
+# The suite runs twice from scratch copies of the configuration, set up
+# for the tests below: with the default event loop, then with IO_URING=1
+# (on kernels without io_uring the server falls back to epoll and the
+# second pass repeats the first). The pipelining checks need python3.
 #
 
 PASS=0
 FAIL=0
 SERVER_PID=""
+ROOT="$PWD"
+CONFIG_DIR=""
 
 # ── helpers ──────────────────────────────────────────────────────────
 
@@ -17,6 +23,10 @@ cleanup() {
     if [ -n "$SERVER_PID" ]; then
         kill "$SERVER_PID" 2>/dev/null || true
         wait "$SERVER_PID" 2>/dev/null || true
+        SERVER_PID=""
+    fi
+    if [ -n "$CONFIG_DIR" ]; then
+        rm -rf "$CONFIG_DIR"
     fi
 }
 trap cleanup EXIT
@@ -36,44 +46,48 @@ check() {
     fi
 }
 
-# ── start server ─────────────────────────────────────────────────────
-
-./http_server >/dev/null 2>&1 &
-SERVER_PID=$!
-
-# Wait up to 2 s for the server to accept connections.
-ready=0
-for i in $(seq 1 20); do
-    if curl -s --max-time 0.1 -o /dev/null "http://localhost:8080/" 2>/dev/null; then
-        ready=1
-        break
-    fi
-    sleep 0.1
-done
-
-if [ "$ready" -eq 0 ]; then
-    echo "FATAL: server did not start within 2 s"
-    exit 1
-fi
+LONG_URL="https://long.example.com/$(printf 'a%.0s' $(seq 1 6000))/"
+LONG_SUFFIX=$(printf 'c%.0s' $(seq 1 3000))
+HUGE_URL="https://huge.example.com/$(printf 'b%.0s' $(seq 1 20000))"
 
-echo "--- Integration Tests ---"
+# Starts the server from a scratch directory holding its config.txt,
+# with the given extra settings, zlog.conf and a routes file with URLs
+# longer than a request and enough routes that a reload takes a while.
+# Many requests may share a connection, and queued responses must
+# progress within 2 s.
+start_server() {
+    CONFIG_DIR=$(mktemp -d)
+    cp "$ROOT/config.txt" "$ROOT/zlog.conf" "$CONFIG_DIR/"
+    printf 'long/*\t%s*\nhuge\t%s\n' "$LONG_URL" "$HUGE_URL" >"$CONFIG_DIR/routes.tsv"
+    seq 1 300000 | awk '{ print "bulk" $1 "\thttps://bulk.example.com/" $1 }' >>"$CONFIG_DIR/routes.tsv"
+    printf '%s\n' "KEEPALIVE_REQUESTS=100000" "WRITE_TIMEOUT=2" "ROUTES_FILE=routes.tsv" "$@" \
+        >>"$CONFIG_DIR/config.txt"
+    (cd "$CONFIG_DIR" && exec "$ROOT/http_server" >/dev/null 2>&1) &
+    SERVER_PID=$!
 
-# ── status code checks ───────────────────────────────────────────────
+    # Wait up to 2 s for the server to accept connections.
+    local ready=0
+    for i in $(seq 1 20); do
+        if curl -s --max-time 0.1 -o /dev/null "http://localhost:8080/" 2>/dev/null; then
+            ready=1
+            break
+        fi
+        sleep 0.1
+    done
 
-for route in google amazon youtube netflix reddit wikipedia; do
-    status=$(curl -s -o /dev/null -w "%{http_code}" "http://localhost:8080/$route")
-    check "HTTP 302 for /$route" "302" "$status"
-done
-
-# Unknown route → 404
-status=$(curl -s -o /dev/null -w "%{http_code}" "http://localhost:8080/doesnotexist")
-check "HTTP 404 for /doesnotexist" "404" "$status"
-
-# Empty path → 404 (no key to look up)
-status=$(curl -s -o /dev/null -w "%{http_code}" "http://localhost:8080/")
-check "HTTP 404 for /" "404" "$status"
+    if [ "$ready" -eq 0 ]; then
+        echo "FATAL: server did not start within 2 s"
+        exit 1
+    fi
+}
 
-# ── Location header checks ───────────────────────────────────────────
+stop_server() {
+    kill "$SERVER_PID" 2>/dev/null || true
+    wait "$SERVER_PID" 2>/dev/null || true
+    SERVER_PID=""
+    rm -rf "$CONFIG_DIR"
+    CONFIG_DIR=""
+}
 
 check_location() {
     local route="$1"
@@ -86,9 +100,184 @@ check_location() {
     check "Location for /$route" "$expected_url" "$location"
 }
 
-check_location "google"    "https://www.google.com"
-check_location "youtube"   "https://www.youtube.com"
-check_location "wikipedia" "https://www.wikipedia.org"
+# Pipelines count requests for /google on one connection from a client
+# with a small receive buffer, which starts reading after delay seconds.
+# Prints the number of complete, correct 302 responses read, then
+# "closed" if the server closed the connection or "open" if it was still
+# open after the last of them.
+pipeline() {
+    python3 - "$1" "$2" <<'PY'
+import socket, sys, threading, time
+
+count, delay = int(sys.argv[1]), float(sys.argv[2])
+s = socket.socket()
+s.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 2048)
+s.connect(("127.0.0.1", 8080))
+
+def send():
+    try:
+        s.sendall(b"GET /google HTTP/1.1\r\nHost: localhost\r\n\r\n" * count)
+    except OSError:
+        pass
+
+threading.Thread(target=send, daemon=True).start()
+time.sleep(delay)
+
+s.settimeout(3)
+data, state = b"", "open"
+try:
+    while data.count(b"\r\n\r\n") < count:
+        chunk = s.recv(65536)
+        if not chunk:
+            state = "closed"
+            break
+        data += chunk
+except ConnectionResetError:
+    state = "closed"
+except socket.timeout:
+    pass
+
+heads = data.split(b"\r\n\r\n")[:-1]
+good = sum(1 for h in heads if h.startswith(b"HTTP/1.1 302 Found\r\n")
+           and b"\r\nLocation: https://www.google.com\r\n" in h + b"\r\n")
+print(good, state)
+PY
+}
+
+# Pipelines count requests for /google and then one for the long
+# passthrough on one connection. Prints the number of correct 302s for
+# /google, then 1 if the long one came back whole as the last response.
+pipeline_long() {
+    python3 - "$1" "$LONG_SUFFIX" "$LONG_URL" <<'PY'
+import socket, sys
+
+count, suffix, url = int(sys.argv[1]), sys.argv[2], sys.argv[3]
+s = socket.create_connection(("127.0.0.1", 8080))
+s.sendall(b"GET /google HTTP/1.1\r\nHost: localhost\r\n\r\n" * count
+          + b"GET /long/" + suffix.encode() + b" HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n")
+
+s.settimeout(3)
+data = b""
+try:
+    while True:
+        chunk = s.recv(65536)
+        if not chunk:
+            break
+        data += chunk
+except (ConnectionResetError, socket.timeout):
+    pass
+
+heads = data.split(b"\r\n\r\n")[:-1]
+good = sum(1 for h in heads[:-1] if h.startswith(b"HTTP/1.1 302 Found\r\n")
+           and b"\r\nLocation: https://www.google.com\r\n" in h + b"\r\n")
+whole = len(heads) == count + 1 and heads[-1].startswith(b"HTTP/1.1 302 Found\r\n") \
+    and ("\r\nLocation: " + url + suffix + "\r\n").encode() in heads[-1] + b"\r\n"
+print(good, 1 if whole else 0)
+PY
+}
+
+run_suite() {
+    # ── status code checks ───────────────────────────────────────────────
+
+    for route in google amazon youtube netflix reddit wikipedia; do
+        status=$(curl -s -o /dev/null -w "%{http_code}" "http://localhost:8080/$route")
+        check "HTTP 302 for /$route" "302" "$status"
+    done
+
+    # Unknown route → 404
+    status=$(curl -s -o /dev/null -w "%{http_code}" "http://localhost:8080/doesnotexist")
+    check "HTTP 404 for /doesnotexist" "404" "$status"
+
+    # Empty path → 404 (no key to look up)
+    status=$(curl -s -o /dev/null -w "%{http_code}" "http://localhost:8080/")
+    check "HTTP 404 for /" "404" "$status"
+
+    # ── Location header checks ───────────────────────────────────────────
+
+    check_location "google"    "https://www.google.com"
+    check_location "youtube"   "https://www.youtube.com"
+    check_location "wikipedia" "https://www.wikipedia.org"
+
+    # A passthrough longer than any stack buffer arrives whole; a URL past
+    # the output buffer is refused rather than cut.
+    location=$(curl -sI "http://localhost:8080/long/$LONG_SUFFIX" \
+        | grep -i "^location:" | tr -d '\r' | sed 's/^[Ll]ocation: //')
+    check "Long passthrough Location whole" "1" "$([ "$location" = "$LONG_URL$LONG_SUFFIX" ] && echo 1)"
+    status=$(curl -s -o /dev/null -w "%{http_code}" "http://localhost:8080/huge")
+    check "HTTP 500 for a URL past the output buffer" "500" "$status"
+    # Behind responses still queued, the long one waits for room rather
+    # than being refused.
+    check "Long passthrough pipelined behind queued responses" "102 1" "$(pipeline_long 102)"
+
+    # ── keep-alive checks ───────────────────────────────────────────────
+
+    # Two requests in one curl invocation must reuse the same connection.
+    reused=$(curl -sv -o /dev/null -o /dev/null \
+        "http://localhost:8080/google" "http://localhost:8080/amazon" 2>&1 \
+        | grep -c "Re-using existing connection")
+    check "Keep-alive connection reuse" "1" "$reused"
+
+    # Connection: close is honoured and echoed back.
+    conn_hdr=$(curl -sI -H "Connection: close" "http://localhost:8080/google" \
+        | grep -i "^connection:" | tr -d '\r')
+    check "Connection: close echoed" "Connection: close" "$conn_hdr"
+
+    # A request split across TCP segments is reassembled before parsing.
+    split_status=$(
+        exec 3<>/dev/tcp/localhost/8080
+        printf 'GET /goo' >&3
+        sleep 0.2
+        printf 'gle HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n' >&3
+        head -n 1 <&3 | tr -d '\r'
+    )
+    check "Request split across reads" "HTTP/1.1 302 Found" "$split_status"
+
+    # Many short connections at once, each closed after its response, so
+    # descriptors are reused while the previous ones are being closed.
+    ok=$(for i in $(seq 1 200); do
+        curl -s -o /dev/null -w "%{http_code}\n" -H "Connection: close" \
+            "http://localhost:8080/google" &
+    done | grep -c "^302$"; wait)
+    check "Concurrent closing connections" "200" "$ok"
+
+    # ── reload checks ───────────────────────────────────────────────────
+
+    # A second SIGHUP lands while the first reload is still running, when
+    # the main thread is not waiting for signals: no other thread may take
+    # it, or its default action ends the server.
+    kill -HUP "$SERVER_PID"
+    sleep 0.05
+    kill -HUP "$SERVER_PID"
+    sleep 1
+    alive=$(kill -0 "$SERVER_PID" 2>/dev/null && echo 1)
+    check "Server survives SIGHUPs during a reload" "1" "$alive"
+    status=$(curl -s -o /dev/null -w "%{http_code}" "http://localhost:8080/bulk300000")
+    check "HTTP 302 after reloads" "302" "$status"
+
+    # ── output budget checks ────────────────────────────────────────────
+
+    # Far more responses than the socket buffers hold: the server queues
+    # what it cannot send, stops reading requests at its output budget
+    # and resumes once the client drains. Every response arrives whole.
+    check "Pipelined responses read late" "50000 open" "$(pipeline 50000 0.5)"
+
+    # A client that never reads leaves its output queued past
+    # WRITE_TIMEOUT and is closed, with whole responses before the cut.
+    result=$(pipeline 50000 4.5)
+    check "Stalled reader closed" "closed" "${result#* }"
+    check "Stalled reader got fewer responses" "1" "$([ "${result% *}" -lt 50000 ] && echo 1)"
+}
+
+echo "--- Integration Tests ---"
+start_server
+run_suite
+stop_server
+
+echo ""
+echo "--- Integration Tests (IO_URING=1) ---"
+start_server "IO_URING=1"
+run_suite
+stop_server
 
 # ── summary ──────────────────────────────────────────────────────────
 
@@ -1,12 +1,22 @@
 /*
  * No-op log stubs for unit tests.
- * Replaces utils/logs.c so tests don't require zlog.
+ * Replaces utils/logs.c so tests don't require zlog. The last warning is
+ * kept in logs_stub_warning for tests to check.
  */
 
 #include "../utils/logs.h"
 #include <stdarg.h>
+#include <stdio.h>
+
+char logs_stub_warning[512];
 
 void init_logs(void) {}
 void log_info(const char *format, ...)    { (void)format; }
 void log_error(const char *format, ...)   { (void)format; }
-void log_warning(const char *format, ...) { (void)format; }
+
+void log_warning(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    vsnprintf(logs_stub_warning, sizeof(logs_stub_warning), format, args);
+    va_end(args);
+}
@@ -0,0 +1,169 @@
+/*
+ * Unit tests for utils/access_log.c
+ *
+ * Covers: level filtering, record formatting and truncation, reopening
+ * the log and records from several threads (written or counted dropped).
+ *
+ * Writes temporary files to /tmp and cleans them up after each test.
+ * Linked against tests/logs_stub.c to avoid the zlog dependency.
+ */
+
+#include "unity/unity.h"
+#include "../utils/access_log.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static char log_path[64];
+static char contents[1 << 20];
+
+void setUp(void) {
+    snprintf(log_path, sizeof(log_path), "/tmp/test_access_log_%d.log", getpid());
+    remove(log_path);
+}
+
+void tearDown(void) {
+    init_access_log(log_path, ACCESS_LOG_OFF);
+    remove(log_path);
+}
+
+/* Flushes the log and returns the file's contents. */
+static const char *read_log(void) {
+    flush_access_log();
+    FILE *f = fopen(log_path, "r");
+    TEST_ASSERT_NOT_NULL_MESSAGE(f, "Access log was not created");
+    size_t n = fread(contents, 1, sizeof(contents) - 1, f);
+    contents[n] = '\0';
+    fclose(f);
+    return contents;
+}
+
+static int count_lines(const char *text) {
+    int lines = 0;
+    for (; *text; text++) {
+        lines += *text == '\n';
+    }
+    return lines;
+}
+
+/* ------------------------------------------------------------------ */
+/* Levels                                                              */
+/* ------------------------------------------------------------------ */
+
+void test_level_all_wants_everything(void) {
+    TEST_ASSERT_EQUAL_INT(0, init_access_log(log_path, ACCESS_LOG_ALL));
+    TEST_ASSERT_TRUE(access_log_wants(302));
+    TEST_ASSERT_TRUE(access_log_wants(404));
+}
+
+void test_level_errors_skips_redirects(void) {
+    TEST_ASSERT_EQUAL_INT(0, init_access_log(log_path, ACCESS_LOG_ERRORS));
+    TEST_ASSERT_FALSE(access_log_wants(302));
+    TEST_ASSERT_TRUE(access_log_wants(404));
+}
+
+void test_level_off_wants_nothing(void) {
+    TEST_ASSERT_EQUAL_INT(0, init_access_log(log_path, ACCESS_LOG_OFF));
+    TEST_ASSERT_FALSE(access_log_wants(404));
+}
+
+void test_unwritable_path_fails(void) {
+    TEST_ASSERT_EQUAL_INT(-1, init_access_log("/nonexistent_dir/access.log", ACCESS_LOG_ALL));
+}
+
+/* ------------------------------------------------------------------ */
+/* Records                                                             */
+/* ------------------------------------------------------------------ */
+
+void test_record_is_formatted(void) {
+    TEST_ASSERT_EQUAL_INT(0, init_access_log(log_path, ACCESS_LOG_ALL));
+    access_log_record(302, "GET", "/google", "https://www.google.com");
+    access_log_record(404, "HEAD", "/missing", NULL);
+
+    const char *text = read_log();
+    TEST_ASSERT_EQUAL_INT(2, count_lines(text));
+    TEST_ASSERT_NOT_NULL(strstr(text, " 302 GET /google https://www.google.com\n"));
+    TEST_ASSERT_NOT_NULL(strstr(text, " 404 HEAD /missing\n"));
+}
+
+void test_long_fields_are_truncated(void) {
+    char path[512];
+    memset(path, 'a', sizeof(path) - 1);
+    path[0] = '/';
+    path[sizeof(path) - 1] = '\0';
+
+    TEST_ASSERT_EQUAL_INT(0, init_access_log(log_path, ACCESS_LOG_ALL));
+    access_log_record(404, "GET", path, NULL);
+
+    const char *text = read_log();
+    TEST_ASSERT_EQUAL_INT(1, count_lines(text));
+    TEST_ASSERT_LESS_THAN_INT(256, (int)strlen(text));
+}
+
+void test_reopen_switches_files(void) {
+    char old_path[80];
+    snprintf(old_path, sizeof(old_path), "%s.1", log_path);
+
+    TEST_ASSERT_EQUAL_INT(0, init_access_log(log_path, ACCESS_LOG_ALL));
+    access_log_record(302, "GET", "/before", "https://before.example.com");
+    flush_access_log();
+    TEST_ASSERT_EQUAL_INT(0, rename(log_path, old_path));
+
+    TEST_ASSERT_EQUAL_INT(0, init_access_log(log_path, ACCESS_LOG_ALL));
+    access_log_record(302, "GET", "/after", "https://after.example.com");
+    const char *text = read_log();
+    TEST_ASSERT_NULL(strstr(text, "/before"));
+    TEST_ASSERT_NOT_NULL(strstr(text, "/after"));
+    remove(old_path);
+}
+
+/* Each thread logs from its own ring. */
+static void *log_from_thread(void *arg) {
+    char path[32];
+    for (int i = 0; i < 200; i++) {
+        snprintf(path, sizeof(path), "/t%ld-%d", (long)(intptr_t)arg, i);
+        access_log_record(404, "GET", path, NULL);
+    }
+    return NULL;
+}
+
+void test_records_from_several_threads(void) {
+    TEST_ASSERT_EQUAL_INT(0, init_access_log(log_path, ACCESS_LOG_ALL));
+    unsigned long dropped_before = access_log_dropped();
+
+    pthread_t threads[4];
+    for (long i = 0; i < 4; i++) {
+        TEST_ASSERT_EQUAL_INT(0, pthread_create(&threads[i], NULL, log_from_thread, (void *)(intptr_t)i));
+    }
+    for (int i = 0; i < 4; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    const char *text = read_log();
+    TEST_ASSERT_EQUAL_INT(800, count_lines(text) + (int)(access_log_dropped() - dropped_before));
+    TEST_ASSERT_NOT_NULL(strstr(text, " /t3-199\n"));
+}
+
+/* ------------------------------------------------------------------ */
+/* main                                                                */
+/* ------------------------------------------------------------------ */
+
+int main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_level_all_wants_everything);
+    RUN_TEST(test_level_errors_skips_redirects);
+    RUN_TEST(test_level_off_wants_nothing);
+    RUN_TEST(test_unwritable_path_fails);
+
+    RUN_TEST(test_record_is_formatted);
+    RUN_TEST(test_long_fields_are_truncated);
+    RUN_TEST(test_reopen_switches_files);
+    RUN_TEST(test_records_from_several_threads);
+
+    return UNITY_END();
+}
@@ -0,0 +1,124 @@
+/*
+ * Unit tests for utils/arena.c
+ *
+ * Covers: references staying valid while the arena grows into new
+ * chunks, allocations larger than a chunk, adopting another arena's
+ * chunks, and an arena holding more than 4 GiB.
+ */
+
+#include "unity/unity.h"
+#include "../utils/arena.h"
+
+#include <stdio.h>
+#include <string.h>
+
+static StringArena arena;
+
+static ArenaRef store(StringArena *a, const char *s) {
+    ArenaRef ref;
+    TEST_ASSERT_EQUAL_INT(0, arena_alloc(a, strlen(s) + 1, &ref));
+    memcpy(arena_at(a, ref), s, strlen(s) + 1);
+    return ref;
+}
+
+void setUp(void) {}
+void tearDown(void) { arena_free(&arena); }
+
+void test_allocations_are_packed(void) {
+    ArenaRef a = store(&arena, "docs");
+    ArenaRef b = store(&arena, "blog");
+    TEST_ASSERT_EQUAL_UINT64(a + 5, b);
+    TEST_ASSERT_EQUAL(10, arena.used);
+    TEST_ASSERT_EQUAL(1, arena.count);
+}
+
+/* Far past one chunk: every reference still reads back its string. */
+void test_references_survive_new_chunks(void) {
+    static ArenaRef refs[200000];
+    char s[512];
+    for (int i = 0; i < 200000; i++) {
+        snprintf(s, sizeof(s), "https://example.com/%d/%0400d", i, 0);
+        refs[i] = store(&arena, s);
+    }
+    TEST_ASSERT_GREATER_THAN(1, arena.count);
+    for (int i = 0; i < 200000; i++) {
+        snprintf(s, sizeof(s), "https://example.com/%d/%0400d", i, 0);
+        TEST_ASSERT_EQUAL_STRING(s, arena_at(&arena, refs[i]));
+    }
+    for (size_t i = 0; i < arena.count; i++) {
+        TEST_ASSERT_LESS_OR_EQUAL(ARENA_CHUNK_SIZE, arena.chunks[i].used);
+    }
+}
+
+void test_large_allocation_gets_a_chunk(void) {
+    ArenaRef small = store(&arena, "docs");
+    ArenaRef big;
+    TEST_ASSERT_EQUAL_INT(0, arena_alloc(&arena, ARENA_CHUNK_SIZE + 1, &big));
+    TEST_ASSERT_EQUAL_UINT64((ArenaRef)1 << 32, big);
+    ArenaRef next = store(&arena, "blog");
+    TEST_ASSERT_EQUAL_UINT64(2, next >> 32);
+    TEST_ASSERT_EQUAL_STRING("docs", arena_at(&arena, small));
+    TEST_ASSERT_EQUAL_STRING("blog", arena_at(&arena, next));
+}
+
+void test_adopt_moves_chunks(void) {
+    StringArena other = {0};
+    ArenaRef mine = store(&arena, "docs");
+    ArenaRef theirs = store(&other, "blog");
+    uint32_t base;
+    TEST_ASSERT_EQUAL_INT(0, arena_adopt(&arena, &other, &base));
+    TEST_ASSERT_EQUAL_UINT32(1, base);
+    TEST_ASSERT_NULL(other.chunks);
+    TEST_ASSERT_EQUAL(0, other.used);
+    TEST_ASSERT_EQUAL(10, arena.used);
+    TEST_ASSERT_EQUAL_STRING("docs", arena_at(&arena, mine));
+    TEST_ASSERT_EQUAL_STRING("blog", arena_at(&arena, theirs + ((ArenaRef)base << 32)));
+    arena_free(&other);
+}
+
+void test_adopt_empty(void) {
+    StringArena other = {0};
+    ArenaRef mine = store(&arena, "docs");
+    uint32_t base;
+    TEST_ASSERT_EQUAL_INT(0, arena_adopt(&arena, &other, &base));
+    TEST_ASSERT_EQUAL(1, arena.count);
+    TEST_ASSERT_EQUAL_STRING("docs", arena_at(&arena, mine));
+}
+
+/* Whole-chunk allocations are left untouched but for their ends, so the
+ * pages past 4 GiB are only reserved, never filled. */
+void test_more_than_4_gib(void) {
+    size_t chunks = ((size_t)4 << 30) / ARENA_CHUNK_SIZE + 1;
+    ArenaRef first = 0, last = 0;
+    for (size_t i = 0; i < chunks; i++) {
+        ArenaRef ref;
+        if (arena_alloc(&arena, ARENA_CHUNK_SIZE, &ref) == -1) {
+            TEST_IGNORE_MESSAGE("not enough address space");
+        }
+        char *p = arena_at(&arena, ref);
+        p[0] = (char)i;
+        p[ARENA_CHUNK_SIZE - 1] = (char)i;
+        if (i == 0) {
+            first = ref;
+        }
+        last = ref;
+    }
+    TEST_ASSERT_GREATER_THAN((size_t)UINT32_MAX, arena.used);
+    ArenaRef tail = store(&arena, "docs");
+    TEST_ASSERT_EQUAL_STRING("docs", arena_at(&arena, tail));
+    TEST_ASSERT_EQUAL_CHAR(0, arena_at(&arena, first)[ARENA_CHUNK_SIZE - 1]);
+    TEST_ASSERT_EQUAL_CHAR((char)(chunks - 1), arena_at(&arena, last)[0]);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_allocations_are_packed);
+    RUN_TEST(test_references_survive_new_chunks);
+    RUN_TEST(test_large_allocation_gets_a_chunk);
+    RUN_TEST(test_adopt_moves_chunks);
+    RUN_TEST(test_adopt_empty);
+    RUN_TEST(test_more_than_4_gib);
+
+    return UNITY_END();
+}
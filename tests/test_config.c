@@ -1,5 +1,6 @@
 /*
- * Unit tests for utils/config.c (read_port_from_config).
+ * Unit tests for utils/config.c (read_port_from_config, read_int_from_config,
+ * read_string_from_config).
  *
  * Writes temporary files to /tmp and cleans them up after each test.
  * Linked against tests/logs_stub.c to avoid the zlog dependency.
@@ -78,6 +79,62 @@ void test_file_not_found_returns_minus_one(void) {
         read_port_from_config("/tmp/yathr_nonexistent_file_xyz.txt"));
 }
 
+/* ------------------------------------------------------------------ */
+/* read_int_from_config                                                */
+/* ------------------------------------------------------------------ */
+
+void test_int_key_is_read(void) {
+    write_config("SERVER_PORT=8080\nWORKERS=4\n");
+    TEST_ASSERT_EQUAL_INT(4, read_int_from_config(tmp_path, "WORKERS", 0));
+}
+
+void test_int_missing_key_returns_default(void) {
+    write_config("SERVER_PORT=8080\n");
+    TEST_ASSERT_EQUAL_INT(7, read_int_from_config(tmp_path, "WORKERS", 7));
+}
+
+/* A key that is only a prefix of another key must not match it. */
+void test_int_key_prefix_does_not_match(void) {
+    write_config("WORKERS_MAX=9\n");
+    TEST_ASSERT_EQUAL_INT(0, read_int_from_config(tmp_path, "WORKERS", 0));
+}
+
+void test_int_non_numeric_returns_default(void) {
+    write_config("WORKERS=auto\n");
+    TEST_ASSERT_EQUAL_INT(0, read_int_from_config(tmp_path, "WORKERS", 0));
+}
+
+void test_int_file_not_found_returns_default(void) {
+    TEST_ASSERT_EQUAL_INT(3,
+        read_int_from_config("/tmp/yathr_nonexistent_file_xyz.txt", "WORKERS", 3));
+}
+
+/* ------------------------------------------------------------------ */
+/* read_string_from_config                                             */
+/* ------------------------------------------------------------------ */
+
+void test_string_value_is_read_without_newline(void) {
+    char value[64];
+    write_config("SERVER_PORT=8080\r\nROUTES_CDB=/var/lib/yathr/routes.cdb\r\n");
+    TEST_ASSERT_EQUAL_INT(0, read_string_from_config(tmp_path, "ROUTES_CDB", value, sizeof(value)));
+    TEST_ASSERT_EQUAL_STRING("/var/lib/yathr/routes.cdb", value);
+}
+
+void test_string_missing_key_returns_minus_one(void) {
+    char value[64] = "untouched";
+    write_config("SERVER_PORT=8080\n");
+    TEST_ASSERT_EQUAL_INT(-1, read_string_from_config(tmp_path, "ROUTES_CDB", value, sizeof(value)));
+    TEST_ASSERT_EQUAL_STRING("untouched", value);
+}
+
+/* Values longer than the destination are truncated, never overflowed. */
+void test_string_value_is_truncated_to_buffer(void) {
+    char value[8];
+    write_config("ROUTES_CDB=abcdefghijklmnop\n");
+    TEST_ASSERT_EQUAL_INT(0, read_string_from_config(tmp_path, "ROUTES_CDB", value, sizeof(value)));
+    TEST_ASSERT_EQUAL_STRING("abcdefg", value);
+}
+
 /* ------------------------------------------------------------------ */
 /* main                                                                */
 /* ------------------------------------------------------------------ */
@@ -95,5 +152,15 @@ int main(void) {
     RUN_TEST(test_empty_file_returns_minus_one);
     RUN_TEST(test_file_not_found_returns_minus_one);
 
+    RUN_TEST(test_int_key_is_read);
+    RUN_TEST(test_int_missing_key_returns_default);
+    RUN_TEST(test_int_key_prefix_does_not_match);
+    RUN_TEST(test_int_non_numeric_returns_default);
+    RUN_TEST(test_int_file_not_found_returns_default);
+
+    RUN_TEST(test_string_value_is_read_without_newline);
+    RUN_TEST(test_string_missing_key_returns_minus_one);
+    RUN_TEST(test_string_value_is_truncated_to_buffer);
+
     return UNITY_END();
 }
@@ -0,0 +1,144 @@
+/*
+ * Unit tests for utils/hot_cache.c
+ *
+ * Covers: hits and misses, groups, keys too long to cache, CLOCK eviction
+ * sparing referenced entries, clearing on a new generation, and the index
+ * staying consistent through many evictions.
+ */
+
+#include "unity/unity.h"
+#include "../utils/hot_cache.h"
+
+#include <stdio.h>
+#include <string.h>
+
+static HotCache cache;
+
+/* A deliberately poor hash, so that keys share probe sequences. */
+static uint64_t hash_of(const char *key) {
+    uint64_t hash = 0;
+    for (const char *p = key; *p; p++) {
+        hash = hash * 31 + (unsigned char)*p;
+    }
+    return hash & 0xff;
+}
+
+static void insert(const char *key, const char *url) {
+    hot_cache_insert(&cache, hash_of(key), 0, key, strlen(key), url, strlen(url), NULL, 0);
+}
+
+static const char *find(const char *key) {
+    const HotCacheEntry *e = hot_cache_find(&cache, hash_of(key), 0, key, strlen(key));
+    return e ? e->url : NULL;
+}
+
+void setUp(void) { TEST_ASSERT_EQUAL_INT(0, hot_cache_init(&cache, 4)); }
+void tearDown(void) { hot_cache_free(&cache); }
+
+void test_entry_is_two_cache_lines(void) {
+    TEST_ASSERT_EQUAL(128, sizeof(HotCacheEntry));
+}
+
+void test_hit_and_miss(void) {
+    TEST_ASSERT_NULL(find("docs"));
+    insert("docs", "https://docs.example.com");
+    TEST_ASSERT_EQUAL_STRING("https://docs.example.com", find("docs"));
+    TEST_ASSERT_NULL(find("doc"));
+    TEST_ASSERT_NULL(find("docs2"));
+}
+
+void test_groups_are_kept_apart(void) {
+    hot_cache_insert(&cache, 7, 1, "docs", 4, "https://one", 11, NULL, 0);
+    const HotCacheEntry *e = hot_cache_find(&cache, 7, 1, "docs", 4);
+    TEST_ASSERT_NOT_NULL(e);
+    TEST_ASSERT_EQUAL_UINT16(1, e->group);
+    TEST_ASSERT_NULL(hot_cache_find(&cache, 7, 2, "docs", 4));
+}
+
+void test_long_keys_not_cached(void) {
+    char key[HOT_CACHE_KEY_MAX + 2];
+    memset(key, 'k', sizeof(key) - 1);
+    key[sizeof(key) - 1] = '\0';
+    insert(key, "https://long.example.com");
+    TEST_ASSERT_NULL(find(key));
+    key[HOT_CACHE_KEY_MAX] = '\0';
+    insert(key, "https://long.example.com");
+    TEST_ASSERT_EQUAL_STRING("https://long.example.com", find(key));
+}
+
+/* Keys read since the hand last passed survive; the others go first. */
+void test_clock_spares_referenced_entries(void) {
+    insert("a", "https://a");
+    insert("b", "https://b");
+    insert("c", "https://c");
+    insert("d", "https://d");
+    TEST_ASSERT_NOT_NULL(find("a"));
+    TEST_ASSERT_NOT_NULL(find("c"));
+
+    insert("e", "https://e");
+    TEST_ASSERT_NULL(find("b"));
+    insert("f", "https://f");
+    TEST_ASSERT_NULL(find("d"));
+
+    /* The hand cleared a and c on its way: read them again */
+    TEST_ASSERT_NOT_NULL(find("a"));
+    TEST_ASSERT_NOT_NULL(find("c"));
+    insert("g", "https://g");
+    TEST_ASSERT_NULL(find("e"));
+    TEST_ASSERT_EQUAL_STRING("https://a", find("a"));
+    TEST_ASSERT_EQUAL_STRING("https://c", find("c"));
+    TEST_ASSERT_EQUAL_STRING("https://f", find("f"));
+    TEST_ASSERT_EQUAL_STRING("https://g", find("g"));
+}
+
+void test_clear_on_new_generation(void) {
+    insert("docs", "https://docs.example.com");
+    hot_cache_clear(&cache, 2);
+    TEST_ASSERT_EQUAL_UINT64(2, cache.generation);
+    TEST_ASSERT_NULL(find("docs"));
+    insert("docs", "https://new.example.com");
+    TEST_ASSERT_EQUAL_STRING("https://new.example.com", find("docs"));
+}
+
+/* Every key inserted last is found, every evicted one is not, whatever
+ * the collisions. */
+void test_many_evictions(void) {
+    hot_cache_free(&cache);
+    TEST_ASSERT_EQUAL_INT(0, hot_cache_init(&cache, 64));
+    char key[32], url[32];
+    for (int i = 0; i < 5000; i++) {
+        snprintf(key, sizeof(key), "key-%d", i);
+        snprintf(url, sizeof(url), "https://%d", i);
+        insert(key, url);
+        if (i % 3 == 0) {
+            snprintf(key, sizeof(key), "key-%d", i - i % 64);
+            find(key);
+        }
+    }
+    size_t found = 0;
+    for (int i = 0; i < 5000; i++) {
+        snprintf(key, sizeof(key), "key-%d", i);
+        snprintf(url, sizeof(url), "https://%d", i);
+        const char *hit = find(key);
+        if (hit) {
+            TEST_ASSERT_EQUAL_STRING(url, hit);
+            found++;
+        }
+    }
+    TEST_ASSERT_EQUAL(64, found);
+    TEST_ASSERT_EQUAL_STRING("https://4999", find("key-4999"));
+}
+
+int main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_entry_is_two_cache_lines);
+    RUN_TEST(test_hit_and_miss);
+    RUN_TEST(test_groups_are_kept_apart);
+    RUN_TEST(test_long_keys_not_cached);
+    RUN_TEST(test_clock_spares_referenced_entries);
+    RUN_TEST(test_clear_on_new_generation);
+    RUN_TEST(test_many_evictions);
+
+    return UNITY_END();
+}
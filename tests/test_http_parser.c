@@ -0,0 +1,340 @@
+/*
+ * Unit tests for utils/http_parser.c
+ *
+ * Covers: request line slices, versionless requests, the headers the
+ * server reads (Host, Connection, Content-Length, Transfer-Encoding),
+ * incomplete and malformed heads, a head resumed as it arrives byte by
+ * byte, a buffer left untouched, and a randomized comparison of every
+ * supported word-at-a-time and SIMD scanner against the scalar one.
+ */
+
+#include "unity/unity.h"
+#include "../utils/http_parser.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+void setUp(void)    { http_parser_select(HTTP_SCAN_SCALAR); }
+void tearDown(void) { http_parser_select(HTTP_SCAN_SCALAR); }
+
+static long parse(const char *text, HttpHead *head) {
+    return http_parse_head(text, strlen(text), head, NULL);
+}
+
+/* Runs body once per scanner the CPU supports. */
+#define FOR_EACH_SCANNER(kind) \
+    for (int kind = 0; kind < HTTP_SCAN_COUNT; kind++) \
+        if (http_parser_select((HttpScanKind)kind) == 0)
+
+/* ------------------------------------------------------------------ */
+/* Request line                                                        */
+/* ------------------------------------------------------------------ */
+
+void test_request_line_slices(void) {
+    FOR_EACH_SCANNER(kind) {
+        const char *text = "GET /abc?x=1 HTTP/1.1\r\n\r\n";
+        HttpHead head;
+        TEST_ASSERT_EQUAL_INT64((long)strlen(text), parse(text, &head));
+        TEST_ASSERT_EQUAL_size_t(3, head.method_len);
+        TEST_ASSERT_EQUAL_MEMORY("GET", head.method, 3);
+        TEST_ASSERT_EQUAL_size_t(4, head.path_len);
+        TEST_ASSERT_EQUAL_MEMORY("/abc", head.path, 4);
+        TEST_ASSERT_EQUAL_INT(1, head.minor_version);
+        TEST_ASSERT_NULL(head.host);
+        TEST_ASSERT_EQUAL_INT(HTTP_CONNECTION_DEFAULT, head.connection);
+    }
+}
+
+void test_request_line_tabs_and_http10(void) {
+    HttpHead head;
+    TEST_ASSERT_EQUAL_INT64(18, parse("GET\t/a\t\tHTTP/1.0\n\n", &head));
+    TEST_ASSERT_EQUAL_MEMORY("/a", head.path, 2);
+    TEST_ASSERT_EQUAL_INT(0, head.minor_version);
+}
+
+void test_request_without_version(void) {
+    HttpHead head;
+    TEST_ASSERT_EQUAL_INT64(10, parse("GET /old\r\nHost: ignored\r\n", &head));
+    TEST_ASSERT_EQUAL_INT(-1, head.minor_version);
+    TEST_ASSERT_EQUAL_size_t(4, head.path_len);
+    TEST_ASSERT_NULL(head.host);
+}
+
+void test_buffer_is_not_written(void) {
+    char buffer[] = "GET /abc?q HTTP/1.1\r\nHost: a\r\n\r\n";
+    char copy[sizeof(buffer)];
+    memcpy(copy, buffer, sizeof(buffer));
+    HttpHead head;
+    TEST_ASSERT_TRUE(http_parse_head(buffer, sizeof(buffer) - 1, &head, NULL) > 0);
+    TEST_ASSERT_EQUAL_MEMORY(copy, buffer, sizeof(buffer));
+}
+
+/* ------------------------------------------------------------------ */
+/* Headers                                                             */
+/* ------------------------------------------------------------------ */
+
+void test_host_header_trimmed(void) {
+    FOR_EACH_SCANNER(kind) {
+        HttpHead head;
+        const char *text = "GET / HTTP/1.1\r\nUser-Agent: a-rather-long-agent-string/1.0 (something)\r\n"
+                           "hOsT: \t example.com:8080 \r\nHost: second\r\n\r\n";
+        TEST_ASSERT_EQUAL_INT64((long)strlen(text), parse(text, &head));
+        TEST_ASSERT_EQUAL_size_t(16, head.host_len);
+        TEST_ASSERT_EQUAL_MEMORY("example.com:8080", head.host, 16);
+    }
+}
+
+void test_connection_tokens(void) {
+    HttpHead head;
+    parse("GET / HTTP/1.1\r\nConnection: Keep-Alive, Upgrade\r\n\r\n", &head);
+    TEST_ASSERT_EQUAL_INT(HTTP_CONNECTION_KEEP_ALIVE, head.connection);
+    parse("GET / HTTP/1.1\r\nconnection: CLOSE\r\n\r\n", &head);
+    TEST_ASSERT_EQUAL_INT(HTTP_CONNECTION_CLOSE, head.connection);
+    parse("GET / HTTP/1.1\r\nConnectionx: close\r\n\r\n", &head);
+    TEST_ASSERT_EQUAL_INT(HTTP_CONNECTION_DEFAULT, head.connection);
+    parse("GET / HTTP/1.0\r\nConnection: upgrade ,\tkeep-alive \r\n\r\n", &head);
+    TEST_ASSERT_EQUAL_INT(HTTP_CONNECTION_KEEP_ALIVE, head.connection);
+
+    /* Only whole elements count */
+    parse("GET / HTTP/1.1\r\nConnection: x-close-y\r\n\r\n", &head);
+    TEST_ASSERT_EQUAL_INT(HTTP_CONNECTION_DEFAULT, head.connection);
+    parse("GET / HTTP/1.1\r\nConnection: closed, keep-alived\r\n\r\n", &head);
+    TEST_ASSERT_EQUAL_INT(HTTP_CONNECTION_DEFAULT, head.connection);
+    parse("GET / HTTP/1.1\r\nConnection: close keep-alive\r\n\r\n", &head);
+    TEST_ASSERT_EQUAL_INT(HTTP_CONNECTION_DEFAULT, head.connection);
+    parse("GET / HTTP/1.0\r\nConnection: x-keep-alive, close\r\n\r\n", &head);
+    TEST_ASSERT_EQUAL_INT(HTTP_CONNECTION_CLOSE, head.connection);
+}
+
+void test_body_headers(void) {
+    HttpHead head;
+    parse("POST / HTTP/1.1\r\nContent-Length:  42\r\n\r\n", &head);
+    TEST_ASSERT_EQUAL_size_t(42, head.content_length);
+    TEST_ASSERT_EQUAL_INT(0, head.chunked);
+    parse("POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n", &head);
+    TEST_ASSERT_EQUAL_INT(1, head.chunked);
+    parse("POST / HTTP/1.1\r\nContent-Length: 99999999999999999999999999\r\n\r\n", &head);
+    TEST_ASSERT_EQUAL_size_t((size_t)-1, head.content_length);
+}
+
+/* ------------------------------------------------------------------ */
+/* Incomplete and malformed                                            */
+/* ------------------------------------------------------------------ */
+
+void test_incomplete_heads(void) {
+    FOR_EACH_SCANNER(kind) {
+        HttpHead head;
+        TEST_ASSERT_EQUAL_INT64(0, parse("", &head));
+        TEST_ASSERT_EQUAL_INT64(0, parse("GET / HTTP/1.1", &head));
+        TEST_ASSERT_EQUAL_INT64(0, parse("GET / HTTP/1.1\r\n", &head));
+        TEST_ASSERT_EQUAL_INT64(0, parse("GET / HTTP/1.1\r\nHost: a\r\n", &head));
+        TEST_ASSERT_EQUAL_INT64(0, parse("GET / HTTP/1.1\r\nHost: a\r\n\r", &head));
+    }
+}
+
+/* Fed one more byte per call, a head resumed from its scan completes at
+ * exactly its last byte and parses as it does in one piece; until then
+ * every call records the whole prefix as searched. */
+void test_head_resumed_byte_by_byte(void) {
+    static const char *const texts[] = {
+        "GET /abc?x=1 HTTP/1.1\r\nHost: example.com\r\nConnection: close\r\n\r\n",
+        "GET /a HTTP/1.0\n\n",
+        "GET /old\r\n",
+        "GET / HTTP/1.1\r\nX-Long: aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa\r\n"
+        "Content-Length: 3\r\n\r\n",
+    };
+    FOR_EACH_SCANNER(kind) {
+        for (size_t t = 0; t < sizeof(texts) / sizeof(texts[0]); t++) {
+            const char *text = texts[t];
+            size_t len = strlen(text);
+            HttpHead expected;
+            TEST_ASSERT_EQUAL_INT64((long)len, parse(text, &expected));
+
+            HttpScan scan = {0, 0};
+            HttpHead head;
+            for (size_t k = 1; k < len; k++) {
+                TEST_ASSERT_EQUAL_INT64(0, http_parse_head(text, k, &head, &scan));
+                TEST_ASSERT_EQUAL_size_t(k, scan.scanned);
+            }
+            TEST_ASSERT_EQUAL_INT64((long)len, http_parse_head(text, len, &head, &scan));
+            TEST_ASSERT_EQUAL_size_t(0, scan.scanned);
+            TEST_ASSERT_EQUAL_INT(0, scan.in_headers);
+            TEST_ASSERT_EQUAL_PTR(expected.path, head.path);
+            TEST_ASSERT_EQUAL_size_t(expected.path_len, head.path_len);
+            TEST_ASSERT_EQUAL_INT(expected.minor_version, head.minor_version);
+            TEST_ASSERT_EQUAL_INT(expected.connection, head.connection);
+            TEST_ASSERT_EQUAL_size_t(expected.host_len, head.host_len);
+            TEST_ASSERT_EQUAL_size_t(expected.content_length, head.content_length);
+        }
+    }
+}
+
+void test_malformed_heads(void) {
+    HttpHead head;
+    TEST_ASSERT_EQUAL_INT64(-1, parse(" / HTTP/1.1\r\n\r\n", &head));
+    TEST_ASSERT_EQUAL_INT64(-1, parse("GET\r\n\r\n", &head));
+    TEST_ASSERT_EQUAL_INT64(-1, parse("GET ?q HTTP/1.1\r\n\r\n", &head));
+    TEST_ASSERT_EQUAL_INT64(-1, parse("GET / HTTP/2.0\r\n\r\n", &head));
+    TEST_ASSERT_EQUAL_INT64(-1, parse("GET / HTTP/1\r\n\r\n", &head));
+
+    /* Nothing but HTTP/1.0 or HTTP/1.1, and nothing after it */
+    TEST_ASSERT_EQUAL_INT64(-1, parse("GET / HTTP/1.2\r\n\r\n", &head));
+    TEST_ASSERT_EQUAL_INT64(-1, parse("GET / HTTP/1.x\r\n\r\n", &head));
+    TEST_ASSERT_EQUAL_INT64(-1, parse("GET / HTTP/1.1foo\r\n\r\n", &head));
+    TEST_ASSERT_EQUAL_INT64(-1, parse("GET / HTTP/1.10\r\n\r\n", &head));
+    TEST_ASSERT_EQUAL_INT64(-1, parse("GET / HTTP/1.1 x\r\n\r\n", &head));
+}
+
+/* ------------------------------------------------------------------ */
+/* Scanners against the scalar one                                     */
+/* ------------------------------------------------------------------ */
+
+static uint64_t rng_state = 0x853C49E6748FEA9BULL;
+
+static uint32_t next_random(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return (uint32_t)(rng_state >> 32);
+}
+
+static const char *const seeds[] = {
+    "GET /google HTTP/1.1\r\nHost: localhost:8080\r\nUser-Agent: Mozilla/5.0 (X11; Linux x86_64)\r\n"
+    "Accept: text/html,application/xhtml+xml\r\nConnection: keep-alive\r\n\r\n",
+    "GET /a-much-longer-path/with/several/segments-and-more?utm_source=x&utm_medium=y HTTP/1.0\r\n"
+    "Connection: close\r\nContent-Length: 12\r\n\r\n",
+    "GET\t/x\tHTTP/1.1\nHost:h\nTransfer-Encoding: chunked\n\n",
+    "GET /legacy\r\n",
+};
+
+/* Bytes the parser cares about, weighted against plain letters. */
+static char random_byte(void) {
+    static const char special[] = " \t?\r\n:HhCcTt";
+    uint32_t r = next_random();
+    if (r % 3 == 0) {
+        return special[(r >> 8) % (sizeof(special) - 1)];
+    }
+    return (char)(32 + (r >> 8) % 95);
+}
+
+static size_t mutate(char *out, size_t cap, const char *seed) {
+    size_t len = strlen(seed);
+    memcpy(out, seed, len);
+    int edits = 1 + next_random() % 8;
+    for (int e = 0; e < edits; e++) {
+        size_t pos = len ? next_random() % len : 0;
+        switch (next_random() % 4) {
+        case 0: /* replace */
+            if (len) out[pos] = random_byte();
+            break;
+        case 1: /* insert a run */
+        {
+            size_t run = 1 + next_random() % 40;
+            if (len + run > cap) break;
+            memmove(out + pos + run, out + pos, len - pos);
+            for (size_t i = 0; i < run; i++) out[pos + i] = random_byte();
+            len += run;
+            break;
+        }
+        case 2: /* delete */
+            if (len) {
+                size_t run = 1 + next_random() % 8;
+                if (pos + run > len) run = len - pos;
+                memmove(out + pos, out + pos + run, len - pos - run);
+                len -= run;
+            }
+            break;
+        default: /* truncate */
+            len = pos;
+            break;
+        }
+    }
+    return len;
+}
+
+static void assert_same_head(const char *buffer, long expected_result, const HttpHead *expected,
+                             long result, const HttpHead *head) {
+    TEST_ASSERT_EQUAL_INT64(expected_result, result);
+    if (result <= 0) {
+        return;
+    }
+    TEST_ASSERT_EQUAL_INT64(expected->method - buffer, head->method - buffer);
+    TEST_ASSERT_EQUAL_size_t(expected->method_len, head->method_len);
+    TEST_ASSERT_EQUAL_INT64(expected->path - buffer, head->path - buffer);
+    TEST_ASSERT_EQUAL_size_t(expected->path_len, head->path_len);
+    TEST_ASSERT_EQUAL_INT(expected->minor_version, head->minor_version);
+    TEST_ASSERT_EQUAL_INT(expected->connection, head->connection);
+    TEST_ASSERT_EQUAL_INT(expected->chunked, head->chunked);
+    TEST_ASSERT_EQUAL_size_t(expected->content_length, head->content_length);
+    TEST_ASSERT_EQUAL_INT(expected->host == NULL, head->host == NULL);
+    if (expected->host) {
+        TEST_ASSERT_EQUAL_INT64(expected->host - buffer, head->host - buffer);
+        TEST_ASSERT_EQUAL_size_t(expected->host_len, head->host_len);
+    }
+}
+
+void test_scanners_match_scalar(void) {
+    enum { CAP = 1024, ROUNDS = 200000 };
+    int compared = 0;
+
+    for (int round = 0; round < ROUNDS; round++) {
+        /* Exact-size heap copies, so a read past the end trips ASan. */
+        char text[CAP];
+        size_t len = mutate(text, CAP, seeds[round % (sizeof(seeds) / sizeof(seeds[0]))]);
+        char *buffer = malloc(len ? len : 1);
+        TEST_ASSERT_NOT_NULL(buffer);
+        memcpy(buffer, text, len);
+
+        HttpHead expected;
+        http_parser_select(HTTP_SCAN_SCALAR);
+        long expected_result = http_parse_head(buffer, len, &expected, NULL);
+
+        for (int kind = HTTP_SCAN_SCALAR + 1; kind < HTTP_SCAN_COUNT; kind++) {
+            if (http_parser_select((HttpScanKind)kind) == -1) {
+                continue;
+            }
+            HttpHead head;
+            long result = http_parse_head(buffer, len, &head, NULL);
+            assert_same_head(buffer, expected_result, &expected, result, &head);
+            compared++;
+        }
+        free(buffer);
+    }
+    TEST_ASSERT_TRUE(compared > 0);
+}
+
+void test_init_selects_supported_scanner(void) {
+    init_http_parser();
+    HttpScanKind kind = http_parser_selected();
+    TEST_ASSERT_TRUE(http_scan_supported(kind));
+    for (int k = kind + 1; k < HTTP_SCAN_COUNT; k++) {
+        TEST_ASSERT_FALSE(http_scan_supported((HttpScanKind)k));
+    }
+}
+
+/* ------------------------------------------------------------------ */
+/* main                                                                */
+/* ------------------------------------------------------------------ */
+
+int main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_request_line_slices);
+    RUN_TEST(test_request_line_tabs_and_http10);
+    RUN_TEST(test_request_without_version);
+    RUN_TEST(test_buffer_is_not_written);
+
+    RUN_TEST(test_host_header_trimmed);
+    RUN_TEST(test_connection_tokens);
+    RUN_TEST(test_body_headers);
+
+    RUN_TEST(test_incomplete_heads);
+    RUN_TEST(test_head_resumed_byte_by_byte);
+    RUN_TEST(test_malformed_heads);
+
+    RUN_TEST(test_scanners_match_scalar);
+    RUN_TEST(test_init_selects_supported_scanner);
+
+    return UNITY_END();
+}
@@ -0,0 +1,113 @@
+/*
+ * Unit tests for utils/latency.c
+ *
+ * Covers: bucket boundaries and precision, recording from registered and
+ * unregistered threads, percentiles merged over threads and the
+ * Prometheus summary output.
+ *
+ * init_latency() is never called, so one tick reads as one nanosecond
+ * and recorded values come back unscaled. Histograms are process-wide,
+ * so each test records into its own phase.
+ */
+
+#include "unity/unity.h"
+#include "../utils/latency.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+void setUp(void)    {}
+void tearDown(void) {}
+
+void test_bucket_is_exact_below_sub_buckets(void) {
+    for (uint64_t v = 0; v < LATENCY_SUB_BUCKETS; v++) {
+        TEST_ASSERT_EQUAL_INT((int)v, latency_bucket(v));
+    }
+}
+
+void test_bucket_is_monotonic_and_bounded(void) {
+    int previous = 0;
+    for (uint64_t v = 1; v < (1ull << 44); v += v / 7 + 1) {
+        int bucket = latency_bucket(v);
+        TEST_ASSERT_TRUE(bucket >= previous);
+        TEST_ASSERT_TRUE(bucket < LATENCY_BUCKETS);
+        previous = bucket;
+    }
+    TEST_ASSERT_EQUAL_INT(LATENCY_BUCKETS - 1, latency_bucket(UINT64_MAX));
+}
+
+void test_unregistered_thread_records_nothing(void) {
+    uint64_t before = latency_count(LATENCY_SEND);
+    latency_record(LATENCY_SEND, 100);
+    TEST_ASSERT_EQUAL_UINT64(before, latency_count(LATENCY_SEND));
+}
+
+static void *record_lookups(void *arg) {
+    uint64_t value = *(uint64_t *)arg;
+    TEST_ASSERT_EQUAL_INT(0, latency_register());
+    for (int i = 0; i < 1000; i++) {
+        latency_record(LATENCY_LOOKUP, value);
+    }
+    return NULL;
+}
+
+void test_percentiles_merge_threads(void) {
+    /* 99% of samples at 1000 ticks, 1% at 100000. */
+    uint64_t fast = 1000, slow = 100000;
+    pthread_t threads[100];
+    for (int i = 0; i < 100; i++) {
+        TEST_ASSERT_EQUAL_INT(0, pthread_create(&threads[i], NULL, record_lookups, i == 0 ? &slow : &fast));
+        pthread_join(threads[i], NULL);
+    }
+
+    TEST_ASSERT_EQUAL_UINT64(100000, latency_count(LATENCY_LOOKUP));
+    TEST_ASSERT_UINT64_WITHIN(fast / 32, fast, latency_percentile(LATENCY_LOOKUP, 0.50));
+    TEST_ASSERT_UINT64_WITHIN(fast / 32, fast, latency_percentile(LATENCY_LOOKUP, 0.99));
+    TEST_ASSERT_UINT64_WITHIN(slow / 32, slow, latency_percentile(LATENCY_LOOKUP, 0.999));
+}
+
+void test_empty_phase_reports_zero(void) {
+    TEST_ASSERT_EQUAL_UINT64(0, latency_count(LATENCY_FIRST_BYTE));
+    TEST_ASSERT_EQUAL_UINT64(0, latency_percentile(LATENCY_FIRST_BYTE, 0.99));
+}
+
+void test_format_lists_every_phase(void) {
+    TEST_ASSERT_EQUAL_INT(0, latency_register());
+    latency_record(LATENCY_PARSE, 50);
+
+    char text[8192];
+    size_t len = latency_format(text, sizeof(text));
+    TEST_ASSERT_EQUAL_size_t(strlen(text), len);
+    TEST_ASSERT_NOT_NULL(strstr(text, "# TYPE yathr_request_phase_seconds summary\n"));
+    TEST_ASSERT_NOT_NULL(strstr(text, "yathr_request_phase_seconds{phase=\"parse\",quantile=\"0.5\"} 0.000000050\n"));
+    TEST_ASSERT_NOT_NULL(strstr(text, "yathr_request_phase_seconds_count{phase=\"parse\"} 1\n"));
+    for (int phase = 0; phase < LATENCY_PHASES; phase++) {
+        char expected[128];
+        snprintf(expected, sizeof(expected), "yathr_request_phase_seconds_count{phase=\"%s\"}",
+                 latency_phase_name(phase));
+        TEST_ASSERT_NOT_NULL(strstr(text, expected));
+    }
+}
+
+void test_format_short_buffer_cuts_at_phase(void) {
+    char text[300];
+    size_t len = latency_format(text, sizeof(text));
+    TEST_ASSERT_TRUE(len < sizeof(text));
+    TEST_ASSERT_EQUAL_size_t(strlen(text), len);
+    TEST_ASSERT_EQUAL_CHAR('\n', text[len - 1]);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_bucket_is_exact_below_sub_buckets);
+    RUN_TEST(test_bucket_is_monotonic_and_bounded);
+    RUN_TEST(test_unregistered_thread_records_nothing);
+    RUN_TEST(test_percentiles_merge_threads);
+    RUN_TEST(test_empty_phase_reports_zero);
+    RUN_TEST(test_format_lists_every_phase);
+    RUN_TEST(test_format_short_buffer_cuts_at_phase);
+
+    return UNITY_END();
+}
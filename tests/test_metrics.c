@@ -0,0 +1,111 @@
+/*
+ * Unit tests for utils/metrics.c
+ *
+ * Covers: per-thread counters summed on read (no lost updates between
+ * registered threads), the shared fallback block, the Prometheus text
+ * output and its behaviour with short buffers.
+ *
+ * Counters are process-wide and never reset, so every test works with
+ * differences between totals.
+ */
+
+#include "unity/unity.h"
+#include "../utils/metrics.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#define THREADS 4
+#define INCREMENTS 100000
+
+void setUp(void)    {}
+void tearDown(void) {}
+
+static void *count_requests(void *arg) {
+    (void)arg;
+    TEST_ASSERT_EQUAL_INT(0, metrics_register());
+    for (int i = 0; i < INCREMENTS; i++) {
+        metric_inc(METRIC_REDIRECTS);
+    }
+    metric_add(METRIC_BYTES_SENT, 1000);
+    return NULL;
+}
+
+void test_registered_threads_lose_no_updates(void) {
+    uint64_t redirects = metrics_total(METRIC_REDIRECTS);
+    uint64_t bytes = metrics_total(METRIC_BYTES_SENT);
+
+    pthread_t threads[THREADS];
+    for (int i = 0; i < THREADS; i++) {
+        TEST_ASSERT_EQUAL_INT(0, pthread_create(&threads[i], NULL, count_requests, NULL));
+    }
+    for (int i = 0; i < THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    TEST_ASSERT_EQUAL_UINT64(redirects + THREADS * INCREMENTS, metrics_total(METRIC_REDIRECTS));
+    TEST_ASSERT_EQUAL_UINT64(bytes + THREADS * 1000, metrics_total(METRIC_BYTES_SENT));
+}
+
+void test_unregistered_thread_uses_fallback_block(void) {
+    /* The test runner's thread never registers. */
+    uint64_t before = metrics_total(METRIC_NOT_FOUND);
+    metric_inc(METRIC_NOT_FOUND);
+    metric_add(METRIC_NOT_FOUND, 2);
+    TEST_ASSERT_EQUAL_UINT64(before + 3, metrics_total(METRIC_NOT_FOUND));
+}
+
+void test_format_reports_counters(void) {
+    metric_inc(METRIC_BAD_REQUESTS);
+    metric_inc(METRIC_SERVER_ERRORS);
+    metric_add(METRIC_CONNECTIONS_OPENED, 5);
+    metric_add(METRIC_CONNECTIONS_CLOSED, 2);
+
+    char expected[128];
+    char text[4096];
+    size_t len = metrics_format(text, sizeof(text));
+    TEST_ASSERT_EQUAL_size_t(strlen(text), len);
+
+    snprintf(expected, sizeof(expected), "yathr_requests_total{status=\"302\"} %llu\n",
+             (unsigned long long)metrics_total(METRIC_REDIRECTS));
+    TEST_ASSERT_NOT_NULL(strstr(text, expected));
+    snprintf(expected, sizeof(expected), "yathr_requests_total{status=\"400\"} %llu\n",
+             (unsigned long long)metrics_total(METRIC_BAD_REQUESTS));
+    TEST_ASSERT_NOT_NULL(strstr(text, expected));
+    snprintf(expected, sizeof(expected), "yathr_requests_total{status=\"500\"} %llu\n",
+             (unsigned long long)metrics_total(METRIC_SERVER_ERRORS));
+    TEST_ASSERT_NOT_NULL(strstr(text, expected));
+    snprintf(expected, sizeof(expected), "yathr_connections_active %llu\n",
+             (unsigned long long)(metrics_total(METRIC_CONNECTIONS_OPENED) - metrics_total(METRIC_CONNECTIONS_CLOSED)));
+    TEST_ASSERT_NOT_NULL(strstr(text, expected));
+    TEST_ASSERT_NOT_NULL(strstr(text, "# TYPE yathr_connections_active gauge\n"));
+    TEST_ASSERT_NOT_NULL(strstr(text, "# TYPE yathr_bytes_sent_total counter\n"));
+}
+
+void test_format_value(void) {
+    char text[256];
+    size_t len = metrics_format_value(text, sizeof(text), "yathr_test_total", "counter", "A test.", 42);
+    TEST_ASSERT_EQUAL_STRING("# HELP yathr_test_total A test.\n# TYPE yathr_test_total counter\nyathr_test_total 42\n", text);
+    TEST_ASSERT_EQUAL_size_t(strlen(text), len);
+}
+
+void test_format_short_buffer_writes_nothing_partial(void) {
+    char text[16];
+    TEST_ASSERT_EQUAL_size_t(0, metrics_format_value(text, sizeof(text), "yathr_test_total", "counter", "A test.", 42));
+    TEST_ASSERT_EQUAL_STRING("", text);
+    TEST_ASSERT_EQUAL_size_t(0, metrics_format(text, sizeof(text)));
+    TEST_ASSERT_EQUAL_STRING("", text);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_registered_threads_lose_no_updates);
+    RUN_TEST(test_unregistered_thread_uses_fallback_block);
+    RUN_TEST(test_format_reports_counters);
+    RUN_TEST(test_format_value);
+    RUN_TEST(test_format_short_buffer_writes_nothing_partial);
+
+    return UNITY_END();
+}
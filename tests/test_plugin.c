@@ -0,0 +1,175 @@
+/*
+ * Unit tests for plugins/plugin.c
+ *
+ * Covers: the async pool's lock-free ring with several producers (every
+ * snapshot delivered exactly once), a full ring dropping and counting
+ * what does not fit without blocking the producer, and a pool thread
+ * gone to sleep being woken by the next snapshot rather than its
+ * timeout.
+ */
+
+#include "unity/unity.h"
+#include "../plugins/plugin.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RING_SIZE 16
+#define PRODUCERS 4
+#define PER_PRODUCER 20000
+#define IN_FLIGHT (RING_SIZE / PRODUCERS)
+
+/* Snapshots are told apart by their client_socket, an id below MAX_IDS. */
+#define MAX_IDS (PRODUCERS * PER_PRODUCER)
+
+static atomic_int delivered[MAX_IDS];
+static atomic_long delivered_total;
+static atomic_int wrong_request;
+
+/* While hold is set the plugin stops at its first snapshot, with held set. */
+static pthread_mutex_t hold_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t hold_released = PTHREAD_COND_INITIALIZER;
+static int hold;
+static atomic_int held;
+
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+static void record(RequestData *request_data) {
+    if (strcmp(request_data->method, "GET") != 0 || strcmp(request_data->path, "/docs") != 0) {
+        atomic_store(&wrong_request, 1);
+    }
+    pthread_mutex_lock(&hold_lock);
+    if (hold) {
+        atomic_store(&held, 1);
+        while (hold) {
+            pthread_cond_wait(&hold_released, &hold_lock);
+        }
+    }
+    pthread_mutex_unlock(&hold_lock);
+
+    atomic_fetch_add(&delivered[request_data->client_socket], 1);
+    atomic_fetch_add(&delivered_total, 1);
+}
+
+static void publish(int id) {
+    RequestData request_data = {"GET", "/docs", NULL, id, NULL, NULL};
+    execute_plugins(POST_ROUTING, &request_data);
+}
+
+/* Waits up to two seconds for total snapshots to have been delivered. */
+static void wait_delivered(long total) {
+    uint64_t deadline = now_ms() + 2000;
+    while (atomic_load(&delivered_total) < total && now_ms() < deadline) {
+        usleep(100);
+    }
+    TEST_ASSERT_EQUAL_INT64(total, atomic_load(&delivered_total));
+}
+
+void setUp(void) {
+    for (int i = 0; i < MAX_IDS; i++) {
+        atomic_store(&delivered[i], 0);
+    }
+    atomic_store(&delivered_total, 0);
+}
+
+void tearDown(void) {}
+
+/* Each producer keeps at most IN_FLIGHT snapshots undelivered, so the
+ * ring never fills and nothing may be dropped. */
+static void *produce(void *arg) {
+    int first = (int)(intptr_t)arg * PER_PRODUCER;
+    for (int i = 0; i < PER_PRODUCER; i++) {
+        while (i >= IN_FLIGHT && atomic_load(&delivered[first + i - IN_FLIGHT]) == 0) {
+            sched_yield();
+        }
+        publish(first + i);
+    }
+    return NULL;
+}
+
+void test_producers_delivered_exactly_once(void) {
+    unsigned long dropped = plugin_dropped();
+    pthread_t producers[PRODUCERS];
+    for (intptr_t p = 0; p < PRODUCERS; p++) {
+        TEST_ASSERT_EQUAL_INT(0, pthread_create(&producers[p], NULL, produce, (void *)p));
+    }
+    for (int p = 0; p < PRODUCERS; p++) {
+        pthread_join(producers[p], NULL);
+    }
+
+    wait_delivered(MAX_IDS);
+    for (int i = 0; i < MAX_IDS; i++) {
+        TEST_ASSERT_EQUAL_INT_MESSAGE(1, atomic_load(&delivered[i]), "snapshot lost or repeated");
+    }
+    TEST_ASSERT_EQUAL_UINT64(dropped, plugin_dropped());
+    TEST_ASSERT_EQUAL_INT(0, atomic_load(&wrong_request));
+}
+
+/* With the pool thread stuck on one snapshot, the ring takes RING_SIZE
+ * more and drops the rest; the producer never waits. */
+void test_full_ring_drops_and_counts(void) {
+    unsigned long dropped = plugin_dropped();
+    pthread_mutex_lock(&hold_lock);
+    hold = 1;
+    atomic_store(&held, 0);
+    pthread_mutex_unlock(&hold_lock);
+
+    publish(0);
+    uint64_t deadline = now_ms() + 2000;
+    while (!atomic_load(&held) && now_ms() < deadline) {
+        usleep(100);
+    }
+    TEST_ASSERT_TRUE(atomic_load(&held));
+
+    for (int id = 1; id <= RING_SIZE + 5; id++) {
+        publish(id);
+    }
+    TEST_ASSERT_EQUAL_UINT64(dropped + 5, plugin_dropped());
+
+    pthread_mutex_lock(&hold_lock);
+    hold = 0;
+    pthread_cond_broadcast(&hold_released);
+    pthread_mutex_unlock(&hold_lock);
+
+    wait_delivered(1 + RING_SIZE);
+    for (int id = 0; id <= RING_SIZE; id++) {
+        TEST_ASSERT_EQUAL_INT(1, atomic_load(&delivered[id]));
+    }
+    for (int id = RING_SIZE + 1; id <= RING_SIZE + 5; id++) {
+        TEST_ASSERT_EQUAL_INT(0, atomic_load(&delivered[id]));
+    }
+}
+
+/* Idle for a while the pool thread sleeps, waiting a second at most; a
+ * snapshot must wake it well before that. */
+void test_sleeping_worker_woken(void) {
+    for (int i = 0; i < 3; i++) {
+        usleep(200 * 1000);
+        uint64_t started = now_ms();
+        publish(i);
+        wait_delivered(i + 1);
+        TEST_ASSERT_LESS_THAN_UINT64(300, now_ms() - started);
+    }
+}
+
+int main(void) {
+    register_plugin("record", POST_ROUTING, PLUGIN_ASYNC, record);
+    if (init_plugins(1, RING_SIZE) != 0) {
+        return 1;
+    }
+
+    UNITY_BEGIN();
+
+    RUN_TEST(test_producers_delivered_exactly_once);
+    RUN_TEST(test_full_ring_drops_and_counts);
+    RUN_TEST(test_sleeping_worker_woken);
+
+    return UNITY_END();
+}
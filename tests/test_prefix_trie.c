@@ -0,0 +1,124 @@
+/*
+ * Unit tests for utils/prefix_trie.c
+ *
+ * Covers: the longest of nested prefixes winning, keys that leave an edge
+ * halfway (splits), replacing a value, the empty key, binary keys, misses
+ * and many keys under one prefix.
+ */
+
+#include "unity/unity.h"
+#include "../utils/prefix_trie.h"
+
+#include <stdio.h>
+#include <string.h>
+
+static PrefixTrie trie;
+
+static void insert(const char *key, uint32_t value) {
+    TEST_ASSERT_EQUAL_INT(0, prefix_trie_insert(&trie, key, strlen(key), value));
+}
+
+/* The value of the longest prefix of key, checking its length too. */
+static uint32_t longest(const char *key, size_t expected_len) {
+    size_t matched = (size_t)-1;
+    uint32_t value = prefix_trie_longest(&trie, key, strlen(key), &matched);
+    if (value != PREFIX_TRIE_NONE) {
+        TEST_ASSERT_EQUAL(expected_len, matched);
+    }
+    return value;
+}
+
+void setUp(void) {}
+void tearDown(void) { prefix_trie_free(&trie); }
+
+void test_longest_prefix_wins(void) {
+    insert("docs/", 1);
+    insert("docs/api/", 2);
+    insert("blog/", 3);
+    TEST_ASSERT_EQUAL_UINT32(1, longest("docs/guide", 5));
+    TEST_ASSERT_EQUAL_UINT32(2, longest("docs/api/v2", 9));
+    TEST_ASSERT_EQUAL_UINT32(2, longest("docs/api/", 9));
+    TEST_ASSERT_EQUAL_UINT32(1, longest("docs/ap", 5));
+    TEST_ASSERT_EQUAL_UINT32(3, longest("blog/2024", 5));
+}
+
+void test_misses(void) {
+    insert("docs/", 1);
+    TEST_ASSERT_EQUAL_UINT32(PREFIX_TRIE_NONE, longest("doc", 0));
+    TEST_ASSERT_EQUAL_UINT32(PREFIX_TRIE_NONE, longest("docx/", 0));
+    TEST_ASSERT_EQUAL_UINT32(PREFIX_TRIE_NONE, longest("", 0));
+    TEST_ASSERT_EQUAL_UINT32(PREFIX_TRIE_NONE, longest("blog/", 0));
+}
+
+void test_empty_trie(void) {
+    TEST_ASSERT_EQUAL_UINT32(PREFIX_TRIE_NONE, longest("docs", 0));
+}
+
+/* Inserted longest first, so every shorter key splits an edge. */
+void test_split_edges(void) {
+    insert("abcdef", 1);
+    insert("abcxyz", 2);
+    insert("abc", 3);
+    insert("a", 4);
+    TEST_ASSERT_EQUAL_UINT32(1, longest("abcdefgh", 6));
+    TEST_ASSERT_EQUAL_UINT32(2, longest("abcxyz", 6));
+    TEST_ASSERT_EQUAL_UINT32(3, longest("abcx", 3));
+    TEST_ASSERT_EQUAL_UINT32(3, longest("abcdeX", 3));
+    TEST_ASSERT_EQUAL_UINT32(4, longest("ab", 1));
+    TEST_ASSERT_EQUAL_UINT32(PREFIX_TRIE_NONE, longest("b", 0));
+}
+
+void test_replace_value(void) {
+    insert("docs/", 1);
+    insert("docs/", 7);
+    TEST_ASSERT_EQUAL_UINT32(7, longest("docs/x", 5));
+}
+
+void test_empty_key_matches_everything(void) {
+    insert("", 9);
+    insert("docs/", 1);
+    TEST_ASSERT_EQUAL_UINT32(9, longest("", 0));
+    TEST_ASSERT_EQUAL_UINT32(9, longest("anything", 0));
+    TEST_ASSERT_EQUAL_UINT32(1, longest("docs/x", 5));
+}
+
+/* Keys with NUL and high bytes, as the route namespaces prefix them. */
+void test_binary_keys(void) {
+    TEST_ASSERT_EQUAL_INT(0, prefix_trie_insert(&trie, "\0\0docs", 6, 1));
+    TEST_ASSERT_EQUAL_INT(0, prefix_trie_insert(&trie, "\0\1docs", 6, 2));
+    TEST_ASSERT_EQUAL_INT(0, prefix_trie_insert(&trie, "\xff\xff", 2, 3));
+    size_t matched;
+    TEST_ASSERT_EQUAL_UINT32(1, prefix_trie_longest(&trie, "\0\0docs/a", 8, &matched));
+    TEST_ASSERT_EQUAL_UINT32(2, prefix_trie_longest(&trie, "\0\1docs/a", 8, &matched));
+    TEST_ASSERT_EQUAL_UINT32(3, prefix_trie_longest(&trie, "\xff\xff/a", 4, &matched));
+    TEST_ASSERT_EQUAL(2, matched);
+    TEST_ASSERT_EQUAL_UINT32(PREFIX_TRIE_NONE, prefix_trie_longest(&trie, "\0\2docs", 6, &matched));
+}
+
+void test_many_keys(void) {
+    char key[64];
+    for (uint32_t i = 0; i < 5000; i++) {
+        snprintf(key, sizeof(key), "campaign/%u/", i * 7);
+        insert(key, i);
+    }
+    for (uint32_t i = 0; i < 5000; i++) {
+        snprintf(key, sizeof(key), "campaign/%u/landing", i * 7);
+        TEST_ASSERT_EQUAL_UINT32(i, longest(key, strlen(key) - 7));
+    }
+    TEST_ASSERT_EQUAL_UINT32(PREFIX_TRIE_NONE, longest("campaign/1/landing", 0));
+}
+
+int main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_longest_prefix_wins);
+    RUN_TEST(test_misses);
+    RUN_TEST(test_empty_trie);
+    RUN_TEST(test_split_edges);
+    RUN_TEST(test_replace_value);
+    RUN_TEST(test_empty_key_matches_everything);
+    RUN_TEST(test_binary_keys);
+    RUN_TEST(test_many_keys);
+
+    return UNITY_END();
+}
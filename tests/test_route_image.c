@@ -0,0 +1,194 @@
+/*
+ * Unit tests for utils/route_image.c
+ *
+ * Covers: every compiled key found with its URL and prebuilt response,
+ * misses, repeated keys, empty images, the hosts section, and rejection
+ * of truncated, foreign or corrupted files.
+ */
+
+#include "unity/unity.h"
+#include "../utils/route_image.h"
+#include "../utils/response.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define ROUTES 100000
+
+static char path[64];
+static char (*keys)[24];
+static char (*urls)[48];
+static RouteImageEntry *entries;
+
+void setUp(void) {
+    snprintf(path, sizeof(path), "/tmp/test_route_image_%d.img", getpid());
+}
+
+void tearDown(void) {
+    remove(path);
+}
+
+static size_t make_entries(size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        int key_len = snprintf(keys[i], sizeof(keys[i]), "route%zu", i);
+        int url_len = snprintf(urls[i], sizeof(urls[i]), "https://example.com/%zu", i);
+        entries[i] = (RouteImageEntry){keys[i], key_len, urls[i], url_len};
+    }
+    return count;
+}
+
+void test_every_key_found(void) {
+    size_t count = make_entries(ROUTES);
+    TEST_ASSERT_EQUAL_INT64(ROUTES, route_image_write(path, entries, count, NULL, 0));
+
+    RouteImage image;
+    TEST_ASSERT_EQUAL_INT(0, route_image_open(&image, path, 0));
+    TEST_ASSERT_EQUAL_INT(0, route_image_verify(&image));
+    TEST_ASSERT_EQUAL_UINT64(ROUTES, image.header->count);
+    for (size_t i = 0; i < count; i++) {
+        size_t url_len, response_len;
+        const char *url = route_image_find(&image, keys[i], strlen(keys[i]), &url_len, &response_len);
+        TEST_ASSERT_NOT_NULL(url);
+        TEST_ASSERT_EQUAL_size_t(strlen(urls[i]), url_len);
+        TEST_ASSERT_EQUAL_MEMORY(urls[i], url, url_len);
+        TEST_ASSERT_EQUAL_CHAR('\0', url[url_len]);
+
+        char expected[128];
+        size_t expected_len = format_redirect_response(expected, urls[i], url_len);
+        TEST_ASSERT_EQUAL_size_t(expected_len, response_len);
+        TEST_ASSERT_EQUAL_MEMORY(expected, url + url_len + 1, response_len);
+    }
+    route_image_close(&image);
+}
+
+void test_misses(void) {
+    size_t count = make_entries(1000);
+    TEST_ASSERT_EQUAL_INT64(1000, route_image_write(path, entries, count, NULL, 0));
+
+    RouteImage image;
+    TEST_ASSERT_EQUAL_INT(0, route_image_open(&image, path, 0));
+    size_t url_len, response_len;
+    char key[32];
+    for (int i = 1000; i < 101000; i++) {
+        snprintf(key, sizeof(key), "route%d", i);
+        TEST_ASSERT_NULL(route_image_find(&image, key, strlen(key), &url_len, &response_len));
+    }
+    /* A prefix of a key, and a key with a byte past its end */
+    TEST_ASSERT_NULL(route_image_find(&image, "route1", 5, &url_len, &response_len));
+    TEST_ASSERT_NULL(route_image_find(&image, "route10x", 8, &url_len, &response_len));
+    TEST_ASSERT_NULL(route_image_find(&image, "", 0, &url_len, &response_len));
+    route_image_close(&image);
+}
+
+void test_repeated_keys_keep_last(void) {
+    RouteImageEntry list[] = {
+        {"dup", 3, "https://first.example.com", 25},
+        {"other", 5, "https://other.example.com", 25},
+        {"dup", 3, "https://last.example.com", 24},
+    };
+    TEST_ASSERT_EQUAL_INT64(2, route_image_write(path, list, 3, NULL, 0));
+
+    RouteImage image;
+    TEST_ASSERT_EQUAL_INT(0, route_image_open(&image, path, 0));
+    size_t url_len, response_len;
+    const char *url = route_image_find(&image, "dup", 3, &url_len, &response_len);
+    TEST_ASSERT_NOT_NULL(url);
+    TEST_ASSERT_EQUAL_STRING("https://last.example.com", url);
+    route_image_close(&image);
+}
+
+void test_empty_image(void) {
+    TEST_ASSERT_EQUAL_INT64(0, route_image_write(path, NULL, 0, NULL, 0));
+
+    RouteImage image;
+    TEST_ASSERT_EQUAL_INT(0, route_image_open(&image, path, 1));
+    TEST_ASSERT_EQUAL_INT(0, route_image_verify(&image));
+    size_t url_len, response_len;
+    TEST_ASSERT_NULL(route_image_find(&image, "google", 6, &url_len, &response_len));
+    route_image_close(&image);
+}
+
+void test_hosts_section(void) {
+    static const char hosts[] = "go.example.com\0links.example.com";
+    RouteImageEntry list[] = {{"go.example.com\0docs", 19, "https://go.example.com/docs", 27}};
+    TEST_ASSERT_EQUAL_INT64(1, route_image_write(path, list, 1, hosts, sizeof(hosts)));
+
+    RouteImage image;
+    TEST_ASSERT_EQUAL_INT(0, route_image_open(&image, path, 0));
+    TEST_ASSERT_EQUAL_UINT64(sizeof(hosts), image.header->hosts_size);
+    TEST_ASSERT_EQUAL_MEMORY(hosts, image.map + image.header->hosts, sizeof(hosts));
+    size_t url_len, response_len;
+    TEST_ASSERT_NOT_NULL(route_image_find(&image, "go.example.com\0docs", 19, &url_len, &response_len));
+    TEST_ASSERT_NULL(route_image_find(&image, "docs", 4, &url_len, &response_len));
+    route_image_close(&image);
+}
+
+/* Patches one byte of the file at offset. */
+static void poke(long offset, unsigned char value) {
+    FILE *f = fopen(path, "r+");
+    TEST_ASSERT_NOT_NULL(f);
+    TEST_ASSERT_EQUAL_INT(0, fseek(f, offset, SEEK_SET));
+    TEST_ASSERT_EQUAL_INT(1, (int)fwrite(&value, 1, 1, f));
+    fclose(f);
+}
+
+void test_rejects_bad_files(void) {
+    RouteImage image;
+    TEST_ASSERT_EQUAL_INT(-1, route_image_open(&image, "/tmp/yathr_nonexistent.img", 0));
+
+    /* Not an image */
+    FILE *f = fopen(path, "w");
+    TEST_ASSERT_NOT_NULL(f);
+    for (int i = 0; i < 8192; i++) {
+        fputc('x', f);
+    }
+    fclose(f);
+    TEST_ASSERT_EQUAL_INT(-1, route_image_open(&image, path, 0));
+
+    size_t count = make_entries(100);
+    TEST_ASSERT_EQUAL_INT64(100, route_image_write(path, entries, count, NULL, 0));
+    TEST_ASSERT_EQUAL_INT(0, route_image_open(&image, path, 0));
+    route_image_close(&image);
+
+    /* A header field changed: the header checksum no longer matches */
+    poke(offsetof(RouteImageHeader, count), 0x7f);
+    TEST_ASSERT_EQUAL_INT(-1, route_image_open(&image, path, 0));
+
+    /* A truncated file */
+    TEST_ASSERT_EQUAL_INT64(100, route_image_write(path, entries, count, NULL, 0));
+    TEST_ASSERT_EQUAL_INT(0, truncate(path, ROUTE_IMAGE_PAGE * 2));
+    TEST_ASSERT_EQUAL_INT(-1, route_image_open(&image, path, 0));
+
+    /* A body byte changed: opens, but fails verification */
+    TEST_ASSERT_EQUAL_INT64(100, route_image_write(path, entries, count, NULL, 0));
+    TEST_ASSERT_EQUAL_INT(0, route_image_open(&image, path, 0));
+    long heap = (long)image.header->heap;
+    route_image_close(&image);
+    poke(heap + 20, 'X');
+    TEST_ASSERT_EQUAL_INT(0, route_image_open(&image, path, 0));
+    TEST_ASSERT_EQUAL_INT(-1, route_image_verify(&image));
+    route_image_close(&image);
+}
+
+int main(void) {
+    keys = malloc(ROUTES * sizeof(*keys));
+    urls = malloc(ROUTES * sizeof(*urls));
+    entries = malloc(ROUTES * sizeof(*entries));
+
+    UNITY_BEGIN();
+
+    RUN_TEST(test_every_key_found);
+    RUN_TEST(test_misses);
+    RUN_TEST(test_repeated_keys_keep_last);
+    RUN_TEST(test_empty_image);
+    RUN_TEST(test_hosts_section);
+    RUN_TEST(test_rejects_bad_files);
+
+    int failures = UNITY_END();
+    free(keys);
+    free(urls);
+    free(entries);
+    return failures;
+}
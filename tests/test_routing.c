@@ -2,19 +2,45 @@
  * Unit tests for routing.c
  *
  * Covers: default entries, unknown/null keys, add_redirect (new entry,
- * update, null args, boundary insertions, capacity growth), and
- * cleanup/reinitialize behaviour.
+ * update, null args, boundary insertions, capacity and index growth),
+ * cleanup/reinitialize behaviour, prebuilt responses from find_route,
+ * the negative lookup filter, the cdb-backed route database and
+ * snapshot reloads (bulk loads with duplicate keys and their count,
+ * files split into chunks, pieces with no routes, and one under
+ * concurrent readers), staged lookups with
+ * prefetching, per-host namespaces, compiled route images, the
+ * sorted index, prefix rules and the per-thread route cache.
  */
 
 #include "unity/unity.h"
 #include "../routing.h"
+#include "../utils/cdb.h"
+#include "../utils/metrics.h"
+#include "../utils/qsbr.h"
+#include "../utils/response.h"
+#include "../utils/route_image.h"
+#include "../utils/routes_file.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+
+/* The last warning logged, from logs_stub.c */
+extern char logs_stub_warning[];
 
 /* Reset global routing state before and after every test. */
 void setUp(void)    { cleanup_routing(); }
-void tearDown(void) { cleanup_routing(); }
+void tearDown(void) {
+    cleanup_routing();
+    route_cache_release();
+    configure_route_cache(1024);
+    configure_route_filter(10);
+    configure_route_index(ROUTE_INDEX_HASH);
+}
 
 /* ------------------------------------------------------------------ */
 /* find_redirect – default entries                                     */
@@ -61,12 +87,46 @@ void test_find_redirect_null_key_returns_null(void) {
     TEST_ASSERT_NULL(find_redirect(NULL));
 }
 
-/* Empty string is not NULL – binary search should miss every key and
+/* Empty string is not NULL – the lookup should miss every key and
    return NULL rather than crash. */
 void test_find_redirect_empty_string_returns_null(void) {
     TEST_ASSERT_NULL(find_redirect(""));
 }
 
+/* ------------------------------------------------------------------ */
+/* find_route – length-aware lookup and prebuilt responses             */
+/* ------------------------------------------------------------------ */
+
+void test_find_route_returns_prebuilt_response(void) {
+    static const char expected[] =
+        "HTTP/1.1 302 Found\r\nLocation: https://www.google.com\r\nContent-Length: 0\r\n\r\n";
+    Route route;
+    TEST_ASSERT_EQUAL_INT(1, find_route(NULL, 0, "google", 6, &route));
+    TEST_ASSERT_EQUAL_STRING("https://www.google.com", route.url);
+    TEST_ASSERT_EQUAL_size_t(22, route.url_len);
+    TEST_ASSERT_EQUAL_size_t(sizeof(expected) - 1, route.response_len);
+    TEST_ASSERT_EQUAL_MEMORY(expected, route.response, route.response_len);
+}
+
+void test_find_route_key_is_a_slice(void) {
+    /* The key need not be NUL-terminated: only key_len bytes count. */
+    Route route;
+    TEST_ASSERT_EQUAL_INT(1, find_route(NULL, 0, "google HTTP/1.1", 6, &route));
+    TEST_ASSERT_EQUAL_STRING("https://www.google.com", route.url);
+    TEST_ASSERT_EQUAL_INT(0, find_route(NULL, 0, "google", 5, &route));
+    TEST_ASSERT_EQUAL_INT(0, find_route(NULL, 0, "google", 0, &route));
+}
+
+void test_find_route_response_follows_update(void) {
+    static const char expected[] =
+        "HTTP/1.1 302 Found\r\nLocation: https://search.example.com\r\nContent-Length: 0\r\n\r\n";
+    Route route;
+    TEST_ASSERT_EQUAL_INT(1, add_redirect("google", "https://search.example.com"));
+    TEST_ASSERT_EQUAL_INT(1, find_route(NULL, 0, "google", 6, &route));
+    TEST_ASSERT_EQUAL_size_t(sizeof(expected) - 1, route.response_len);
+    TEST_ASSERT_EQUAL_MEMORY(expected, route.response, route.response_len);
+}
+
 /* ------------------------------------------------------------------ */
 /* add_redirect – basic behaviour                                      */
 /* ------------------------------------------------------------------ */
@@ -142,6 +202,26 @@ void test_add_redirect_beyond_initial_capacity(void) {
     TEST_ASSERT_EQUAL_STRING("https://www.youtube.com", find_redirect("youtube"));
 }
 
+/* Many inserts force repeated index rebuilds; every key, including ones
+   longer than a hash word and ones sharing long prefixes, must stay
+   reachable and misses must still terminate. */
+void test_add_redirect_many_keys(void) {
+    char key[64], url[64];
+    for (int i = 0; i < 50000; i++) {
+        snprintf(key, sizeof(key), "campaign/2024/spring/item-%d", i);
+        snprintf(url, sizeof(url), "https://shop.example.com/%d", i);
+        TEST_ASSERT_EQUAL_INT(1, add_redirect(key, url));
+    }
+    for (int i = 0; i < 50000; i++) {
+        snprintf(key, sizeof(key), "campaign/2024/spring/item-%d", i);
+        snprintf(url, sizeof(url), "https://shop.example.com/%d", i);
+        TEST_ASSERT_EQUAL_STRING(url, find_redirect(key));
+    }
+    TEST_ASSERT_NULL(find_redirect("campaign/2024/spring/item-50000"));
+    TEST_ASSERT_NULL(find_redirect("campaign/2024/spring/item-"));
+    TEST_ASSERT_EQUAL_STRING("https://www.google.com", find_redirect("google"));
+}
+
 /* ------------------------------------------------------------------ */
 /* cleanup_routing                                                     */
 /* ------------------------------------------------------------------ */
@@ -164,6 +244,953 @@ void test_cleanup_then_reinitialize_restores_defaults(void) {
     TEST_ASSERT_EQUAL_STRING("https://www.youtube.com", find_redirect("youtube"));
 }
 
+/* ------------------------------------------------------------------ */
+/* open_route_database                                                 */
+/* ------------------------------------------------------------------ */
+
+/* Writes a cdb the way yathr-mkdb does: the URL NUL-terminated, then its
+ * response. "legacy" holds the URL alone, as older databases do. */
+static void write_route_database(const char *path, int count) {
+    FILE *f = fopen(path, "w+");
+    TEST_ASSERT_NOT_NULL(f);
+    CdbWriter writer;
+    TEST_ASSERT_EQUAL_INT(0, cdb_writer_start(&writer, f));
+    char key[32], value[256];
+    for (int i = 0; i < count; i++) {
+        snprintf(key, sizeof(key), "link%05d", i);
+        int url_len = snprintf(value, sizeof(value), "https://example.com/%d", i);
+        size_t response_len = format_redirect_response(value + url_len + 1, value, url_len);
+        TEST_ASSERT_EQUAL_INT(0, cdb_writer_add(&writer, key, strlen(key), value, url_len + 1 + response_len));
+    }
+    TEST_ASSERT_EQUAL_INT(0, cdb_writer_add(&writer, "google", 6, "https://cdb.example.com", 24));
+    TEST_ASSERT_EQUAL_INT(0, cdb_writer_add(&writer, "legacy", 6, "https://legacy.example.com", 27));
+    TEST_ASSERT_EQUAL_INT(0, cdb_writer_finish(&writer));
+    fclose(f);
+}
+
+void test_route_database_serves_file_routes(void) {
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/test_routing_%d.cdb", getpid());
+    write_route_database(path, 5000);
+
+    TEST_ASSERT_EQUAL_INT(0, open_route_database(path));
+    TEST_ASSERT_EQUAL_STRING("https://example.com/0",    find_redirect("link00000"));
+    TEST_ASSERT_EQUAL_STRING("https://example.com/4999", find_redirect("link04999"));
+    TEST_ASSERT_NULL(find_redirect("link05000"));
+    /* In-memory entries take precedence over the file. */
+    TEST_ASSERT_EQUAL_STRING("https://www.google.com", find_redirect("google"));
+    remove(path);
+}
+
+void test_route_database_prebuilt_and_legacy_values(void) {
+    static const char expected[] =
+        "HTTP/1.1 302 Found\r\nLocation: https://example.com/7\r\nContent-Length: 0\r\n\r\n";
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/test_routing_%d.cdb", getpid());
+    write_route_database(path, 10);
+
+    TEST_ASSERT_EQUAL_INT(0, open_route_database(path));
+    Route route;
+    TEST_ASSERT_EQUAL_INT(1, find_route(NULL, 0, "link00007", 9, &route));
+    TEST_ASSERT_EQUAL_STRING("https://example.com/7", route.url);
+    TEST_ASSERT_EQUAL_size_t(sizeof(expected) - 1, route.response_len);
+    TEST_ASSERT_EQUAL_MEMORY(expected, route.response, route.response_len);
+
+    /* A value holding only the URL is served without a response. */
+    TEST_ASSERT_EQUAL_INT(1, find_route(NULL, 0, "legacy", 6, &route));
+    TEST_ASSERT_EQUAL_STRING("https://legacy.example.com", route.url);
+    TEST_ASSERT_EQUAL_size_t(26, route.url_len);
+    TEST_ASSERT_NULL(route.response);
+    remove(path);
+}
+
+void test_route_database_closed_by_cleanup(void) {
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/test_routing_%d.cdb", getpid());
+    write_route_database(path, 10);
+
+    TEST_ASSERT_EQUAL_INT(0, open_route_database(path));
+    TEST_ASSERT_NOT_NULL(find_redirect("link00001"));
+    cleanup_routing();
+    TEST_ASSERT_NULL(find_redirect("link00001"));
+    remove(path);
+}
+
+void test_route_database_missing_file_fails(void) {
+    TEST_ASSERT_EQUAL_INT(-1, open_route_database("/tmp/yathr_nonexistent_routes.cdb"));
+}
+
+/* ------------------------------------------------------------------ */
+/* Route filter                                                        */
+/* ------------------------------------------------------------------ */
+
+void test_filter_rejects_unknown_keys(void) {
+    init_routing();
+    uint64_t rejected = metrics_total(METRIC_FILTER_REJECTED);
+    uint64_t passed = metrics_total(METRIC_FILTER_FALSE_POSITIVES);
+    char key[32];
+    for (int i = 0; i < 10000; i++) {
+        snprintf(key, sizeof(key), "scanner/%d.php", i);
+        TEST_ASSERT_NULL(find_redirect(key));
+    }
+    /* Every miss is counted once, and at 10 bits per key nearly all of
+     * them stop at the filter. */
+    uint64_t new_rejected = metrics_total(METRIC_FILTER_REJECTED) - rejected;
+    uint64_t new_passed = metrics_total(METRIC_FILTER_FALSE_POSITIVES) - passed;
+    TEST_ASSERT_EQUAL_UINT64(10000, new_rejected + new_passed);
+    TEST_ASSERT_TRUE(new_passed < 300);
+}
+
+void test_filter_keeps_added_and_database_keys(void) {
+    char path[64], key[32];
+    snprintf(path, sizeof(path), "/tmp/test_routing_%d.cdb", getpid());
+    write_route_database(path, 3000);
+    TEST_ASSERT_EQUAL_INT(0, open_route_database(path));
+
+    /* Growing well past the size the filter was built for rebuilds it. */
+    for (int i = 0; i < 5000; i++) {
+        snprintf(key, sizeof(key), "added%d", i);
+        TEST_ASSERT_EQUAL_INT(1, add_redirect(key, "https://example.com/added"));
+    }
+    for (int i = 0; i < 5000; i++) {
+        snprintf(key, sizeof(key), "added%d", i);
+        TEST_ASSERT_NOT_NULL(find_redirect(key));
+    }
+    for (int i = 0; i < 3000; i++) {
+        snprintf(key, sizeof(key), "link%05d", i);
+        TEST_ASSERT_NOT_NULL(find_redirect(key));
+    }
+    TEST_ASSERT_EQUAL_STRING("https://legacy.example.com", find_redirect("legacy"));
+    remove(path);
+}
+
+void test_filter_false_positive_rate(void) {
+    char key[32];
+    for (int i = 0; i < 20000; i++) {
+        snprintf(key, sizeof(key), "key%d", i);
+        TEST_ASSERT_EQUAL_INT(1, add_redirect(key, "https://example.com"));
+    }
+    uint64_t passed = metrics_total(METRIC_FILTER_FALSE_POSITIVES);
+    for (int i = 0; i < 100000; i++) {
+        snprintf(key, sizeof(key), "missing%d", i);
+        TEST_ASSERT_NULL(find_redirect(key));
+    }
+    /* About 1% at 10 bits per key; allow twice that. */
+    TEST_ASSERT_TRUE(metrics_total(METRIC_FILTER_FALSE_POSITIVES) - passed < 2000);
+}
+
+void test_filter_disabled(void) {
+    configure_route_filter(0);
+    init_routing();
+    uint64_t rejected = metrics_total(METRIC_FILTER_REJECTED);
+    TEST_ASSERT_NULL(find_redirect("nonexistent"));
+    TEST_ASSERT_EQUAL_STRING("https://www.google.com", find_redirect("google"));
+    TEST_ASSERT_EQUAL_UINT64(rejected, metrics_total(METRIC_FILTER_REJECTED));
+}
+
+/* ------------------------------------------------------------------ */
+/* reload_routing                                                      */
+/* ------------------------------------------------------------------ */
+
+static void write_routes_file(const char *path, const char *contents) {
+    FILE *f = fopen(path, "w");
+    TEST_ASSERT_NOT_NULL(f);
+    fputs(contents, f);
+    fclose(f);
+}
+
+void test_reload_routing_replaces_table(void) {
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/test_routing_%d.tsv", getpid());
+    write_routes_file(path, "# comment\n/docs\thttps://docs.example.com\r\n"
+                            "google,https://override.example.com\nmalformed\n");
+
+    add_redirect("temporary", "https://temporary.example.com");
+    TEST_ASSERT_EQUAL_INT(0, reload_routing(path, NULL, NULL));
+    TEST_ASSERT_EQUAL_STRING("https://docs.example.com", find_redirect("docs"));
+    /* File routes override the defaults; entries added before are gone. */
+    TEST_ASSERT_EQUAL_STRING("https://override.example.com", find_redirect("google"));
+    TEST_ASSERT_EQUAL_STRING("https://www.bing.com", find_redirect("bing"));
+    TEST_ASSERT_NULL(find_redirect("temporary"));
+    remove(path);
+}
+
+void test_reload_routing_duplicate_keys_keep_last(void) {
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/test_routing_%d.tsv", getpid());
+    write_routes_file(path, "dup\thttps://first.example.com\n"
+                            "other\thttps://other.example.com\n"
+                            "dup\thttps://last.example.com\n"
+                            "bing\thttps://bing.example.com\n");
+
+    TEST_ASSERT_EQUAL_INT(0, reload_routing(path, NULL, NULL));
+    Route route;
+    TEST_ASSERT_EQUAL_INT(1, find_route(NULL, 0, "dup", 3, &route));
+    TEST_ASSERT_EQUAL_STRING("https://last.example.com", route.url);
+    TEST_ASSERT_EQUAL_size_t(redirect_response_size(route.url_len), route.response_len);
+    TEST_ASSERT_EQUAL_STRING("https://other.example.com", find_redirect("other"));
+    TEST_ASSERT_EQUAL_STRING("https://bing.example.com", find_redirect("bing"));
+    /* The first dup and the default bing were overridden. */
+    TEST_ASSERT_NOT_NULL(strstr(logs_stub_warning, "2 routes"));
+    /* The table stays writable after a bulk load. */
+    TEST_ASSERT_EQUAL_INT(1, add_redirect("dup", "https://added.example.com"));
+    TEST_ASSERT_EQUAL_STRING("https://added.example.com", find_redirect("dup"));
+    remove(path);
+}
+
+void test_reload_routing_bulk_file(void) {
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/test_routing_%d.tsv", getpid());
+    FILE *f = fopen(path, "w");
+    TEST_ASSERT_NOT_NULL(f);
+    for (int i = 0; i < 50000; i++) {
+        fprintf(f, "bulk%d\thttps://example.com/%d\n", i, i);
+    }
+    fclose(f);
+
+    TEST_ASSERT_EQUAL_INT(0, reload_routing(path, NULL, NULL));
+    for (int i = 0; i < 50000; i += 997) {
+        char key[32], url[64], expected[128];
+        snprintf(key, sizeof(key), "bulk%d", i);
+        snprintf(url, sizeof(url), "https://example.com/%d", i);
+        Route route;
+        TEST_ASSERT_EQUAL_INT(1, find_route(NULL, 0, key, strlen(key), &route));
+        TEST_ASSERT_EQUAL_STRING(url, route.url);
+        size_t len = format_redirect_response(expected, url, strlen(url));
+        TEST_ASSERT_EQUAL_size_t(len, route.response_len);
+        TEST_ASSERT_EQUAL_MEMORY(expected, route.response, len);
+    }
+    TEST_ASSERT_EQUAL_STRING("https://www.google.com", find_redirect("google"));
+    TEST_ASSERT_NULL(find_redirect("bulk50000"));
+    remove(path);
+}
+
+/* Keys repeated far apart land in different chunks; every repeat is
+ * counted once, wherever its earlier line was. */
+void test_reload_routing_counts_duplicates_across_chunks(void) {
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/test_routing_%d.tsv", getpid());
+    FILE *f = fopen(path, "w");
+    TEST_ASSERT_NOT_NULL(f);
+    for (int i = 0; i < 200000; i++) {
+        fprintf(f, "bulk%d\thttps://example.com/%d\n", i, i);
+        if (i % 1000 == 0) {
+            fprintf(f, "bulk%d\thttps://near.example.com/%d\n", i, i);
+        }
+    }
+    for (int i = 0; i < 1000; i++) {
+        fprintf(f, "bulk%d\thttps://late.example.com/%d\n", i * 7, i);
+    }
+    fclose(f);
+
+    logs_stub_warning[0] = '\0';
+    TEST_ASSERT_EQUAL_INT(0, reload_routing(path, NULL, NULL));
+    TEST_ASSERT_EQUAL_STRING("https://late.example.com/1", find_redirect("bulk7"));
+    TEST_ASSERT_EQUAL_STRING("https://near.example.com/1000", find_redirect("bulk1000"));
+    TEST_ASSERT_EQUAL_STRING("https://late.example.com/0", find_redirect("bulk0"));
+    char expected[64];
+    snprintf(expected, sizeof(expected), "Route reload: %d routes in %s", 200 + 1000, path);
+    TEST_ASSERT_EQUAL_STRING_LEN(expected, logs_stub_warning, strlen(expected));
+    remove(path);
+}
+
+/* Pieces with no routes are merged as nothing. */
+void test_reload_routing_comments_only(void) {
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/test_routing_%d.tsv", getpid());
+    FILE *f = fopen(path, "w");
+    TEST_ASSERT_NOT_NULL(f);
+    for (int i = 0; i < 100000; i++) {
+        fprintf(f, "# comment line %d\n\n", i);
+    }
+    fclose(f);
+
+    logs_stub_warning[0] = '\0';
+    TEST_ASSERT_EQUAL_INT(0, reload_routing(path, NULL, NULL));
+    TEST_ASSERT_EQUAL_STRING("https://www.google.com", find_redirect("google"));
+    TEST_ASSERT_EQUAL_STRING("", logs_stub_warning);
+    remove(path);
+}
+
+/* Records which lines each chunk saw; lines are "line<N>\t..." */
+typedef struct {
+    long first;
+    long last;
+    long count;
+    int ordered;
+} ChunkLog;
+
+static int log_chunk_route(void *ctx, const RouteLine *route) {
+    const char *key = route->key;
+    size_t key_len = route->key_len;
+    ChunkLog *log = ctx;
+    long n = strtol(key + 4, NULL, 10);
+    TEST_ASSERT_EQUAL_INT(0, strncmp(key, "line", 4));
+    TEST_ASSERT_TRUE(key_len > 4);
+    if (log->count > 0 && n != log->last + 1) {
+        log->ordered = 0;
+    }
+    if (log->count == 0) {
+        log->first = n;
+    }
+    log->last = n;
+    log->count++;
+    return 0;
+}
+
+void test_read_routes_file_chunked_covers_every_line_once(void) {
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/test_routing_%d.tsv", getpid());
+    FILE *f = fopen(path, "w");
+    TEST_ASSERT_NOT_NULL(f);
+    const long lines = 120000;  /* about 4 MiB: several chunks */
+    for (long i = 0; i < lines; i++) {
+        fprintf(f, "line%ld\thttps://example.com/a/fairly/long/path/%ld\n", i, i);
+    }
+    fprintf(f, "malformed\nline%ld\thttps://example.com/no-newline", lines);
+    fclose(f);
+
+    ChunkLog logs[8];
+    void *contexts[8];
+    memset(logs, 0, sizeof(logs));
+    for (int i = 0; i < 8; i++) {
+        logs[i].ordered = 1;
+        contexts[i] = &logs[i];
+    }
+    size_t skipped = 0;
+    long routes = read_routes_file_chunked(path, log_chunk_route, contexts, 4, &skipped);
+    remove(path);
+
+    TEST_ASSERT_EQUAL_size_t(1, skipped);
+    TEST_ASSERT_EQUAL_INT64(lines + 1, routes);
+    long expected = 0;
+    int used = 0;
+    for (int i = 0; i < 8; i++) {
+        if (logs[i].count == 0) {
+            continue;
+        }
+        used++;
+        TEST_ASSERT_TRUE(logs[i].ordered);
+        TEST_ASSERT_EQUAL_INT64(expected, logs[i].first);
+        expected = logs[i].last + 1;
+    }
+    TEST_ASSERT_EQUAL_INT(4, used);
+}
+
+void test_reload_routing_with_database(void) {
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/test_routing_%d.cdb", getpid());
+    write_route_database(path, 100);
+
+    TEST_ASSERT_EQUAL_INT(0, reload_routing(NULL, NULL, path));
+    TEST_ASSERT_EQUAL_STRING("https://example.com/99", find_redirect("link00099"));
+    TEST_ASSERT_EQUAL_INT(0, reload_routing(NULL, NULL, NULL));
+    TEST_ASSERT_NULL(find_redirect("link00099"));
+    remove(path);
+}
+
+void test_reload_routing_failure_keeps_table(void) {
+    add_redirect("kept", "https://kept.example.com");
+    TEST_ASSERT_EQUAL_INT(-1, reload_routing("/tmp/yathr_nonexistent_routes.tsv", NULL, NULL));
+    TEST_ASSERT_EQUAL_INT(-1, reload_routing(NULL, NULL, "/tmp/yathr_nonexistent_routes.cdb"));
+    TEST_ASSERT_EQUAL_STRING("https://kept.example.com", find_redirect("kept"));
+}
+
+/* ------------------------------------------------------------------ */
+/* route_prefetch – staged lookups                                     */
+/* ------------------------------------------------------------------ */
+
+/* Steps a batch the way the event loop does and checks the lookups that
+ * follow still see every route, hit or miss. */
+void test_route_prefetch_batch(void) {
+    char keys[64][32];
+    RoutePrefetch prefetches[64];
+    for (int i = 0; i < 2000; i++) {
+        char key[32], url[64];
+        snprintf(key, sizeof(key), "batch%d", i);
+        snprintf(url, sizeof(url), "https://example.com/%d", i);
+        TEST_ASSERT_EQUAL_INT(1, add_redirect(key, url));
+    }
+    TEST_ASSERT_EQUAL_INT(1, add_host_redirect("go.example.com", "batch1", "https://go.example.com/1"));
+
+    for (int i = 0; i < 64; i++) {
+        /* Every other key is not routed */
+        snprintf(keys[i], sizeof(keys[i]), "batch%d", i % 2 ? i * 997 : i * 31 + 1);
+        route_prefetch_start(&prefetches[i], "go.example.com", 14, keys[i], strlen(keys[i]));
+    }
+    for (int steps = 0, pending = 64; pending > 0; steps++) {
+        TEST_ASSERT_TRUE(steps < 4);
+        int next = 0;
+        for (int i = 0; i < pending; i++) {
+            if (route_prefetch_step(&prefetches[i])) {
+                prefetches[next++] = prefetches[i];
+            }
+        }
+        pending = next;
+    }
+
+    for (int i = 0; i < 64; i++) {
+        int n = i % 2 ? i * 997 : i * 31 + 1;
+        char url[64];
+        snprintf(url, sizeof(url), n == 1 ? "https://go.example.com/%d" : "https://example.com/%d", n);
+        Route route;
+        TEST_ASSERT_EQUAL_INT(n < 2000, find_route("go.example.com", 14, keys[i], strlen(keys[i]), &route));
+        if (n < 2000) {
+            TEST_ASSERT_EQUAL_STRING(url, route.url);
+        }
+    }
+}
+
+/* ------------------------------------------------------------------ */
+/* Host namespaces                                                     */
+/* ------------------------------------------------------------------ */
+
+void test_parse_route_line_host_column(void) {
+    RouteLine route;
+    TEST_ASSERT_EQUAL_INT(1, parse_route_line("docs\thttps://docs.example.com", 30, &route));
+    TEST_ASSERT_NULL(route.host);
+    TEST_ASSERT_EQUAL_size_t(4, route.key_len);
+
+    static const char line[] = "go.example.com\tdocs\thttps://docs.example.com";
+    TEST_ASSERT_EQUAL_INT(1, parse_route_line(line, sizeof(line) - 1, &route));
+    TEST_ASSERT_EQUAL_MEMORY("go.example.com", route.host, route.host_len);
+    TEST_ASSERT_EQUAL_size_t(14, route.host_len);
+    TEST_ASSERT_EQUAL_MEMORY("docs", route.key, route.key_len);
+    TEST_ASSERT_EQUAL_size_t(24, route.url_len);
+}
+
+void test_normalize_host(void) {
+    static const char *cases[][2] = {
+        {"Go.Example.COM",      "go.example.com"},
+        {"go.example.com:8080", "go.example.com"},
+        {"go.example.com.",     "go.example.com"},
+        {"[::1]:8080",          "[::1]"},
+        {"localhost",           "localhost"},
+    };
+    char out[HOST_NAME_MAX_LEN];
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        long len = normalize_host(cases[i][0], strlen(cases[i][0]), out);
+        TEST_ASSERT_EQUAL_INT64((long)strlen(cases[i][1]), len);
+        TEST_ASSERT_EQUAL_MEMORY(cases[i][1], out, len);
+    }
+    TEST_ASSERT_EQUAL_INT64(-1, normalize_host(":8080", 5, out));
+    char long_host[300];
+    memset(long_host, 'a', sizeof(long_host));
+    TEST_ASSERT_EQUAL_INT64(-1, normalize_host(long_host, sizeof(long_host), out));
+}
+
+void test_host_routes_shadow_default_namespace(void) {
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/test_routing_%d.tsv", getpid());
+    write_routes_file(path, "docs\thttps://docs.example.com\n"
+                            "go.example.com\tdocs\thttps://go.example.com/docs\n"
+                            "Links.Example.com\tdocs\thttps://links.example.com/docs\n"
+                            "go.example.com\tgoogle\thttps://go.example.com/google\n");
+
+    TEST_ASSERT_EQUAL_INT(0, reload_routing(path, NULL, NULL));
+    Route route;
+    TEST_ASSERT_EQUAL_INT(1, find_route("go.example.com", 14, "docs", 4, &route));
+    TEST_ASSERT_EQUAL_STRING("https://go.example.com/docs", route.url);
+    /* Case, port and a trailing dot do not change the host. */
+    TEST_ASSERT_EQUAL_INT(1, find_route("LINKS.example.com.:8080", 23, "docs", 4, &route));
+    TEST_ASSERT_EQUAL_STRING("https://links.example.com/docs", route.url);
+    TEST_ASSERT_EQUAL_INT(1, find_route("go.example.com", 14, "google", 6, &route));
+    TEST_ASSERT_EQUAL_STRING("https://go.example.com/google", route.url);
+
+    /* Keys a host lacks, unknown hosts and no host at all fall back. */
+    TEST_ASSERT_EQUAL_INT(1, find_route("links.example.com", 17, "google", 6, &route));
+    TEST_ASSERT_EQUAL_STRING("https://www.google.com", route.url);
+    TEST_ASSERT_EQUAL_INT(1, find_route("other.example.com", 17, "docs", 4, &route));
+    TEST_ASSERT_EQUAL_STRING("https://docs.example.com", route.url);
+    TEST_ASSERT_EQUAL_STRING("https://docs.example.com", find_redirect("docs"));
+    TEST_ASSERT_EQUAL_INT(0, find_route("go.example.com", 14, "missing", 7, &route));
+    remove(path);
+}
+
+void test_host_routes_only_for_their_host(void) {
+    TEST_ASSERT_EQUAL_INT(1, add_host_redirect("Go.Example.com", "private", "https://private.example.com"));
+    Route route;
+    TEST_ASSERT_EQUAL_INT(1, find_route("go.example.com:80", 17, "private", 7, &route));
+    TEST_ASSERT_EQUAL_STRING("https://private.example.com", route.url);
+    TEST_ASSERT_EQUAL_INT(0, find_route("other.example.com", 17, "private", 7, &route));
+    TEST_ASSERT_NULL(find_redirect("private"));
+    TEST_ASSERT_EQUAL_INT(0, add_host_redirect("", "private", "https://private.example.com"));
+}
+
+/* Many hosts with the same keys: every host sees its own URL. */
+void test_host_namespaces_many_hosts(void) {
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/test_routing_%d.tsv", getpid());
+    FILE *f = fopen(path, "w");
+    TEST_ASSERT_NOT_NULL(f);
+    for (int h = 0; h < 300; h++) {
+        for (int k = 0; k < 20; k++) {
+            fprintf(f, "host%d.example.com\tkey%d\thttps://example.com/%d/%d\n", h, k, h, k);
+        }
+    }
+    fclose(f);
+
+    TEST_ASSERT_EQUAL_INT(0, reload_routing(path, NULL, NULL));
+    for (int h = 0; h < 300; h += 7) {
+        for (int k = 0; k < 20; k += 3) {
+            char host[64], key[32], url[64];
+            int host_len = snprintf(host, sizeof(host), "host%d.example.com", h);
+            snprintf(key, sizeof(key), "key%d", k);
+            snprintf(url, sizeof(url), "https://example.com/%d/%d", h, k);
+            Route route;
+            TEST_ASSERT_EQUAL_INT(1, find_route(host, host_len, key, strlen(key), &route));
+            TEST_ASSERT_EQUAL_STRING(url, route.url);
+        }
+    }
+    TEST_ASSERT_NULL(find_redirect("key0"));
+    remove(path);
+}
+
+/* A database the way yathr-mkdb writes host routes: "host\0key" keys and
+ * the host list under ROUTE_HOSTS_KEY. */
+void test_host_routes_from_database(void) {
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/test_routing_%d.cdb", getpid());
+    FILE *f = fopen(path, "w+");
+    TEST_ASSERT_NOT_NULL(f);
+    CdbWriter writer;
+    TEST_ASSERT_EQUAL_INT(0, cdb_writer_start(&writer, f));
+    TEST_ASSERT_EQUAL_INT(0, cdb_writer_add(&writer, "docs", 4, "https://docs.example.com", 25));
+    TEST_ASSERT_EQUAL_INT(0, cdb_writer_add(&writer, "go.example.com\0docs", 19, "https://go.example.com/docs", 28));
+    TEST_ASSERT_EQUAL_INT(0, cdb_writer_add(&writer, ROUTE_HOSTS_KEY, ROUTE_HOSTS_KEY_LEN, "go.example.com", 15));
+    TEST_ASSERT_EQUAL_INT(0, cdb_writer_finish(&writer));
+    fclose(f);
+
+    uint64_t passed = metrics_total(METRIC_FILTER_FALSE_POSITIVES);
+    TEST_ASSERT_EQUAL_INT(0, reload_routing(NULL, NULL, path));
+    Route route;
+    TEST_ASSERT_EQUAL_INT(1, find_route("Go.example.com", 14, "docs", 4, &route));
+    TEST_ASSERT_EQUAL_STRING("https://go.example.com/docs", route.url);
+    TEST_ASSERT_EQUAL_INT(1, find_route("other.example.com", 17, "docs", 4, &route));
+    TEST_ASSERT_EQUAL_STRING("https://docs.example.com", route.url);
+    /* The filter holds host keys under their namespace, not as written. */
+    TEST_ASSERT_EQUAL_UINT64(passed, metrics_total(METRIC_FILTER_FALSE_POSITIVES));
+    TEST_ASSERT_EQUAL_INT(0, find_route(NULL, 0, "go.example.com", 14, &route));
+    remove(path);
+}
+
+/* ------------------------------------------------------------------ */
+/* route images                                                        */
+/* ------------------------------------------------------------------ */
+
+/* An image the way yathr-compile writes it: "link%05d" keys, one host
+ * route keyed "host\0key", and the hosts section. */
+static void write_route_image(const char *path, int count) {
+    static const char hosts[] = "go.example.com";
+    char (*keys)[16] = malloc(count * sizeof(*keys));
+    char (*urls)[48] = malloc(count * sizeof(*urls));
+    RouteImageEntry *entries = malloc((count + 3) * sizeof(RouteImageEntry));
+    TEST_ASSERT_NOT_NULL(entries);
+    for (int i = 0; i < count; i++) {
+        int key_len = snprintf(keys[i], sizeof(keys[i]), "link%05d", i);
+        int url_len = snprintf(urls[i], sizeof(urls[i]), "https://image.example.com/%d", i);
+        entries[i] = (RouteImageEntry){keys[i], key_len, urls[i], url_len};
+    }
+    entries[count] = (RouteImageEntry){"docs", 4, "https://docs.example.com", 24};
+    entries[count + 1] = (RouteImageEntry){"go.example.com\0docs", 19, "https://go.example.com/docs", 27};
+    entries[count + 2] = (RouteImageEntry){"shared", 6, "https://image.example.com/shared", 32};
+    TEST_ASSERT_EQUAL_INT64(count + 3, route_image_write(path, entries, count + 3, hosts, sizeof(hosts)));
+    free(keys);
+    free(urls);
+    free(entries);
+}
+
+void test_route_image_serves_routes(void) {
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/test_routing_%d.img", getpid());
+    write_route_image(path, 5000);
+
+    TEST_ASSERT_EQUAL_INT(0, reload_routing(NULL, path, NULL));
+    TEST_ASSERT_EQUAL_STRING("https://image.example.com/0",    find_redirect("link00000"));
+    TEST_ASSERT_EQUAL_STRING("https://image.example.com/4999", find_redirect("link04999"));
+    TEST_ASSERT_NULL(find_redirect("link05000"));
+
+    static const char expected[] =
+        "HTTP/1.1 302 Found\r\nLocation: https://image.example.com/7\r\nContent-Length: 0\r\n\r\n";
+    Route route;
+    TEST_ASSERT_EQUAL_INT(1, find_route(NULL, 0, "link00007", 9, &route));
+    TEST_ASSERT_EQUAL_size_t(sizeof(expected) - 1, route.response_len);
+    TEST_ASSERT_EQUAL_MEMORY(expected, route.response, route.response_len);
+
+    /* Host routes come from the image's own hosts section. */
+    TEST_ASSERT_EQUAL_INT(1, find_route("Go.Example.com:8080", 19, "docs", 4, &route));
+    TEST_ASSERT_EQUAL_STRING("https://go.example.com/docs", route.url);
+    TEST_ASSERT_EQUAL_INT(1, find_route("other.example.com", 17, "docs", 4, &route));
+    TEST_ASSERT_EQUAL_STRING("https://docs.example.com", route.url);
+    remove(path);
+}
+
+/* In-memory routes shadow the image, which shadows the database. */
+void test_route_image_precedence(void) {
+    char tsv[64], img[64], cdb[64];
+    snprintf(tsv, sizeof(tsv), "/tmp/test_routing_%d.tsv", getpid());
+    snprintf(img, sizeof(img), "/tmp/test_routing_%d.img", getpid());
+    snprintf(cdb, sizeof(cdb), "/tmp/test_routing_%d.cdb", getpid());
+    write_routes_file(tsv, "shared\thttps://memory.example.com/shared\n");
+    write_route_image(img, 100);
+    write_route_database(cdb, 200);
+
+    TEST_ASSERT_EQUAL_INT(0, reload_routing(tsv, img, cdb));
+    TEST_ASSERT_EQUAL_STRING("https://memory.example.com/shared", find_redirect("shared"));
+    TEST_ASSERT_EQUAL_STRING("https://image.example.com/99", find_redirect("link00099"));
+    TEST_ASSERT_EQUAL_STRING("https://example.com/150", find_redirect("link00150"));
+    remove(tsv);
+    remove(img);
+    remove(cdb);
+}
+
+/* The filter is built over the in-memory routes only; keys it turns away
+ * are still looked up in the image. */
+void test_route_image_not_hidden_by_filter(void) {
+    char tsv[64], img[64];
+    snprintf(tsv, sizeof(tsv), "/tmp/test_routing_%d.tsv", getpid());
+    snprintf(img, sizeof(img), "/tmp/test_routing_%d.img", getpid());
+    write_routes_file(tsv, "memory\thttps://memory.example.com\n");
+    write_route_image(img, 2000);
+
+    TEST_ASSERT_EQUAL_INT(0, reload_routing(tsv, img, NULL));
+    for (int i = 0; i < 2000; i++) {
+        char key[16];
+        snprintf(key, sizeof(key), "link%05d", i);
+        TEST_ASSERT_NOT_NULL(find_redirect(key));
+    }
+    remove(tsv);
+    remove(img);
+}
+
+void test_route_image_invalid_file_fails(void) {
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/test_routing_%d.tsv", getpid());
+    write_routes_file(path, "kept\thttps://kept.example.com\n");
+
+    TEST_ASSERT_EQUAL_INT(0, reload_routing(path, NULL, NULL));
+    TEST_ASSERT_EQUAL_INT(-1, reload_routing(NULL, path, NULL));
+    TEST_ASSERT_EQUAL_INT(-1, reload_routing(NULL, "/tmp/yathr_nonexistent_routes.img", NULL));
+    TEST_ASSERT_EQUAL_STRING("https://kept.example.com", find_redirect("kept"));
+    remove(path);
+}
+
+/* ------------------------------------------------------------------ */
+/* sorted index                                                        */
+/* ------------------------------------------------------------------ */
+
+/* Keys sharing their first 14 bytes are told apart past the inline
+ * prefix; host routes keep their own namespace. */
+void test_sorted_index_serves_routes(void) {
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/test_routing_%d.tsv", getpid());
+    FILE *f = fopen(path, "w");
+    TEST_ASSERT_NOT_NULL(f);
+    for (int i = 0; i < 3000; i++) {
+        fprintf(f, "campaign/2024/spring/item-%d\thttps://shop.example.com/%d\n", i, i);
+        fprintf(f, "k%d\thttps://short.example.com/%d\n", i, i);
+    }
+    fprintf(f, "k7\thttps://short.example.com/last\n");
+    fprintf(f, "go.example.com\tk7\thttps://go.example.com/k7\n");
+    fclose(f);
+
+    configure_route_index(ROUTE_INDEX_SORTED);
+    TEST_ASSERT_EQUAL_INT(0, reload_routing(path, NULL, NULL));
+    char key[64], url[64];
+    for (int i = 0; i < 3000; i++) {
+        snprintf(key, sizeof(key), "campaign/2024/spring/item-%d", i);
+        snprintf(url, sizeof(url), "https://shop.example.com/%d", i);
+        TEST_ASSERT_EQUAL_STRING(url, find_redirect(key));
+        if (i != 7) {
+            snprintf(key, sizeof(key), "k%d", i);
+            snprintf(url, sizeof(url), "https://short.example.com/%d", i);
+            TEST_ASSERT_EQUAL_STRING(url, find_redirect(key));
+        }
+    }
+    TEST_ASSERT_EQUAL_STRING("https://short.example.com/last", find_redirect("k7"));
+    TEST_ASSERT_EQUAL_STRING("https://www.google.com", find_redirect("google"));
+    Route route;
+    TEST_ASSERT_EQUAL_INT(1, find_route("go.example.com", 14, "k7", 2, &route));
+    TEST_ASSERT_EQUAL_STRING("https://go.example.com/k7", route.url);
+
+    TEST_ASSERT_NULL(find_redirect("campaign/2024/spring/item-3000"));
+    TEST_ASSERT_NULL(find_redirect("campaign/2024/spring/item-"));
+    TEST_ASSERT_NULL(find_redirect("campaign/2024/"));
+    TEST_ASSERT_NULL(find_redirect("k"));
+    TEST_ASSERT_NULL(find_redirect("zzz"));
+    TEST_ASSERT_NULL(find_redirect(""));
+    remove(path);
+}
+
+/* Keys added after the sorted index was built are found, before and
+ * after they are merged into it. */
+void test_sorted_index_add_redirect(void) {
+    configure_route_index(ROUTE_INDEX_SORTED);
+    char key[64], url[64];
+    for (int i = 0; i < 20000; i++) {
+        snprintf(key, sizeof(key), "campaign/2024/spring/item-%d", i);
+        snprintf(url, sizeof(url), "https://shop.example.com/%d", i);
+        TEST_ASSERT_EQUAL_INT(1, add_redirect(key, url));
+        if (i % 997 == 0) {
+            TEST_ASSERT_EQUAL_STRING(url, find_redirect(key));
+            TEST_ASSERT_EQUAL_STRING("https://shop.example.com/0", find_redirect("campaign/2024/spring/item-0"));
+        }
+    }
+    TEST_ASSERT_EQUAL_INT(1, add_redirect("campaign/2024/spring/item-5", "https://shop.example.com/five"));
+    for (int i = 0; i < 20000; i++) {
+        snprintf(key, sizeof(key), "campaign/2024/spring/item-%d", i);
+        snprintf(url, sizeof(url), "https://shop.example.com/%d", i);
+        TEST_ASSERT_EQUAL_STRING(i == 5 ? "https://shop.example.com/five" : url, find_redirect(key));
+    }
+    TEST_ASSERT_NULL(find_redirect("campaign/2024/spring/item-20000"));
+    TEST_ASSERT_EQUAL_STRING("https://www.google.com", find_redirect("google"));
+}
+
+/* ------------------------------------------------------------------ */
+/* prefix rules                                                        */
+/* ------------------------------------------------------------------ */
+
+void test_prefix_rules_longest_match(void) {
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/test_routing_%d.tsv", getpid());
+    write_routes_file(path, "docs/*\thttps://docs.example.com/*\n"
+                            "docs/api/*\thttps://api.example.com/reference\n"
+                            "docs/exact\thttps://exact.example.com\n"
+                            "go.example.com\tblog/*\thttps://go.example.com/posts/*\n");
+    TEST_ASSERT_EQUAL_INT(0, reload_routing(path, NULL, NULL));
+
+    /* Exact keys come first, with their prebuilt response. */
+    Route route;
+    TEST_ASSERT_EQUAL_INT(1, find_route(NULL, 0, "docs/exact", 10, &route));
+    TEST_ASSERT_EQUAL_STRING("https://exact.example.com", route.url);
+    TEST_ASSERT_NOT_NULL(route.response);
+    TEST_ASSERT_EQUAL(0, route.suffix_len);
+
+    /* Passthrough: the rest of the key follows the URL. */
+    TEST_ASSERT_EQUAL_INT(1, find_route(NULL, 0, "docs/guide/intro", 16, &route));
+    TEST_ASSERT_EQUAL_STRING("https://docs.example.com/", route.url);
+    TEST_ASSERT_NULL(route.response);
+    TEST_ASSERT_EQUAL(11, route.suffix_len);
+    TEST_ASSERT_EQUAL_MEMORY("guide/intro", route.suffix, 11);
+
+    /* The longer prefix wins; without passthrough the URL is used as is. */
+    TEST_ASSERT_EQUAL_INT(1, find_route(NULL, 0, "docs/api/v2", 11, &route));
+    TEST_ASSERT_EQUAL_STRING("https://api.example.com/reference", route.url);
+    TEST_ASSERT_EQUAL(0, route.suffix_len);
+    TEST_ASSERT_EQUAL_MEMORY(REDIRECT_HEADER "https://api.example.com/reference", route.response,
+                             sizeof(REDIRECT_HEADER) - 1 + 33);
+
+    /* Nothing left over: the prebuilt response of the bare URL. */
+    TEST_ASSERT_EQUAL_INT(1, find_route(NULL, 0, "docs/", 5, &route));
+    TEST_ASSERT_EQUAL_STRING("https://docs.example.com/", route.url);
+    TEST_ASSERT_NOT_NULL(route.response);
+    TEST_ASSERT_EQUAL(0, route.suffix_len);
+
+    /* A host's rules are its own; its other keys fall back. */
+    TEST_ASSERT_EQUAL_INT(1, find_route("go.example.com", 14, "blog/2024/hello", 15, &route));
+    TEST_ASSERT_EQUAL_STRING("https://go.example.com/posts/", route.url);
+    TEST_ASSERT_EQUAL_MEMORY("2024/hello", route.suffix, route.suffix_len);
+    TEST_ASSERT_EQUAL_INT(0, find_route(NULL, 0, "blog/2024/hello", 15, &route));
+    TEST_ASSERT_EQUAL_INT(1, find_route("go.example.com", 14, "docs/x", 6, &route));
+    TEST_ASSERT_EQUAL_STRING("https://docs.example.com/", route.url);
+
+    TEST_ASSERT_EQUAL_INT(0, find_route(NULL, 0, "doc", 3, &route));
+    TEST_ASSERT_EQUAL_STRING("https://www.google.com", find_redirect("google"));
+    remove(path);
+}
+
+/* Control characters would end the Location header early. */
+void test_prefix_rule_suffix_without_control_characters(void) {
+    TEST_ASSERT_EQUAL_INT(1, add_redirect("files/*", "https://files.example.com/*"));
+    Route route;
+    TEST_ASSERT_EQUAL_INT(0, find_route(NULL, 0, "files/a\rSet-Cookie: x", 21, &route));
+    TEST_ASSERT_EQUAL_INT(0, find_route(NULL, 0, "files/a\x7f", 8, &route));
+    TEST_ASSERT_EQUAL_INT(1, find_route(NULL, 0, "files/a%0D", 10, &route));
+}
+
+void test_add_redirect_prefix_rule(void) {
+    TEST_ASSERT_EQUAL_INT(1, add_redirect("files/*", "https://old.example.com/*"));
+    TEST_ASSERT_EQUAL_INT(1, add_redirect("files/*", "https://files.example.com/*"));
+    TEST_ASSERT_EQUAL_INT(1, add_redirect("files/readme", "https://readme.example.com"));
+    TEST_ASSERT_EQUAL_INT(1, add_host_redirect("go.example.com", "*", "https://go.example.com/"));
+
+    Route route;
+    TEST_ASSERT_EQUAL_INT(1, find_route(NULL, 0, "files/a.txt", 11, &route));
+    TEST_ASSERT_EQUAL_STRING("https://files.example.com/", route.url);
+    TEST_ASSERT_EQUAL_MEMORY("a.txt", route.suffix, route.suffix_len);
+    TEST_ASSERT_EQUAL_STRING("https://readme.example.com", find_redirect("files/readme"));
+    /* The rule key is the prefix: the wildcard itself is not a key. */
+    TEST_ASSERT_EQUAL_STRING("https://files.example.com/", find_redirect("files/"));
+
+    /* A host's catch-all takes its keys before the default namespace's. */
+    TEST_ASSERT_EQUAL_INT(1, find_route("go.example.com", 14, "google", 6, &route));
+    TEST_ASSERT_EQUAL_STRING("https://go.example.com/", route.url);
+    TEST_ASSERT_EQUAL_INT(1, find_route("go.example.com", 14, "files/a.txt", 11, &route));
+    TEST_ASSERT_EQUAL_STRING("https://go.example.com/", route.url);
+    TEST_ASSERT_EQUAL_STRING("https://www.google.com", find_redirect("google"));
+}
+
+/* Rules from every chunk of a large file, later ones overriding. */
+void test_prefix_rules_bulk_file(void) {
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/test_routing_%d.tsv", getpid());
+    FILE *f = fopen(path, "w");
+    TEST_ASSERT_NOT_NULL(f);
+    for (int i = 0; i < 200000; i++) {
+        fprintf(f, "route-%d\thttps://bulk.example.com/%d\n", i, i);
+        if (i % 50000 == 0) {
+            fprintf(f, "section-%d/*\thttps://section.example.com/%d/*\n", i, i);
+            fprintf(f, "shared/*\thttps://shared.example.com/%d/\n", i);
+        }
+    }
+    fclose(f);
+
+    TEST_ASSERT_EQUAL_INT(0, reload_routing(path, NULL, NULL));
+    TEST_ASSERT_EQUAL_STRING("https://bulk.example.com/123456", find_redirect("route-123456"));
+    Route route;
+    for (int i = 0; i < 200000; i += 50000) {
+        char key[64], url[64];
+        snprintf(key, sizeof(key), "section-%d/page", i);
+        snprintf(url, sizeof(url), "https://section.example.com/%d/", i);
+        TEST_ASSERT_EQUAL_INT(1, find_route(NULL, 0, key, strlen(key), &route));
+        TEST_ASSERT_EQUAL_STRING(url, route.url);
+        TEST_ASSERT_EQUAL_MEMORY("page", route.suffix, route.suffix_len);
+    }
+    TEST_ASSERT_EQUAL_STRING("https://shared.example.com/150000/", find_redirect("shared/anything"));
+    TEST_ASSERT_NOT_NULL(strstr(logs_stub_warning, "3 routes"));
+    remove(path);
+}
+
+/* ------------------------------------------------------------------ */
+/* route cache                                                         */
+/* ------------------------------------------------------------------ */
+
+void test_route_cache_serves_repeated_lookups(void) {
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/test_routing_%d.img", getpid());
+    write_route_image(path, 100);
+    TEST_ASSERT_EQUAL_INT(0, route_cache_register());
+    TEST_ASSERT_EQUAL_INT(0, reload_routing(NULL, path, NULL));
+
+    uint64_t hits = metrics_total(METRIC_ROUTE_CACHE_HITS);
+    uint64_t misses = metrics_total(METRIC_ROUTE_CACHE_MISSES);
+    Route first, again;
+    TEST_ASSERT_EQUAL_INT(1, find_route(NULL, 0, "link00007", 9, &first));
+    TEST_ASSERT_EQUAL_INT(1, find_route(NULL, 0, "link00007", 9, &again));
+    TEST_ASSERT_EQUAL_UINT64(hits + 1, metrics_total(METRIC_ROUTE_CACHE_HITS));
+    TEST_ASSERT_EQUAL_UINT64(misses + 1, metrics_total(METRIC_ROUTE_CACHE_MISSES));
+    TEST_ASSERT_EQUAL_STRING("https://image.example.com/7", again.url);
+    TEST_ASSERT_EQUAL_PTR(first.response, again.response);
+    TEST_ASSERT_EQUAL_size_t(first.response_len, again.response_len);
+
+    /* Namespaces are cached apart, and misses are not cached. */
+    TEST_ASSERT_EQUAL_INT(1, find_route("go.example.com", 14, "docs", 4, &again));
+    TEST_ASSERT_EQUAL_STRING("https://go.example.com/docs", again.url);
+    TEST_ASSERT_EQUAL_INT(1, find_route(NULL, 0, "docs", 4, &again));
+    TEST_ASSERT_EQUAL_STRING("https://docs.example.com", again.url);
+    TEST_ASSERT_EQUAL_INT(0, find_route(NULL, 0, "link00100", 9, &again));
+    TEST_ASSERT_EQUAL_INT(0, find_route(NULL, 0, "link00100", 9, &again));
+
+    /* In-memory routes are not cached. */
+    hits = metrics_total(METRIC_ROUTE_CACHE_HITS);
+    TEST_ASSERT_EQUAL_STRING("https://www.google.com", find_redirect("google"));
+    TEST_ASSERT_EQUAL_STRING("https://www.google.com", find_redirect("google"));
+    TEST_ASSERT_EQUAL_UINT64(hits, metrics_total(METRIC_ROUTE_CACHE_HITS));
+    remove(path);
+}
+
+/* Cached routes never outlive the table they came from, nor hide a
+ * change made to it. */
+void test_route_cache_invalidated_by_changes(void) {
+    char tsv[64], cdb[64];
+    snprintf(tsv, sizeof(tsv), "/tmp/test_routing_%d.tsv", getpid());
+    snprintf(cdb, sizeof(cdb), "/tmp/test_routing_%d.cdb", getpid());
+    write_route_database(cdb, 10);
+    TEST_ASSERT_EQUAL_INT(0, route_cache_register());
+    TEST_ASSERT_EQUAL_INT(0, reload_routing(NULL, NULL, cdb));
+    TEST_ASSERT_EQUAL_STRING("https://example.com/7", find_redirect("link00007"));
+    TEST_ASSERT_EQUAL_STRING("https://example.com/7", find_redirect("link00007"));
+
+    /* A reload to a table that shadows the key */
+    write_routes_file(tsv, "link00007\thttps://reloaded.example.com\n");
+    TEST_ASSERT_EQUAL_INT(0, reload_routing(tsv, NULL, cdb));
+    TEST_ASSERT_EQUAL_STRING("https://reloaded.example.com", find_redirect("link00007"));
+
+    /* A route added in place */
+    TEST_ASSERT_EQUAL_STRING("https://example.com/3", find_redirect("link00003"));
+    TEST_ASSERT_EQUAL_INT(1, add_redirect("link00003", "https://added.example.com"));
+    TEST_ASSERT_EQUAL_STRING("https://added.example.com", find_redirect("link00003"));
+
+    /* The database going away */
+    TEST_ASSERT_EQUAL_STRING("https://example.com/5", find_redirect("link00005"));
+    close_route_database();
+    TEST_ASSERT_NULL(find_redirect("link00005"));
+    remove(tsv);
+    remove(cdb);
+}
+
+void test_route_cache_disabled(void) {
+    configure_route_cache(0);
+    TEST_ASSERT_EQUAL_INT(0, route_cache_register());
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/test_routing_%d.cdb", getpid());
+    write_route_database(path, 10);
+    TEST_ASSERT_EQUAL_INT(0, reload_routing(NULL, NULL, path));
+    uint64_t misses = metrics_total(METRIC_ROUTE_CACHE_MISSES);
+    TEST_ASSERT_EQUAL_STRING("https://example.com/7", find_redirect("link00007"));
+    TEST_ASSERT_EQUAL_UINT64(misses, metrics_total(METRIC_ROUTE_CACHE_MISSES));
+    remove(path);
+}
+
+static atomic_int readers_stop;
+static atomic_long reader_misses;
+
+/* Looks routes up like an event loop: online while reading, offline between batches. */
+static void *route_reader(void *arg) {
+    (void)arg;
+    int id = qsbr_register();
+    while (!atomic_load(&readers_stop)) {
+        qsbr_online(id);
+        for (int i = 0; i < 1000; i++) {
+            const char *url = find_redirect("reloaded");
+            if (url == NULL || strncmp(url, "https://reload.example.com/", 27) != 0) {
+                atomic_fetch_add(&reader_misses, 1);
+            }
+        }
+        qsbr_offline(id);
+    }
+    return NULL;
+}
+
+void test_reload_routing_under_concurrent_readers(void) {
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/test_routing_%d.tsv", getpid());
+    write_routes_file(path, "reloaded\thttps://reload.example.com/0\n");
+    TEST_ASSERT_EQUAL_INT(0, reload_routing(path, NULL, NULL));
+
+    pthread_t threads[4];
+    atomic_store(&readers_stop, 0);
+    atomic_store(&reader_misses, 0);
+    for (int i = 0; i < 4; i++) {
+        TEST_ASSERT_EQUAL_INT(0, pthread_create(&threads[i], NULL, route_reader, NULL));
+    }
+
+    for (int round = 1; round <= 50; round++) {
+        char contents[128];
+        snprintf(contents, sizeof(contents), "reloaded\thttps://reload.example.com/%d\n", round);
+        write_routes_file(path, contents);
+        TEST_ASSERT_EQUAL_INT(0, reload_routing(path, NULL, NULL));
+    }
+
+    atomic_store(&readers_stop, 1);
+    for (int i = 0; i < 4; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    TEST_ASSERT_EQUAL_INT(0, (int)atomic_load(&reader_misses));
+    TEST_ASSERT_EQUAL_STRING("https://reload.example.com/50", find_redirect("reloaded"));
+    remove(path);
+}
+
 /* ------------------------------------------------------------------ */
 /* main                                                                */
 /* ------------------------------------------------------------------ */
@@ -177,6 +1204,10 @@ int main(void) {
     RUN_TEST(test_find_redirect_null_key_returns_null);
     RUN_TEST(test_find_redirect_empty_string_returns_null);
 
+    RUN_TEST(test_find_route_returns_prebuilt_response);
+    RUN_TEST(test_find_route_key_is_a_slice);
+    RUN_TEST(test_find_route_response_follows_update);
+
     RUN_TEST(test_add_redirect_new_key_is_findable);
     RUN_TEST(test_add_redirect_updates_existing_key);
     RUN_TEST(test_add_redirect_null_key_returns_zero);
@@ -186,9 +1217,56 @@ int main(void) {
     RUN_TEST(test_add_redirect_insert_after_last_default);
     RUN_TEST(test_add_redirect_insert_in_middle);
     RUN_TEST(test_add_redirect_beyond_initial_capacity);
+    RUN_TEST(test_add_redirect_many_keys);
 
     RUN_TEST(test_cleanup_removes_added_entries);
     RUN_TEST(test_cleanup_then_reinitialize_restores_defaults);
 
+    RUN_TEST(test_route_database_serves_file_routes);
+    RUN_TEST(test_route_database_prebuilt_and_legacy_values);
+    RUN_TEST(test_route_database_closed_by_cleanup);
+    RUN_TEST(test_route_database_missing_file_fails);
+
+    RUN_TEST(test_filter_rejects_unknown_keys);
+    RUN_TEST(test_filter_keeps_added_and_database_keys);
+    RUN_TEST(test_filter_false_positive_rate);
+    RUN_TEST(test_filter_disabled);
+
+    RUN_TEST(test_reload_routing_replaces_table);
+    RUN_TEST(test_reload_routing_duplicate_keys_keep_last);
+    RUN_TEST(test_reload_routing_counts_duplicates_across_chunks);
+    RUN_TEST(test_reload_routing_comments_only);
+    RUN_TEST(test_reload_routing_bulk_file);
+    RUN_TEST(test_read_routes_file_chunked_covers_every_line_once);
+    RUN_TEST(test_reload_routing_with_database);
+    RUN_TEST(test_reload_routing_failure_keeps_table);
+    RUN_TEST(test_reload_routing_under_concurrent_readers);
+
+    RUN_TEST(test_route_prefetch_batch);
+
+    RUN_TEST(test_parse_route_line_host_column);
+    RUN_TEST(test_normalize_host);
+    RUN_TEST(test_host_routes_shadow_default_namespace);
+    RUN_TEST(test_host_routes_only_for_their_host);
+    RUN_TEST(test_host_namespaces_many_hosts);
+    RUN_TEST(test_host_routes_from_database);
+
+    RUN_TEST(test_route_image_serves_routes);
+    RUN_TEST(test_route_image_precedence);
+    RUN_TEST(test_route_image_not_hidden_by_filter);
+    RUN_TEST(test_route_image_invalid_file_fails);
+
+    RUN_TEST(test_sorted_index_serves_routes);
+    RUN_TEST(test_sorted_index_add_redirect);
+
+    RUN_TEST(test_prefix_rules_longest_match);
+    RUN_TEST(test_prefix_rule_suffix_without_control_characters);
+    RUN_TEST(test_add_redirect_prefix_rule);
+    RUN_TEST(test_prefix_rules_bulk_file);
+
+    RUN_TEST(test_route_cache_serves_repeated_lookups);
+    RUN_TEST(test_route_cache_invalidated_by_changes);
+    RUN_TEST(test_route_cache_disabled);
+
     return UNITY_END();
 }
@@ -0,0 +1,148 @@
+/*
+ * Unit tests for utils/sorted_index.c
+ *
+ * Covers: prefixes ordering like their keys, lower bounds for present and
+ * absent keys, keys told apart only past the inline prefix, groups, the
+ * in-order walk, and empty indexes.
+ */
+
+#include "unity/unity.h"
+#include "../utils/sorted_index.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define KEYS 5000
+
+static char keys[KEYS][40];
+static SortedIndexItem items[KEYS];
+static SortedIndex sorted;
+
+typedef struct {
+    const char *key;
+    size_t key_len;
+} Probe;
+
+static int compare_key(const void *ctx, uint32_t value) {
+    const Probe *probe = ctx;
+    size_t len = strlen(keys[value]);
+    size_t common = len < probe->key_len ? len : probe->key_len;
+    int cmp = memcmp(keys[value], probe->key, common);
+    return cmp != 0 ? cmp : (len > probe->key_len) - (len < probe->key_len);
+}
+
+/* The position of key in group 0, or of the first key above it. */
+static size_t lower_bound(const char *key) {
+    Probe probe = {key, strlen(key)};
+    return sorted_index_lower_bound(&sorted, sorted_prefix(0, key, probe.key_len), compare_key, &probe);
+}
+
+/* Keys "<prefix><i * 2>" in shuffled order, each valued by its number. */
+static void build(const char *prefix, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        size_t j = (i * 7919) % count;
+        int len = snprintf(keys[j], sizeof(keys[j]), "%s%06zu", prefix, j * 2);
+        items[i] = (SortedIndexItem){sorted_prefix(0, keys[j], len), keys[j], (uint32_t)len, (uint32_t)j};
+    }
+    TEST_ASSERT_EQUAL_INT(0, sorted_index_build(&sorted, items, count));
+}
+
+void setUp(void) {}
+void tearDown(void) { sorted_index_free(&sorted); }
+
+void test_prefix_orders_like_keys(void) {
+    static const char *ordered[] = {"", "a", "a\x01", "ab", "abcdefghijklmn", "abcdefghijklmnop", "b", "\xff"};
+    size_t count = sizeof(ordered) / sizeof(ordered[0]);
+    for (size_t i = 0; i + 1 < count; i++) {
+        SortedPrefix a = sorted_prefix(0, ordered[i], strlen(ordered[i]));
+        SortedPrefix b = sorted_prefix(0, ordered[i + 1], strlen(ordered[i + 1]));
+        TEST_ASSERT_TRUE(a.hi < b.hi || (a.hi == b.hi && a.lo <= b.lo));
+    }
+    /* The group comes before any key byte. */
+    SortedPrefix low = sorted_prefix(1, "\xff\xff", 2);
+    SortedPrefix high = sorted_prefix(2, "", 0);
+    TEST_ASSERT_TRUE(low.hi < high.hi);
+}
+
+void test_lower_bound_present_and_absent(void) {
+    build("k", KEYS);
+    for (size_t i = 0; i < KEYS; i++) {
+        char key[40];
+        snprintf(key, sizeof(key), "k%06zu", i * 2);
+        size_t pos = lower_bound(key);
+        TEST_ASSERT_NOT_EQUAL(0, pos);
+        TEST_ASSERT_EQUAL_UINT32(i, sorted.values[pos]);
+
+        /* Between two keys: the next one up */
+        snprintf(key, sizeof(key), "k%06zu", i * 2 + 1);
+        pos = lower_bound(key);
+        if (i + 1 < KEYS) {
+            TEST_ASSERT_EQUAL_UINT32(i + 1, sorted.values[pos]);
+        } else {
+            TEST_ASSERT_EQUAL(0, pos);
+        }
+    }
+    TEST_ASSERT_EQUAL_UINT32(0, sorted.values[lower_bound("")]);
+    TEST_ASSERT_EQUAL(0, lower_bound("z"));
+}
+
+/* All keys share their first 20 bytes, so every comparison falls through
+ * to compare_key. */
+void test_keys_sharing_the_prefix(void) {
+    build("campaign/2024/spring-", KEYS);
+    for (size_t i = 0; i < KEYS; i += 3) {
+        char key[40];
+        snprintf(key, sizeof(key), "campaign/2024/spring-%06zu", i * 2);
+        size_t pos = lower_bound(key);
+        TEST_ASSERT_NOT_EQUAL(0, pos);
+        TEST_ASSERT_EQUAL_UINT32(i, sorted.values[pos]);
+    }
+    TEST_ASSERT_EQUAL_UINT32(0, sorted.values[lower_bound("campaign/2024/spring-")]);
+    TEST_ASSERT_EQUAL(0, lower_bound("campaign/2024/spring-999999"));
+}
+
+void test_walk_in_key_order(void) {
+    build("k", KEYS);
+    size_t pos = lower_bound("");
+    for (size_t i = 0; i < KEYS; i++) {
+        TEST_ASSERT_NOT_EQUAL(0, pos);
+        TEST_ASSERT_EQUAL_UINT32(i, sorted.values[pos]);
+        pos = sorted_index_next(&sorted, pos);
+    }
+    TEST_ASSERT_EQUAL(0, pos);
+}
+
+void test_groups_are_kept_apart(void) {
+    strcpy(keys[1], "docs");
+    strcpy(keys[2], "docs");
+    SortedIndexItem two[] = {
+        {sorted_prefix(2, "docs", 4), "docs", 4, 2},
+        {sorted_prefix(1, "docs", 4), "docs", 4, 1},
+    };
+    TEST_ASSERT_EQUAL_INT(0, sorted_index_build(&sorted, two, 2));
+    Probe probe = {"docs", 4};
+    size_t pos = sorted_index_lower_bound(&sorted, sorted_prefix(1, "docs", 4), compare_key, &probe);
+    TEST_ASSERT_EQUAL_UINT32(1, sorted.values[pos]);
+    pos = sorted_index_lower_bound(&sorted, sorted_prefix(2, "docs", 4), compare_key, &probe);
+    TEST_ASSERT_EQUAL_UINT32(2, sorted.values[pos]);
+    TEST_ASSERT_EQUAL(0, sorted_index_lower_bound(&sorted, sorted_prefix(3, "docs", 4), compare_key, &probe));
+}
+
+void test_empty_index(void) {
+    TEST_ASSERT_EQUAL_INT(0, sorted_index_build(&sorted, NULL, 0));
+    TEST_ASSERT_EQUAL(0, lower_bound("k"));
+}
+
+int main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_prefix_orders_like_keys);
+    RUN_TEST(test_lower_bound_present_and_absent);
+    RUN_TEST(test_keys_sharing_the_prefix);
+    RUN_TEST(test_walk_in_key_order);
+    RUN_TEST(test_groups_are_kept_apart);
+    RUN_TEST(test_empty_index);
+
+    return UNITY_END();
+}
@@ -0,0 +1,166 @@
+/*
+ * Unit tests for utils/timer_wheel.c
+ *
+ * Covers: firing on the exact tick across level boundaries, delays beyond
+ * the top level, cancel and reschedule, large jumps of the clock and
+ * callbacks that schedule again.
+ */
+
+#include "unity/unity.h"
+#include "../utils/timer_wheel.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define TIMERS 5000
+
+typedef struct {
+    TimerNode node;
+    uint64_t fired_at;
+    int fired;
+} TestTimer;
+
+static TimerWheel wheel;
+static TestTimer timers[TIMERS];
+
+void setUp(void) {
+    memset(&wheel, 0, sizeof(wheel));
+    memset(timers, 0, sizeof(timers));
+}
+
+void tearDown(void) {}
+
+static void on_expire(TimerNode *node, void *ctx) {
+    TestTimer *timer = (TestTimer *)node;
+    timer->fired_at = *(uint64_t *)ctx;
+    timer->fired++;
+}
+
+/* Advances one tick at a time, so fired_at records the exact tick. */
+static void run_until(uint64_t end) {
+    while (wheel.now < end) {
+        uint64_t next = wheel.now + 1;
+        timer_wheel_advance(&wheel, next, on_expire, &next);
+    }
+}
+
+void test_timers_fire_on_their_tick(void) {
+    static const uint64_t delays[] = {1, 2, 63, 64, 65, 127, 128, 4095, 4096, 4097, 262143, 262144, 300000};
+    size_t count = sizeof(delays) / sizeof(delays[0]);
+    uint64_t start = 1000;
+
+    timer_wheel_advance(&wheel, start, on_expire, NULL);
+    for (size_t i = 0; i < count; i++) {
+        timer_schedule(&wheel, &timers[i].node, start + delays[i]);
+    }
+    TEST_ASSERT_EQUAL_size_t(count, wheel.count);
+
+    run_until(start + 300001);
+    for (size_t i = 0; i < count; i++) {
+        TEST_ASSERT_EQUAL_INT(1, timers[i].fired);
+        TEST_ASSERT_EQUAL_UINT64(start + delays[i], timers[i].fired_at);
+    }
+    TEST_ASSERT_EQUAL_size_t(0, wheel.count);
+}
+
+void test_random_timers_fire_on_their_tick(void) {
+    srand(42);
+    uint64_t start = 123456;
+    timer_wheel_advance(&wheel, start, on_expire, NULL);
+    for (int i = 0; i < TIMERS; i++) {
+        timer_schedule(&wheel, &timers[i].node, start + 1 + (uint64_t)(rand() % 20000));
+    }
+
+    run_until(start + 20001);
+    for (int i = 0; i < TIMERS; i++) {
+        TEST_ASSERT_EQUAL_INT(1, timers[i].fired);
+        TEST_ASSERT_EQUAL_UINT64(timers[i].node.expires, timers[i].fired_at);
+    }
+}
+
+void test_delay_beyond_top_level_fires_on_time(void) {
+    uint64_t span = 1ull << (TIMER_SLOT_BITS * TIMER_LEVELS);
+    timer_schedule(&wheel, &timers[0].node, span + 10);
+    timer_wheel_advance(&wheel, span + 9, on_expire, &(uint64_t){0});
+    TEST_ASSERT_EQUAL_INT(0, timers[0].fired);
+    run_until(span + 10);
+    TEST_ASSERT_EQUAL_INT(1, timers[0].fired);
+    TEST_ASSERT_EQUAL_UINT64(span + 10, timers[0].fired_at);
+}
+
+void test_cancel_and_reschedule(void) {
+    timer_schedule(&wheel, &timers[0].node, 10);
+    timer_schedule(&wheel, &timers[1].node, 10);
+    TEST_ASSERT_TRUE(timer_pending(&timers[0].node));
+
+    timer_cancel(&wheel, &timers[0].node);
+    TEST_ASSERT_FALSE(timer_pending(&timers[0].node));
+    timer_cancel(&wheel, &timers[0].node);     /* cancelling twice is harmless */
+    timer_schedule(&wheel, &timers[1].node, 200);
+    TEST_ASSERT_EQUAL_size_t(1, wheel.count);
+
+    run_until(199);
+    TEST_ASSERT_EQUAL_INT(0, timers[0].fired);
+    TEST_ASSERT_EQUAL_INT(0, timers[1].fired);
+    run_until(200);
+    TEST_ASSERT_EQUAL_INT(1, timers[1].fired);
+    TEST_ASSERT_EQUAL_UINT64(200, timers[1].fired_at);
+}
+
+void test_past_deadline_fires_on_next_tick(void) {
+    timer_wheel_advance(&wheel, 50, on_expire, NULL);
+    timer_schedule(&wheel, &timers[0].node, 20);
+    run_until(51);
+    TEST_ASSERT_EQUAL_INT(1, timers[0].fired);
+    TEST_ASSERT_EQUAL_UINT64(51, timers[0].fired_at);
+    TEST_ASSERT_EQUAL_UINT64(51, timers[0].node.expires);
+}
+
+void test_jump_fires_everything_due(void) {
+    for (int i = 0; i < 100; i++) {
+        timer_schedule(&wheel, &timers[i].node, 1 + i * 100);
+    }
+    uint64_t now = 5000;
+    timer_wheel_advance(&wheel, now, on_expire, &now);
+    for (int i = 0; i < 100; i++) {
+        TEST_ASSERT_EQUAL_INT(1 + i * 100 <= 5000 ? 1 : 0, timers[i].fired);
+    }
+    TEST_ASSERT_EQUAL_size_t(50, wheel.count);
+}
+
+void test_empty_wheel_jumps(void) {
+    timer_wheel_advance(&wheel, 1ull << 40, on_expire, NULL);
+    TEST_ASSERT_EQUAL_UINT64(1ull << 40, wheel.now);
+}
+
+static void reschedule(TimerNode *node, void *ctx) {
+    TestTimer *timer = (TestTimer *)node;
+    timer->fired++;
+    if (timer->fired < 5) {
+        timer_schedule((TimerWheel *)ctx, node, node->expires + 70);
+    }
+}
+
+void test_callback_may_schedule_again(void) {
+    timer_schedule(&wheel, &timers[0].node, 70);
+    for (uint64_t t = 1; t <= 1000; t++) {
+        timer_wheel_advance(&wheel, t, reschedule, &wheel);
+    }
+    TEST_ASSERT_EQUAL_INT(5, timers[0].fired);
+    TEST_ASSERT_EQUAL_size_t(0, wheel.count);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_timers_fire_on_their_tick);
+    RUN_TEST(test_random_timers_fire_on_their_tick);
+    RUN_TEST(test_delay_beyond_top_level_fires_on_time);
+    RUN_TEST(test_cancel_and_reschedule);
+    RUN_TEST(test_past_deadline_fires_on_next_tick);
+    RUN_TEST(test_jump_fires_everything_due);
+    RUN_TEST(test_empty_wheel_jumps);
+    RUN_TEST(test_callback_may_schedule_again);
+
+    return UNITY_END();
+}
@@ -0,0 +1,174 @@
+/*
+ * Autor: Guido Barosio
+ * Email: guido@bravo47.com
+ * Fecha: 2024-06-08
+ */
+
+/*
+ * yathr-compile: compiles a TSV or CSV file of key/URL pairs into the
+ * route image served by http_server (ROUTES_IMAGE in config.txt), or
+ * checks an existing image.
+ *
+ *   yathr-compile routes.tsv routes.img
+ *   yathr-compile -v routes.img
+ *
+ * The input format is the one read by utils/routes_file.c. The image
+ * (see utils/route_image.h) holds a minimal perfect hash over the keys
+ * and every route's prebuilt response, so the server opens it with one
+ * mmap. If a key repeats, the last URL wins, as with ROUTES_FILE.
+ */
+
+#include "../utils/arena.h"
+#include "../utils/route_image.h"
+#include "../utils/routes_file.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+// A route read so far: key and URL are back to back in the arena, which
+// may still move, so entries point into it only once reading is done.
+typedef struct {
+    ArenaRef offset;
+    uint32_t key_len;
+    uint32_t url_len;
+} Pending;
+
+static int verify(const char *path) {
+    RouteImage image;
+    if (route_image_open(&image, path, 0) == -1) {
+        fprintf(stderr, "%s: %s\n", path, errno == EINVAL ? "not a valid route image" : strerror(errno));
+        return EXIT_FAILURE;
+    }
+    int valid = route_image_verify(&image) == 0;
+    printf("%s: %llu routes, %s\n", path, (unsigned long long)image.header->count,
+           valid ? "checksum ok" : "checksum MISMATCH");
+    route_image_close(&image);
+    return valid ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int main(int argc, char **argv) {
+    if (argc == 3 && strcmp(argv[1], "-v") == 0) {
+        return verify(argv[2]);
+    }
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s <routes.tsv|routes.csv> <output.img>\n       %s -v <image.img>\n",
+                argv[0], argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    FILE *in = fopen(argv[1], "r");
+    if (in == NULL) {
+        fprintf(stderr, "fopen %s failed: %s\n", argv[1], strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    struct timespec started;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+
+    StringArena strings = {0};
+    Pending *pending = NULL;
+    size_t count = 0, capacity = 0;
+    HostList hosts = {0};
+    char *line = NULL;
+    size_t line_cap = 0;
+    ssize_t line_len;
+    size_t line_no = 0, skipped = 0;
+
+    while ((line_len = getline(&line, &line_cap, in)) != -1) {
+        line_no++;
+
+        RouteLine route;
+        int parsed = parse_route_line(line, line_len, &route);
+        if (parsed == 0) {
+            continue;
+        }
+        if (parsed < 0) {
+            fprintf(stderr, "%s:%zu: expected key and URL, skipped\n", argv[1], line_no);
+            skipped++;
+            continue;
+        }
+        if (is_prefix_rule(route.key, route.key_len)) {
+            fprintf(stderr, "%s:%zu: prefix rules are served from the routes file only, skipped\n",
+                    argv[1], line_no);
+            skipped++;
+            continue;
+        }
+
+        char host[HOST_NAME_MAX_LEN];
+        long host_len = 0;
+        if (route.host) {
+            host_len = normalize_host(route.host, route.host_len, host);
+            if (host_len < 0) {
+                fprintf(stderr, "%s:%zu: bad host name, skipped\n", argv[1], line_no);
+                skipped++;
+                continue;
+            }
+        }
+
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 4096;
+            Pending *grown = realloc(pending, capacity * sizeof(Pending));
+            if (grown == NULL) {
+                fprintf(stderr, "%s:%zu: out of memory\n", argv[1], line_no);
+                return EXIT_FAILURE;
+            }
+            pending = grown;
+        }
+        size_t key_len = host_len ? host_len + 1 + route.key_len : route.key_len;
+        ArenaRef offset;
+        if (arena_alloc(&strings, key_len + route.url_len, &offset) == -1 ||
+            (host_len && host_list_add(&hosts, host, host_len) == -1)) {
+            fprintf(stderr, "%s:%zu: out of memory\n", argv[1], line_no);
+            return EXIT_FAILURE;
+        }
+        char *p = arena_at(&strings, offset);
+        if (host_len) {
+            memcpy(p, host, host_len);
+            p[host_len] = '\0';
+            p += host_len + 1;
+        }
+        memcpy(p, route.key, route.key_len);
+        memcpy(p + route.key_len, route.url, route.url_len);
+        pending[count++] = (Pending){offset, (uint32_t)key_len, (uint32_t)route.url_len};
+    }
+    free(line);
+    fclose(in);
+
+    RouteImageEntry *entries = malloc((count ? count : 1) * sizeof(RouteImageEntry));
+    if (entries == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return EXIT_FAILURE;
+    }
+    for (size_t i = 0; i < count; i++) {
+        const char *key = arena_at(&strings, pending[i].offset);
+        entries[i] = (RouteImageEntry){key, pending[i].key_len, key + pending[i].key_len, pending[i].url_len};
+    }
+    free(pending);
+
+    // Build next to the target and rename, so a running server never maps
+    // a half-written file
+    char tmp_path[4096];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", argv[2]);
+    long routes = route_image_write(tmp_path, entries, count, hosts.names, hosts.len);
+    if (routes < 0) {
+        fprintf(stderr, "write %s failed: %s\n", tmp_path, strerror(errno));
+        remove(tmp_path);
+        return EXIT_FAILURE;
+    }
+    free(entries);
+    free(hosts.names);
+    arena_free(&strings);
+
+    if (rename(tmp_path, argv[2]) == -1) {
+        fprintf(stderr, "rename to %s failed: %s\n", argv[2], strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    struct timespec finished;
+    clock_gettime(CLOCK_MONOTONIC, &finished);
+    printf("%ld routes compiled into %s in %.2f s (%zu lines skipped)\n", routes, argv[2],
+           (finished.tv_sec - started.tv_sec) + (finished.tv_nsec - started.tv_nsec) / 1e9, skipped);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,166 @@
+/*
+ * Autor: Guido Barosio
+ * Email: guido@bravo47.com
+ * Fecha: 2024-06-08
+ */
+
+/*
+ * yathr-mkdb: converts a TSV or CSV file of key/URL pairs into the cdb
+ * file served by http_server (ROUTES_CDB in config.txt).
+ *
+ *   yathr-mkdb routes.tsv routes.cdb
+ *
+ * The input format is the one read by utils/routes_file.c. Each value is
+ * the URL with a trailing NUL followed by the route's complete 302
+ * response, so the server hands both out straight from the mapping. If a
+ * key repeats, the first URL wins. Routes for a host are keyed
+ * "host\0key", and the hosts are listed under ROUTE_HOSTS_KEY so the
+ * server learns them without reading every record.
+ */
+
+#include "../utils/cdb.h"
+#include "../utils/response.h"
+#include "../utils/routes_file.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+// Grows *buffer to hold len bytes. Returns 0, or -1 when out of memory.
+static int reserve(char **buffer, size_t *cap, size_t len) {
+    if (len <= *cap) {
+        return 0;
+    }
+    char *grown = realloc(*buffer, len);
+    if (grown == NULL) {
+        return -1;
+    }
+    *buffer = grown;
+    *cap = len;
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s <routes.tsv|routes.csv> <output.cdb>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    FILE *in = fopen(argv[1], "r");
+    if (in == NULL) {
+        fprintf(stderr, "fopen %s failed: %s\n", argv[1], strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    // Build next to the target and rename, so a running server never maps
+    // a half-written file
+    char tmp_path[4096];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", argv[2]);
+    FILE *out = fopen(tmp_path, "w+");
+    if (out == NULL) {
+        fprintf(stderr, "fopen %s failed: %s\n", tmp_path, strerror(errno));
+        fclose(in);
+        return EXIT_FAILURE;
+    }
+
+    CdbWriter writer;
+    if (cdb_writer_start(&writer, out) == -1) {
+        fprintf(stderr, "write %s failed: %s\n", tmp_path, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    char *line = NULL;
+    size_t line_cap = 0;
+    char *value = NULL;
+    size_t value_cap = 0;
+    char *key = NULL;
+    size_t key_cap = 0;
+    HostList hosts = {0};
+    ssize_t line_len;
+    size_t line_no = 0, added = 0, skipped = 0;
+
+    while ((line_len = getline(&line, &line_cap, in)) != -1) {
+        line_no++;
+
+        RouteLine route;
+        int parsed = parse_route_line(line, line_len, &route);
+        if (parsed == 0) {
+            continue;
+        }
+        if (parsed < 0) {
+            fprintf(stderr, "%s:%zu: expected key and URL, skipped\n", argv[1], line_no);
+            skipped++;
+            continue;
+        }
+        if (is_prefix_rule(route.key, route.key_len)) {
+            fprintf(stderr, "%s:%zu: prefix rules are served from the routes file only, skipped\n",
+                    argv[1], line_no);
+            skipped++;
+            continue;
+        }
+
+        char host[HOST_NAME_MAX_LEN];
+        long host_len = 0;
+        if (route.host) {
+            host_len = normalize_host(route.host, route.host_len, host);
+            if (host_len < 0) {
+                fprintf(stderr, "%s:%zu: bad host name, skipped\n", argv[1], line_no);
+                skipped++;
+                continue;
+            }
+        }
+
+        size_t key_len = host_len ? host_len + 1 + route.key_len : route.key_len;
+        size_t value_len = route.url_len + 1 + redirect_response_size(route.url_len);
+        if (reserve(&key, &key_cap, key_len) == -1 || reserve(&value, &value_cap, value_len) == -1 ||
+            (host_len && host_list_add(&hosts, host, host_len) == -1)) {
+            fprintf(stderr, "%s:%zu: out of memory\n", argv[1], line_no);
+            fclose(out);
+            remove(tmp_path);
+            return EXIT_FAILURE;
+        }
+        if (host_len) {
+            memcpy(key, host, host_len);
+            key[host_len] = '\0';
+            memcpy(key + host_len + 1, route.key, route.key_len);
+        } else {
+            memcpy(key, route.key, route.key_len);
+        }
+        memcpy(value, route.url, route.url_len);
+        value[route.url_len] = '\0';
+        format_redirect_response(value + route.url_len + 1, route.url, route.url_len);
+
+        if (cdb_writer_add(&writer, key, key_len, value, value_len) == -1) {
+            fprintf(stderr, "%s:%zu: write failed: %s\n", argv[1], line_no, strerror(errno));
+            fclose(out);
+            remove(tmp_path);
+            return EXIT_FAILURE;
+        }
+        added++;
+    }
+    free(line);
+    free(value);
+    free(key);
+    fclose(in);
+
+    if (hosts.len > 0 && cdb_writer_add(&writer, ROUTE_HOSTS_KEY, ROUTE_HOSTS_KEY_LEN, hosts.names, hosts.len) == -1) {
+        fprintf(stderr, "write %s failed: %s\n", tmp_path, strerror(errno));
+        fclose(out);
+        remove(tmp_path);
+        return EXIT_FAILURE;
+    }
+    free(hosts.names);
+
+    if (cdb_writer_finish(&writer) == -1 || fclose(out) != 0) {
+        fprintf(stderr, "Failed to finish %s (the format is limited to 4 GB)\n", tmp_path);
+        remove(tmp_path);
+        return EXIT_FAILURE;
+    }
+    if (rename(tmp_path, argv[2]) == -1) {
+        fprintf(stderr, "rename to %s failed: %s\n", argv[2], strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    printf("%zu routes written to %s (%zu lines skipped)\n", added, argv[2], skipped);
+    return EXIT_SUCCESS;
+}
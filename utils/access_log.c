@@ -0,0 +1,266 @@
+/*
+ * Autor: Guido Barosio
+ * Email: guido@bravo47.com
+ * Fecha: 2024-06-08
+ */
+
+#include "access_log.h"
+#include "logs.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#define RING_SIZE 1024              // records per thread, power of two
+#define BATCH_SIZE (64 * 1024)
+#define WRITER_INTERVAL_MS 50
+
+// One request, captured by the event loop without any formatting. Long
+// fields are truncated. 256 bytes: four whole cache lines, no straddling.
+typedef struct {
+    int64_t seconds;
+    uint32_t micros;
+    uint16_t status;
+    uint8_t method_len;
+    uint8_t path_len;
+    uint16_t target_len;
+    char method[14];
+    char path[112];
+    char target[112];
+} AccessRecord;
+
+// Single-producer single-consumer ring owned by one event loop thread.
+// The writer is the only consumer.
+typedef struct AccessRing {
+    AccessRecord records[RING_SIZE];
+    _Alignas(64) atomic_size_t head;    // next slot the producer fills
+    _Alignas(64) atomic_size_t tail;    // next slot the writer drains
+    struct AccessRing *next;
+} AccessRing;
+
+int access_log_level = ACCESS_LOG_OFF;
+
+static _Atomic(AccessRing *) rings = NULL;
+static __thread AccessRing *thread_ring = NULL;
+static atomic_ulong dropped = 0;
+static atomic_int wakeup_pending = 0;
+
+static int log_fd = -1;
+static int writer_started = 0;
+static pthread_t writer_thread;
+// Serializes draining (the writer thread and explicit flushes) and fd swaps
+static pthread_mutex_t drain_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t wakeup_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wakeup = PTHREAD_COND_INITIALIZER;
+
+static AccessRing *register_ring(void) {
+    AccessRing *ring = calloc(1, sizeof(AccessRing));
+    if (ring == NULL) {
+        return NULL;
+    }
+    ring->next = atomic_load(&rings);
+    while (!atomic_compare_exchange_weak(&rings, &ring->next, ring)) {
+    }
+    return ring;
+}
+
+static size_t copy_field(char *dst, size_t size, const char *src) {
+    if (src == NULL) {
+        return 0;
+    }
+    size_t len = strnlen(src, size);
+    memcpy(dst, src, len);
+    return len;
+}
+
+// Appends one record to the calling thread's ring. Never blocks: when the
+// writer falls behind the record is dropped and counted.
+void access_log_record(int status, const char *method, const char *path, const char *target) {
+    AccessRing *ring = thread_ring;
+    if (ring == NULL) {
+        ring = thread_ring = register_ring();
+        if (ring == NULL) {
+            atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+            return;
+        }
+    }
+
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if (head - tail == RING_SIZE) {
+        atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+        return;
+    }
+
+    AccessRecord *record = &ring->records[head & (RING_SIZE - 1)];
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    record->seconds = now.tv_sec;
+    record->micros = (uint32_t)(now.tv_nsec / 1000);
+    record->status = (uint16_t)status;
+    record->method_len = (uint8_t)copy_field(record->method, sizeof(record->method), method);
+    record->path_len = (uint8_t)copy_field(record->path, sizeof(record->path), path);
+    record->target_len = (uint16_t)copy_field(record->target, sizeof(record->target), target);
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+
+    // Wake the writer early once a ring is half full; otherwise it picks
+    // records up on its next tick
+    if (head + 1 - tail >= RING_SIZE / 2 &&
+        !atomic_exchange_explicit(&wakeup_pending, 1, memory_order_relaxed)) {
+        pthread_mutex_lock(&wakeup_lock);
+        pthread_cond_signal(&wakeup);
+        pthread_mutex_unlock(&wakeup_lock);
+    }
+}
+
+static void write_batch(const char *batch, size_t len) {
+    while (len > 0 && log_fd != -1) {
+        ssize_t n = write(log_fd, batch, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            log_error("Access log write failed: %s", strerror(errno));
+            return;
+        }
+        batch += n;
+        len -= (size_t)n;
+    }
+}
+
+// "2024-06-08 12:00:00.123456 302 GET /google https://www.google.com"
+static size_t format_record(char *out, const AccessRecord *record, int64_t *cached_second, char *cached_stamp) {
+    if (record->seconds != *cached_second) {
+        time_t seconds = (time_t)record->seconds;
+        struct tm tm;
+        localtime_r(&seconds, &tm);
+        strftime(cached_stamp, 20, "%Y-%m-%d %H:%M:%S", &tm);
+        *cached_second = record->seconds;
+    }
+
+    char *p = out;
+    memcpy(p, cached_stamp, 19);
+    p += 19;
+    p += sprintf(p, ".%06u %03u ", record->micros, record->status);
+    memcpy(p, record->method, record->method_len);
+    p += record->method_len;
+    *p++ = ' ';
+    memcpy(p, record->path, record->path_len);
+    p += record->path_len;
+    if (record->target_len > 0) {
+        *p++ = ' ';
+        memcpy(p, record->target, record->target_len);
+        p += record->target_len;
+    }
+    *p++ = '\n';
+    return (size_t)(p - out);
+}
+
+// Formats everything queued so far into batches of up to BATCH_SIZE bytes,
+// one write() per batch. Returns the number of records drained.
+static size_t drain_rings(void) {
+    static char batch[BATCH_SIZE];
+    static int64_t cached_second = -1;
+    static char cached_stamp[20];
+    size_t used = 0;
+    size_t drained = 0;
+
+    pthread_mutex_lock(&drain_lock);
+    for (AccessRing *ring = atomic_load(&rings); ring; ring = ring->next) {
+        size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+        for (; tail != head; tail++) {
+            if (BATCH_SIZE - used < sizeof(AccessRecord) + 64) {
+                write_batch(batch, used);
+                used = 0;
+            }
+            used += format_record(batch + used, &ring->records[tail & (RING_SIZE - 1)],
+                                  &cached_second, cached_stamp);
+            drained++;
+        }
+        atomic_store_explicit(&ring->tail, tail, memory_order_release);
+    }
+    write_batch(batch, used);
+    pthread_mutex_unlock(&drain_lock);
+    return drained;
+}
+
+static void *access_log_writer(void *arg) {
+    (void)arg;
+    while (1) {
+        if (drain_rings() > 0) {
+            continue;
+        }
+        pthread_mutex_lock(&wakeup_lock);
+        if (!atomic_exchange_explicit(&wakeup_pending, 0, memory_order_relaxed)) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += WRITER_INTERVAL_MS * 1000000L;
+            if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&wakeup, &wakeup_lock, &deadline);
+            atomic_store_explicit(&wakeup_pending, 0, memory_order_relaxed);
+        }
+        pthread_mutex_unlock(&wakeup_lock);
+    }
+    return NULL;
+}
+
+// Opens (or reopens, e.g. after rotation) the access log and starts the
+// writer thread on first use. Records queued before a reopen go to the
+// old file. Returns 0 on success, -1 on error.
+int init_access_log(const char *path, int level) {
+    int fd = -1;
+    if (level > ACCESS_LOG_OFF) {
+        fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (fd == -1) {
+            log_error("Failed to open access log %s: %s", path, strerror(errno));
+            return -1;
+        }
+    }
+
+    flush_access_log();
+    pthread_mutex_lock(&drain_lock);
+    if (log_fd != -1) {
+        close(log_fd);
+    }
+    log_fd = fd;
+    access_log_level = level;
+    pthread_mutex_unlock(&drain_lock);
+
+    if (level > ACCESS_LOG_OFF && !writer_started) {
+        // The writer starts with every signal blocked, whatever the
+        // caller's mask: signals are the main thread's to take
+        sigset_t all, saved;
+        sigfillset(&all);
+        pthread_sigmask(SIG_SETMASK, &all, &saved);
+        int rc = pthread_create(&writer_thread, NULL, access_log_writer, NULL);
+        pthread_sigmask(SIG_SETMASK, &saved, NULL);
+        if (rc != 0) {
+            log_error("Failed to start access log writer: %s", strerror(rc));
+            return -1;
+        }
+        pthread_detach(writer_thread);
+        writer_started = 1;
+    }
+    return 0;
+}
+
+// Writes out everything recorded so far, from the calling thread.
+void flush_access_log(void) {
+    drain_rings();
+}
+
+unsigned long access_log_dropped(void) {
+    return atomic_load_explicit(&dropped, memory_order_relaxed);
+}
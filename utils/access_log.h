@@ -0,0 +1,29 @@
+/*
+ * Autor: Guido Barosio
+ * Email: guido@bravo47.com
+ * Fecha: 2024-06-08
+ */
+
+#ifndef ACCESS_LOG_H
+#define ACCESS_LOG_H
+
+#include <stddef.h>
+
+// What gets logged: nothing, failed lookups (4xx/5xx) only, or every request
+#define ACCESS_LOG_OFF 0
+#define ACCESS_LOG_ERRORS 1
+#define ACCESS_LOG_ALL 2
+
+extern int access_log_level;
+
+// Checked by the caller before anything is copied or formatted.
+static inline int access_log_wants(int status) {
+    return access_log_level >= (status >= 400 ? ACCESS_LOG_ERRORS : ACCESS_LOG_ALL);
+}
+
+int init_access_log(const char *path, int level);
+void access_log_record(int status, const char *method, const char *path, const char *target);
+void flush_access_log(void);
+unsigned long access_log_dropped(void);
+
+#endif // ACCESS_LOG_H
@@ -0,0 +1,115 @@
+/*
+ * Autor: Guido Barosio
+ * Email: guido@bravo47.com
+ * Fecha: 2024-06-08
+ */
+
+#include "arena.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_MIN_CAPACITY 4096
+
+static int chunks_grow(StringArena *arena, size_t count) {
+    if (arena->count + count <= arena->capacity) {
+        return 0;
+    }
+    if (arena->count + count > UINT32_MAX) {
+        errno = ENOMEM;
+        return -1;
+    }
+    size_t capacity = arena->capacity ? arena->capacity * 2 : 4;
+    while (capacity < arena->count + count) {
+        capacity *= 2;
+    }
+    ArenaChunk *chunks = realloc(arena->chunks, capacity * sizeof(ArenaChunk));
+    if (chunks == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+    arena->chunks = chunks;
+    arena->capacity = capacity;
+    return 0;
+}
+
+// Makes room for len more contiguous bytes: in the last chunk, grown up
+// to ARENA_CHUNK_SIZE, or else in a new one. Returns 0, or -1 with errno
+// set to ENOMEM when out of memory or len is past ARENA_CHUNK_MAX.
+int arena_reserve(StringArena *arena, size_t len) {
+    if (len > ARENA_CHUNK_MAX) {
+        errno = ENOMEM;
+        return -1;
+    }
+    ArenaChunk *last = arena->count ? &arena->chunks[arena->count - 1] : NULL;
+    if (last && len <= last->capacity - last->used) {
+        return 0;
+    }
+
+    size_t needed = last ? last->used + len : len;
+    if (last == NULL || needed > ARENA_CHUNK_SIZE) {
+        // A new chunk, starting small while the arena is
+        if (chunks_grow(arena, 1) == -1) {
+            return -1;
+        }
+        last = &arena->chunks[arena->count++];
+        *last = (ArenaChunk){NULL, 0, 0};
+        needed = len;
+    }
+
+    size_t capacity = last->capacity ? last->capacity : ARENA_MIN_CAPACITY;
+    while (capacity < needed) {
+        capacity *= 2;
+    }
+    if (capacity > ARENA_CHUNK_SIZE) {
+        capacity = needed > ARENA_CHUNK_SIZE ? needed : ARENA_CHUNK_SIZE;
+    }
+    char *data = realloc(last->data, capacity);
+    if (data == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+    last->data = data;
+    last->capacity = capacity;
+    return 0;
+}
+
+// Allocates len bytes and stores their reference. Returns 0 or -1 (see
+// arena_reserve()).
+int arena_alloc(StringArena *arena, size_t len, ArenaRef *ref) {
+    if (arena_reserve(arena, len) == -1) {
+        return -1;
+    }
+    ArenaChunk *last = &arena->chunks[arena->count - 1];
+    *ref = ((ArenaRef)(arena->count - 1) << 32) | (uint32_t)last->used;
+    last->used += len;
+    arena->used += len;
+    return 0;
+}
+
+// Moves the chunks of from behind those of arena, without copying their
+// bytes, and empties from. A reference into from becomes one into arena
+// by adding (ArenaRef)base << 32. Returns 0, or -1 when out of memory,
+// leaving both as they were.
+int arena_adopt(StringArena *arena, StringArena *from, uint32_t *base) {
+    if (chunks_grow(arena, from->count) == -1) {
+        return -1;
+    }
+    *base = (uint32_t)arena->count;
+    if (from->count > 0) {
+        memcpy(arena->chunks + arena->count, from->chunks, from->count * sizeof(ArenaChunk));
+    }
+    arena->count += from->count;
+    arena->used += from->used;
+    free(from->chunks);
+    *from = (StringArena){0};
+    return 0;
+}
+
+void arena_free(StringArena *arena) {
+    for (size_t i = 0; i < arena->count; i++) {
+        free(arena->chunks[i].data);
+    }
+    free(arena->chunks);
+    *arena = (StringArena){0};
+}
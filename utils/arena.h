@@ -0,0 +1,49 @@
+/*
+ * Autor: Guido Barosio
+ * Email: guido@bravo47.com
+ * Fecha: 2024-06-08
+ */
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define ARENA_CHUNK_SIZE ((size_t)64 << 20)
+#define ARENA_CHUNK_MAX UINT32_MAX
+
+// Where an allocation lives: the chunk number in the high 32 bits, the
+// offset in it in the low 32.
+typedef uint64_t ArenaRef;
+
+typedef struct {
+    char *data;
+    size_t used;
+    size_t capacity;
+} ArenaChunk;
+
+// Bump allocator for strings that live and die together. Allocations are
+// packed back to back, with no per-allocation header or alignment, in
+// chunks of up to ARENA_CHUNK_SIZE (larger allocations get one of their
+// own, up to ARENA_CHUNK_MAX), so the arena has no limit of its own and
+// never copies more than one chunk to grow. The last chunk grows by
+// doubling and may move when it does: keep references, not pointers,
+// across allocations. Nothing is freed before the whole arena.
+typedef struct {
+    ArenaChunk *chunks;
+    size_t count;
+    size_t capacity;
+    size_t used;            // bytes allocated, over all chunks
+} StringArena;
+
+int arena_alloc(StringArena *arena, size_t len, ArenaRef *ref);
+int arena_reserve(StringArena *arena, size_t len);
+int arena_adopt(StringArena *arena, StringArena *from, uint32_t *base);
+void arena_free(StringArena *arena);
+
+static inline char *arena_at(const StringArena *arena, ArenaRef ref) {
+    return arena->chunks[ref >> 32].data + (uint32_t)ref;
+}
+
+#endif // ARENA_H
@@ -0,0 +1,45 @@
+/*
+ * Autor: Guido Barosio
+ * Email: guido@bravo47.com
+ * Fecha: 2024-06-08
+ */
+
+#include "bloom.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Sizes the filter for keys entries at bits_per_key bits each and sets
+// the probe count that minimises false positives for that size
+// (bits_per_key * ln 2). Returns 0, or -1 when out of memory.
+int bloom_init(BloomFilter *filter, size_t keys, int bits_per_key) {
+    if (bits_per_key < 1) {
+        bits_per_key = 1;
+    }
+    size_t bits = (keys ? keys : 1) * (size_t)bits_per_key;
+    size_t block_count = (bits + 511) / 512;
+    uint64_t *blocks = aligned_alloc(64, block_count * 64);
+    if (blocks == NULL) {
+        return -1;
+    }
+    memset(blocks, 0, block_count * 64);
+
+    int probes = (bits_per_key * 69 + 50) / 100;
+    if (probes < 1) {
+        probes = 1;
+    }
+    if (probes > BLOOM_MAX_PROBES) {
+        probes = BLOOM_MAX_PROBES;
+    }
+
+    filter->blocks = blocks;
+    filter->block_count = block_count;
+    filter->probes = probes;
+    return 0;
+}
+
+void bloom_free(BloomFilter *filter) {
+    free(filter->blocks);
+    filter->blocks = NULL;
+    filter->block_count = 0;
+    filter->probes = 0;
+}
@@ -0,0 +1,281 @@
+/*
+ * Autor: Guido Barosio
+ * Email: guido@bravo47.com
+ * Fecha: 2024-06-08
+ */
+
+#include "cdb.h"
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Layout: a 2048-byte header of 256 (position, slot count) pairs, the
+// records (key length, value length, key, value), then 256 open-addressing
+// tables of (hash, record position) slots. All integers are 32-bit
+// little-endian.
+#define CDB_HEADER_SIZE 2048
+
+static uint32_t unpack(const unsigned char *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void pack(unsigned char *p, uint32_t v) {
+    p[0] = v & 0xff;
+    p[1] = (v >> 8) & 0xff;
+    p[2] = (v >> 16) & 0xff;
+    p[3] = (v >> 24) & 0xff;
+}
+
+uint32_t cdb_hash(const char *key, size_t len) {
+    uint32_t h = 5381;
+    for (size_t i = 0; i < len; i++) {
+        h = ((h << 5) + h) ^ (unsigned char)key[i];
+    }
+    return h;
+}
+
+int cdb_open(Cdb *cdb, const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 || st.st_size < CDB_HEADER_SIZE) {
+        close(fd);
+        return -1;
+    }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+    // Lookups hop between a table slot and a record: no point reading ahead
+    madvise(map, st.st_size, MADV_RANDOM);
+
+    cdb->map = map;
+    cdb->size = st.st_size;
+    return 0;
+}
+
+void cdb_close(Cdb *cdb) {
+    if (cdb->map) {
+        munmap((void *)cdb->map, cdb->size);
+        cdb->map = NULL;
+        cdb->size = 0;
+    }
+}
+
+// Returns a pointer into the mapping and sets *value_len, or NULL when the
+// key is missing. Offsets are bounds-checked, so a truncated or corrupt
+// file yields misses rather than faults.
+const char *cdb_find(const Cdb *cdb, const char *key, size_t key_len, size_t *value_len) {
+    if (cdb->map == NULL) {
+        return NULL;
+    }
+
+    uint32_t hash = cdb_hash(key, key_len);
+    const unsigned char *header = cdb->map + (hash & 0xff) * 8;
+    uint32_t table = unpack(header);
+    uint32_t slots = unpack(header + 4);
+    if (slots == 0 || table > cdb->size || (cdb->size - table) / 8 < slots) {
+        return NULL;
+    }
+
+    uint32_t slot = (hash >> 8) % slots;
+    for (uint32_t probes = 0; probes < slots; probes++) {
+        const unsigned char *entry = cdb->map + table + slot * 8;
+        uint32_t pos = unpack(entry + 4);
+        if (pos == 0) {
+            return NULL;
+        }
+        if (unpack(entry) == hash && pos <= cdb->size - 8) {
+            const unsigned char *record = cdb->map + pos;
+            uint32_t klen = unpack(record);
+            uint32_t dlen = unpack(record + 4);
+            if (klen == key_len && (uint64_t)pos + 8 + klen + dlen <= cdb->size &&
+                memcmp(record + 8, key, key_len) == 0) {
+                *value_len = dlen;
+                return (const char *)record + 8 + klen;
+            }
+        }
+        if (++slot == slots) {
+            slot = 0;
+        }
+    }
+    return NULL;
+}
+
+// Walks the records in file order. Returns the number visited, or -1 when
+// the record area is corrupt or the callback stopped the walk.
+long cdb_foreach(const Cdb *cdb, CdbRecordCallback callback, void *ctx) {
+    if (cdb->map == NULL) {
+        return 0;
+    }
+
+    // Records run from the header to the first hash table
+    uint32_t end = (uint32_t)(cdb->size < UINT32_MAX ? cdb->size : UINT32_MAX);
+    for (int t = 0; t < 256; t++) {
+        uint32_t table = unpack(cdb->map + t * 8);
+        if (table >= CDB_HEADER_SIZE && table < end) {
+            end = table;
+        }
+    }
+
+    // Read ahead for the walk, then back to random access for lookups
+    madvise((void *)cdb->map, end, MADV_SEQUENTIAL);
+    long count = 0;
+    uint64_t pos = CDB_HEADER_SIZE;
+    while (pos + 8 <= end) {
+        const unsigned char *record = cdb->map + pos;
+        uint32_t klen = unpack(record);
+        uint32_t dlen = unpack(record + 4);
+        if (pos + 8 + klen + dlen > end) {
+            count = -1;
+            break;
+        }
+        if (callback(ctx, (const char *)record + 8, klen, (const char *)record + 8 + klen, dlen) != 0) {
+            count = -1;
+            break;
+        }
+        count++;
+        pos += 8 + (uint64_t)klen + dlen;
+    }
+    madvise((void *)cdb->map, cdb->size, MADV_RANDOM);
+    return count;
+}
+
+// Number of records, from the table sizes: cdbmake-compatible writers,
+// yathr-mkdb included, give each table two slots per record.
+size_t cdb_count(const Cdb *cdb) {
+    size_t slots = 0;
+    if (cdb->map == NULL) {
+        return 0;
+    }
+    for (int t = 0; t < 256; t++) {
+        slots += unpack(cdb->map + t * 8 + 4);
+    }
+    return slots / 2;
+}
+
+int cdb_writer_start(CdbWriter *writer, FILE *file) {
+    unsigned char header[CDB_HEADER_SIZE] = {0};
+    memset(writer, 0, sizeof(*writer));
+    writer->file = file;
+    writer->pos = CDB_HEADER_SIZE;
+    // Placeholder header, rewritten by cdb_writer_finish
+    return fwrite(header, 1, sizeof(header), file) == sizeof(header) ? 0 : -1;
+}
+
+int cdb_writer_add(CdbWriter *writer, const char *key, size_t key_len, const char *value, size_t value_len) {
+    uint64_t record_len = 8 + (uint64_t)key_len + value_len;
+    if ((uint64_t)writer->pos + record_len > UINT32_MAX) {
+        return -1;  // The format addresses at most 4 GB
+    }
+
+    if (writer->count == writer->capacity) {
+        size_t capacity = writer->capacity ? writer->capacity * 2 : 1024;
+        CdbSlot *records = realloc(writer->records, capacity * sizeof(CdbSlot));
+        if (records == NULL) {
+            return -1;
+        }
+        writer->records = records;
+        writer->capacity = capacity;
+    }
+
+    unsigned char lengths[8];
+    pack(lengths, (uint32_t)key_len);
+    pack(lengths + 4, (uint32_t)value_len);
+    if (fwrite(lengths, 1, 8, writer->file) != 8 ||
+        fwrite(key, 1, key_len, writer->file) != key_len ||
+        fwrite(value, 1, value_len, writer->file) != value_len) {
+        return -1;
+    }
+
+    writer->records[writer->count].hash = cdb_hash(key, key_len);
+    writer->records[writer->count].pos = writer->pos;
+    writer->count++;
+    writer->pos += (uint32_t)record_len;
+    return 0;
+}
+
+int cdb_writer_finish(CdbWriter *writer) {
+    unsigned char header[CDB_HEADER_SIZE];
+    size_t counts[256] = {0};
+    size_t starts[256];
+    int rc = -1;
+
+    for (size_t i = 0; i < writer->count; i++) {
+        counts[writer->records[i].hash & 0xff]++;
+    }
+
+    // Group records by table so each table is filled in one pass
+    size_t offset = 0;
+    for (int t = 0; t < 256; t++) {
+        starts[t] = offset;
+        offset += counts[t];
+    }
+    CdbSlot *grouped = malloc((writer->count ? writer->count : 1) * sizeof(CdbSlot));
+    size_t max_slots = 0;
+    for (int t = 0; t < 256; t++) {
+        if (counts[t] * 2 > max_slots) max_slots = counts[t] * 2;
+    }
+    CdbSlot *table = calloc(max_slots ? max_slots : 1, sizeof(CdbSlot));
+    unsigned char *packed = malloc((max_slots ? max_slots : 1) * 8);
+    if (grouped == NULL || table == NULL || packed == NULL) {
+        goto out;
+    }
+
+    size_t fill[256];
+    memcpy(fill, starts, sizeof(fill));
+    for (size_t i = 0; i < writer->count; i++) {
+        grouped[fill[writer->records[i].hash & 0xff]++] = writer->records[i];
+    }
+
+    for (int t = 0; t < 256; t++) {
+        uint32_t slots = (uint32_t)(counts[t] * 2);
+        if ((uint64_t)writer->pos + (uint64_t)slots * 8 > UINT32_MAX) {
+            goto out;
+        }
+        pack(header + t * 8, writer->pos);
+        pack(header + t * 8 + 4, slots);
+        if (slots == 0) {
+            continue;
+        }
+
+        memset(table, 0, slots * sizeof(CdbSlot));
+        for (size_t i = starts[t]; i < starts[t] + counts[t]; i++) {
+            uint32_t slot = (grouped[i].hash >> 8) % slots;
+            while (table[slot].pos != 0) {
+                if (++slot == slots) slot = 0;
+            }
+            table[slot] = grouped[i];
+        }
+        for (uint32_t s = 0; s < slots; s++) {
+            pack(packed + s * 8, table[s].hash);
+            pack(packed + s * 8 + 4, table[s].pos);
+        }
+        if (fwrite(packed, 8, slots, writer->file) != slots) {
+            goto out;
+        }
+        writer->pos += slots * 8;
+    }
+
+    if (fseek(writer->file, 0, SEEK_SET) == 0 &&
+        fwrite(header, 1, sizeof(header), writer->file) == sizeof(header) &&
+        fflush(writer->file) == 0) {
+        rc = 0;
+    }
+
+out:
+    free(grouped);
+    free(table);
+    free(packed);
+    free(writer->records);
+    writer->records = NULL;
+    return rc;
+}
@@ -0,0 +1,51 @@
+/*
+ * Autor: Guido Barosio
+ * Email: guido@bravo47.com
+ * Fecha: 2024-06-08
+ */
+
+#ifndef CDB_H
+#define CDB_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Read-only constant database in the cdb format used by tinycdb and
+// cdbmake, mapped into memory. Lookups read the mapping directly, so the
+// file's pages are shared by every thread and process through the page
+// cache.
+typedef struct {
+    const unsigned char *map;
+    size_t size;
+} Cdb;
+
+int cdb_open(Cdb *cdb, const char *path);
+void cdb_close(Cdb *cdb);
+const char *cdb_find(const Cdb *cdb, const char *key, size_t key_len, size_t *value_len);
+
+// Called for each record by cdb_foreach(); a nonzero return stops the walk.
+typedef int (*CdbRecordCallback)(void *ctx, const char *key, size_t key_len, const char *value, size_t value_len);
+long cdb_foreach(const Cdb *cdb, CdbRecordCallback callback, void *ctx);
+size_t cdb_count(const Cdb *cdb);
+uint32_t cdb_hash(const char *key, size_t len);
+
+typedef struct {
+    uint32_t hash;
+    uint32_t pos;
+} CdbSlot;
+
+// Streams records to a file and writes the hash tables on finish.
+typedef struct {
+    FILE *file;
+    uint32_t pos;
+    CdbSlot *records;
+    size_t count;
+    size_t capacity;
+} CdbWriter;
+
+int cdb_writer_start(CdbWriter *writer, FILE *file);
+int cdb_writer_add(CdbWriter *writer, const char *key, size_t key_len, const char *value, size_t value_len);
+int cdb_writer_finish(CdbWriter *writer);
+
+#endif // CDB_H
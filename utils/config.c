@@ -7,6 +7,7 @@
 #include "config.h"
 #include "logs.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 
@@ -29,3 +30,56 @@ int read_port_from_config(const char *filename) {
     fclose(file);
     return port;
 }
+
+// Reads an integer KEY=value entry. Returns default_value when the file,
+// the key or a valid number is missing.
+int read_int_from_config(const char *filename, const char *key, int default_value) {
+    FILE *file = fopen(filename, "r");
+    if (!file) {
+        return default_value;
+    }
+
+    char buffer[128];
+    size_t key_len = strlen(key);
+    int value = default_value;
+
+    while (fgets(buffer, sizeof(buffer), file)) {
+        if (strncmp(buffer, key, key_len) == 0 && buffer[key_len] == '=') {
+            char *end;
+            long parsed = strtol(buffer + key_len + 1, &end, 10);
+            if (end != buffer + key_len + 1) {
+                value = (int)parsed;
+            }
+            break;
+        }
+    }
+
+    fclose(file);
+    return value;
+}
+
+// Copies the value of a KEY=value entry, without the line break, into
+// value. Returns 0 on success and -1 when the file or the key is missing.
+int read_string_from_config(const char *filename, const char *key, char *value, size_t value_size) {
+    FILE *file = fopen(filename, "r");
+    if (!file) {
+        return -1;
+    }
+
+    char buffer[1024];
+    size_t key_len = strlen(key);
+    int rc = -1;
+
+    while (fgets(buffer, sizeof(buffer), file)) {
+        if (strncmp(buffer, key, key_len) == 0 && buffer[key_len] == '=') {
+            char *start = buffer + key_len + 1;
+            start[strcspn(start, "\r\n")] = '\0';
+            snprintf(value, value_size, "%s", start);
+            rc = 0;
+            break;
+        }
+    }
+
+    fclose(file);
+    return rc;
+}
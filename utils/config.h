@@ -7,6 +7,10 @@
 #ifndef CONFIG_H
 #define CONFIG_H
 
+#include <stddef.h>
+
 int read_port_from_config(const char *filename);
+int read_int_from_config(const char *filename, const char *key, int default_value);
+int read_string_from_config(const char *filename, const char *key, char *value, size_t value_size);
 
 #endif // CONFIG_H
@@ -0,0 +1,49 @@
+/*
+ * Autor: Guido Barosio
+ * Email: guido@bravo47.com
+ * Fecha: 2024-06-08
+ */
+
+#ifndef HASH_H
+#define HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// 64-bit hash for short keys: eight bytes per multiply, finished with the
+// murmur3 avalanche so both the low bits (table index) and the high bits
+// (stored fingerprint) are well mixed. Different seeds give independent
+// hashes, for structures that must retry with another function.
+static inline uint64_t hash_bytes_seeded(const char *key, size_t len, uint64_t seed) {
+    const uint64_t m = 0x9E3779B97F4A7C15ULL;
+    uint64_t h = 0x243F6A8885A308D3ULL ^ (len * m) ^ seed;
+    const char *p = key;
+
+    while (len >= 8) {
+        uint64_t w;
+        memcpy(&w, p, 8);
+        h = (h ^ w) * m;
+        h ^= h >> 29;
+        p += 8;
+        len -= 8;
+    }
+    if (len > 0) {
+        uint64_t w = 0;
+        memcpy(&w, p, len);
+        h = (h ^ w) * m;
+    }
+
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+static inline uint64_t hash_bytes(const char *key, size_t len) {
+    return hash_bytes_seeded(key, len, 0);
+}
+
+#endif // HASH_H
@@ -0,0 +1,120 @@
+/*
+ * Autor: Guido Barosio
+ * Email: guido@bravo47.com
+ * Fecha: 2024-06-08
+ */
+
+#include "hot_cache.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Allocates room for capacity entries, with an index at most half full.
+// Returns 0, or -1 when out of memory.
+int hot_cache_init(HotCache *cache, size_t capacity) {
+    if (capacity == 0 || capacity > UINT32_MAX / 2) {
+        errno = EINVAL;
+        return -1;
+    }
+    size_t slots = 16;
+    while (slots < capacity * 2) {
+        slots <<= 1;
+    }
+    HotCache built = {aligned_alloc(64, capacity * sizeof(HotCacheEntry)), calloc(slots, sizeof(uint32_t)),
+                      slots - 1, capacity, 0, 0, 0};
+    if (built.entries == NULL || built.index == NULL) {
+        hot_cache_free(&built);
+        return -1;
+    }
+    *cache = built;
+    return 0;
+}
+
+void hot_cache_free(HotCache *cache) {
+    free(cache->entries);
+    free(cache->index);
+    *cache = (HotCache){0};
+}
+
+// Drops every entry: they point into the table of another generation,
+// which may be gone. Lookups after this are for tables of generation.
+void hot_cache_clear(HotCache *cache, uint64_t generation) {
+    if (cache->count > 0) {
+        memset(cache->index, 0, (cache->index_mask + 1) * sizeof(uint32_t));
+        cache->count = 0;
+        cache->hand = 0;
+    }
+    cache->generation = generation;
+}
+
+// Returns the entry for key in group, marking it referenced, or NULL.
+const HotCacheEntry *hot_cache_find(HotCache *cache, uint64_t hash, uint16_t group, const char *key, size_t key_len) {
+    for (size_t pos = (size_t)hash & cache->index_mask; cache->index[pos] != 0; pos = (pos + 1) & cache->index_mask) {
+        HotCacheEntry *e = &cache->entries[cache->index[pos] - 1];
+        if (e->hash == hash && e->group == group && e->key_len == key_len && memcmp(e->key, key, key_len) == 0) {
+            if (!e->referenced) {
+                e->referenced = 1;
+            }
+            return e;
+        }
+    }
+    return NULL;
+}
+
+// Takes an entry out of the index, moving back the ones probed past it so
+// that no probe sequence has a hole.
+static void index_remove(HotCache *cache, uint32_t entry) {
+    size_t mask = cache->index_mask;
+    size_t hole = (size_t)cache->entries[entry].hash & mask;
+    while (cache->index[hole] != entry + 1) {
+        hole = (hole + 1) & mask;
+    }
+    for (size_t pos = (hole + 1) & mask; cache->index[pos] != 0; pos = (pos + 1) & mask) {
+        size_t home = (size_t)cache->entries[cache->index[pos] - 1].hash & mask;
+        if (((pos - home) & mask) >= ((pos - hole) & mask)) {
+            cache->index[hole] = cache->index[pos];
+            hole = pos;
+        }
+    }
+    cache->index[hole] = 0;
+}
+
+// Adds a route found for key in group, evicting one when full. Keys
+// longer than HOT_CACHE_KEY_MAX are not cached.
+void hot_cache_insert(HotCache *cache, uint64_t hash, uint16_t group, const char *key, size_t key_len,
+                      const char *url, size_t url_len, const char *response, size_t response_len) {
+    if (key_len > HOT_CACHE_KEY_MAX || url_len > UINT32_MAX || response_len > UINT32_MAX) {
+        return;
+    }
+
+    size_t victim;
+    if (cache->count < cache->capacity) {
+        victim = cache->count++;
+    } else {
+        // Every entry referenced is one full turn at most
+        while (cache->entries[cache->hand].referenced) {
+            cache->entries[cache->hand].referenced = 0;
+            cache->hand = cache->hand + 1 == cache->capacity ? 0 : cache->hand + 1;
+        }
+        victim = cache->hand;
+        cache->hand = cache->hand + 1 == cache->capacity ? 0 : cache->hand + 1;
+        index_remove(cache, (uint32_t)victim);
+    }
+
+    HotCacheEntry *e = &cache->entries[victim];
+    e->hash = hash;
+    e->url = url;
+    e->response = response;
+    e->url_len = (uint32_t)url_len;
+    e->response_len = (uint32_t)response_len;
+    e->group = group;
+    e->key_len = (uint8_t)key_len;
+    e->referenced = 0;
+    memcpy(e->key, key, key_len);
+
+    size_t pos = (size_t)hash & cache->index_mask;
+    while (cache->index[pos] != 0) {
+        pos = (pos + 1) & cache->index_mask;
+    }
+    cache->index[pos] = (uint32_t)victim + 1;
+}
@@ -0,0 +1,54 @@
+/*
+ * Autor: Guido Barosio
+ * Email: guido@bravo47.com
+ * Fecha: 2024-06-08
+ */
+
+#ifndef HOT_CACHE_H
+#define HOT_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Small fixed-size cache of routes found in the mapped sources, owned by
+// one thread: no locks and no shared cache lines. Entries are found by
+// the key's route hash through an open-addressing table of their numbers
+// and evicted with CLOCK: a hand sweeps the entries, clearing the
+// referenced bit of those read since it last passed and taking the first
+// one found clear. Entries start clear, so a key read once is the first
+// to go and a scan of cold keys cannot flush the hot ones.
+//
+// The cache holds pointers into a route table; the generation ties them
+// to it (see hot_cache_clear()).
+#define HOT_CACHE_KEY_MAX 92
+
+typedef struct {
+    uint64_t hash;
+    const char *url;
+    const char *response;   // NULL for database values without one
+    uint32_t url_len;
+    uint32_t response_len;
+    uint16_t group;         // the route namespace
+    uint8_t key_len;
+    uint8_t referenced;
+    char key[HOT_CACHE_KEY_MAX];
+} HotCacheEntry;            // two cache lines
+
+typedef struct {
+    HotCacheEntry *entries;
+    uint32_t *index;        // entry number + 1; 0 marks an empty slot
+    size_t index_mask;
+    size_t capacity;
+    size_t count;
+    size_t hand;
+    uint64_t generation;
+} HotCache;
+
+int hot_cache_init(HotCache *cache, size_t capacity);
+void hot_cache_free(HotCache *cache);
+void hot_cache_clear(HotCache *cache, uint64_t generation);
+const HotCacheEntry *hot_cache_find(HotCache *cache, uint64_t hash, uint16_t group, const char *key, size_t key_len);
+void hot_cache_insert(HotCache *cache, uint64_t hash, uint16_t group, const char *key, size_t key_len,
+                      const char *url, size_t url_len, const char *response, size_t response_len);
+
+#endif // HOT_CACHE_H
@@ -0,0 +1,387 @@
+/*
+ * Autor: Guido Barosio
+ * Email: guido@bravo47.com
+ * Fecha: 2024-06-08
+ */
+
+#include "http_parser.h"
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define HTTP_SCAN_X86 1
+#endif
+
+#define MAX_SET 4
+#define BLOCK 32
+
+// Returns a mask with bit i set when p[i] is one of the set_len (at most
+// MAX_SET) bytes of set, for the BLOCK bytes at p.
+typedef uint32_t (*MatchBlock)(const char *p, const char *set, int set_len);
+
+static uint32_t match_scalar(const char *p, size_t len, const char *set, int set_len) {
+    uint32_t mask = 0;
+    for (size_t i = 0; i < len; i++) {
+        for (int j = 0; j < set_len; j++) {
+            if (p[i] == set[j]) {
+                mask |= 1u << i;
+                break;
+            }
+        }
+    }
+    return mask;
+}
+
+static uint32_t match_block_scalar(const char *p, const char *set, int set_len) {
+    return match_scalar(p, BLOCK, set, set_len);
+}
+
+// Portable word-at-a-time version: eight bytes per 64-bit operation. A
+// byte of x ^ needle is zero exactly where the needle matches; the high
+// bit of each byte of ~(((x & 0x7f..) + 0x7f..) | x) flags those bytes
+// without carries between them, and one multiply gathers the eight flags.
+static uint32_t match_word(uint64_t word, const char *set, int set_len) {
+    const uint64_t low7 = 0x7F7F7F7F7F7F7F7FULL;
+    uint64_t hits = 0;
+    for (int j = 0; j < set_len; j++) {
+        uint64_t x = word ^ ((uint64_t)(unsigned char)set[j] * 0x0101010101010101ULL);
+        hits |= ~(((x & low7) + low7) | x) & ~low7;
+    }
+    return (uint32_t)(((hits >> 7) * 0x0102040810204080ULL) >> 56);
+}
+
+static uint32_t match_block_swar(const char *p, const char *set, int set_len) {
+    uint32_t mask = 0;
+    for (int i = 0; i < BLOCK; i += 8) {
+        uint64_t word;
+        memcpy(&word, p + i, 8);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        word = __builtin_bswap64(word);
+#endif
+        mask |= match_word(word, set, set_len) << i;
+    }
+    return mask;
+}
+
+#ifdef HTTP_SCAN_X86
+static uint32_t match_block_sse2(const char *p, const char *set, int set_len) {
+    __m128i low = _mm_loadu_si128((const __m128i *)p);
+    __m128i high = _mm_loadu_si128((const __m128i *)(p + 16));
+    __m128i needle = _mm_set1_epi8(set[0]);
+    __m128i low_hits = _mm_cmpeq_epi8(low, needle);
+    __m128i high_hits = _mm_cmpeq_epi8(high, needle);
+    for (int j = 1; j < set_len; j++) {
+        needle = _mm_set1_epi8(set[j]);
+        low_hits = _mm_or_si128(low_hits, _mm_cmpeq_epi8(low, needle));
+        high_hits = _mm_or_si128(high_hits, _mm_cmpeq_epi8(high, needle));
+    }
+    return (uint32_t)_mm_movemask_epi8(low_hits) | (uint32_t)_mm_movemask_epi8(high_hits) << 16;
+}
+
+__attribute__((target("avx2")))
+static uint32_t match_block_avx2(const char *p, const char *set, int set_len) {
+    __m256i block = _mm256_loadu_si256((const __m256i *)p);
+    __m256i hits = _mm256_cmpeq_epi8(block, _mm256_set1_epi8(set[0]));
+    for (int j = 1; j < set_len; j++) {
+        hits = _mm256_or_si256(hits, _mm256_cmpeq_epi8(block, _mm256_set1_epi8(set[j])));
+    }
+    return (uint32_t)_mm256_movemask_epi8(hits);
+}
+#endif
+
+// Set once at start-up, before the event loops run
+static MatchBlock match_block = match_block_swar;
+
+// Matches for the bytes from p up to BLOCK or the end of the buffer,
+// whichever comes first. Near the end the block is loaded so that it ends
+// with the buffer, overlapping bytes already seen, and shifted: only a
+// buffer shorter than one block is matched a byte at a time, and nothing
+// outside [buffer, end) is read.
+static uint32_t match_at(const char *buffer, const char *p, const char *end, const char *set, int set_len) {
+    size_t left = end - p;
+    if (left >= BLOCK) {
+        return match_block(p, set, set_len);
+    }
+    if (end - buffer >= BLOCK) {
+        return match_block(end - BLOCK, set, set_len) >> (BLOCK - left);
+    }
+    return match_scalar(p, left, set, set_len);
+}
+
+// First byte from p in set, or end.
+static const char *find_any(const char *buffer, const char *p, const char *end, const char *set, int set_len) {
+    for (; p < end; p += BLOCK) {
+        uint32_t mask = match_at(buffer, p, end, set, set_len);
+        if (mask) {
+            return p + __builtin_ctz(mask);
+        }
+    }
+    return end;
+}
+
+static const char *const scan_names[HTTP_SCAN_COUNT] = {"scalar", "swar", "sse2", "avx2"};
+
+static HttpScanKind selected = HTTP_SCAN_SWAR;
+
+int http_scan_supported(HttpScanKind kind) {
+    switch (kind) {
+    case HTTP_SCAN_SCALAR:
+    case HTTP_SCAN_SWAR:
+        return 1;
+#ifdef HTTP_SCAN_X86
+    case HTTP_SCAN_SSE2:
+        return 1;   // part of x86-64
+    case HTTP_SCAN_AVX2:
+        return __builtin_cpu_supports("avx2");
+#endif
+    default:
+        return 0;
+    }
+}
+
+const char *http_scan_name(HttpScanKind kind) {
+    return kind < HTTP_SCAN_COUNT ? scan_names[kind] : "unknown";
+}
+
+// Switches the scanner. Returns 0, or -1 when the CPU lacks it.
+int http_parser_select(HttpScanKind kind) {
+    if (!http_scan_supported(kind)) {
+        return -1;
+    }
+    switch (kind) {
+    case HTTP_SCAN_SWAR:
+        match_block = match_block_swar;
+        break;
+#ifdef HTTP_SCAN_X86
+    case HTTP_SCAN_SSE2:
+        match_block = match_block_sse2;
+        break;
+    case HTTP_SCAN_AVX2:
+        match_block = match_block_avx2;
+        break;
+#endif
+    default:
+        match_block = match_block_scalar;
+        break;
+    }
+    selected = kind;
+    return 0;
+}
+
+HttpScanKind http_parser_selected(void) {
+    return selected;
+}
+
+// Picks the widest scanner the CPU supports.
+void init_http_parser(void) {
+    for (int kind = HTTP_SCAN_COUNT - 1; kind >= 0; kind--) {
+        if (http_parser_select((HttpScanKind)kind) == 0) {
+            return;
+        }
+    }
+}
+
+static const char *skip_space(const char *p, const char *end) {
+    while (p < end && (*p == ' ' || *p == '\t')) p++;
+    return p;
+}
+
+// End of [start, end) without its trailing blanks.
+static const char *trim_space(const char *start, const char *end) {
+    while (end > start && (end[-1] == ' ' || end[-1] == '\t')) end--;
+    return end;
+}
+
+// End of the token at p on a line ending at line_stop. The scan runs to
+// the end of the buffer rather than of the line, with '\n' in set, and
+// is clamped to the line, which also drops a CR before the line break.
+static const char *token_end(const char *buffer, const char *p, const char *line_stop, const char *end,
+                             const char *set, int set_len) {
+    const char *found = find_any(buffer, p, end, set, set_len);
+    return found < line_stop ? found : line_stop;
+}
+
+static int header_is(const char *line, size_t line_len, const char *name, size_t name_len) {
+    return line_len > name_len && line[name_len] == ':' && strncasecmp(line, name, name_len) == 0;
+}
+
+// True when token, compared without regard to case, is one of the
+// comma-separated elements of the header value [value, end). A longer
+// element that merely contains it does not count.
+static int value_has_token(const char *value, const char *end, const char *token) {
+    size_t token_len = strlen(token);
+    while (value < end) {
+        const char *element = skip_space(value, end);
+        const char *comma = element;
+        while (comma < end && *comma != ',') comma++;
+        const char *element_end = trim_space(element, comma);
+        if ((size_t)(element_end - element) == token_len && strncasecmp(element, token, token_len) == 0) {
+            return 1;
+        }
+        value = comma + 1;
+    }
+    return 0;
+}
+
+// Picks out the headers the server acts on; the rest are skipped. The
+// first letter rules out most lines before any name is compared.
+static void parse_header(const char *line, size_t line_len, HttpHead *head) {
+    const char *end = line + line_len;
+    switch (line[0] | 0x20) {
+    case 'h':
+        if (header_is(line, line_len, "Host", 4) && head->host == NULL) {
+            const char *value = skip_space(line + 5, end);
+            head->host = value;
+            head->host_len = trim_space(value, end) - value;
+        }
+        break;
+    case 'c':
+        if (header_is(line, line_len, "Connection", 10)) {
+            if (value_has_token(line + 11, end, "close")) {
+                head->connection = HTTP_CONNECTION_CLOSE;
+            } else if (value_has_token(line + 11, end, "keep-alive")) {
+                head->connection = HTTP_CONNECTION_KEEP_ALIVE;
+            }
+        } else if (header_is(line, line_len, "Content-Length", 14)) {
+            size_t length = 0;
+            for (const char *p = skip_space(line + 15, end); p < end && *p >= '0' && *p <= '9'; p++) {
+                if (length > ((size_t)-1 - 9) / 10) {
+                    length = (size_t)-1;
+                    break;
+                }
+                length = length * 10 + (size_t)(*p - '0');
+            }
+            head->content_length = length;
+        }
+        break;
+    case 't':
+        if (header_is(line, line_len, "Transfer-Encoding", 17)) {
+            head->chunked = 1;
+        }
+        break;
+    }
+}
+
+// Looks for the end of the head among the bytes read since scan was
+// saved: any line break while the request line is incomplete, otherwise
+// one closing an empty line. Moves scan on and returns 0 when there is
+// none yet.
+static int head_may_end(const char *buffer, const char *end, HttpScan *scan) {
+    const char *nl = find_any(buffer, buffer + scan->scanned, end, "\n", 1);
+    if (!scan->in_headers) {
+        if (nl < end) {
+            return 1;
+        }
+    } else {
+        // The request line's break comes before scanned, so the two bytes
+        // in front of a later one are in the buffer
+        for (; nl < end; nl = find_any(buffer, nl + 1, end, "\n", 1)) {
+            if (nl[-1] == '\n' || (nl[-1] == '\r' && nl[-2] == '\n')) {
+                return 1;
+            }
+        }
+    }
+    scan->scanned = end - buffer;
+    return 0;
+}
+
+// Records in scan, when there is one, that the head is incomplete.
+static long incomplete(size_t len, int in_headers, HttpScan *scan) {
+    if (scan) {
+        scan->scanned = len;
+        scan->in_headers = in_headers;
+    }
+    return 0;
+}
+
+// The parse itself, from the start of the buffer.
+static long parse_head(const char *buffer, const char *end, HttpHead *head, HttpScan *scan) {
+    const char *line_end = find_any(buffer, buffer, end, "\n", 1);
+    if (line_end == end) {
+        return incomplete(end - buffer, 0, scan);
+    }
+    const char *line_stop = line_end;
+    if (line_stop > buffer && line_stop[-1] == '\r') line_stop--;
+
+    // Method, target (split at the query string) and version, separated
+    // by blanks
+    const char *method = buffer;
+    const char *method_end = token_end(buffer, method, line_stop, end, " \t\n", 3);
+    const char *path = skip_space(method_end, line_stop);
+    const char *path_end = token_end(buffer, path, line_stop, end, " \t?\n", 4);
+    const char *target_end = token_end(buffer, path_end, line_stop, end, " \t\n", 3);
+    const char *version = skip_space(target_end, line_stop);
+
+    if (method_end == method || path_end == path) {
+        return -1;
+    }
+
+    head->method = method;
+    head->method_len = method_end - method;
+    head->path = path;
+    head->path_len = path_end - path;
+    head->host = NULL;
+    head->host_len = 0;
+    head->connection = HTTP_CONNECTION_DEFAULT;
+    head->chunked = 0;
+    head->content_length = 0;
+
+    if (version == line_stop) {
+        // Request line without a version: no headers follow
+        head->minor_version = -1;
+        return line_end + 1 - buffer;
+    }
+    // The version closes the request line and is one of the two spoken
+    if (line_stop - version != 8 || memcmp(version, "HTTP/1.", 7) != 0 || (version[7] != '0' && version[7] != '1')) {
+        return -1;
+    }
+    head->minor_version = version[7] - '0';
+
+    // Headers run until an empty line. Line breaks are matched a block at
+    // a time and taken from the mask one by one, so a block is compared
+    // once however many lines it holds.
+    const char *line = line_end + 1;
+    const char *block = line;
+    uint32_t breaks = block < end ? match_at(buffer, block, end, "\n", 1) : 0;
+    while (1) {
+        while (breaks == 0) {
+            block += BLOCK;
+            if (block >= end) {
+                return incomplete(end - buffer, 1, scan);
+            }
+            breaks = match_at(buffer, block, end, "\n", 1);
+        }
+        const char *next = block + __builtin_ctz(breaks);
+        breaks &= breaks - 1;
+
+        size_t line_len = next - line;
+        if (line_len > 0 && line[line_len - 1] == '\r') line_len--;
+        if (line_len == 0) {
+            return next + 1 - buffer;
+        }
+        parse_header(line, line_len, head);
+        line = next + 1;
+    }
+}
+
+// Parses the request head at the start of buffer: the request line and,
+// when it carries a version, the headers up to the empty line. Returns
+// the length of the head, 0 when it is incomplete and -1 when it is
+// malformed. A body is not included; see head->content_length.
+// With a scan, an incomplete head is parsed again only once the newly
+// read bytes may complete it; until then only they are searched. scan is
+// zeroed on any result but 0.
+long http_parse_head(const char *buffer, size_t len, HttpHead *head, HttpScan *scan) {
+    const char *end = buffer + len;
+    if (scan && scan->scanned > 0 && !head_may_end(buffer, end, scan)) {
+        return 0;
+    }
+    long result = parse_head(buffer, end, head, scan);
+    if (scan && result != 0) {
+        scan->scanned = 0;
+        scan->in_headers = 0;
+    }
+    return result;
+}
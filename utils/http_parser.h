@@ -0,0 +1,60 @@
+/*
+ * Autor: Guido Barosio
+ * Email: guido@bravo47.com
+ * Fecha: 2024-06-08
+ */
+
+#ifndef HTTP_PARSER_H
+#define HTTP_PARSER_H
+
+#include <stddef.h>
+
+// Scanner implementations, all matching 32-byte blocks of the request
+// against a few delimiters at a time. init_http_parser() picks the widest
+// the CPU supports; until then, and on other architectures, the portable
+// word-at-a-time one runs. The scalar one is the reference for tests.
+typedef enum {
+    HTTP_SCAN_SCALAR,   // a byte at a time
+    HTTP_SCAN_SWAR,     // 8 bytes per 64-bit operation
+    HTTP_SCAN_SSE2,     // 16 bytes per instruction
+    HTTP_SCAN_AVX2,     // 32 bytes per instruction
+    HTTP_SCAN_COUNT
+} HttpScanKind;
+
+typedef enum {
+    HTTP_CONNECTION_DEFAULT,    // no Connection header, or neither token
+    HTTP_CONNECTION_CLOSE,
+    HTTP_CONNECTION_KEEP_ALIVE
+} HttpConnection;
+
+// A parsed request head. Every string is a slice of the parsed buffer,
+// which is never written to.
+typedef struct {
+    const char *method;
+    size_t method_len;
+    const char *path;           // the request target without its query string
+    size_t path_len;
+    const char *host;           // NULL without a Host header
+    size_t host_len;
+    int minor_version;          // x in HTTP/1.x, -1 for a request line without a version
+    HttpConnection connection;
+    int chunked;                // Transfer-Encoding present
+    size_t content_length;
+} HttpHead;
+
+// Where the search for the end of a head still arriving stopped, so that
+// the next call, on the same buffer grown by newly read bytes, only
+// searches those. Zero it for each new request.
+typedef struct {
+    size_t scanned;             // bytes known not to hold the end of the head
+    int in_headers;             // the request line is complete; only an empty line ends the head
+} HttpScan;
+
+void init_http_parser(void);
+int http_parser_select(HttpScanKind kind);
+HttpScanKind http_parser_selected(void);
+int http_scan_supported(HttpScanKind kind);
+const char *http_scan_name(HttpScanKind kind);
+long http_parse_head(const char *buffer, size_t len, HttpHead *head, HttpScan *scan);
+
+#endif // HTTP_PARSER_H
@@ -0,0 +1,198 @@
+/*
+ * Autor: Guido Barosio
+ * Email: guido@bravo47.com
+ * Fecha: 2024-06-08
+ */
+
+#include "latency.h"
+#include "logs.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <time.h>
+
+#define MAX_LATENCY_THREADS 256
+
+static _Atomic(LatencyBlock *) blocks[MAX_LATENCY_THREADS];
+static atomic_int block_count = 0;
+static double ns_per_tick = 1.0;
+
+__thread LatencyBlock *latency_block = NULL;
+
+static const char *phase_names[LATENCY_PHASES] = {
+    "first_byte", "parse", "pre_routing", "lookup", "respond", "post_routing", "send", "total"
+};
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// Measures the tick rate against CLOCK_MONOTONIC. Histograms count raw
+// ticks; they are only converted to time when read.
+void init_latency(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    struct timespec pause = {0, 20000000};
+    uint64_t ns = monotonic_ns();
+    uint64_t ticks = latency_now();
+    nanosleep(&pause, NULL);
+    uint64_t elapsed_ticks = latency_now() - ticks;
+    uint64_t elapsed_ns = monotonic_ns() - ns;
+    if (elapsed_ticks > 0) {
+        ns_per_tick = (double)elapsed_ns / (double)elapsed_ticks;
+    }
+#endif
+}
+
+// Gives the calling thread histograms of its own; until then its
+// latency_record() calls do nothing. Returns 0, or -1 when out of blocks
+// or memory.
+int latency_register(void) {
+    if (latency_block) {
+        return 0;
+    }
+    LatencyBlock *block = calloc(1, sizeof(LatencyBlock));
+    if (block == NULL) {
+        return -1;
+    }
+    int id = atomic_fetch_add(&block_count, 1);
+    if (id >= MAX_LATENCY_THREADS) {
+        atomic_fetch_sub(&block_count, 1);
+        free(block);
+        return -1;
+    }
+    atomic_store_explicit(&blocks[id], block, memory_order_release);
+    latency_block = block;
+    return 0;
+}
+
+// Sums phase's histogram over every thread into histogram and returns
+// the number of samples.
+static uint64_t merge(LatencyPhase phase, uint64_t *histogram, uint64_t *sum) {
+    int count = atomic_load(&block_count);
+    uint64_t total = 0;
+
+    for (int b = 0; b < LATENCY_BUCKETS; b++) {
+        histogram[b] = 0;
+    }
+    *sum = 0;
+    for (int i = 0; i < count && i < MAX_LATENCY_THREADS; i++) {
+        LatencyBlock *block = atomic_load_explicit(&blocks[i], memory_order_acquire);
+        if (block == NULL) {
+            continue;   // registering right now
+        }
+        for (int b = 0; b < LATENCY_BUCKETS; b++) {
+            uint64_t n = __atomic_load_n(&block->counts[phase][b], __ATOMIC_RELAXED);
+            histogram[b] += n;
+            total += n;
+        }
+        *sum += __atomic_load_n(&block->sums[phase], __ATOMIC_RELAXED);
+    }
+    return total;
+}
+
+// Midpoint of the tick values that fall into bucket index
+static uint64_t bucket_value(int index) {
+    if (index < LATENCY_SUB_BUCKETS) {
+        return (uint64_t)index;
+    }
+    int bit = (index - LATENCY_SUB_BUCKETS) / (LATENCY_SUB_BUCKETS / 2) + 6;
+    int shift = bit - 5;
+    uint64_t low = ((uint64_t)((index - LATENCY_SUB_BUCKETS) % (LATENCY_SUB_BUCKETS / 2)) + LATENCY_SUB_BUCKETS / 2) << shift;
+    return low + ((1ull << shift) >> 1);
+}
+
+// Value in nanoseconds below which fraction of the samples fall.
+static uint64_t percentile_of(const uint64_t *histogram, uint64_t total, double fraction) {
+    if (total == 0) {
+        return 0;
+    }
+    // Rank of the sample, rounded up
+    uint64_t rank = (uint64_t)(fraction * (double)total);
+    if (rank == 0 || (double)rank < fraction * (double)total) {
+        rank++;
+    }
+    uint64_t seen = 0;
+    for (int b = 0; b < LATENCY_BUCKETS; b++) {
+        seen += histogram[b];
+        if (seen >= rank) {
+            return (uint64_t)((double)bucket_value(b) * ns_per_tick);
+        }
+    }
+    return 0;
+}
+
+uint64_t latency_count(LatencyPhase phase) {
+    uint64_t histogram[LATENCY_BUCKETS];
+    uint64_t sum;
+    return merge(phase, histogram, &sum);
+}
+
+uint64_t latency_percentile(LatencyPhase phase, double fraction) {
+    uint64_t histogram[LATENCY_BUCKETS];
+    uint64_t sum;
+    uint64_t total = merge(phase, histogram, &sum);
+    return percentile_of(histogram, total, fraction);
+}
+
+const char *latency_phase_name(LatencyPhase phase) {
+    return phase_names[phase];
+}
+
+// Writes every phase as a Prometheus summary (p50, p99, p99.9, sum and
+// count). Returns the number of bytes written; output that does not fit
+// is cut at a phase boundary.
+size_t latency_format(char *out, size_t size) {
+    static const char header[] =
+        "# HELP yathr_request_phase_seconds Server-side time spent per request phase.\n"
+        "# TYPE yathr_request_phase_seconds summary\n";
+    uint64_t histogram[LATENCY_BUCKETS];
+    size_t len = 0;
+
+    int n = snprintf(out, size, "%s", header);
+    if (n < 0 || (size_t)n >= size) {
+        if (size > 0) {
+            out[0] = '\0';
+        }
+        return 0;
+    }
+    len = n;
+
+    for (int phase = 0; phase < LATENCY_PHASES; phase++) {
+        uint64_t sum;
+        uint64_t total = merge(phase, histogram, &sum);
+        const char *name = phase_names[phase];
+        n = snprintf(out + len, size - len,
+                     "yathr_request_phase_seconds{phase=\"%s\",quantile=\"0.5\"} %.9f\n"
+                     "yathr_request_phase_seconds{phase=\"%s\",quantile=\"0.99\"} %.9f\n"
+                     "yathr_request_phase_seconds{phase=\"%s\",quantile=\"0.999\"} %.9f\n"
+                     "yathr_request_phase_seconds_sum{phase=\"%s\"} %.9f\n"
+                     "yathr_request_phase_seconds_count{phase=\"%s\"} %llu\n",
+                     name, percentile_of(histogram, total, 0.50) / 1e9,
+                     name, percentile_of(histogram, total, 0.99) / 1e9,
+                     name, percentile_of(histogram, total, 0.999) / 1e9,
+                     name, (double)sum * ns_per_tick / 1e9,
+                     name, (unsigned long long)total);
+        if (n < 0 || (size_t)n >= size - len) {
+            out[len] = '\0';
+            break;
+        }
+        len += n;
+    }
+    return len;
+}
+
+// Logs p50/p99/p99.9 of every phase (on SIGUSR1).
+void latency_dump(void) {
+    uint64_t histogram[LATENCY_BUCKETS];
+    for (int phase = 0; phase < LATENCY_PHASES; phase++) {
+        uint64_t sum;
+        uint64_t total = merge(phase, histogram, &sum);
+        log_info("Latency %-12s count=%llu p50=%lluns p99=%lluns p999=%lluns", phase_names[phase],
+                 (unsigned long long)total,
+                 (unsigned long long)percentile_of(histogram, total, 0.50),
+                 (unsigned long long)percentile_of(histogram, total, 0.99),
+                 (unsigned long long)percentile_of(histogram, total, 0.999));
+    }
+}
@@ -0,0 +1,90 @@
+/*
+ * Autor: Guido Barosio
+ * Email: guido@bravo47.com
+ * Fecha: 2024-06-08
+ */
+
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <time.h>
+#endif
+
+// Phases of the request path timed per worker.
+typedef enum {
+    LATENCY_FIRST_BYTE,     // accept to the first request bytes being processed
+    LATENCY_PARSE,          // request head search and parse
+    LATENCY_PRE_ROUTING,    // PRE_ROUTING plugins
+    LATENCY_LOOKUP,         // route lookup
+    LATENCY_RESPOND,        // queueing the response and the access log record
+    LATENCY_POST_ROUTING,   // POST_ROUTING plugins
+    LATENCY_SEND,           // handing queued output to the kernel (per flush)
+    LATENCY_TOTAL,          // parse through POST_ROUTING, per request
+    LATENCY_PHASES
+} LatencyPhase;
+
+// Log-linear buckets over clock ticks: exact below 64, then 32 buckets
+// per power of two (at most ~3% error). Longer times land in the last
+// bucket.
+#define LATENCY_SUB_BUCKETS 64
+#define LATENCY_MAX_BIT 40
+#define LATENCY_BUCKETS (LATENCY_SUB_BUCKETS + (LATENCY_MAX_BIT - 6) * (LATENCY_SUB_BUCKETS / 2))
+
+// One thread's histograms, allocated by latency_register(). Only the
+// owning thread writes them.
+typedef struct {
+    uint64_t sums[LATENCY_PHASES];
+    uint64_t counts[LATENCY_PHASES][LATENCY_BUCKETS];
+} LatencyBlock;
+
+extern __thread LatencyBlock *latency_block;
+
+// Cheap timestamp in clock ticks: the TSC on x86, CLOCK_MONOTONIC (a vDSO
+// call, in nanoseconds) elsewhere. init_latency() measures the tick rate.
+static inline uint64_t latency_now(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+static inline int latency_bucket(uint64_t ticks) {
+    if (ticks < LATENCY_SUB_BUCKETS) {
+        return (int)ticks;
+    }
+    int bit = 63 - __builtin_clzll(ticks);      // >= 6
+    if (bit >= LATENCY_MAX_BIT) {
+        return LATENCY_BUCKETS - 1;
+    }
+    int shift = bit - 5;
+    return LATENCY_SUB_BUCKETS + (bit - 6) * (LATENCY_SUB_BUCKETS / 2) + (int)((ticks >> shift) - LATENCY_SUB_BUCKETS / 2);
+}
+
+// Records ticks (an end minus a start timestamp) for phase. A no-op on
+// threads that did not register.
+static inline void latency_record(LatencyPhase phase, uint64_t ticks) {
+    if (latency_block) {
+        uint64_t *count = &latency_block->counts[phase][latency_bucket(ticks)];
+        uint64_t *sum = &latency_block->sums[phase];
+        __atomic_store_n(count, __atomic_load_n(count, __ATOMIC_RELAXED) + 1, __ATOMIC_RELAXED);
+        __atomic_store_n(sum, __atomic_load_n(sum, __ATOMIC_RELAXED) + ticks, __ATOMIC_RELAXED);
+    }
+}
+
+void init_latency(void);
+int latency_register(void);
+uint64_t latency_count(LatencyPhase phase);
+uint64_t latency_percentile(LatencyPhase phase, double fraction);
+const char *latency_phase_name(LatencyPhase phase);
+size_t latency_format(char *out, size_t size);
+void latency_dump(void);
+
+#endif // LATENCY_H
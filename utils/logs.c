@@ -9,30 +9,44 @@
 #include <stdarg.h>
 #include <zlog.h>
 
+// Looked up once: zlog_get_category() takes a lock and walks a list
+static zlog_category_t *category = NULL;
+
 void init_logs() {
     if (dzlog_init("zlog.conf", "my_cat")) {
         printf("init failed\n");
         return;
     }
+    category = zlog_get_category("my_cat");
 }
 
+// The level is checked before the format string is touched
 void log_info(const char *format, ...) {
+    if (category == NULL || !zlog_level_enabled(category, ZLOG_LEVEL_INFO)) {
+        return;
+    }
     va_list args;
     va_start(args, format);
-    vzlog_info(zlog_get_category("my_cat"), format, args);
+    vzlog_info(category, format, args);
     va_end(args);
 }
 
 void log_error(const char *format, ...) {
+    if (category == NULL || !zlog_level_enabled(category, ZLOG_LEVEL_ERROR)) {
+        return;
+    }
     va_list args;
     va_start(args, format);
-    vzlog_error(zlog_get_category("my_cat"), format, args);
+    vzlog_error(category, format, args);
     va_end(args);
 }
 
 void log_warning(const char *format, ...) {
+    if (category == NULL || !zlog_level_enabled(category, ZLOG_LEVEL_WARN)) {
+        return;
+    }
     va_list args;
     va_start(args, format);
-    vzlog_warn(zlog_get_category("my_cat"), format, args);
+    vzlog_warn(category, format, args);
     va_end(args);
 }
@@ -0,0 +1,121 @@
+/*
+ * Autor: Guido Barosio
+ * Email: guido@bravo47.com
+ * Fecha: 2024-06-08
+ */
+
+#include "metrics.h"
+#include <stdio.h>
+#include <stdatomic.h>
+
+#define MAX_METRIC_THREADS 256
+
+static MetricBlock blocks[MAX_METRIC_THREADS];
+static MetricBlock shared_block;
+static atomic_int block_count = 0;
+
+__thread MetricBlock *metric_block = &shared_block;
+
+// Gives the calling thread a block of its own. Returns 0, or -1 when all
+// blocks are taken and the thread keeps using the shared one.
+int metrics_register(void) {
+    int id = atomic_fetch_add(&block_count, 1);
+    if (id >= MAX_METRIC_THREADS) {
+        atomic_fetch_sub(&block_count, 1);
+        return -1;
+    }
+    metric_block = &blocks[id];
+    return 0;
+}
+
+// Sums a counter over every thread. Each block is read without stopping
+// its writer, so the total may trail the most recent updates.
+uint64_t metrics_total(Metric metric) {
+    int count = atomic_load(&block_count);
+    if (count > MAX_METRIC_THREADS) {
+        count = MAX_METRIC_THREADS;
+    }
+
+    uint64_t total = __atomic_load_n(&shared_block.values[metric], __ATOMIC_RELAXED);
+    for (int i = 0; i < count; i++) {
+        total += __atomic_load_n(&blocks[i].values[metric], __ATOMIC_RELAXED);
+    }
+    return total;
+}
+
+// Appends one metric in the Prometheus text format. Returns the number of
+// bytes written, or 0 when it does not fit.
+size_t metrics_format_value(char *out, size_t size, const char *name, const char *type,
+                            const char *help, unsigned long long value) {
+    int n = snprintf(out, size, "# HELP %s %s\n# TYPE %s %s\n%s %llu\n", name, help, name, type, name, value);
+    if (n < 0 || (size_t)n >= size) {
+        if (size > 0) {
+            out[0] = '\0';
+        }
+        return 0;
+    }
+    return (size_t)n;
+}
+
+// Writes the server's counters in the Prometheus text format. Returns the
+// number of bytes written; output that does not fit is cut at a metric
+// boundary.
+size_t metrics_format(char *out, size_t size) {
+    uint64_t opened = metrics_total(METRIC_CONNECTIONS_OPENED);
+    uint64_t closed = metrics_total(METRIC_CONNECTIONS_CLOSED);
+    size_t len = 0;
+
+    int n = snprintf(out, size,
+                     "# HELP yathr_requests_total Requests answered, by response status.\n"
+                     "# TYPE yathr_requests_total counter\n"
+                     "yathr_requests_total{status=\"302\"} %llu\n"
+                     "yathr_requests_total{status=\"404\"} %llu\n"
+                     "yathr_requests_total{status=\"400\"} %llu\n"
+                     "yathr_requests_total{status=\"500\"} %llu\n",
+                     (unsigned long long)metrics_total(METRIC_REDIRECTS),
+                     (unsigned long long)metrics_total(METRIC_NOT_FOUND),
+                     (unsigned long long)metrics_total(METRIC_BAD_REQUESTS),
+                     (unsigned long long)metrics_total(METRIC_SERVER_ERRORS));
+    if (n < 0 || (size_t)n >= size) {
+        if (size > 0) {
+            out[0] = '\0';
+        }
+        return 0;
+    }
+    len = n;
+
+    len += metrics_format_value(out + len, size - len, "yathr_connections_accepted_total", "counter",
+                                "Client connections accepted.", opened);
+    // The totals are read one after the other, so a connection closing
+    // in between can make closes briefly outnumber opens
+    len += metrics_format_value(out + len, size - len, "yathr_connections_active", "gauge",
+                                "Client connections currently open.", opened > closed ? opened - closed : 0);
+    len += metrics_format_value(out + len, size - len, "yathr_accept_errors_total", "counter",
+                                "Failed accepts, other than the listener running dry.",
+                                metrics_total(METRIC_ACCEPT_ERRORS));
+    len += metrics_format_value(out + len, size - len, "yathr_bytes_sent_total", "counter",
+                                "Response bytes written to client sockets.", metrics_total(METRIC_BYTES_SENT));
+    len += metrics_format_value(out + len, size - len, "yathr_route_filter_rejected_total", "counter",
+                                "Lookups answered by the route filter alone.", metrics_total(METRIC_FILTER_REJECTED));
+    len += metrics_format_value(out + len, size - len, "yathr_route_filter_false_positives_total", "counter",
+                                "Lookups the route filter passed that found no route.",
+                                metrics_total(METRIC_FILTER_FALSE_POSITIVES));
+
+    uint64_t cache_hits = metrics_total(METRIC_ROUTE_CACHE_HITS);
+    uint64_t cache_misses = metrics_total(METRIC_ROUTE_CACHE_MISSES);
+    len += metrics_format_value(out + len, size - len, "yathr_route_cache_hits_total", "counter",
+                                "Lookups answered by a worker's route cache.", cache_hits);
+    len += metrics_format_value(out + len, size - len, "yathr_route_cache_misses_total", "counter",
+                                "Route cache lookups that went on to the route table.", cache_misses);
+    n = snprintf(out + len, size - len,
+                 "# HELP yathr_route_cache_hit_ratio Share of route cache lookups it answered.\n"
+                 "# TYPE yathr_route_cache_hit_ratio gauge\n"
+                 "yathr_route_cache_hit_ratio %.4f\n",
+                 cache_hits + cache_misses > 0 ? (double)cache_hits / (double)(cache_hits + cache_misses) : 0.0);
+    if (n > 0 && (size_t)n < size - len) {
+        len += n;
+    } else if (len < size) {
+        out[len] = '\0';
+    }
+    return len;
+}
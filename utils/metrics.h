@@ -0,0 +1,55 @@
+/*
+ * Autor: Guido Barosio
+ * Email: guido@bravo47.com
+ * Fecha: 2024-06-08
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum {
+    METRIC_REDIRECTS,           // 302 responses
+    METRIC_NOT_FOUND,           // 404 responses
+    METRIC_BAD_REQUESTS,        // 400 responses
+    METRIC_SERVER_ERRORS,       // 500 responses
+    METRIC_CONNECTIONS_OPENED,
+    METRIC_CONNECTIONS_CLOSED,
+    METRIC_ACCEPT_ERRORS,
+    METRIC_BYTES_SENT,
+    METRIC_FILTER_REJECTED,         // lookups the route filter turned away
+    METRIC_FILTER_FALSE_POSITIVES,  // lookups it let through that missed anyway
+    METRIC_ROUTE_CACHE_HITS,        // lookups answered by a worker's route cache
+    METRIC_ROUTE_CACHE_MISSES,      // lookups that asked it and went on to the table
+    METRIC_COUNT
+} Metric;
+
+// One thread's counters, on cache lines of their own. Only the owning
+// thread writes them, so an update is a plain load, add and store (no
+// locked instruction); a scrape sums every block with relaxed loads.
+typedef struct {
+    _Alignas(64) uint64_t values[METRIC_COUNT];
+} MetricBlock;
+
+// The calling thread's block. Threads that never call metrics_register()
+// share a fallback block, where concurrent updates may be lost.
+extern __thread MetricBlock *metric_block;
+
+static inline void metric_add(Metric metric, uint64_t n) {
+    uint64_t *value = &metric_block->values[metric];
+    __atomic_store_n(value, __atomic_load_n(value, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED);
+}
+
+static inline void metric_inc(Metric metric) {
+    metric_add(metric, 1);
+}
+
+int metrics_register(void);
+uint64_t metrics_total(Metric metric);
+size_t metrics_format(char *out, size_t size);
+size_t metrics_format_value(char *out, size_t size, const char *name, const char *type,
+                            const char *help, unsigned long long value);
+
+#endif // METRICS_H
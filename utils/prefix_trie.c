@@ -0,0 +1,181 @@
+/*
+ * Autor: Guido Barosio
+ * Email: guido@bravo47.com
+ * Fecha: 2024-06-08
+ */
+
+#include "prefix_trie.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Appends a node with the given label and no children. Returns its
+// number, or -1 when out of memory. Invalidates pointers to nodes.
+static long node_add(PrefixTrie *trie, uint32_t label, uint32_t label_len, uint32_t value) {
+    if (trie->count >= UINT32_MAX) {
+        errno = ENOSPC;
+        return -1;
+    }
+    if (trie->count == trie->capacity) {
+        size_t capacity = trie->capacity ? trie->capacity * 2 : 16;
+        PrefixTrieNode *nodes = realloc(trie->nodes, capacity * sizeof(PrefixTrieNode));
+        if (nodes == NULL) {
+            return -1;
+        }
+        trie->nodes = nodes;
+        trie->capacity = capacity;
+    }
+    trie->nodes[trie->count] = (PrefixTrieNode){label, label_len, value, 0, 0, NULL, NULL};
+    return (long)trie->count++;
+}
+
+static int child_add(PrefixTrieNode *node, unsigned char first, uint32_t child) {
+    if (node->child_count == node->child_capacity) {
+        uint32_t capacity = node->child_capacity ? node->child_capacity * 2 : 2;
+        unsigned char *firsts = realloc(node->first, capacity);
+        if (firsts == NULL) {
+            return 0;
+        }
+        node->first = firsts;
+        uint32_t *children = realloc(node->children, capacity * sizeof(uint32_t));
+        if (children == NULL) {
+            return 0;
+        }
+        node->children = children;
+        node->child_capacity = capacity;
+    }
+    node->first[node->child_count] = first;
+    node->children[node->child_count] = child;
+    node->child_count++;
+    return 1;
+}
+
+// Position among node's children of the one whose label starts with c,
+// or -1.
+static long child_find(const PrefixTrieNode *node, unsigned char c) {
+    const unsigned char *found = node->child_count ? memchr(node->first, c, node->child_count) : NULL;
+    return found ? found - node->first : -1;
+}
+
+// Copies the rest of a key into the label pool. Returns its offset, or -1.
+static long label_add(PrefixTrie *trie, const char *bytes, size_t len) {
+    if (trie->labels_used + len > UINT32_MAX) {
+        errno = ENOSPC;
+        return -1;
+    }
+    if (trie->labels_used + len > trie->labels_capacity) {
+        size_t capacity = trie->labels_capacity ? trie->labels_capacity : 256;
+        while (capacity < trie->labels_used + len) {
+            capacity *= 2;
+        }
+        char *labels = realloc(trie->labels, capacity);
+        if (labels == NULL) {
+            return -1;
+        }
+        trie->labels = labels;
+        trie->labels_capacity = capacity;
+    }
+    memcpy(trie->labels + trie->labels_used, bytes, len);
+    trie->labels_used += len;
+    return (long)(trie->labels_used - len);
+}
+
+// Adds key with value, replacing the value of a key already there. Key
+// is a slice, not NUL-terminated. Returns 0, or -1 when out of memory; a
+// failed insertion leaves the keys already there in place.
+int prefix_trie_insert(PrefixTrie *trie, const char *key, size_t len, uint32_t value) {
+    if (trie->count == 0 && node_add(trie, 0, 0, PREFIX_TRIE_NONE) == -1) {
+        return -1;
+    }
+
+    uint32_t n = 0;
+    size_t depth = 0;
+    while (depth < len) {
+        long pos = child_find(&trie->nodes[n], (unsigned char)key[depth]);
+        if (pos < 0) {
+            // Nothing shares the next byte: the rest hangs off n as a leaf
+            long label = label_add(trie, key + depth, len - depth);
+            long leaf = label >= 0 ? node_add(trie, (uint32_t)label, (uint32_t)(len - depth), value) : -1;
+            if (leaf == -1) {
+                return -1;
+            }
+            if (!child_add(&trie->nodes[n], (unsigned char)key[depth], (uint32_t)leaf)) {
+                trie->count--;
+                return -1;
+            }
+            return 0;
+        }
+
+        uint32_t c = trie->nodes[n].children[pos];
+        const PrefixTrieNode *child = &trie->nodes[c];
+        const char *label = trie->labels + child->label;
+        size_t common = 1;
+        while (common < child->label_len && depth + common < len && label[common] == key[depth + common]) {
+            common++;
+        }
+        if (common < child->label_len) {
+            // The key leaves the edge halfway: split it, the upper part
+            // becoming a node of its own with the old child below
+            long mid = node_add(trie, child->label, (uint32_t)common, PREFIX_TRIE_NONE);
+            if (mid == -1) {
+                return -1;
+            }
+            PrefixTrieNode *lower = &trie->nodes[c];
+            if (!child_add(&trie->nodes[mid], (unsigned char)trie->labels[lower->label + common], c)) {
+                trie->count--;
+                return -1;
+            }
+            lower->label += (uint32_t)common;
+            lower->label_len -= (uint32_t)common;
+            trie->nodes[n].children[pos] = (uint32_t)mid;
+            c = (uint32_t)mid;
+        }
+        n = c;
+        depth += common;
+    }
+    trie->nodes[n].value = value;
+    return 0;
+}
+
+// Returns the value of the longest key that key (a slice) starts with,
+// setting matched to its length, or PREFIX_TRIE_NONE when none does.
+uint32_t prefix_trie_longest(const PrefixTrie *trie, const char *key, size_t len, size_t *matched) {
+    if (trie->count == 0) {
+        return PREFIX_TRIE_NONE;
+    }
+
+    uint32_t best = PREFIX_TRIE_NONE;
+    const PrefixTrieNode *node = &trie->nodes[0];
+    size_t depth = 0;
+    while (1) {
+        if (node->value != PREFIX_TRIE_NONE) {
+            best = node->value;
+            *matched = depth;
+        }
+        if (depth == len) {
+            break;
+        }
+        long pos = child_find(node, (unsigned char)key[depth]);
+        if (pos < 0) {
+            break;
+        }
+        const PrefixTrieNode *child = &trie->nodes[node->children[pos]];
+        if (child->label_len > len - depth ||
+            memcmp(trie->labels + child->label, key + depth, child->label_len) != 0) {
+            break;
+        }
+        depth += child->label_len;
+        node = child;
+    }
+    return best;
+}
+
+void prefix_trie_free(PrefixTrie *trie) {
+    for (size_t i = 0; i < trie->count; i++) {
+        free(trie->nodes[i].first);
+        free(trie->nodes[i].children);
+    }
+    free(trie->nodes);
+    free(trie->labels);
+    *trie = (PrefixTrie){0};
+}
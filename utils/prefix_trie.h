@@ -0,0 +1,47 @@
+/*
+ * Autor: Guido Barosio
+ * Email: guido@bravo47.com
+ * Fecha: 2024-06-08
+ */
+
+#ifndef PREFIX_TRIE_H
+#define PREFIX_TRIE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Path-compressed trie (a radix tree) over byte-string keys, answering
+// which of its keys is the longest prefix of a given string. A node with
+// a single child is merged into it, so each edge carries a label of any
+// length and a lookup takes one step per branching point rather than per
+// byte: a key set like "docs/", "docs/api/" and "blog/" is three nodes
+// below the root however long the keys are.
+//
+// Labels are slices of one pool that only ever grows; splitting an edge
+// splits its slice in two and copies nothing.
+#define PREFIX_TRIE_NONE UINT32_MAX
+
+typedef struct {
+    uint32_t label;         // offset in the pool
+    uint32_t label_len;
+    uint32_t value;         // PREFIX_TRIE_NONE when no key ends here
+    uint32_t child_count;
+    uint32_t child_capacity;
+    unsigned char *first;   // each child's first label byte, unordered
+    uint32_t *children;     // node numbers, same positions
+} PrefixTrieNode;
+
+typedef struct {
+    PrefixTrieNode *nodes;  // nodes[0] is the root, with an empty label
+    size_t count;
+    size_t capacity;
+    char *labels;
+    size_t labels_used;
+    size_t labels_capacity;
+} PrefixTrie;
+
+int prefix_trie_insert(PrefixTrie *trie, const char *key, size_t len, uint32_t value);
+uint32_t prefix_trie_longest(const PrefixTrie *trie, const char *key, size_t len, size_t *matched);
+void prefix_trie_free(PrefixTrie *trie);
+
+#endif // PREFIX_TRIE_H
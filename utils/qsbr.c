@@ -0,0 +1,59 @@
+/*
+ * Autor: Guido Barosio
+ * Email: guido@bravo47.com
+ * Fecha: 2024-06-08
+ */
+
+#include "qsbr.h"
+#include <stdatomic.h>
+#include <time.h>
+
+#define MAX_READERS 256
+
+// Each reader records the epoch it last entered online with, or 0 while
+// offline. Padded so readers never share a cache line.
+typedef struct {
+    _Alignas(64) atomic_ulong epoch;
+} Reader;
+
+static Reader readers[MAX_READERS];
+static atomic_int reader_count = 0;
+static atomic_ulong global_epoch = 1;
+
+// Returns the reader id, or -1 when all slots are taken.
+int qsbr_register(void) {
+    int id = atomic_fetch_add(&reader_count, 1);
+    if (id >= MAX_READERS) {
+        atomic_fetch_sub(&reader_count, 1);
+        return -1;
+    }
+    atomic_store(&readers[id].epoch, 0);
+    return id;
+}
+
+void qsbr_online(int reader) {
+    // seq_cst store + fence: the epoch must be visible before this thread
+    // loads any shared pointer
+    atomic_store(&readers[reader].epoch, atomic_load(&global_epoch));
+    atomic_thread_fence(memory_order_seq_cst);
+}
+
+void qsbr_offline(int reader) {
+    atomic_store_explicit(&readers[reader].epoch, 0, memory_order_release);
+}
+
+void qsbr_synchronize(void) {
+    unsigned long target = atomic_fetch_add(&global_epoch, 1) + 1;
+    int count = atomic_load(&reader_count);
+
+    for (int i = 0; i < count; i++) {
+        while (1) {
+            unsigned long seen = atomic_load_explicit(&readers[i].epoch, memory_order_acquire);
+            if (seen == 0 || seen >= target) {
+                break;
+            }
+            struct timespec pause = {0, 1000000};
+            nanosleep(&pause, NULL);
+        }
+    }
+}
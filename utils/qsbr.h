@@ -0,0 +1,21 @@
+/*
+ * Autor: Guido Barosio
+ * Email: guido@bravo47.com
+ * Fecha: 2024-06-08
+ */
+
+#ifndef QSBR_H
+#define QSBR_H
+
+// Quiescent-state-based reclamation. Reader threads (the event loops)
+// register once and report when they hold no references to shared
+// snapshots: offline while blocked in the event wait, online while
+// handling events. A writer that unpublished a snapshot calls
+// qsbr_synchronize(), which returns once every reader has been offline or
+// re-entered online since, after which the old snapshot can be freed.
+int qsbr_register(void);
+void qsbr_online(int reader);
+void qsbr_offline(int reader);
+void qsbr_synchronize(void);
+
+#endif // QSBR_H
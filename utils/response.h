@@ -0,0 +1,36 @@
+/*
+ * Autor: Guido Barosio
+ * Email: guido@bravo47.com
+ * Fecha: 2024-06-08
+ */
+
+#ifndef RESPONSE_H
+#define RESPONSE_H
+
+#include <stddef.h>
+#include <string.h>
+
+// The 302 response for a route, complete with the empty line that ends
+// the head. It only depends on the URL, so it is serialized once when the
+// route is loaded (or by yathr-mkdb) and copied verbatim per request.
+#define REDIRECT_HEADER "HTTP/1.1 302 Found\r\nLocation: "
+#define REDIRECT_FOOTER "\r\nContent-Length: 0\r\n\r\n"
+
+static inline size_t redirect_response_size(size_t url_len) {
+    return sizeof(REDIRECT_HEADER) - 1 + url_len + sizeof(REDIRECT_FOOTER) - 1;
+}
+
+// Writes the response into out, which holds redirect_response_size()
+// bytes, and returns its length.
+static inline size_t format_redirect_response(char *out, const char *url, size_t url_len) {
+    char *p = out;
+    memcpy(p, REDIRECT_HEADER, sizeof(REDIRECT_HEADER) - 1);
+    p += sizeof(REDIRECT_HEADER) - 1;
+    memcpy(p, url, url_len);
+    p += url_len;
+    memcpy(p, REDIRECT_FOOTER, sizeof(REDIRECT_FOOTER) - 1);
+    p += sizeof(REDIRECT_FOOTER) - 1;
+    return (size_t)(p - out);
+}
+
+#endif // RESPONSE_H
@@ -0,0 +1,503 @@
+/*
+ * Autor: Guido Barosio
+ * Email: guido@bravo47.com
+ * Fecha: 2024-06-08
+ */
+
+#include "route_image.h"
+#include "hash.h"
+#include "response.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#define BYTE_ORDER_MARK 0x01020304u
+#define RECORD_HEADER 12            // key, URL and response lengths, uint32_t each
+#define CHECKSUM_BLOCK (1 << 20)
+#define MAX_BUCKET_KEYS 64
+#define MAX_SEEDS 16
+
+// Multiply-shift onto [0, range): the high bits of hash pick the result,
+// so sorting keys by hash sorts them by bucket too.
+static uint64_t scale(uint64_t hash, uint64_t range) {
+    return (uint64_t)(((unsigned __int128)hash * range) >> 64);
+}
+
+static uint64_t position_of(uint64_t hash, uint16_t pilot, uint64_t table_size) {
+    uint64_t x = hash ^ ((uint64_t)pilot + 1) * 0x9E3779B97F4A7C15ULL;
+    x ^= x >> 33;
+    x *= 0xFF51AFD7ED558CCDULL;
+    x ^= x >> 33;
+    return scale(x, table_size);
+}
+
+static uint16_t fingerprint_of(uint64_t hash) {
+    return (uint16_t)hash;
+}
+
+static uint64_t header_checksum(const RouteImageHeader *header) {
+    return hash_bytes((const char *)header, offsetof(RouteImageHeader, header_checksum));
+}
+
+// Chains a hash of each block of the body, so the writer can compute it
+// reading the file back in blocks of the same size.
+static uint64_t checksum_block(uint64_t sum, const char *block, size_t len) {
+    return hash_bytes_seeded(block, len, sum);
+}
+
+static int section_fits(uint64_t offset, uint64_t len, uint64_t file_size) {
+    return offset % ROUTE_IMAGE_PAGE == 0 && offset <= file_size && len <= file_size - offset;
+}
+
+static int header_valid(const RouteImageHeader *h, size_t size) {
+    if (memcmp(h->magic, ROUTE_IMAGE_MAGIC, sizeof(h->magic)) != 0 || h->version != ROUTE_IMAGE_VERSION ||
+        h->byte_order != BYTE_ORDER_MARK || h->header_checksum != header_checksum(h) || h->file_size != size) {
+        return 0;
+    }
+    if (h->count >= UINT32_MAX || h->table_size < h->count || h->table_size - h->count >= UINT32_MAX ||
+        h->buckets == 0 || h->buckets > h->count + 1) {
+        return 0;
+    }
+    return section_fits(h->pilots, h->buckets * sizeof(uint16_t), size) &&
+           section_fits(h->fingerprints, h->count * sizeof(uint16_t), size) &&
+           section_fits(h->remap, (h->table_size - h->count) * sizeof(uint32_t), size) &&
+           section_fits(h->offsets, h->count * sizeof(uint64_t), size) &&
+           section_fits(h->heap, h->heap_size, size) &&
+           section_fits(h->hosts, h->hosts_size, size);
+}
+
+// Maps an image and checks its header. With populate the whole file is
+// read in now (MAP_POPULATE where available); otherwise pages fault in as
+// lookups reach them. The body checksum is left to route_image_verify().
+int route_image_open(RouteImage *image, const char *path, int populate) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        return -1;
+    }
+    if (st.st_size < ROUTE_IMAGE_PAGE) {
+        close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+
+    int flags = MAP_SHARED;
+#ifdef MAP_POPULATE
+    if (populate) {
+        flags |= MAP_POPULATE;
+    }
+#endif
+    void *map = mmap(NULL, st.st_size, PROT_READ, flags, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+    if (!populate) {
+        madvise(map, st.st_size, MADV_RANDOM);
+    }
+
+    const RouteImageHeader *h = map;
+    if (!header_valid(h, st.st_size)) {
+        munmap(map, st.st_size);
+        errno = EINVAL;
+        return -1;
+    }
+
+    const unsigned char *base = map;
+    image->map = base;
+    image->size = st.st_size;
+    image->header = h;
+    image->pilots = (const uint16_t *)(base + h->pilots);
+    image->fingerprints = (const uint16_t *)(base + h->fingerprints);
+    image->remap = (const uint32_t *)(base + h->remap);
+    image->offsets = (const uint64_t *)(base + h->offsets);
+    image->heap = (const char *)(base + h->heap);
+    return 0;
+}
+
+void route_image_close(RouteImage *image) {
+    if (image->map) {
+        munmap((void *)image->map, image->size);
+    }
+    memset(image, 0, sizeof(*image));
+}
+
+// Reads the whole image and checks the body checksum. Returns 0, or -1
+// with errno set to EINVAL when it does not match.
+int route_image_verify(const RouteImage *image) {
+    uint64_t sum = 0;
+    for (size_t pos = ROUTE_IMAGE_PAGE; pos < image->size; pos += CHECKSUM_BLOCK) {
+        size_t len = image->size - pos < CHECKSUM_BLOCK ? image->size - pos : CHECKSUM_BLOCK;
+        sum = checksum_block(sum, (const char *)image->map + pos, len);
+    }
+    if (sum != image->header->body_checksum) {
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
+
+// Returns the URL of key, followed by its NUL and response, and sets the
+// lengths; NULL when the key is missing. Offsets are bounds-checked, so
+// a corrupt body yields misses rather than faults.
+const char *route_image_find(const RouteImage *image, const char *key, size_t key_len, size_t *url_len,
+                             size_t *response_len) {
+    const RouteImageHeader *h = image->header;
+    if (h == NULL || h->count == 0) {
+        return NULL;
+    }
+
+    uint64_t hash = hash_bytes_seeded(key, key_len, h->seed);
+    uint64_t pos = position_of(hash, image->pilots[scale(hash, h->buckets)], h->table_size);
+    if (pos >= h->count) {
+        pos = image->remap[pos - h->count];
+        if (pos >= h->count) {
+            return NULL;
+        }
+    }
+    if (image->fingerprints[pos] != fingerprint_of(hash)) {
+        return NULL;
+    }
+
+    uint64_t offset = image->offsets[pos];
+    if (h->heap_size < RECORD_HEADER || offset > h->heap_size - RECORD_HEADER) {
+        return NULL;
+    }
+    uint32_t lens[3];
+    memcpy(lens, image->heap + offset, sizeof(lens));
+    uint64_t record_len = (uint64_t)lens[0] + lens[1] + 1 + lens[2];
+    const char *record = image->heap + offset + RECORD_HEADER;
+    if (record_len > h->heap_size - offset - RECORD_HEADER || lens[0] != key_len ||
+        memcmp(record, key, key_len) != 0) {
+        return NULL;
+    }
+    *url_len = lens[1];
+    *response_len = lens[2];
+    return record + key_len;
+}
+
+// ── writing ─────────────────────────────────────────────────────────
+
+typedef struct {
+    uint64_t hash;
+    uint64_t entry;
+} KeyHash;
+
+static int compare_key_hashes(const void *a, const void *b) {
+    const KeyHash *x = a, *y = b;
+    if (x->hash != y->hash) {
+        return x->hash < y->hash ? -1 : 1;
+    }
+    return x->entry < y->entry ? -1 : x->entry > y->entry;
+}
+
+static uint64_t page_align(uint64_t offset) {
+    return (offset + ROUTE_IMAGE_PAGE - 1) & ~(uint64_t)(ROUTE_IMAGE_PAGE - 1);
+}
+
+// Hashes and sorts the keys, dropping repeated ones: the last entry for a
+// key wins. Returns the number left, or -1 when two different keys share
+// a hash and the seed must change.
+static long hash_keys(const RouteImageEntry *entries, size_t count, uint64_t seed, KeyHash *keys) {
+    for (size_t i = 0; i < count; i++) {
+        keys[i].hash = hash_bytes_seeded(entries[i].key, entries[i].key_len, seed);
+        keys[i].entry = i;
+    }
+    qsort(keys, count, sizeof(KeyHash), compare_key_hashes);
+
+    size_t kept = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (kept > 0 && keys[kept - 1].hash == keys[i].hash) {
+            const RouteImageEntry *a = &entries[keys[kept - 1].entry], *b = &entries[keys[i].entry];
+            if (a->key_len != b->key_len || memcmp(a->key, b->key, a->key_len) != 0) {
+                return -1;
+            }
+            keys[kept - 1] = keys[i];   // sorted by entry within a hash: later wins
+            continue;
+        }
+        keys[kept++] = keys[i];
+    }
+    return (long)kept;
+}
+
+// Finds a pilot for every bucket, largest buckets first while the table
+// is emptiest. Returns 0, or -1 when some bucket fits under no pilot.
+static int place_buckets(const KeyHash *keys, size_t count, uint64_t buckets, uint64_t table_size,
+                         uint16_t *pilots, uint64_t *taken) {
+    uint32_t *starts = calloc(buckets + 1, sizeof(uint32_t));
+    uint32_t *order = malloc(buckets * sizeof(uint32_t));
+    uint32_t by_size[MAX_BUCKET_KEYS + 2] = {0};
+    int result = -1;
+    if (starts == NULL || order == NULL) {
+        goto done;
+    }
+
+    // Keys are sorted by hash, so each bucket is a run of them
+    for (size_t i = 0; i < count; i++) {
+        starts[scale(keys[i].hash, buckets) + 1]++;
+    }
+    for (uint64_t b = 0; b < buckets; b++) {
+        if (starts[b + 1] > MAX_BUCKET_KEYS) {
+            goto done;
+        }
+        by_size[MAX_BUCKET_KEYS - starts[b + 1] + 1]++;
+        starts[b + 1] += starts[b];
+    }
+    for (int s = 1; s <= MAX_BUCKET_KEYS + 1; s++) {
+        by_size[s] += by_size[s - 1];
+    }
+    for (uint64_t b = 0; b < buckets; b++) {
+        order[by_size[MAX_BUCKET_KEYS - (starts[b + 1] - starts[b])]++] = (uint32_t)b;
+    }
+
+    for (uint64_t i = 0; i < buckets; i++) {
+        uint32_t b = order[i];
+        uint32_t size = starts[b + 1] - starts[b];
+        if (size == 0) {
+            break;
+        }
+        const KeyHash *bucket = &keys[starts[b]];
+        uint64_t positions[MAX_BUCKET_KEYS];
+        uint32_t pilot = 0;
+        for (; pilot <= UINT16_MAX; pilot++) {
+            uint32_t k = 0;
+            for (; k < size; k++) {
+                uint64_t pos = position_of(bucket[k].hash, (uint16_t)pilot, table_size);
+                if (taken[pos >> 6] & (1ULL << (pos & 63))) {
+                    break;
+                }
+                uint32_t j = 0;
+                while (j < k && positions[j] != pos) {
+                    j++;
+                }
+                if (j < k) {
+                    break;
+                }
+                positions[k] = pos;
+            }
+            if (k == size) {
+                break;
+            }
+        }
+        if (pilot > UINT16_MAX) {
+            goto done;
+        }
+        for (uint32_t k = 0; k < size; k++) {
+            taken[positions[k] >> 6] |= 1ULL << (positions[k] & 63);
+        }
+        pilots[b] = (uint16_t)pilot;
+    }
+    result = 0;
+
+done:
+    free(starts);
+    free(order);
+    return result;
+}
+
+static int write_at(FILE *file, uint64_t offset, const void *data, size_t len) {
+    if (len == 0) {
+        return 0;
+    }
+    if (fseeko(file, (off_t)offset, SEEK_SET) == -1 || fwrite(data, 1, len, file) != len) {
+        return -1;
+    }
+    return 0;
+}
+
+// Compiles entries into an image at path. Hosts is the NUL-separated host
+// list (may be empty). Returns the number of distinct routes written, or
+// -1 with errno set.
+long route_image_write(const char *path, RouteImageEntry *entries, size_t count, const char *hosts,
+                       size_t hosts_len) {
+    if (count >= UINT32_MAX) {
+        errno = EFBIG;
+        return -1;
+    }
+
+    RouteImageHeader header;
+    memset(&header, 0, sizeof(header));
+    KeyHash *keys = malloc((count ? count : 1) * sizeof(KeyHash));
+    uint16_t *pilots = NULL, *fingerprints = NULL;
+    uint32_t *remap = NULL;
+    uint64_t *offsets = NULL, *taken = NULL;
+    char *record = NULL;
+    FILE *file = NULL;
+    long n = -1;
+    int error = ENOMEM;
+    if (keys == NULL) {
+        goto fail;
+    }
+
+    // A fresh seed whenever two keys collide or a bucket cannot be placed
+    int placed = 0;
+    for (uint64_t attempt = 0; attempt < MAX_SEEDS && !placed; attempt++) {
+        header.seed = (attempt + 1) * 0xD6E8FEB86659FD93ULL;
+        n = hash_keys(entries, count, header.seed, keys);
+        if (n < 0) {
+            continue;
+        }
+        header.count = (uint64_t)n;
+        header.buckets = n > 0 ? ((uint64_t)n + ROUTE_IMAGE_BUCKET_KEYS - 1) / ROUTE_IMAGE_BUCKET_KEYS : 1;
+        // About 3% spare positions keep the last buckets easy to place
+        header.table_size = n > 0 ? (uint64_t)n + (uint64_t)n / 32 + 1 : 0;
+
+        free(pilots);
+        free(taken);
+        pilots = calloc(header.buckets, sizeof(uint16_t));
+        taken = calloc(header.table_size / 64 + 1, sizeof(uint64_t));
+        if (pilots == NULL || taken == NULL) {
+            goto fail;
+        }
+        errno = 0;
+        placed = place_buckets(keys, (size_t)n, header.buckets, header.table_size, pilots, taken) == 0;
+        if (!placed && errno == ENOMEM) {
+            goto fail;
+        }
+    }
+    if (!placed) {
+        error = EAGAIN;
+        goto fail;
+    }
+
+    // Positions past the last key move onto the free ones below it
+    uint64_t spare = header.table_size - header.count;
+    remap = calloc(spare ? spare : 1, sizeof(uint32_t));
+    fingerprints = calloc(n ? n : 1, sizeof(uint16_t));
+    offsets = calloc(n ? n : 1, sizeof(uint64_t));
+    if (remap == NULL || fingerprints == NULL || offsets == NULL) {
+        goto fail;
+    }
+    uint64_t free_pos = 0;
+    for (uint64_t pos = header.count; pos < header.table_size; pos++) {
+        if (taken[pos >> 6] & (1ULL << (pos & 63))) {
+            while (taken[free_pos >> 6] & (1ULL << (free_pos & 63))) {
+                free_pos++;
+            }
+            remap[pos - header.count] = (uint32_t)free_pos++;
+        }
+    }
+
+    size_t max_record = 0;
+    for (long i = 0; i < n; i++) {
+        const RouteImageEntry *e = &entries[keys[i].entry];
+        uint64_t pos = position_of(keys[i].hash, pilots[scale(keys[i].hash, header.buckets)], header.table_size);
+        if (pos >= header.count) {
+            pos = remap[pos - header.count];
+        }
+        size_t record_len = RECORD_HEADER + e->key_len + e->url_len + 1 + redirect_response_size(e->url_len);
+        fingerprints[pos] = fingerprint_of(keys[i].hash);
+        offsets[pos] = header.heap_size;
+        header.heap_size += record_len;
+        if (record_len > max_record) {
+            max_record = record_len;
+        }
+    }
+
+    memcpy(header.magic, ROUTE_IMAGE_MAGIC, sizeof(header.magic));
+    header.version = ROUTE_IMAGE_VERSION;
+    header.byte_order = BYTE_ORDER_MARK;
+    header.pilots = ROUTE_IMAGE_PAGE;
+    header.fingerprints = page_align(header.pilots + header.buckets * sizeof(uint16_t));
+    header.remap = page_align(header.fingerprints + header.count * sizeof(uint16_t));
+    header.offsets = page_align(header.remap + spare * sizeof(uint32_t));
+    header.heap = page_align(header.offsets + header.count * sizeof(uint64_t));
+    header.hosts = page_align(header.heap + header.heap_size);
+    header.hosts_size = hosts_len;
+    header.file_size = header.hosts + hosts_len;
+
+    record = malloc(max_record ? max_record : 1);
+    file = fopen(path, "w+");
+    if (record == NULL || file == NULL) {
+        error = errno;
+        goto fail;
+    }
+    error = EIO;
+    if (write_at(file, header.pilots, pilots, header.buckets * sizeof(uint16_t)) == -1 ||
+        write_at(file, header.fingerprints, fingerprints, header.count * sizeof(uint16_t)) == -1 ||
+        write_at(file, header.remap, remap, spare * sizeof(uint32_t)) == -1 ||
+        write_at(file, header.offsets, offsets, header.count * sizeof(uint64_t)) == -1 ||
+        fseeko(file, (off_t)header.heap, SEEK_SET) == -1) {
+        goto fail;
+    }
+    for (long i = 0; i < n; i++) {
+        const RouteImageEntry *e = &entries[keys[i].entry];
+        uint32_t lens[3] = {(uint32_t)e->key_len, (uint32_t)e->url_len, (uint32_t)redirect_response_size(e->url_len)};
+        char *p = record;
+        memcpy(p, lens, sizeof(lens));
+        p += sizeof(lens);
+        memcpy(p, e->key, e->key_len);
+        p += e->key_len;
+        memcpy(p, e->url, e->url_len);
+        p += e->url_len;
+        *p++ = '\0';
+        p += format_redirect_response(p, e->url, e->url_len);
+        if (fwrite(record, 1, p - record, file) != (size_t)(p - record)) {
+            goto fail;
+        }
+    }
+    // The hosts section is written even when empty, so the file reaches
+    // its full size
+    if (write_at(file, header.hosts, hosts, hosts_len) == -1 ||
+        ftruncate(fileno(file), (off_t)header.file_size) == -1 || fflush(file) != 0) {
+        goto fail;
+    }
+
+    // Read the body back for its checksum
+    if (fseeko(file, ROUTE_IMAGE_PAGE, SEEK_SET) == -1) {
+        goto fail;
+    }
+    free(record);
+    record = malloc(CHECKSUM_BLOCK);
+    if (record == NULL) {
+        error = ENOMEM;
+        goto fail;
+    }
+    for (uint64_t pos = ROUTE_IMAGE_PAGE; pos < header.file_size; pos += CHECKSUM_BLOCK) {
+        size_t len = header.file_size - pos < CHECKSUM_BLOCK ? header.file_size - pos : CHECKSUM_BLOCK;
+        if (fread(record, 1, len, file) != len) {
+            goto fail;
+        }
+        header.body_checksum = checksum_block(header.body_checksum, record, len);
+    }
+    header.header_checksum = header_checksum(&header);
+    if (write_at(file, 0, &header, sizeof(header)) == -1 || fclose(file) != 0) {
+        file = NULL;
+        goto fail;
+    }
+
+    free(keys);
+    free(pilots);
+    free(taken);
+    free(remap);
+    free(fingerprints);
+    free(offsets);
+    free(record);
+    return n;
+
+fail:
+    if (file) {
+        fclose(file);
+    }
+    free(keys);
+    free(pilots);
+    free(taken);
+    free(remap);
+    free(fingerprints);
+    free(offsets);
+    free(record);
+    errno = error;
+    return -1;
+}
@@ -0,0 +1,82 @@
+/*
+ * Autor: Guido Barosio
+ * Email: guido@bravo47.com
+ * Fecha: 2024-06-08
+ */
+
+#ifndef ROUTE_IMAGE_H
+#define ROUTE_IMAGE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// A route image is a routes file compiled by yathr-compile into the form
+// the server looks routes up in, so opening it is a single mmap: no
+// parsing, no allocation, and pages shared through the page cache.
+//
+// Keys are placed by a minimal perfect hash in the style of PTHash: a key
+// hashes to a bucket of about four keys, the bucket's 16-bit pilot picks
+// the key's position, and the few positions past the last key are mapped
+// back onto the free ones below it. A lookup reads one pilot, one 16-bit
+// fingerprint that turns most misses away, then the record: key, URL,
+// NUL and the prebuilt response, back to back in the string heap.
+//
+// Integers are in the byte order of the machine that wrote the image
+// (checked when opening, so arrays are used straight from the mapping).
+// Each section starts on a page boundary. Routes for a host are keyed
+// "host\0key", and the hosts section lists the hosts NUL-separated.
+#define ROUTE_IMAGE_MAGIC "YATHRIMG"
+#define ROUTE_IMAGE_VERSION 1
+#define ROUTE_IMAGE_PAGE 4096
+#define ROUTE_IMAGE_BUCKET_KEYS 4
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;        // 0x01020304 as written
+    uint64_t seed;              // of the key hash
+    uint64_t count;             // keys, and positions after remapping
+    uint64_t table_size;        // positions the pilots map onto, >= count
+    uint64_t buckets;
+    // Section offsets from the start of the file, and sizes in bytes
+    uint64_t pilots;            // uint16_t per bucket
+    uint64_t fingerprints;      // uint16_t per key
+    uint64_t remap;             // uint32_t per position from count on
+    uint64_t offsets;           // uint64_t per key: its record in the heap
+    uint64_t heap;
+    uint64_t heap_size;
+    uint64_t hosts;
+    uint64_t hosts_size;
+    uint64_t file_size;
+    uint64_t body_checksum;     // of every byte after the first page
+    uint64_t header_checksum;   // of the fields above
+} RouteImageHeader;
+
+typedef struct {
+    const unsigned char *map;
+    size_t size;
+    const RouteImageHeader *header;
+    const uint16_t *pilots;
+    const uint16_t *fingerprints;
+    const uint32_t *remap;
+    const uint64_t *offsets;
+    const char *heap;
+} RouteImage;
+
+// One route for route_image_write(). Key and URL are slices.
+typedef struct {
+    const char *key;
+    size_t key_len;
+    const char *url;
+    size_t url_len;
+} RouteImageEntry;
+
+int route_image_open(RouteImage *image, const char *path, int populate);
+void route_image_close(RouteImage *image);
+int route_image_verify(const RouteImage *image);
+const char *route_image_find(const RouteImage *image, const char *key, size_t key_len, size_t *url_len,
+                             size_t *response_len);
+long route_image_write(const char *path, RouteImageEntry *entries, size_t count, const char *hosts,
+                       size_t hosts_len);
+
+#endif // ROUTE_IMAGE_H
@@ -0,0 +1,278 @@
+/*
+ * Autor: Guido Barosio
+ * Email: guido@bravo47.com
+ * Fecha: 2024-06-08
+ */
+
+#include "routes_file.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Splits one line (without its line break) into slices of the line.
+// Returns 1 for a route, 0 for a blank or comment line and -1 for a
+// malformed line.
+int parse_route_line(const char *line, size_t len, RouteLine *route) {
+    while (len > 0 && (line[len - 1] == '\r' || line[len - 1] == '\n')) {
+        len--;
+    }
+    if (len == 0 || line[0] == '#') {
+        return 0;
+    }
+    const char *end = line + len;
+
+    const char *sep = memchr(line, '\t', len);
+    route->host = NULL;
+    route->host_len = 0;
+    if (sep) {
+        // A second tab makes the first field a host: URLs hold no tabs
+        const char *second = memchr(sep + 1, '\t', end - (sep + 1));
+        if (second) {
+            if (sep == line) {
+                return -1;
+            }
+            route->host = line;
+            route->host_len = sep - line;
+            line = sep + 1;
+            sep = second;
+        }
+    } else {
+        sep = memchr(line, ',', len);
+    }
+    if (sep == NULL) {
+        return -1;
+    }
+
+    const char *k = line[0] == '/' ? line + 1 : line;
+    if (sep <= k || sep + 1 == end) {
+        return -1;
+    }
+
+    route->key = k;
+    route->key_len = sep - k;
+    route->url = sep + 1;
+    route->url_len = end - (sep + 1);
+    return 1;
+}
+
+int is_prefix_rule(const char *key, size_t key_len) {
+    return key_len > 0 && key[key_len - 1] == ROUTE_PREFIX_WILDCARD;
+}
+
+// Writes the canonical form of a host name, as sent in a Host header or
+// written in a routes file, to out (HOST_NAME_MAX_LEN bytes): lower case,
+// without a port or a trailing dot. IPv6 literals keep their brackets.
+// Returns its length, or -1 when nothing is left or it does not fit.
+long normalize_host(const char *host, size_t len, char *out) {
+    const char *end = host + len;
+    const char *cut;
+    if (len > 0 && host[0] == '[') {
+        cut = memchr(host, ']', len);
+        cut = cut ? cut + 1 : end;
+    } else {
+        cut = memchr(host, ':', len);
+        cut = cut ? cut : end;
+    }
+    while (cut > host && cut[-1] == '.') cut--;
+
+    size_t n = cut - host;
+    if (n == 0 || n > HOST_NAME_MAX_LEN) {
+        return -1;
+    }
+    for (size_t i = 0; i < n; i++) {
+        char c = host[i];
+        out[i] = c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+    }
+    return (long)n;
+}
+
+// Adds host to the list unless it is there already. Returns 0, or -1 when
+// out of memory.
+int host_list_add(HostList *hosts, const char *host, size_t len) {
+    if (hosts->last && hosts->last_len == len && memcmp(hosts->last, host, len) == 0) {
+        return 0;
+    }
+    for (size_t pos = 0; pos < hosts->len; ) {
+        size_t n = strlen(hosts->names + pos);
+        if (n == len && memcmp(hosts->names + pos, host, len) == 0) {
+            hosts->last = hosts->names + pos;
+            hosts->last_len = len;
+            return 0;
+        }
+        pos += n + 1;
+    }
+    if (hosts->len + len + 1 > hosts->cap) {
+        size_t cap = hosts->cap ? hosts->cap * 2 : 1024;
+        while (cap < hosts->len + len + 1) cap *= 2;
+        char *grown = realloc(hosts->names, cap);
+        if (grown == NULL) {
+            return -1;
+        }
+        hosts->names = grown;
+        hosts->cap = cap;
+    }
+    memcpy(hosts->names + hosts->len, host, len);
+    hosts->names[hosts->len + len] = '\0';
+    hosts->last = hosts->names + hosts->len;
+    hosts->last_len = len;
+    hosts->len += len + 1;
+    return 0;
+}
+
+#define MIN_CHUNK_SIZE (1 << 20)
+
+typedef struct {
+    const char *start;
+    const char *end;
+    RouteCallback callback;
+    void *ctx;
+    long routes;            // -1 when the callback failed
+    size_t skipped;
+    int error;              // errno left by the failing callback
+    pthread_t thread;
+} Chunk;
+
+static void *parse_chunk(void *arg) {
+    Chunk *chunk = arg;
+    const char *p = chunk->start;
+
+    while (p < chunk->end) {
+        const char *nl = memchr(p, '\n', chunk->end - p);
+        const char *line_end = nl ? nl : chunk->end;
+        RouteLine route;
+        int parsed = parse_route_line(p, line_end - p, &route);
+        p = line_end + 1;
+        if (parsed < 0) {
+            chunk->skipped++;
+            continue;
+        }
+        if (parsed == 0) {
+            continue;
+        }
+        if (chunk->callback(chunk->ctx, &route) != 0) {
+            chunk->error = errno;
+            chunk->routes = -1;
+            break;
+        }
+        chunk->routes++;
+    }
+    return NULL;
+}
+
+// Maps the file and parses it in up to max_chunks pieces split at line
+// boundaries, each on its own thread (the first on the caller's), with
+// at least MIN_CHUNK_SIZE bytes per piece. Chunk i hands its routes, in
+// file order, to callback with contexts[i]; contexts past the number of
+// chunks used are left alone, and chunk i covers lines before chunk
+// i + 1's, so walking the contexts in order replays the file in order.
+// Malformed lines are skipped and counted in *skipped. Returns the number
+// of routes read, or -1 with errno set when the file cannot be read or a
+// callback fails (the other chunks may have run to completion).
+long read_routes_file_chunked(const char *path, RouteCallback callback, void **contexts,
+                              int max_chunks, size_t *skipped) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return -1;
+    }
+    size_t size = (size_t)st.st_size;
+    if (size == 0) {
+        close(fd);
+        return 0;
+    }
+    char *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    int saved = errno;
+    close(fd);
+    if (map == MAP_FAILED) {
+        errno = saved;
+        return -1;
+    }
+    posix_madvise(map, size, POSIX_MADV_SEQUENTIAL);
+
+    size_t chunk_count = size / MIN_CHUNK_SIZE;
+    if (chunk_count > (size_t)max_chunks) {
+        chunk_count = (size_t)max_chunks;
+    }
+    if (chunk_count < 1) {
+        chunk_count = 1;
+    }
+    Chunk *chunks = calloc(chunk_count, sizeof(Chunk));
+    if (chunks == NULL) {
+        munmap(map, size);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    // Each piece starts just past the first line break at or after its
+    // even share of the file, so no line is split or read twice
+    const char *end = map + size;
+    for (size_t i = 0; i < chunk_count; i++) {
+        const char *start = map + size * i / chunk_count;
+        if (i > 0) {
+            const char *nl = memchr(start - 1, '\n', end - (start - 1));
+            start = nl ? nl + 1 : end;
+            if (start < chunks[i - 1].start) {
+                start = chunks[i - 1].start;
+            }
+            chunks[i - 1].end = start;
+        }
+        chunks[i].start = start;
+        chunks[i].end = end;
+        chunks[i].callback = callback;
+        chunks[i].ctx = contexts[i];
+    }
+
+    size_t started = 1;
+    for (; started < chunk_count; started++) {
+        if (pthread_create(&chunks[started].thread, NULL, parse_chunk, &chunks[started]) != 0) {
+            break;
+        }
+    }
+    // Pieces without a thread are parsed here, in order
+    parse_chunk(&chunks[0]);
+    for (size_t i = started; i < chunk_count; i++) {
+        parse_chunk(&chunks[i]);
+    }
+    for (size_t i = 1; i < started; i++) {
+        pthread_join(chunks[i].thread, NULL);
+    }
+
+    long routes = 0;
+    int error = 0;
+    for (size_t i = 0; i < chunk_count; i++) {
+        *skipped += chunks[i].skipped;
+        if (chunks[i].routes < 0) {
+            if (error == 0) {
+                error = chunks[i].error;
+            }
+            routes = -1;
+        } else if (routes >= 0) {
+            routes += chunks[i].routes;
+        }
+    }
+
+    free(chunks);
+    munmap(map, size);
+    if (routes < 0) {
+        errno = error;
+    }
+    return routes;
+}
+
+// Calls callback for every route in the file, in order. Malformed lines
+// are skipped and counted in *skipped. Returns the number of routes read,
+// or -1 when the file cannot be read (errno is set) or the callback fails.
+long read_routes_file(const char *path, RouteCallback callback, void *ctx, size_t *skipped) {
+    return read_routes_file_chunked(path, callback, &ctx, 1, skipped);
+}
@@ -0,0 +1,62 @@
+/*
+ * Autor: Guido Barosio
+ * Email: guido@bravo47.com
+ * Fecha: 2024-06-08
+ */
+
+#ifndef ROUTES_FILE_H
+#define ROUTES_FILE_H
+
+#include <stddef.h>
+
+// Route source files hold one route per line, "key<TAB>url" or
+// "key,url", or "host<TAB>key<TAB>url" for a route served only to
+// requests for that Host (see normalize_host()). A leading '/' on the key
+// is dropped; blank lines and lines starting with '#' are skipped.
+//
+// A key ending in ROUTE_PREFIX_WILDCARD is a prefix rule, matching every
+// key that starts with the rest of it ("docs/*"); when its URL ends in
+// one too, the rest of the requested key replaces it
+// ("https://docs.example.com/*"). Only the server's routes file holds
+// them: the route compilers skip them.
+#define ROUTE_PREFIX_WILDCARD '*'
+
+// yathr-mkdb and yathr-compile store a route for a host under "host\0key"
+// and list the hosts they saw, NUL-separated, under this key, which no
+// request can ask for.
+#define ROUTE_HOSTS_KEY "\0"
+#define ROUTE_HOSTS_KEY_LEN 1
+
+#define HOST_NAME_MAX_LEN 255
+
+typedef struct {
+    const char *host;       // NULL for a route without one
+    size_t host_len;
+    const char *key;
+    size_t key_len;
+    const char *url;
+    size_t url_len;
+} RouteLine;
+
+typedef int (*RouteCallback)(void *ctx, const RouteLine *route);
+
+// The distinct host names a route compiler has seen, NUL-separated, as
+// listed under ROUTE_HOSTS_KEY. Files name a handful of hosts, usually
+// grouped, so a linear search behind a last-seen check is plenty.
+typedef struct {
+    char *names;
+    size_t len;
+    size_t cap;
+    const char *last;
+    size_t last_len;
+} HostList;
+
+int parse_route_line(const char *line, size_t len, RouteLine *route);
+int is_prefix_rule(const char *key, size_t key_len);
+long normalize_host(const char *host, size_t len, char *out);
+int host_list_add(HostList *hosts, const char *host, size_t len);
+long read_routes_file(const char *path, RouteCallback callback, void *ctx, size_t *skipped);
+long read_routes_file_chunked(const char *path, RouteCallback callback, void **contexts,
+                              int max_chunks, size_t *skipped);
+
+#endif // ROUTES_FILE_H
@@ -0,0 +1,71 @@
+/*
+ * Autor: Guido Barosio
+ * Email: guido@bravo47.com
+ * Fecha: 2024-06-08
+ */
+
+#include "sorted_index.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Prefix first, then the whole key, shorter before longer when one starts
+// the other, which is the order the zero-padded prefixes already agree
+// with.
+static int item_compare(const void *a, const void *b) {
+    const SortedIndexItem *x = a;
+    const SortedIndexItem *y = b;
+    if (x->prefix.hi != y->prefix.hi) {
+        return x->prefix.hi < y->prefix.hi ? -1 : 1;
+    }
+    if (x->prefix.lo != y->prefix.lo) {
+        return x->prefix.lo < y->prefix.lo ? -1 : 1;
+    }
+    size_t len = x->key_len < y->key_len ? x->key_len : y->key_len;
+    int cmp = memcmp(x->key, y->key, len);
+    if (cmp != 0) {
+        return cmp;
+    }
+    if (x->key_len != y->key_len) {
+        return x->key_len < y->key_len ? -1 : 1;
+    }
+    return x->value < y->value ? -1 : x->value > y->value;
+}
+
+// Lays the sorted items out breadth-first: an in-order walk of the tree
+// visits its positions in key order. Returns the next item to place.
+static size_t place(SortedIndex *index, const SortedIndexItem *items, size_t next, size_t k) {
+    if (k <= index->count) {
+        next = place(index, items, next, 2 * k);
+        index->nodes[k] = items[next].prefix;
+        index->values[k] = items[next].value;
+        next = place(index, items, next + 1, 2 * k + 1);
+    }
+    return next;
+}
+
+// Sorts items (in place) and builds index over them. Returns 0, or -1
+// when out of memory, leaving index untouched.
+int sorted_index_build(SortedIndex *index, SortedIndexItem *items, size_t count) {
+    size_t bytes = ((count + 1) * sizeof(SortedPrefix) + 63) & ~(size_t)63;
+    SortedIndex built = {aligned_alloc(64, bytes), malloc((count + 1) * sizeof(uint32_t)), count};
+    if (built.nodes == NULL || built.values == NULL) {
+        sorted_index_free(&built);
+        return -1;
+    }
+    memset(built.nodes, 0, sizeof(SortedPrefix));
+    built.values[0] = 0;
+
+    qsort(items, count, sizeof(SortedIndexItem), item_compare);
+    place(&built, items, 0, 1);
+    sorted_index_free(index);
+    *index = built;
+    return 0;
+}
+
+void sorted_index_free(SortedIndex *index) {
+    free(index->nodes);
+    free(index->values);
+    index->nodes = NULL;
+    index->values = NULL;
+    index->count = 0;
+}
@@ -0,0 +1,113 @@
+/*
+ * Autor: Guido Barosio
+ * Email: guido@bravo47.com
+ * Fecha: 2024-06-08
+ */
+
+#ifndef SORTED_INDEX_H
+#define SORTED_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Ordered index over byte-string keys, each in a 16-bit group (the route
+// namespace), laid out in Eytzinger order: the sorted keys as a complete
+// binary tree stored breadth-first, node k's children at 2k and 2k + 1.
+// A search walks down from the root without a data-dependent branch and
+// prefetches the node's descendants four levels down, which sit next to
+// each other, so the misses of consecutive levels overlap.
+//
+// Nodes hold a fixed-width prefix of their key instead of a pointer to
+// it: the group, then the first 14 key bytes, big-endian and zero-padded,
+// so comparing two prefixes as integers orders them like the keys they
+// were taken from. Only where the prefixes are equal does a search ask
+// the caller to compare the whole keys.
+#define SORTED_INDEX_PREFIX_BYTES 14
+
+typedef struct {
+    uint64_t hi;            // group, then key bytes 0-5
+    uint64_t lo;            // key bytes 6-13
+} SortedPrefix;
+
+// One key for sorted_index_build(). The key is a slice.
+typedef struct {
+    SortedPrefix prefix;
+    const char *key;
+    uint32_t key_len;
+    uint32_t value;
+} SortedIndexItem;
+
+typedef struct {
+    SortedPrefix *nodes;    // count + 1, from 1; cache-line aligned
+    uint32_t *values;       // each node's value, same positions
+    size_t count;
+} SortedIndex;
+
+int sorted_index_build(SortedIndex *index, SortedIndexItem *items, size_t count);
+void sorted_index_free(SortedIndex *index);
+
+static inline SortedPrefix sorted_prefix(uint16_t group, const char *key, size_t key_len) {
+    unsigned char bytes[SORTED_INDEX_PREFIX_BYTES] = {0};
+    for (size_t i = 0; i < key_len && i < SORTED_INDEX_PREFIX_BYTES; i++) {
+        bytes[i] = (unsigned char)key[i];
+    }
+    SortedPrefix prefix = {(uint64_t)group << 48, 0};
+    for (int i = 0; i < 6; i++) {
+        prefix.hi |= (uint64_t)bytes[i] << (40 - 8 * i);
+    }
+    for (int i = 0; i < 8; i++) {
+        prefix.lo |= (uint64_t)bytes[6 + i] << (56 - 8 * i);
+    }
+    return prefix;
+}
+
+static inline int sorted_prefix_equal(SortedPrefix a, SortedPrefix b) {
+    return a.hi == b.hi && a.lo == b.lo;
+}
+
+// Compares the key stored with value to the key searched for, like memcmp
+// and then by length.
+typedef int (*SortedKeyCompare)(const void *ctx, uint32_t value);
+
+// Position of the first node whose key is not below the one searched for,
+// whose prefix is prefix, or 0 when there is none. The loop runs once per
+// level whatever the keys are, and the comparison feeds the next position
+// arithmetically instead of choosing between two branches; compare is
+// only called for nodes with the same prefix.
+static inline size_t sorted_index_lower_bound(const SortedIndex *index, SortedPrefix prefix,
+                                              SortedKeyCompare compare, const void *ctx) {
+    const SortedPrefix *nodes = index->nodes;
+    size_t k = 1;
+    while (k <= index->count) {
+        // Node k's 16 descendants four levels down: 256 bytes from 16k.
+        // Near the leaves there are none, and prefetching past the array
+        // would only cost page walks
+        const char *ahead = (const char *)(nodes + (16 * k <= index->count ? 16 * k : 0));
+        __builtin_prefetch(ahead);
+        __builtin_prefetch(ahead + 64);
+        __builtin_prefetch(ahead + 128);
+        __builtin_prefetch(ahead + 192);
+        SortedPrefix node = nodes[k];
+        size_t below = (node.hi < prefix.hi) | ((node.hi == prefix.hi) & (node.lo < prefix.lo));
+        if (__builtin_expect(sorted_prefix_equal(node, prefix), 0)) {
+            below = compare(ctx, index->values[k]) < 0;
+        }
+        k = 2 * k + below;
+    }
+    // Undo the right turns taken after the last left one
+    return k >> __builtin_ffsll((long long)~k);
+}
+
+// The position after pos in key order, or 0 past the last.
+static inline size_t sorted_index_next(const SortedIndex *index, size_t pos) {
+    if (2 * pos + 1 <= index->count) {
+        pos = 2 * pos + 1;
+        while (2 * pos <= index->count) {
+            pos = 2 * pos;
+        }
+        return pos;
+    }
+    return pos >> __builtin_ffsll((long long)~pos);
+}
+
+#endif // SORTED_INDEX_H
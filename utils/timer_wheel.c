@@ -0,0 +1,113 @@
+/*
+ * Autor: Guido Barosio
+ * Email: guido@bravo47.com
+ * Fecha: 2024-06-08
+ */
+
+#include "timer_wheel.h"
+
+#define SLOT_MASK (TIMER_SLOTS - 1)
+#define LEVEL_SPAN(level) (1ull << (TIMER_SLOT_BITS * (level)))
+
+static void link_node(TimerNode **head, TimerNode *node) {
+    node->next = *head;
+    if (*head) {
+        (*head)->pprev = &node->next;
+    }
+    *head = node;
+    node->pprev = head;
+}
+
+static void unlink_node(TimerNode *node) {
+    *node->pprev = node->next;
+    if (node->next) {
+        node->next->pprev = node->pprev;
+    }
+    node->next = NULL;
+    node->pprev = NULL;
+}
+
+// Files the node under the lowest level whose span covers its delay. A
+// node due now lands in the current level-0 slot, which is only still to
+// be run while the wheel is cascading.
+static void place(TimerWheel *wheel, TimerNode *node) {
+    uint64_t expires = node->expires;
+    uint64_t delay = expires - wheel->now;
+    if (delay >= LEVEL_SPAN(TIMER_LEVELS)) {
+        // Beyond the top level: park it as far out as possible, it is
+        // placed again when that slot comes round
+        expires = wheel->now + LEVEL_SPAN(TIMER_LEVELS) - 1;
+        delay = expires - wheel->now;
+    }
+
+    int level = 0;
+    while (delay >= LEVEL_SPAN(level + 1)) {
+        level++;
+    }
+    link_node(&wheel->slots[level][(expires >> (TIMER_SLOT_BITS * level)) & SLOT_MASK], node);
+}
+
+// (Re)schedules node to fire once the wheel reaches expires.
+void timer_schedule(TimerWheel *wheel, TimerNode *node, uint64_t expires) {
+    if (timer_pending(node)) {
+        unlink_node(node);
+    } else {
+        wheel->count++;
+    }
+    // Already due: the next tick
+    node->expires = expires > wheel->now ? expires : wheel->now + 1;
+    place(wheel, node);
+}
+
+void timer_cancel(TimerWheel *wheel, TimerNode *node) {
+    if (timer_pending(node)) {
+        unlink_node(node);
+        wheel->count--;
+    }
+}
+
+// Moves every timer of a higher-level slot down to where it now belongs.
+static int cascade(TimerWheel *wheel, int level) {
+    int index = (int)((wheel->now >> (TIMER_SLOT_BITS * level)) & SLOT_MASK);
+    TimerNode *node = wheel->slots[level][index];
+    wheel->slots[level][index] = NULL;
+    while (node) {
+        TimerNode *next = node->next;
+        node->pprev = NULL;
+        place(wheel, node);
+        node = next;
+    }
+    return index;
+}
+
+// Advances the wheel to now one tick at a time, calling expire for each
+// timer that comes due. The node is unscheduled before the call, so the
+// callback may schedule it again or free it.
+void timer_wheel_advance(TimerWheel *wheel, uint64_t now, TimerCallback expire, void *ctx) {
+    while (wheel->now < now) {
+        if (wheel->count == 0) {
+            wheel->now = now;
+            return;
+        }
+        wheel->now++;
+
+        int index = (int)(wheel->now & SLOT_MASK);
+        for (int level = 1; index == 0 && level < TIMER_LEVELS; level++) {
+            index = cascade(wheel, level);
+        }
+
+        TimerNode **slot = &wheel->slots[0][wheel->now & SLOT_MASK];
+        while (*slot) {
+            TimerNode *node = *slot;
+            unlink_node(node);
+            if (node->expires > wheel->now) {
+                // Parked beyond the top level and not due yet
+                node->pprev = NULL;
+                place(wheel, node);
+                continue;
+            }
+            wheel->count--;
+            expire(node, ctx);
+        }
+    }
+}
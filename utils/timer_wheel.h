@@ -0,0 +1,48 @@
+/*
+ * Autor: Guido Barosio
+ * Email: guido@bravo47.com
+ * Fecha: 2024-06-08
+ */
+
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Hierarchical timing wheel. Level 0 has one slot per tick, each level
+// above has slots 64 times wider; a timer sits in the lowest level whose
+// span covers its delay and moves down a level each time the level below
+// wraps around. Scheduling and cancelling are O(1) list operations and an
+// advance only touches the slots that come due, so the cost does not grow
+// with the number of pending timers.
+#define TIMER_LEVELS 4
+#define TIMER_SLOT_BITS 6
+#define TIMER_SLOTS (1 << TIMER_SLOT_BITS)
+
+// Embedded in the object it times; pprev is NULL while not scheduled.
+typedef struct TimerNode {
+    struct TimerNode *next;
+    struct TimerNode **pprev;
+    uint64_t expires;
+} TimerNode;
+
+// A zeroed wheel is ready for use. Its first advance on an empty wheel
+// jumps straight to the given time.
+typedef struct {
+    uint64_t now;
+    size_t count;
+    TimerNode *slots[TIMER_LEVELS][TIMER_SLOTS];
+} TimerWheel;
+
+typedef void (*TimerCallback)(TimerNode *node, void *ctx);
+
+static inline int timer_pending(const TimerNode *node) {
+    return node->pprev != NULL;
+}
+
+void timer_schedule(TimerWheel *wheel, TimerNode *node, uint64_t expires);
+void timer_cancel(TimerWheel *wheel, TimerNode *node);
+void timer_wheel_advance(TimerWheel *wheel, uint64_t now, TimerCallback expire, void *ctx);
+
+#endif // TIMER_WHEEL_H
@@ -0,0 +1,309 @@
+/*
+ * Autor: Guido Barosio
+ * Email: guido@bravo47.com
+ * Fecha: 2024-06-08
+ */
+
+#ifdef __linux__
+
+#include "uring.h"
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#define SQPOLL_IDLE_MS 1000
+
+static int sys_setup(unsigned entries, struct io_uring_params *params) {
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int sys_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags, void *arg, size_t arg_size) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, arg_size);
+}
+
+static int sys_register(int fd, unsigned opcode, void *arg, unsigned nr_args) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+// Creates the rings. With sqpoll a kernel thread picks submissions up
+// from the shared ring, so submitting normally needs no system call.
+// Returns 0 on success, -1 with errno set.
+int uring_init(Uring *ring, unsigned entries, int sqpoll) {
+    struct io_uring_params params;
+    memset(ring, 0, sizeof(*ring));
+    memset(&params, 0, sizeof(params));
+
+    if (sqpoll) {
+        params.flags = IORING_SETUP_SQPOLL;
+        params.sq_thread_idle = SQPOLL_IDLE_MS;
+    } else {
+        // Completions are only reaped by the loop itself: no need to
+        // interrupt it to run task work
+        params.flags = IORING_SETUP_COOP_TASKRUN;
+    }
+    ring->fd = sys_setup(entries, &params);
+    if (ring->fd == -1 && errno == EINVAL && !sqpoll) {
+        params.flags = 0;
+        ring->fd = sys_setup(entries, &params);
+    }
+    if (ring->fd == -1) {
+        return -1;
+    }
+    if (!(params.features & IORING_FEAT_EXT_ARG)) {
+        // Waiting with a timeout needs 5.11+
+        close(ring->fd);
+        errno = ENOSYS;
+        return -1;
+    }
+    ring->setup_flags = params.flags;
+
+    ring->sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_map_size > ring->sq_map_size) {
+            ring->sq_map_size = ring->cq_map_size;
+        }
+        ring->cq_map_size = ring->sq_map_size;
+    }
+
+    ring->sq_map = mmap(NULL, ring->sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_map == MAP_FAILED) {
+        goto fail;
+    }
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_map = ring->sq_map;
+    } else {
+        ring->cq_map = mmap(NULL, ring->cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                            ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cq_map == MAP_FAILED) {
+            ring->cq_map = NULL;
+            goto fail;
+        }
+    }
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        ring->sqes = NULL;
+        goto fail;
+    }
+
+    char *sq = ring->sq_map;
+    ring->sq_head = (unsigned *)(sq + params.sq_off.head);
+    ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    ring->sq_flags = (unsigned *)(sq + params.sq_off.flags);
+    ring->sq_mask = *(unsigned *)(sq + params.sq_off.ring_mask);
+    ring->sq_entries = *(unsigned *)(sq + params.sq_off.ring_entries);
+    // SQE i always sits in array slot i, so the indirection array is
+    // filled once
+    unsigned *array = (unsigned *)(sq + params.sq_off.array);
+    for (unsigned i = 0; i < ring->sq_entries; i++) {
+        array[i] = i;
+    }
+
+    char *cq = ring->cq_map;
+    ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    ring->cq_mask = *(unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    return 0;
+
+fail:
+    {
+        int saved = errno;
+        uring_exit(ring);
+        errno = saved;
+    }
+    return -1;
+}
+
+void uring_exit(Uring *ring) {
+    if (ring->buf_ring) {
+        munmap(ring->buf_ring, ring->buf_count * sizeof(struct io_uring_buf));
+    }
+    if (ring->buffers) {
+        munmap(ring->buffers, (size_t)ring->buf_count * ring->buf_size);
+    }
+    if (ring->sqes) {
+        munmap(ring->sqes, ring->sqes_size);
+    }
+    if (ring->cq_map && ring->cq_map != ring->sq_map) {
+        munmap(ring->cq_map, ring->cq_map_size);
+    }
+    if (ring->sq_map && ring->sq_map != MAP_FAILED) {
+        munmap(ring->sq_map, ring->sq_map_size);
+    }
+    if (ring->fd >= 0) {
+        close(ring->fd);
+    }
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = -1;
+}
+
+static unsigned sq_space(Uring *ring) {
+    unsigned head = atomic_load_explicit((_Atomic unsigned *)ring->sq_head, memory_order_acquire);
+    return ring->sq_entries - (*ring->sq_tail + ring->sq_pending - head);
+}
+
+// Makes sure count SQEs can be queued back to back, submitting what is
+// queued if needed, so a linked chain never straddles two submissions.
+// Returns 0 on success, -1 if the ring stays full.
+int uring_reserve(Uring *ring, unsigned count) {
+    if (sq_space(ring) >= count) {
+        return 0;
+    }
+    if (uring_submit(ring) < 0) {
+        return -1;
+    }
+    return sq_space(ring) >= count ? 0 : -1;
+}
+
+// Returns a zeroed SQE to fill in, or NULL if the ring stays full.
+struct io_uring_sqe *uring_get_sqe(Uring *ring) {
+    if (uring_reserve(ring, 1) == -1) {
+        return NULL;
+    }
+    struct io_uring_sqe *sqe = &ring->sqes[(*ring->sq_tail + ring->sq_pending) & ring->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sq_pending++;
+    return sqe;
+}
+
+// Publishes the filled SQEs to the kernel's view of the ring. Returns the
+// flags io_uring_enter() needs to get them consumed: none when an awake
+// SQ thread will pick them up.
+static unsigned publish(Uring *ring, unsigned *to_submit) {
+    *to_submit = ring->sq_pending;
+    if (ring->sq_pending) {
+        atomic_store_explicit((_Atomic unsigned *)ring->sq_tail, *ring->sq_tail + ring->sq_pending,
+                              memory_order_release);
+        ring->sq_pending = 0;
+    }
+    if (!(ring->setup_flags & IORING_SETUP_SQPOLL)) {
+        return 0;
+    }
+    *to_submit = 0;
+    // Pairs with the SQ thread setting NEED_WAKEUP before it sleeps
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit((_Atomic unsigned *)ring->sq_flags, memory_order_relaxed) & IORING_SQ_NEED_WAKEUP) {
+        return IORING_ENTER_SQ_WAKEUP;
+    }
+    return 0;
+}
+
+// Submits queued SQEs without waiting. With an awake SQ thread this is
+// free of system calls.
+int uring_submit(Uring *ring) {
+    unsigned to_submit;
+    unsigned flags = publish(ring, &to_submit);
+    if (to_submit == 0 && flags == 0) {
+        return 0;
+    }
+    int rc;
+    do {
+        rc = sys_enter(ring->fd, to_submit, 0, flags, NULL, 0);
+    } while (rc == -1 && errno == EINTR);
+    return rc;
+}
+
+// Submits queued SQEs and, unless completions are already waiting, blocks
+// for at least one for up to timeout_ms (forever if negative): one system
+// call per event loop iteration. Returns 0 on success or timeout, -1 on
+// error with errno set.
+int uring_wait(Uring *ring, int timeout_ms) {
+    unsigned to_submit;
+    unsigned flags = publish(ring, &to_submit);
+
+    unsigned head = *ring->cq_head;
+    unsigned tail = atomic_load_explicit((_Atomic unsigned *)ring->cq_tail, memory_order_acquire);
+    if (head != tail) {
+        if (to_submit == 0 && flags == 0) {
+            return 0;
+        }
+        return sys_enter(ring->fd, to_submit, 0, flags, NULL, 0) == -1 && errno != EINTR ? -1 : 0;
+    }
+
+    struct __kernel_timespec timeout = {timeout_ms / 1000, (timeout_ms % 1000) * 1000000LL};
+    struct io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    arg.ts = timeout_ms < 0 ? 0 : (uint64_t)(uintptr_t)&timeout;
+
+    int rc = sys_enter(ring->fd, to_submit, 1, flags | IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+                       &arg, sizeof(arg));
+    if (rc == -1 && errno != ETIME && errno != EINTR) {
+        return -1;
+    }
+    return 0;
+}
+
+struct io_uring_cqe *uring_peek_cqe(Uring *ring) {
+    unsigned head = *ring->cq_head;
+    unsigned tail = atomic_load_explicit((_Atomic unsigned *)ring->cq_tail, memory_order_acquire);
+    if (head == tail) {
+        return NULL;
+    }
+    return &ring->cqes[head & ring->cq_mask];
+}
+
+void uring_cqe_seen(Uring *ring) {
+    atomic_store_explicit((_Atomic unsigned *)ring->cq_head, *ring->cq_head + 1, memory_order_release);
+}
+
+// Registers count buffers of size bytes as provided buffer group group.
+// Receives that select from the group take whichever buffer is next, so
+// idle connections pin no receive memory.
+int uring_setup_buffers(Uring *ring, unsigned count, unsigned size, unsigned short group) {
+    size_t ring_size = count * sizeof(struct io_uring_buf);
+    ring->buf_ring = mmap(NULL, ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring->buf_ring == MAP_FAILED) {
+        ring->buf_ring = NULL;
+        return -1;
+    }
+    ring->buffers = mmap(NULL, (size_t)count * size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring->buffers == MAP_FAILED) {
+        ring->buffers = NULL;
+        return -1;
+    }
+    ring->buf_count = count;
+    ring->buf_size = size;
+    ring->buf_group = group;
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)ring->buf_ring;
+    reg.ring_entries = count;
+    reg.bgid = group;
+    if (sys_register(ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) == -1) {
+        return -1;
+    }
+
+    for (unsigned i = 0; i < count; i++) {
+        uring_recycle_buffer(ring, i);
+    }
+    uring_publish_buffers(ring);
+    return 0;
+}
+
+char *uring_buffer(Uring *ring, unsigned id) {
+    return ring->buffers + (size_t)id * ring->buf_size;
+}
+
+// Queues a buffer for reuse; it becomes visible to the kernel with the
+// next uring_publish_buffers().
+void uring_recycle_buffer(Uring *ring, unsigned id) {
+    struct io_uring_buf *buf = &ring->buf_ring->bufs[ring->buf_tail & (ring->buf_count - 1)];
+    buf->addr = (uint64_t)(uintptr_t)uring_buffer(ring, id);
+    buf->len = ring->buf_size;
+    buf->bid = (unsigned short)id;
+    ring->buf_tail++;
+}
+
+void uring_publish_buffers(Uring *ring) {
+    atomic_store_explicit((_Atomic unsigned short *)&ring->buf_ring->tail, ring->buf_tail, memory_order_release);
+}
+
+#endif // __linux__
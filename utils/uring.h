@@ -0,0 +1,61 @@
+/*
+ * Autor: Guido Barosio
+ * Email: guido@bravo47.com
+ * Fecha: 2024-06-08
+ */
+
+#ifndef URING_H
+#define URING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <linux/io_uring.h>
+
+// Minimal io_uring driver on the raw system calls (no liburing): the
+// mapped submission and completion rings plus one ring of provided
+// buffers that multishot receives pick their buffers from.
+typedef struct {
+    int fd;
+    unsigned setup_flags;
+
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_flags;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    unsigned sq_pending;        // SQEs filled but not yet published to the kernel
+    struct io_uring_sqe *sqes;
+
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+
+    void *sq_map;
+    size_t sq_map_size;
+    void *cq_map;
+    size_t cq_map_size;
+    size_t sqes_size;
+
+    struct io_uring_buf_ring *buf_ring;
+    char *buffers;
+    unsigned buf_count;
+    unsigned buf_size;
+    unsigned short buf_tail;
+    unsigned short buf_group;
+} Uring;
+
+int uring_init(Uring *ring, unsigned entries, int sqpoll);
+void uring_exit(Uring *ring);
+int uring_reserve(Uring *ring, unsigned count);
+struct io_uring_sqe *uring_get_sqe(Uring *ring);
+int uring_submit(Uring *ring);
+int uring_wait(Uring *ring, int timeout_ms);
+struct io_uring_cqe *uring_peek_cqe(Uring *ring);
+void uring_cqe_seen(Uring *ring);
+int uring_setup_buffers(Uring *ring, unsigned count, unsigned size, unsigned short group);
+char *uring_buffer(Uring *ring, unsigned id);
+void uring_recycle_buffer(Uring *ring, unsigned id);
+void uring_publish_buffers(Uring *ring);
+
+#endif // URING_H